@@ -3,6 +3,7 @@
 #define ATOMIC_HH
 
 #include <pthread.h>
+#include <new>
 #include <queue>
 #include <sched.h>
 #include <errno.h>
@@ -14,6 +15,11 @@
 
 #define MAX_THREADS 100
 
+// Assumed size of a cache line.
+#define CACHE_LINE_SIZE 64
+// Number of stripes of a StripedCounter.
+#define NUM_COUNTER_STRIPES 16
+
 #if defined(HAVE_GCC_ATOMICS)
 #include "atomic/gcc_atomics.h"
 #elif defined(HAVE_ATOMIC_H)
@@ -218,6 +224,119 @@ public:
     }
 };
 
+/**
+ * Get the counter stripe the calling thread updates.  Threads are handed
+ * stripes in turn the first time they ask for one.
+ */
+inline size_t getCounterStripe() {
+    static ThreadLocal<void*> stripe;
+    static Atomic<size_t> nextStripe;
+    void *s = stripe.get();
+    if (s == NULL) {
+        s = reinterpret_cast<void*>(nextStripe++ % NUM_COUNTER_STRIPES + 1);
+        stripe.set(s);
+    }
+    return reinterpret_cast<size_t>(s) - 1;
+}
+
+/**
+ * A counter updated by many threads and read rarely.
+ *
+ * Every thread adds to its own cache line sized stripe, so threads updating
+ * the counter at the same time don't fight over a cache line.  Reading it
+ * adds up the stripes.
+ */
+template <typename T>
+class StripedCounter {
+public:
+
+    StripedCounter(const T &initial = 0) : stripes(allocStripes()) {
+        set(initial);
+    }
+
+    ~StripedCounter() {
+        for (size_t i = 0; i < NUM_COUNTER_STRIPES; ++i) {
+            stripes[i].~Stripe();
+        }
+        free(stripes);
+    }
+
+    T get() const {
+        T rv = 0;
+        for (size_t i = 0; i < NUM_COUNTER_STRIPES; ++i) {
+            rv += stripes[i].value.get();
+        }
+        return rv;
+    }
+
+    /**
+     * Set the counter.  Updates made while it is being set may be lost.
+     */
+    void set(const T &newValue) {
+        for (size_t i = 1; i < NUM_COUNTER_STRIPES; ++i) {
+            stripes[i].value.set(0);
+        }
+        stripes[0].value.set(newValue);
+    }
+
+    operator T() const {
+        return get();
+    }
+
+    void operator =(const T &newValue) {
+        set(newValue);
+    }
+
+    void operator ++() {
+        incr(1);
+    }
+
+    void operator --() {
+        decr(1);
+    }
+
+    void operator +=(const T &increment) {
+        incr(increment);
+    }
+
+    void operator -=(const T &decrement) {
+        decr(decrement);
+    }
+
+    void incr(const T &increment) {
+        stripes[getCounterStripe()].value.incr(increment);
+    }
+
+    void decr(const T &decrement) {
+        stripes[getCounterStripe()].value.decr(decrement);
+    }
+
+private:
+    struct Stripe {
+        Atomic<T> value;
+    } __attribute__((aligned(CACHE_LINE_SIZE)));
+
+    // The counters live in objects allocated with new, which doesn't
+    // honour the alignment of Stripe, so the stripes get their own
+    // cache line aligned block.
+    static Stripe *allocStripes() {
+        void *p = NULL;
+        if (posix_memalign(&p, CACHE_LINE_SIZE,
+                           NUM_COUNTER_STRIPES * sizeof(Stripe)) != 0) {
+            throw std::bad_alloc();
+        }
+        Stripe *rv = static_cast<Stripe*>(p);
+        for (size_t i = 0; i < NUM_COUNTER_STRIPES; ++i) {
+            new (rv + i) Stripe();
+        }
+        return rv;
+    }
+
+    Stripe *stripes;
+
+    DISALLOW_COPY_AND_ASSIGN(StripedCounter);
+};
+
 /**
  * A lighter-weight, smaller lock than a mutex.
  *
@@ -76,6 +76,15 @@ public:
 
     void complete(void);
 
+    /**
+     * A backfill only reads the hash tables under their locks and
+     * talks to its producer and checkpoints through the locked tap
+     * connection map, so it may run beside other tasks.
+     */
+    bool isConcurrent() {
+        return true;
+    }
+
 private:
 
     void setEvents();
@@ -117,6 +126,10 @@ public:
         return std::string("Backfilling items from memory and disk.");
     }
 
+    bool isConcurrent() {
+        return true;
+    }
+
     shared_ptr<BackFillVisitor> bfv;
     EventuallyPersistentEngine *engine;
     EventuallyPersistentStore *epstore;
@@ -0,0 +1,73 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+
+#include "bgfetcher.hh"
+#include "ep.hh"
+
+void BgFetcher::notifyBGEvent(const RCPtr<VBucket> &vb) {
+    LockHolder lh(queueMutex);
+    pendingVBuckets.push_back(vb);
+    if (!scheduled) {
+        scheduled = true;
+        shared_ptr<BgFetcherCallback> cb(new BgFetcherCallback(this));
+        dispatcher->schedule(cb, NULL, Priority::BgFetcherPriority,
+                             store->getBGFetchDelay());
+    }
+}
+
+bool BgFetcher::run(Dispatcher &d, TaskId t) {
+    std::vector<RCPtr<VBucket> > vbs;
+    LockHolder lh(queueMutex);
+    if (pendingVBuckets.empty()) {
+        scheduled = false;
+        return false;
+    }
+    vbs.swap(pendingVBuckets);
+    lh.unlock();
+
+    std::vector<RCPtr<VBucket> >::iterator it;
+    for (it = vbs.begin(); it != vbs.end(); ++it) {
+        vb_bgfetch_queue_t items;
+        if ((*it)->getBGFetchItems(items) > 0) {
+            doFetch(*it, items);
+        }
+    }
+
+    // Look for fetches that were queued while we were busy
+    uint32_t delay = store->getBGFetchDelay();
+    if (delay > 0) {
+        d.snooze(t, delay);
+    }
+    return true;
+}
+
+void BgFetcher::doFetch(const RCPtr<VBucket> &vb, vb_bgfetch_queue_t &items) {
+    uint16_t vbId = vb->getId();
+    hrtime_t start(gethrtime());
+    store->getROUnderlying()->getMulti(vbId, store->getVBucketVersion(vbId),
+                                       items);
+    hrtime_t stop(gethrtime());
+
+    stats.bgBatchSizeHisto.add(items.size());
+    if (stop > start) {
+        stats.bgBatchLoadHisto.add((stop - start) / 1000);
+    }
+
+    store->completeBGFetchMulti(vbId, items, start);
+    VBucket::clearBGFetchItems(items);
+}
@@ -0,0 +1,88 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#ifndef BGFETCHER_HH
+#define BGFETCHER_HH 1
+
+#include <vector>
+
+#include "common.hh"
+#include "dispatcher.hh"
+#include "vbucket.hh"
+
+class EventuallyPersistentStore;
+
+/**
+ * Services the background fetches of all the vbuckets.
+ *
+ * Non-resident reads are queued on their vbucket (see
+ * VBucket::queueBGFetchItem) and the vbucket is handed to the
+ * BgFetcher.  A single dispatcher job then drains each vbucket's queue
+ * and reads the whole batch through KVStore::getMulti(), instead of
+ * scheduling a job and doing a separate disk read for every miss.
+ */
+class BgFetcher {
+public:
+    BgFetcher(EventuallyPersistentStore *s, Dispatcher *d, EPStats &st) :
+        store(s), dispatcher(d), stats(st), scheduled(false) { }
+
+    /**
+     * Note that the given vbucket has new fetches queued and make sure
+     * a fetch job is scheduled to service them.
+     */
+    void notifyBGEvent(const RCPtr<VBucket> &vb);
+
+    /**
+     * Service all the vbuckets with pending fetches.
+     *
+     * @return true if the job should be run again
+     */
+    bool run(Dispatcher &d, TaskId t);
+
+private:
+    void doFetch(const RCPtr<VBucket> &vb, vb_bgfetch_queue_t &items);
+
+    EventuallyPersistentStore *store;
+    Dispatcher                *dispatcher;
+    EPStats                   &stats;
+
+    Mutex                       queueMutex;
+    std::vector<RCPtr<VBucket> > pendingVBuckets;
+    bool                        scheduled;
+
+    DISALLOW_COPY_AND_ASSIGN(BgFetcher);
+};
+
+/**
+ * A DispatcherCallback adaptor over BgFetcher.
+ */
+class BgFetcherCallback : public DispatcherCallback {
+public:
+    BgFetcherCallback(BgFetcher *f) : fetcher(f) { }
+
+    bool callback(Dispatcher &d, TaskId t) {
+        return fetcher->run(d, t);
+    }
+
+    std::string description() {
+        return std::string("Batching background fetch");
+    }
+
+private:
+    BgFetcher *fetcher;
+};
+
+#endif /* BGFETCHER_HH */
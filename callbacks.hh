@@ -7,6 +7,7 @@
 #include "locks.hh"
 
 class Item;
+class ItemView;
 class StoredValue;
 
 /**
@@ -14,15 +15,15 @@ class StoredValue;
  */
 class GetValue {
 public:
-    GetValue() : value(NULL), storedValue(NULL), id(-1),
+    GetValue() : value(NULL), view(NULL), storedValue(NULL), id(-1),
                  vb_version(-1), status(ENGINE_KEY_ENOENT),
                  partial(false) { }
 
     explicit GetValue(Item *v, ENGINE_ERROR_CODE s=ENGINE_SUCCESS,
                       uint64_t i = -1, uint16_t vbucket_version = -1,
                       StoredValue *sv = NULL, bool incomplete = false) :
-        value(v), storedValue(sv), id(i), vb_version(vbucket_version), status(s),
-        partial(incomplete) { }
+        value(v), view(NULL), storedValue(sv), id(i), vb_version(vbucket_version),
+        status(s), partial(incomplete) { }
 
 
 
@@ -31,6 +32,14 @@ public:
      */
     Item* getValue() { return value; }
 
+    /**
+     * The value retrieved for the key, when it was asked for as an
+     * ItemView (see EventuallyPersistentStore::getView()).
+     */
+    ItemView* getView() { return view; }
+
+    void setView(ItemView *v) { view = v; }
+
     /**
      * Engine code describing what happened.
      */
@@ -53,6 +62,8 @@ public:
 
     /**
      * Get the StoredValue instance associated with the item (if applicable).
+     * Lock-free lookups never set it, as the StoredValue isn't safe to
+     * touch once the lookup's epoch has ended.
      */
     StoredValue* getStoredValue() const {
         return storedValue;
@@ -69,6 +80,7 @@ public:
 private:
 
     Item* value;
+    ItemView* view;
     StoredValue* storedValue;
     uint64_t id;
     uint16_t vb_version;
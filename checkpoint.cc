@@ -1,5 +1,7 @@
 /* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
 #include "config.h"
+#include <algorithm>
+
 #include "vbucket.hh"
 #include "checkpoint.hh"
 #include "ep_engine.h"
@@ -36,6 +38,61 @@ private:
     CheckpointConfig &config;
 };
 
+size_t CheckpointQueue::push_back(const queued_item &qi, uint64_t mutationId) {
+    if (tail - first == chunks.size() * CHECKPOINT_CHUNK_SIZE) {
+        chunks.push_back(new Chunk);
+    }
+    size_t off = tail - first;
+    Chunk *chunk = chunks[off / CHECKPOINT_CHUNK_SIZE];
+    chunk->items[off % CHECKPOINT_CHUNK_SIZE] = qi;
+    chunk->mutationIds[off % CHECKPOINT_CHUNK_SIZE] = mutationId;
+    ++numItems;
+    return tail++;
+}
+
+size_t CheckpointQueue::push_front(const queued_item &qi, uint64_t mutationId) {
+    if (head == first) {
+        chunks.push_front(new Chunk);
+        first -= CHECKPOINT_CHUNK_SIZE;
+    }
+    size_t off = --head - first;
+    Chunk *chunk = chunks[off / CHECKPOINT_CHUNK_SIZE];
+    chunk->items[off % CHECKPOINT_CHUNK_SIZE] = qi;
+    chunk->mutationIds[off % CHECKPOINT_CHUNK_SIZE] = mutationId;
+    ++numItems;
+    return head;
+}
+
+void CheckpointQueue::erase(size_t pos) {
+    assert(at(pos));
+    at(pos).reset();
+    --numItems;
+}
+
+void CheckpointQueue::pop_back() {
+    tail = prevPos(tail);
+    at(tail).reset();
+    --numItems;
+}
+
+void CheckpointQueue::swap(CheckpointQueue &other) {
+    chunks.swap(other.chunks);
+    std::swap(first, other.first);
+    std::swap(head, other.head);
+    std::swap(tail, other.tail);
+    std::swap(numItems, other.numItems);
+}
+
+void CheckpointQueue::clear() {
+    std::deque<Chunk*>::iterator it = chunks.begin();
+    for (; it != chunks.end(); ++it) {
+        delete *it;
+    }
+    chunks.clear();
+    first = head = tail = 0;
+    numItems = 0;
+}
+
 Checkpoint::~Checkpoint() {
     getLogger()->log(EXTENSION_LOG_INFO, NULL,
                      "Checkpoint %d for vbucket %d is purged from memory.\n",
@@ -50,121 +107,227 @@ void Checkpoint::setState(checkpoint_state state) {
 
 void Checkpoint::popBackCheckpointEndItem() {
     if (toWrite.size() > 0 && toWrite.back()->getOperation() == queue_op_checkpoint_end) {
+        // The index entry refers to the item's key, so it goes first.
+        checkpoint_index::iterator it = keyIndex.find(index_key(toWrite.back()));
+        if (it != keyIndex.end()) {
+            keyIndex.erase(it);
+            size_t entrySize = sizeof(index_key) + sizeof(index_entry);
+            memOverhead -= entrySize;
+            stats.memOverhead.decr(entrySize);
+        }
         toWrite.pop_back();
     }
 }
 
 bool Checkpoint::keyExists(const std::string &key) {
-    return keyIndex.find(key) != keyIndex.end();
+    return keyIndex.find(index_key(key)) != keyIndex.end();
 }
 
-queue_dirty_t Checkpoint::queueDirty(const queued_item &qi, CheckpointManager *checkpointManager) {
-    assert (checkpointState == opened);
+void Checkpoint::replaceItem(const CheckpointQueue::iterator &pos, const queued_item &qi) {
+    assert((*pos)->getKey() == qi->getKey());
+    checkpoint_index::iterator it = keyIndex.find(index_key(*pos));
+    if (it != keyIndex.end()) {
+        it->first.key = &qi->getKey();
+    }
+    *pos = qi;
+}
 
-    uint64_t newMutationId = checkpointManager->nextMutationId();
-    queue_dirty_t rv;
+void Checkpoint::updateQueueMemory() {
+    size_t now = toWrite.memorySize();
+    if (now > queueMemory) {
+        memOverhead += now - queueMemory;
+        stats.memOverhead.incr(now - queueMemory);
+        assert(stats.memOverhead.get() < GIGANTOR);
+    } else if (now < queueMemory) {
+        memOverhead -= queueMemory - now;
+        stats.memOverhead.decr(queueMemory - now);
+    }
+    queueMemory = now;
+}
 
-    checkpoint_index::iterator it = keyIndex.find(qi->getKey());
-    // Check if this checkpoint already had an item for the same key.
-    if (it != keyIndex.end()) {
-        std::list<queued_item>::iterator currPos = it->second.position;
-        uint64_t currMutationId = it->second.mutation_id;
-        CheckpointCursor &pcursor = checkpointManager->persistenceCursor;
+void Checkpoint::compact(CheckpointManager *checkpointManager) {
+    typedef std::vector<std::pair<uint64_t, CheckpointCursor*> > cursor_list;
+    // The cursors walking through this checkpoint in queue order, which
+    // is that of the mutation ids.  One at an empty slot is moved back to
+    // the item before it, which changes nothing as far as the items still
+    // to come are concerned.
+    cursor_list walking;
+    CheckpointCursor &pcursor = checkpointManager->persistenceCursor;
+    if (*(pcursor.currentCheckpoint) == this) {
+        walking.push_back(std::make_pair(0, &pcursor));
+    }
+    std::map<const std::string, CheckpointCursor>::iterator map_it;
+    for (map_it = checkpointManager->tapCursors.begin();
+         map_it != checkpointManager->tapCursors.end(); ++map_it) {
+        if (*(map_it->second.currentCheckpoint) == this) {
+            walking.push_back(std::make_pair(0, &map_it->second));
+        }
+    }
+    cursor_list::iterator cit;
+    for (cit = walking.begin(); cit != walking.end(); ++cit) {
+        if (!*(cit->second->currentPos)) {
+            --(cit->second->currentPos);
+        }
+        cit->first = getMutationId(cit->second->currentPos);
+    }
+    std::sort(walking.begin(), walking.end());
+
+    CheckpointQueue compacted;
+    cit = walking.begin();
+    CheckpointQueue::iterator it = toWrite.begin();
+    for (; it != toWrite.end(); ++it) {
+        uint64_t mutationId = getMutationId(it);
+        size_t pos = compacted.push_back(*it, mutationId);
+        // A cursor left at an empty slot in front of all the items ends
+        // up at the first one.
+        for (; cit != walking.end() && cit->first <= mutationId; ++cit) {
+            cit->first = mutationId;
+            cit->second->currentPos = CheckpointQueue::iterator(&toWrite, pos);
+        }
+        if ((*it)->getKey().size() > 0) {
+            checkpoint_index::iterator ita = keyIndex.find(index_key(*it));
+            assert(ita != keyIndex.end());
+            ita->second.position = pos;
+        }
+    }
+    assert(cit == walking.end());
+
+    toWrite.swap(compacted);
+    cursorsByMutationId.swap(walking);
+    cursorsSorted = true;
+    updateQueueMemory();
+}
 
+void Checkpoint::adjustCursorOffsets(uint64_t mutationId,
+                                     CheckpointManager *checkpointManager) {
+    typedef std::vector<std::pair<uint64_t, CheckpointCursor*> > cursor_list;
+    if (!cursorsSorted) {
+        CheckpointCursor &pcursor = checkpointManager->persistenceCursor;
         if (*(pcursor.currentCheckpoint) == this) {
-            // If the existing item is in the left-hand side of the item pointed by the
-            // persistence cursor, decrease the persistence cursor's offset by 1.
-            const std::string &key = (*(pcursor.currentPos))->getKey();
-            checkpoint_index::iterator ita = keyIndex.find(key);
-            if (ita != keyIndex.end()) {
-                uint64_t mutationId = ita->second.mutation_id;
-                if (currMutationId <= mutationId) {
-                    checkpointManager->decrCursorOffset_UNLOCKED(pcursor, 1);
-                }
-            }
-            // If the persistence cursor points to the existing item for the same key,
-            // shift the cursor left by 1.
-            if (pcursor.currentPos == currPos) {
-                checkpointManager->decrCursorPos_UNLOCKED(pcursor);
-            }
+            cursorsByMutationId.push_back(std::make_pair(getMutationId(pcursor.currentPos),
+                                                         &pcursor));
         }
-
         std::map<const std::string, CheckpointCursor>::iterator map_it;
         for (map_it = checkpointManager->tapCursors.begin();
-             map_it != checkpointManager->tapCursors.end(); map_it++) {
-
-            if (*(map_it->second.currentCheckpoint) == this) {
-                const std::string &key = (*(map_it->second.currentPos))->getKey();
-                checkpoint_index::iterator ita = keyIndex.find(key);
-                if (ita != keyIndex.end()) {
-                    uint64_t mutationId = ita->second.mutation_id;
-                    if (currMutationId <= mutationId) {
-                        checkpointManager->decrCursorOffset_UNLOCKED(map_it->second, 1);
-                    }
-                }
-                // If an TAP cursor points to the existing item for the same key, shift it left by 1
-                if (map_it->second.currentPos == currPos) {
-                    checkpointManager->decrCursorPos_UNLOCKED(map_it->second);
-                }
+             map_it != checkpointManager->tapCursors.end(); ++map_it) {
+            CheckpointCursor &cursor = map_it->second;
+            if (*(cursor.currentCheckpoint) == this) {
+                cursorsByMutationId.push_back(std::make_pair(getMutationId(cursor.currentPos),
+                                                             &cursor));
             }
         }
+        std::sort(cursorsByMutationId.begin(), cursorsByMutationId.end());
+        cursorsSorted = true;
+    }
+
+    // Cursors only move forward while they stay in this checkpoint, so
+    // one that was past the item when sorted still is.  Only the others
+    // are looked at again, and they usually haven't moved far enough to
+    // change the order.
+    cursor_list::iterator it = cursorsByMutationId.begin();
+    for (; it != cursorsByMutationId.end() && it->first < mutationId; ++it) {
+        it->first = getMutationId(it->second->currentPos);
+    }
+    cursor_list::iterator sorted = cursorsByMutationId.begin();
+    while (sorted != it && (sorted + 1 == cursorsByMutationId.end() ||
+                            sorted->first <= (sorted + 1)->first)) {
+        ++sorted;
+    }
+    if (sorted != it) {
+        std::sort(cursorsByMutationId.begin(), it);
+        std::inplace_merge(cursorsByMutationId.begin(), it, cursorsByMutationId.end());
+    }
+
+    // Every cursor at or past the item has one item less behind it.
+    cursor_list::iterator past =
+        std::lower_bound(cursorsByMutationId.begin(), cursorsByMutationId.end(),
+                         std::make_pair(mutationId, static_cast<CheckpointCursor*>(NULL)));
+    size_t numBehind = past - cursorsByMutationId.begin();
+    if (numBehind * 2 > cursorsByMutationId.size()) {
+        for (; past != cursorsByMutationId.end(); ++past) {
+            checkpointManager->decrCursorOffset_UNLOCKED(*(past->second), 1);
+        }
+    } else {
+        // The offsets pick it up from numReplaced, so hand the item back to
+        // the cursors that haven't reached it.
+        ++numReplaced;
+        for (it = cursorsByMutationId.begin(); it != past; ++it) {
+            ++(it->second->offset);
+        }
+    }
+}
+
+queue_dirty_t Checkpoint::queueDirty(const queued_item &qi, CheckpointManager *checkpointManager) {
+    assert (checkpointState == opened);
+
+    uint64_t newMutationId = checkpointManager->nextMutationId();
+    queue_dirty_t rv;
+
+    checkpoint_index::iterator it = keyIndex.find(index_key(qi));
+    // Check if this checkpoint already had an item for the same key.
+    if (it != keyIndex.end()) {
+        size_t currPos = it->second.position;
+        adjustCursorOffsets(toWrite.mutationIdAt(currPos), checkpointManager);
+
         // Copy the queued time of the existing item to the new one.
-        qi->setQueuedTime((*currPos)->getQueuedTime());
-        // Remove the existing item for the same key from the list.
+        qi->setQueuedTime(toWrite.at(currPos)->getQueuedTime());
+        // Empty the existing item's slot, leaving the cursors at it in
+        // place, and reuse its index entry for the new item pushed into
+        // the tail.
+        it->first.key = &qi->getKey();
         toWrite.erase(currPos);
+        it->second.position = toWrite.push_back(qi, newMutationId);
         rv = EXISTING_ITEM;
+
+        // Squeeze the empty slots out once they outnumber the items.
+        if (toWrite.numSlots() > 2 * toWrite.size() + CHECKPOINT_CHUNK_SIZE) {
+            compact(checkpointManager);
+        }
     } else {
         if (qi->getOperation() == queue_op_set || qi->getOperation() == queue_op_del) {
             ++numItems;
         }
         rv = NEW_ITEM;
-    }
-    // Push the new item into the list
-    toWrite.push_back(qi);
-
-    if (qi->getKey().size() > 0) {
-        std::list<queued_item>::iterator last = toWrite.end();
-        // --last is okay as the list is not empty now.
-        index_entry entry = {--last, newMutationId};
-        // Set the index of the key to the new item that is pushed back into the list.
-        keyIndex[qi->getKey()] = entry;
-        if (rv == NEW_ITEM) {
-            size_t newEntrySize = qi->getKey().size() + sizeof(index_entry) + sizeof(queued_item);
+        // Push the new item into the tail
+        size_t pos = toWrite.push_back(qi, newMutationId);
+
+        if (qi->getKey().size() > 0) {
+            index_entry entry = {pos};
+            // Set the index of the key to the new item that is pushed back into the queue.
+            keyIndex[index_key(qi)] = entry;
+            size_t newEntrySize = sizeof(index_key) + sizeof(index_entry);
             memOverhead += newEntrySize;
             stats.memOverhead.incr(newEntrySize);
             assert(stats.memOverhead.get() < GIGANTOR);
         }
     }
+    updateQueueMemory();
     return rv;
 }
 
 size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
     size_t numNewItems = 0;
     size_t newEntryMemOverhead = 0;
-    std::list<queued_item>::reverse_iterator rit = pPrevCheckpoint->rbegin();
+    CheckpointQueue::iterator rit = pPrevCheckpoint->end();
+    CheckpointQueue::iterator rend = pPrevCheckpoint->begin();
 
     getLogger()->log(EXTENSION_LOG_INFO, NULL,
                      "Collapse the checkpoint %d into the checkpoint %d for vbucket %d.\n",
                      pPrevCheckpoint->getId(), checkpointId, vbucketId);
 
-    for (; rit != pPrevCheckpoint->rend(); ++rit) {
+    while (rit != rend) {
+        --rit;
         const std::string &key = (*rit)->getKey();
         if (key.size() == 0) {
             continue;
         }
-        checkpoint_index::iterator it = keyIndex.find(key);
+        index_key ikey(*rit);
+        checkpoint_index::iterator it = keyIndex.find(ikey);
         if (it == keyIndex.end()) {
-            // Skip the first two meta items
-            std::list<queued_item>::iterator pos = toWrite.begin();
-            for (; pos != toWrite.end(); ++pos) {
-                if ((*pos)->getKey().compare("") != 0) {
-                    break;
-                }
-            }
-            toWrite.insert(pos, *rit);
-            index_entry entry = {--pos, pPrevCheckpoint->getMutationIdForKey(key)};
-            keyIndex[key] = entry;
-            newEntryMemOverhead += key.size() + sizeof(index_entry);
+            size_t pos = toWrite.push_front(*rit, pPrevCheckpoint->getMutationId(rit));
+            index_entry entry = {pos};
+            keyIndex[ikey] = entry;
+            newEntryMemOverhead += sizeof(index_key) + sizeof(index_entry);
             ++numItems;
             ++numNewItems;
         }
@@ -172,18 +335,48 @@ size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
     memOverhead += newEntryMemOverhead;
     stats.memOverhead.incr(newEntryMemOverhead);
     assert(stats.memOverhead.get() < GIGANTOR);
+    updateQueueMemory();
     return numNewItems;
 }
 
-uint64_t Checkpoint::getMutationIdForKey(const std::string &key) {
+uint64_t Checkpoint::getMutationIdForKey(const index_key &key) {
     uint64_t mid = 0;
     checkpoint_index::iterator it = keyIndex.find(key);
     if (it != keyIndex.end()) {
-        mid = it->second.mutation_id;
+        mid = toWrite.mutationIdAt(it->second.position);
     }
     return mid;
 }
 
+CheckpointReclaimList::~CheckpointReclaimList() {
+    std::vector<uint16_t> vbids;
+    popAll(vbids);
+}
+
+bool CheckpointReclaimList::push(uint16_t vbid) {
+    Node *node = new Node(vbid, NULL);
+    Node *oldHead;
+    do {
+        oldHead = head.get();
+        node->next = oldHead;
+    } while (!head.cas(oldHead, node));
+
+    return oldHead == NULL;
+}
+
+void CheckpointReclaimList::popAll(std::vector<uint16_t> &vbids) {
+    Node *node = head.swap(NULL);
+    size_t start = vbids.size();
+    while (node != NULL) {
+        vbids.push_back(node->vbid);
+        Node *next = node->next;
+        delete node;
+        node = next;
+    }
+    // The most recent push was on top.
+    std::reverse(vbids.begin() + start, vbids.end());
+}
+
 CheckpointManager::~CheckpointManager() {
     LockHolder lh(queueLock);
     std::list<Checkpoint*>::iterator it = checkpointList.begin();
@@ -228,8 +421,8 @@ void CheckpointManager::setOpenCheckpointId_UNLOCKED(uint64_t id) {
         checkpointList.back()->setId(id);
         // Update the checkpoint_start item with the new Id.
         queued_item qi = createCheckpointItem(id, vbucketId, queue_op_checkpoint_start);
-        std::list<queued_item>::iterator it = ++(checkpointList.back()->begin());
-        *it = qi;
+        CheckpointQueue::iterator it = ++(checkpointList.back()->begin());
+        checkpointList.back()->replaceItem(it, qi);
     }
 }
 
@@ -292,11 +485,14 @@ void CheckpointManager::registerPersistenceCursor() {
     assert(checkpointList.size() > 0);
     persistenceCursor.currentCheckpoint = checkpointList.begin();
     persistenceCursor.currentPos = checkpointList.front()->begin();
+    setCursorOffset_UNLOCKED(persistenceCursor, 0);
     checkpointList.front()->registerCursorName(persistenceCursor.name);
+    checkpointList.front()->invalidateCursorOrder();
 }
 
 bool CheckpointManager::registerTAPCursor(const std::string &name, uint64_t checkpointId,
                                           bool closedCheckpointOnly, bool alwaysFromBeginning) {
+    ReclaimNotifier rn(*this);
     LockHolder lh(queueLock);
     assert(checkpointList.size() > 0);
 
@@ -324,6 +520,7 @@ bool CheckpointManager::registerTAPCursor(const std::string &name, uint64_t chec
     std::map<const std::string, CheckpointCursor>::iterator map_it = tapCursors.find(name);
     if (map_it != tapCursors.end()) {
         (*(map_it->second.currentCheckpoint))->removeCursorName(name);
+        (*(map_it->second.currentCheckpoint))->invalidateCursorOrder();
     }
 
     if (!found) {
@@ -332,14 +529,15 @@ bool CheckpointManager::registerTAPCursor(const std::string &name, uint64_t chec
                          "Set the cursor with the name \"%s\" to the open checkpoint.\n",
                          checkpointId, vbucketId, name.c_str());
         it = --(checkpointList.end());
-        CheckpointCursor cursor(name, it, (*it)->begin(),
-                            numItems - ((*it)->getNumItems() + 1), // 1 is for checkpoint start item
-                            closedCheckpointOnly, open_chk_id);
+        CheckpointCursor cursor(name, it, (*it)->begin(), 0, closedCheckpointOnly, open_chk_id);
+        setCursorOffset_UNLOCKED(cursor,
+                                 numItems - ((*it)->getNumItems() + 1)); // 1 is for checkpoint start item
         tapCursors[name] = cursor;
         (*it)->registerCursorName(name);
+        (*it)->invalidateCursorOrder();
     } else {
         size_t offset = 0;
-        std::list<queued_item>::iterator curr;
+        CheckpointQueue::iterator curr;
 
         getLogger()->log(EXTENSION_LOG_DEBUG, NULL,
                          "Checkpoint %d for vbucket %d exists in memory. "
@@ -352,7 +550,7 @@ bool CheckpointManager::registerTAPCursor(const std::string &name, uint64_t chec
             // If the cursor is currently in the checkpoint to start with, simply start from
             // its current position.
             curr = map_it->second.currentPos;
-            offset = map_it->second.offset;
+            offset = getCursorOffset_UNLOCKED(map_it->second);
         } else {
             // Set the cursor's position to the begining of the checkpoint to start with
             curr = (*it)->begin();
@@ -362,16 +560,20 @@ bool CheckpointManager::registerTAPCursor(const std::string &name, uint64_t chec
             }
         }
 
-        CheckpointCursor cursor(name, it, curr, offset, closedCheckpointOnly, open_chk_id);
+        CheckpointCursor cursor(name, it, curr, 0, closedCheckpointOnly, open_chk_id);
+        setCursorOffset_UNLOCKED(cursor, offset);
         tapCursors[name] = cursor;
         // Register the tap cursor's name to the checkpoint.
         (*it)->registerCursorName(name);
+        (*it)->invalidateCursorOrder();
     }
+    reportUnrefCheckpoint_UNLOCKED();
 
     return found;
 }
 
 bool CheckpointManager::removeTAPCursor(const std::string &name) {
+    ReclaimNotifier rn(*this);
     LockHolder lh(queueLock);
 
     getLogger()->log(EXTENSION_LOG_INFO, NULL,
@@ -391,9 +593,11 @@ bool CheckpointManager::removeTAPCursor(const std::string &name) {
     std::list<Checkpoint*>::iterator cit = checkpointList.begin();
     for (; cit != checkpointList.end(); cit++) {
         (*cit)->removeCursorName(name);
+        (*cit)->invalidateCursorOrder();
     }
 
     tapCursors.erase(it);
+    reportUnrefCheckpoint_UNLOCKED();
     return true;
 }
 
@@ -450,9 +654,12 @@ bool CheckpointManager::isCheckpointCreationForHighMemUsage(const RCPtr<VBucket>
 size_t CheckpointManager::removeClosedUnrefCheckpoints(const RCPtr<VBucket> &vbucket,
                                                        bool &newOpenCheckpointCreated) {
 
-    // This function is executed periodically by the non-IO dispatcher.
+    // This function is executed by the checkpoint remover, periodically and whenever
+    // this vbucket was put on the reclaim list.
     LockHolder lh(queueLock);
     assert(vbucket);
+    // Checkpoints unreferenced by the time we're done are removed by this very run.
+    reclaimPending = true;
     uint64_t oldCheckpointId = 0;
     bool canCreateNewCheckpoint = false;
     if (checkpointList.size() < checkpointConfig.getMaxCheckpoints() ||
@@ -495,12 +702,11 @@ size_t CheckpointManager::removeClosedUnrefCheckpoints(const RCPtr<VBucket> &vbu
         }
     }
 
-    if (checkpointConfig.canKeepClosedCheckpoints()) {
-        double memoryUsed = static_cast<double>(stats.getTotalMemoryUsed());
-        if (memoryUsed < stats.mem_high_wat &&
-            checkpointList.size() <= checkpointConfig.getMaxCheckpoints()) {
-            return 0;
-        }
+    if (keepsClosedCheckpoints_UNLOCKED()) {
+        // Nothing is reported to the reclaim list while we keep the
+        // closed checkpoints, so it's safe to clear this.
+        reclaimPending = false;
+        return 0;
     }
 
     size_t numUnrefItems = 0;
@@ -543,6 +749,7 @@ size_t CheckpointManager::removeClosedUnrefCheckpoints(const RCPtr<VBucket> &vbu
           checkpointConfig.isInconsistentSlaveCheckpoint()))) {
         collapseClosedCheckpoints(unrefCheckpointList);
     }
+    reclaimPending = false;
     lh.unlock();
 
     std::list<Checkpoint*>::iterator chkpoint_it = unrefCheckpointList.begin();
@@ -612,8 +819,9 @@ void CheckpointManager::collapseClosedCheckpoints(std::list<Checkpoint*> &collap
             if (cursor) {
                 cursor->currentCheckpoint = lastClosedChk;
                 cursor->currentPos =  (*lastClosedChk)->begin();
-                cursor->offset = 0;
+                setCursorOffset_UNLOCKED(*cursor, 0);
                 (*lastClosedChk)->registerCursorName(cursor->name);
+                (*lastClosedChk)->invalidateCursorOrder();
             }
         }
 
@@ -710,10 +918,11 @@ uint64_t CheckpointManager::getAllItemsFromCurrentPosition(CheckpointCursor &cur
 }
 
 uint64_t CheckpointManager::getAllItemsForPersistence(std::vector<queued_item> &items) {
+    ReclaimNotifier rn(*this);
     LockHolder lh(queueLock);
     // Get all the items up to the end of the current open checkpoint.
     uint64_t checkpoint_id = getAllItemsFromCurrentPosition(persistenceCursor, 0, items);
-    persistenceCursor.offset = numItems;
+    setCursorOffset_UNLOCKED(persistenceCursor, numItems);
 
     getLogger()->log(EXTENSION_LOG_DEBUG, NULL,
                      "Grab %d items through the persistence cursor from vbucket %d.\n",
@@ -724,6 +933,7 @@ uint64_t CheckpointManager::getAllItemsForPersistence(std::vector<queued_item> &
 
 uint64_t CheckpointManager::getAllItemsForTAPConnection(const std::string &name,
                                                     std::vector<queued_item> &items) {
+    ReclaimNotifier rn(*this);
     LockHolder lh(queueLock);
     std::map<const std::string, CheckpointCursor>::iterator it = tapCursors.find(name);
     if (it == tapCursors.end()) {
@@ -733,7 +943,7 @@ uint64_t CheckpointManager::getAllItemsForTAPConnection(const std::string &name,
         return 0;
     }
     uint64_t checkpointId = getAllItemsFromCurrentPosition(it->second, 0, items);
-    it->second.offset = numItems;
+    setCursorOffset_UNLOCKED(it->second, numItems);
 
     getLogger()->log(EXTENSION_LOG_DEBUG, NULL,
                      "Grab %d items through the tap cursor with name \"%s\" from vbucket %d.\n",
@@ -743,6 +953,7 @@ uint64_t CheckpointManager::getAllItemsForTAPConnection(const std::string &name,
 }
 
 queued_item CheckpointManager::nextItem(const std::string &name, bool &isLastMutationItem) {
+    ReclaimNotifier rn(*this);
     LockHolder lh(queueLock);
     isLastMutationItem = false;
     std::map<const std::string, CheckpointCursor>::iterator it = tapCursors.find(name);
@@ -845,15 +1056,16 @@ void CheckpointManager::resetCursors() {
     // Reset the persistence cursor.
     persistenceCursor.currentCheckpoint = checkpointList.begin();
     persistenceCursor.currentPos = checkpointList.front()->begin();
-    persistenceCursor.offset = 0;
+    setCursorOffset_UNLOCKED(persistenceCursor, 0);
     checkpointList.front()->registerCursorName(persistenceCursor.name);
+    checkpointList.front()->invalidateCursorOrder();
 
     // Reset all the TAP cursors.
     std::map<const std::string, CheckpointCursor>::iterator cit = tapCursors.begin();
     for (; cit != tapCursors.end(); ++cit) {
         cit->second.currentCheckpoint = checkpointList.begin();
         cit->second.currentPos = checkpointList.front()->begin();
-        cit->second.offset = 0;
+        setCursorOffset_UNLOCKED(cit->second, 0);
         checkpointList.front()->registerCursorName(cit->second.name);
     }
 }
@@ -868,16 +1080,50 @@ bool CheckpointManager::moveCursorToNextCheckpoint(CheckpointCursor &cursor) {
         }
     }
 
+    size_t offset = getCursorOffset_UNLOCKED(cursor);
     // Remove the cursor's name from its current checkpoint.
     (*(cursor.currentCheckpoint))->removeCursorName(cursor.name);
+    (*(cursor.currentCheckpoint))->invalidateCursorOrder();
     // Move the cursor to the next checkpoint.
     ++(cursor.currentCheckpoint);
     cursor.currentPos = (*(cursor.currentCheckpoint))->begin();
+    setCursorOffset_UNLOCKED(cursor, offset);
     // Register the cursor's name to its new current checkpoint.
     (*(cursor.currentCheckpoint))->registerCursorName(cursor.name);
+    (*(cursor.currentCheckpoint))->invalidateCursorOrder();
+    reportUnrefCheckpoint_UNLOCKED();
     return true;
 }
 
+void CheckpointManager::reportUnrefCheckpoint_UNLOCKED() {
+    if (!checkpointConfig.hasReclaimList() || reclaimPending) {
+        return;
+    }
+    Checkpoint *oldest = checkpointList.front();
+    if (oldest->getState() == closed && oldest->getNumberOfCursors() == 0 &&
+        !keepsClosedCheckpoints_UNLOCKED()) {
+        reclaimPending = true;
+        if (checkpointConfig.pushReclaim(vbucketId)) {
+            reclaimNotify = true;
+        }
+    }
+}
+
+bool CheckpointManager::keepsClosedCheckpoints_UNLOCKED() {
+    if (!checkpointConfig.canKeepClosedCheckpoints()) {
+        return false;
+    }
+    double memoryUsed = static_cast<double>(stats.getTotalMemoryUsed());
+    return memoryUsed < stats.mem_high_wat &&
+        checkpointList.size() <= checkpointConfig.getMaxCheckpoints();
+}
+
+void CheckpointManager::notifyReclaimList() {
+    if (reclaimNotify.cas(true, false)) {
+        checkpointConfig.notifyReclaimList();
+    }
+}
+
 uint64_t CheckpointManager::checkOpenCheckpoint_UNLOCKED(bool forceCreation, bool timeBound) {
     int checkpoint_id = 0;
 
@@ -911,21 +1157,23 @@ bool CheckpointManager::eligibleForEviction(const std::string &key) {
     // Get the mutation id of the item pointed by the slowest cursor.
     // This won't cause much overhead as the number of cursors per vbucket is
     // usually bounded to 3 (persistence cursor + 2 replicas).
-    const std::string &pkey = (*(persistenceCursor.currentPos))->getKey();
-    smallest_mid = (*(persistenceCursor.currentCheckpoint))->getMutationIdForKey(pkey);
+    smallest_mid = (*(persistenceCursor.currentCheckpoint))->getMutationId(
+                                                             persistenceCursor.currentPos);
     std::map<const std::string, CheckpointCursor>::iterator mit = tapCursors.begin();
     for (; mit != tapCursors.end(); ++mit) {
-        const std::string &tkey = (*(mit->second.currentPos))->getKey();
-        uint64_t mid = (*(mit->second.currentCheckpoint))->getMutationIdForKey(tkey);
+        CheckpointCursor &cursor = mit->second;
+        uint64_t mid = (*(cursor.currentCheckpoint))->getMutationId(cursor.currentPos);
         if (mid < smallest_mid) {
             smallest_mid = mid;
         }
     }
 
     bool can_evict = true;
+    // Hash the key once for all the checkpoints.
+    index_key ikey(key);
     std::list<Checkpoint*>::reverse_iterator it = checkpointList.rbegin();
     for (; it != checkpointList.rend(); ++it) {
-        uint64_t mid = (*it)->getMutationIdForKey(key);
+        uint64_t mid = (*it)->getMutationIdForKey(ikey);
         if (mid == 0) { // key doesn't exist in a checkpoint.
             continue;
         }
@@ -943,7 +1191,8 @@ size_t CheckpointManager::getNumItemsForTAPConnection(const std::string &name) {
     size_t remains = 0;
     std::map<const std::string, CheckpointCursor>::iterator it = tapCursors.find(name);
     if (it != tapCursors.end()) {
-        remains = (numItems >= it->second.offset) ? numItems - it->second.offset : 0;
+        size_t offset = getCursorOffset_UNLOCKED(it->second);
+        remains = (numItems >= offset) ? numItems - offset : 0;
     }
     return remains;
 }
@@ -952,6 +1201,7 @@ void CheckpointManager::decrTapCursorFromCheckpointEnd(const std::string &name)
     LockHolder lh(queueLock);
     std::map<const std::string, CheckpointCursor>::iterator it = tapCursors.find(name);
     if (it != tapCursors.end() &&
+        *(it->second.currentPos) &&
         (*(it->second.currentPos))->getOperation() == queue_op_checkpoint_end) {
         decrCursorOffset_UNLOCKED(it->second, 1);
         decrCursorPos_UNLOCKED(it->second);
@@ -959,7 +1209,7 @@ void CheckpointManager::decrTapCursorFromCheckpointEnd(const std::string &name)
 }
 
 bool CheckpointManager::isLastMutationItemInCheckpoint(CheckpointCursor &cursor) {
-    std::list<queued_item>::iterator it = cursor.currentPos;
+    CheckpointQueue::iterator it = cursor.currentPos;
     ++it;
     if (it == (*(cursor.currentCheckpoint))->end() ||
         (*it)->getOperation() == queue_op_checkpoint_end) {
@@ -1009,6 +1259,7 @@ bool CheckpointManager::checkAndAddNewCheckpoint(uint64_t id, bool &pCursorRepos
             setOpenCheckpointId_UNLOCKED(id);
             // Reposition all the cursors in the open checkpoint to the begining position
             // so that a checkpoint_start message can be sent again with the correct id.
+            checkpointList.back()->invalidateCursorOrder();
             const std::set<std::string> &cursors = checkpointList.back()->getCursorNameList();
             std::set<std::string>::const_iterator cit = cursors.begin();
             for (; cit != cursors.end(); ++cit) {
@@ -1065,7 +1316,7 @@ bool CheckpointManager::hasNext(const std::string &name) {
     }
 
     bool hasMore = true;
-    std::list<queued_item>::iterator curr = it->second.currentPos;
+    CheckpointQueue::iterator curr = it->second.currentPos;
     ++curr;
     if (curr == (*(it->second.currentCheckpoint))->end() &&
         (*(it->second.currentCheckpoint))->getState() == opened) {
@@ -1091,7 +1342,7 @@ queued_item CheckpointManager::createCheckpointItem(uint64_t id,
 bool CheckpointManager::hasNextForPersistence() {
     LockHolder lh(queueLock);
     bool hasMore = true;
-    std::list<queued_item>::iterator curr = persistenceCursor.currentPos;
+    CheckpointQueue::iterator curr = persistenceCursor.currentPos;
     ++curr;
     if (curr == (*(persistenceCursor.currentCheckpoint))->end() &&
         (*(persistenceCursor.currentCheckpoint))->getState() == opened) {
@@ -1119,6 +1370,7 @@ void CheckpointManager::decrCursorOffset_UNLOCKED(CheckpointCursor &cursor, size
 void CheckpointManager::decrCursorPos_UNLOCKED(CheckpointCursor &cursor) {
     if (cursor.currentPos != (*(cursor.currentCheckpoint))->begin()) {
         --(cursor.currentPos);
+        (*(cursor.currentCheckpoint))->invalidateCursorOrder();
     }
 }
 
@@ -1146,6 +1398,7 @@ CheckpointConfig::CheckpointConfig(EventuallyPersistentEngine &e) {
     inconsistentSlaveCheckpoint = config.isInconsistentSlaveChk();
     itemNumBasedNewCheckpoint = config.isItemNumBasedNewChk();
     keepClosedCheckpoints = config.isKeepClosedChks();
+    reclaimList = NULL;
 }
 
 bool CheckpointConfig::validateCheckpointMaxItemsParam(size_t checkpoint_max_items) {
@@ -3,9 +3,11 @@
 #define CHECKPOINT_HH 1
 
 #include <assert.h>
+#include <deque>
 #include <list>
 #include <map>
 #include <set>
+#include <vector>
 
 #include "common.hh"
 #include "atomic.hh"
@@ -24,6 +26,9 @@
 #define DEFAULT_MAX_CHECKPOINTS 2
 #define MAX_CHECKPOINTS_UPPER_BOUND 5
 
+// Number of item slots in each chunk of a checkpoint queue.
+#define CHECKPOINT_CHUNK_SIZE 64
+
 /**
  * The state of a given checkpoint.
  */
@@ -33,17 +38,237 @@ typedef enum {
 } checkpoint_state;
 
 /**
- * A checkpoint index entry.
+ * The items of a checkpoint in queueing order.
+ *
+ * Items are kept in fixed size chunks of slots, and each item is
+ * addressed by a position that doesn't change while items are added at
+ * either end.  The position of the slot at offset o of the chunk c is
+ * that of the first slot plus c * CHECKPOINT_CHUNK_SIZE + o; positions
+ * wrap around, so they must only be compared for equality.
+ *
+ * Every slot also records the mutation id of its item, which stays
+ * there once the item is erased, so a cursor's progress can be told
+ * from its position alone.
+ *
+ * Erasing an item leaves an empty slot behind, which iteration skips.
+ * The owner squeezes the empty slots out by copying the items to a new
+ * queue when there are too many of them.
+ */
+class CheckpointQueue {
+public:
+
+    /**
+     * An iterator over the items of a queue.  It remains valid as items
+     * are added to or erased from the queue, but not across a swap().
+     */
+    class iterator {
+    public:
+        iterator() : queue(NULL), pos(0) { }
+
+        iterator(CheckpointQueue *q, size_t p) : queue(q), pos(p) { }
+
+        queued_item &operator*() const {
+            return queue->at(pos);
+        }
+
+        iterator &operator++() {
+            pos = queue->nextPos(pos);
+            return *this;
+        }
+
+        iterator &operator--() {
+            pos = queue->prevPos(pos);
+            return *this;
+        }
+
+        bool operator==(const iterator &other) const {
+            return pos == other.pos && queue == other.queue;
+        }
+
+        bool operator!=(const iterator &other) const {
+            return !(*this == other);
+        }
+
+        size_t position() const {
+            return pos;
+        }
+
+    private:
+        CheckpointQueue *queue;
+        size_t           pos;
+    };
+
+    CheckpointQueue() : first(0), head(0), tail(0), numItems(0) { }
+
+    ~CheckpointQueue() {
+        clear();
+    }
+
+    /**
+     * Append an item and return its position.
+     */
+    size_t push_back(const queued_item &qi, uint64_t mutationId);
+
+    /**
+     * Add an item in front of all the others and return its position.
+     */
+    size_t push_front(const queued_item &qi, uint64_t mutationId);
+
+    /**
+     * Remove the item at the given position, leaving its slot empty.
+     */
+    void erase(size_t pos);
+
+    /**
+     * Remove the last item, releasing its slot.
+     */
+    void pop_back();
+
+    /**
+     * The item at the given position (NULL for an empty slot).
+     */
+    queued_item &at(size_t pos) {
+        size_t off = pos - first;
+        return chunks[off / CHECKPOINT_CHUNK_SIZE]->items[off % CHECKPOINT_CHUNK_SIZE];
+    }
+
+    /**
+     * The mutation id of the item at the given position, or of the item
+     * that used to be there.
+     */
+    uint64_t mutationIdAt(size_t pos) const {
+        size_t off = pos - first;
+        return chunks[off / CHECKPOINT_CHUNK_SIZE]->mutationIds[off % CHECKPOINT_CHUNK_SIZE];
+    }
+
+    /**
+     * The position of the first item after the given one, or end().
+     */
+    size_t nextPos(size_t pos) {
+        do {
+            ++pos;
+        } while (pos != tail && !at(pos));
+        return pos;
+    }
+
+    /**
+     * The position of the last item before the given one, or the given
+     * position if there is none.
+     */
+    size_t prevPos(size_t pos) {
+        size_t p = pos;
+        while (p != head) {
+            if (at(--p)) {
+                return p;
+            }
+        }
+        return pos;
+    }
+
+    iterator begin() {
+        size_t pos = head;
+        while (pos != tail && !at(pos)) {
+            ++pos;
+        }
+        return iterator(this, pos);
+    }
+
+    iterator end() {
+        return iterator(this, tail);
+    }
+
+    /**
+     * The last item; the queue must not be empty.
+     */
+    queued_item &back() {
+        return at(prevPos(tail));
+    }
+
+    /**
+     * The number of items in the queue.
+     */
+    size_t size() const {
+        return numItems;
+    }
+
+    /**
+     * The number of slots in use, including the empty ones.
+     */
+    size_t numSlots() const {
+        return tail - head;
+    }
+
+    /**
+     * The memory held by the chunks of this queue.
+     */
+    size_t memorySize() const {
+        return chunks.size() * sizeof(Chunk);
+    }
+
+    /**
+     * Exchange the contents of two queues.  Positions and iterators of
+     * either queue become meaningless.
+     */
+    void swap(CheckpointQueue &other);
+
+    void clear();
+
+private:
+    struct Chunk {
+        queued_item items[CHECKPOINT_CHUNK_SIZE];
+        uint64_t    mutationIds[CHECKPOINT_CHUNK_SIZE];
+    };
+
+    std::deque<Chunk*>       chunks;
+    size_t                   first;     // position of the first slot of the first chunk
+    size_t                   head;      // position of the first slot in use
+    size_t                   tail;      // position after the last slot in use
+    size_t                   numItems;
+
+    DISALLOW_COPY_AND_ASSIGN(CheckpointQueue);
+};
+
+/**
+ * A checkpoint index entry.  The item's mutation id is kept in its
+ * queue slot.
  */
 struct index_entry {
-    std::list<queued_item>::iterator position;
-    uint64_t mutation_id;
+    size_t position;
+};
+
+/**
+ * A key in the checkpoint index.
+ *
+ * It refers to the key of a queued item held by the checkpoint (or to a
+ * caller's string while looking up) instead of copying it, and carries
+ * the key's hash so the index doesn't compute it again.  The key is
+ * pointed at the newer item when an item is replaced by one for the same
+ * key, which changes neither its hash nor its equality.
+ */
+struct index_key {
+    explicit index_key(const std::string &k) : key(&k), hash(hashKey(k)) { }
+    explicit index_key(const queued_item &qi) : key(&qi->getKey()),
+                                                hash(qi->getKeyHash()) { }
+
+    bool operator==(const index_key &other) const {
+        return hash == other.hash && *key == *other.key;
+    }
+
+    mutable const std::string *key;
+    uint64_t hash;
+};
+
+struct index_key_hash {
+    size_t operator()(const index_key &k) const {
+        return static_cast<size_t>(k.hash);
+    }
 };
 
 /**
- * The checkpoint index maps a key to a checkpoint index_entry.
+ * The checkpoint index maps a key to a checkpoint index_entry.  An
+ * entry must be erased before the queued item its key refers to.
  */
-typedef unordered_map<std::string, index_entry> checkpoint_index;
+typedef unordered_map<index_key, index_entry, index_key_hash> checkpoint_index;
 
 class Checkpoint;
 class CheckpointManager;
@@ -57,24 +282,27 @@ class CheckpointCursor {
     friend class CheckpointManager;
     friend class Checkpoint;
 public:
-    CheckpointCursor() { }
+    CheckpointCursor() : replacedMark(0) { }
 
-    CheckpointCursor(const std::string &n) : name(n) { }
+    CheckpointCursor(const std::string &n) : name(n), replacedMark(0) { }
 
     CheckpointCursor(const std::string &n,
                      std::list<Checkpoint*>::iterator checkpoint,
-                     std::list<queued_item>::iterator pos,
+                     CheckpointQueue::iterator pos,
                      size_t os = 0, bool isClosedCheckpointOnly = false,
                      uint64_t openChkId = 1) :
         name(n), currentCheckpoint(checkpoint), currentPos(pos),
-        offset(os), closedCheckpointOnly(isClosedCheckpointOnly),
+        offset(os), replacedMark(0), closedCheckpointOnly(isClosedCheckpointOnly),
         openChkIdAtRegistration(openChkId) { }
 
 private:
     std::string                      name;
     std::list<Checkpoint*>::iterator currentCheckpoint;
-    std::list<queued_item>::iterator currentPos;
+    CheckpointQueue::iterator        currentPos;
+    // The number of items behind the cursor is offset less the number of
+    // items the current checkpoint replaced since it was replacedMark.
     Atomic<size_t>                   offset;
+    size_t                           replacedMark;
     bool                             closedCheckpointOnly;
     uint64_t                         openChkIdAtRegistration;
 };
@@ -94,7 +322,8 @@ class Checkpoint {
 public:
     Checkpoint(EPStats &st, uint64_t id, uint16_t vbid, checkpoint_state state = opened) :
         stats(st), checkpointId(id), vbucketId(vbid), creationTime(ep_real_time()),
-        checkpointState(state), numItems(0), memOverhead(0) {
+        checkpointState(state), numItems(0), numReplaced(0), memOverhead(0),
+        queueMemory(0), cursorsSorted(false) {
         stats.memOverhead.incr(memorySize());
         assert(stats.memOverhead.get() < GIGANTOR);
     }
@@ -189,21 +418,18 @@ public:
     queue_dirty_t queueDirty(const queued_item &qi, CheckpointManager *checkpointManager);
 
 
-    std::list<queued_item>::iterator begin() {
+    CheckpointQueue::iterator begin() {
         return toWrite.begin();
     }
 
-    std::list<queued_item>::iterator end() {
+    CheckpointQueue::iterator end() {
         return toWrite.end();
     }
 
-    std::list<queued_item>::reverse_iterator rbegin() {
-        return toWrite.rbegin();
-    }
-
-    std::list<queued_item>::reverse_iterator rend() {
-        return toWrite.rend();
-    }
+    /**
+     * Replace the item at a given position by another one for the same key.
+     */
+    void replaceItem(const CheckpointQueue::iterator &pos, const queued_item &qi);
 
     bool keyExists(const std::string &key);
 
@@ -230,20 +456,123 @@ public:
      * @param key a key to retrieve its mutation id
      * @return the mutation id for a given key
      */
-    uint64_t getMutationIdForKey(const std::string &key);
+    uint64_t getMutationIdForKey(const std::string &key) {
+        return getMutationIdForKey(index_key(key));
+    }
+
+    uint64_t getMutationIdForKey(const index_key &key);
+
+    /**
+     * Get the mutation id of the item a cursor in this checkpoint is at.
+     */
+    uint64_t getMutationId(const CheckpointQueue::iterator &pos) const {
+        return toWrite.mutationIdAt(pos.position());
+    }
+
+    /**
+     * Return the number of items replaced by newer ones for the same key
+     * that the cursors' offsets are yet to account for.
+     */
+    size_t getNumReplaced() const {
+        return numReplaced;
+    }
+
+    /**
+     * Forget the order of the cursors in this checkpoint.  This must be
+     * called whenever a cursor enters or leaves the checkpoint, or moves
+     * backwards in it.
+     */
+    void invalidateCursorOrder() {
+        cursorsSorted = false;
+        cursorsByMutationId.clear();
+    }
 
 private:
+    /**
+     * Decrease the offsets of the cursors at or past the item with the
+     * given mutation id, which is being replaced.  The cursors are kept
+     * sorted by the mutation id they're at, and only the ones on the
+     * smaller side of the item have their offsets changed.
+     */
+    void adjustCursorOffsets(uint64_t mutationId, CheckpointManager *checkpointManager);
+
+    /**
+     * Copy the items to a new queue without the empty slots left by
+     * deduplication, moving the index entries and the cursors along.
+     */
+    void compact(CheckpointManager *checkpointManager);
+
+    /**
+     * Account for the chunks allocated or released by the queue.
+     */
+    void updateQueueMemory();
+
     EPStats                       &stats;
     uint64_t                       checkpointId;
     uint16_t                       vbucketId;
     rel_time_t                     creationTime;
     checkpoint_state               checkpointState;
     size_t                         numItems;
+    size_t                         numReplaced;
     std::set<std::string>          cursors; // List of cursors with their unique names.
-    // List is used for queueing mutations as vector incurs shift operations for deduplication.
-    std::list<queued_item>         toWrite;
+    CheckpointQueue                toWrite;
     checkpoint_index               keyIndex;
     size_t                         memOverhead;
+    size_t                         queueMemory; // part of memOverhead held by toWrite
+    // The cursors in this checkpoint ordered by the mutation ids they were
+    // at when last sorted, which they may have moved past since.
+    std::vector<std::pair<uint64_t, CheckpointCursor*> > cursorsByMutationId;
+    bool                           cursorsSorted;
+};
+
+/**
+ * The vbuckets whose oldest closed checkpoint lost its last cursor, in the
+ * order they were reported, waiting for the checkpoint remover.
+ *
+ * Checkpoint managers push onto it while holding their queue lock, so the
+ * list itself is a lock-free stack; the remover takes everything off it at
+ * once.  The owner is notified after the pushing manager released its
+ * lock.
+ */
+class CheckpointReclaimList {
+public:
+    CheckpointReclaimList() : head(NULL) {}
+
+    virtual ~CheckpointReclaimList();
+
+    /**
+     * Add a vbucket to the list.
+     *
+     * @return true if the list was empty, in which case notify() is
+     *         due once the caller's locks are released
+     */
+    bool push(uint16_t vbid);
+
+    /**
+     * Take all the vbuckets off the list, appending them to vbids in the
+     * order they were pushed.
+     */
+    void popAll(std::vector<uint16_t> &vbids);
+
+    bool empty() const {
+        return head.get() == NULL;
+    }
+
+    /**
+     * Called after a push made the list non-empty.
+     */
+    virtual void notify() {}
+
+private:
+    struct Node {
+        Node(uint16_t id, Node *n) : vbid(id), next(n) {}
+        uint16_t vbid;
+        Node    *next;
+    };
+
+    AtomicPtr<Node> head;
+
+    DISALLOW_COPY_AND_ASSIGN(CheckpointReclaimList);
 };
 
 /**
@@ -261,7 +590,7 @@ public:
         stats(st), checkpointConfig(config), vbucketId(vbucket), numItems(0),
         mutationCounter(0), persistenceCursor("persistence"),
         isCollapsedCheckpoint(false),
-        checkpointExtension(false)
+        checkpointExtension(false), reclaimPending(false), reclaimNotify(false)
     {
         addNewCheckpoint(checkpointId);
         registerPersistenceCursor();
@@ -373,7 +702,7 @@ public:
      */
     size_t getNumItemsForPersistence_UNLOCKED() {
         size_t num_items = numItems;
-        size_t offset = persistenceCursor.offset;
+        size_t offset = getCursorOffset_UNLOCKED(persistenceCursor);
         return num_items > offset ? num_items - offset : 0;
     }
 
@@ -494,6 +823,23 @@ private:
 
     void decrCursorPos_UNLOCKED(CheckpointCursor &cursor);
 
+    /**
+     * Return the number of items behind a given cursor.
+     */
+    size_t getCursorOffset_UNLOCKED(const CheckpointCursor &cursor) const {
+        size_t pending = (*(cursor.currentCheckpoint))->getNumReplaced() - cursor.replacedMark;
+        size_t offset = cursor.offset;
+        return offset > pending ? offset - pending : 0;
+    }
+
+    /**
+     * Set the number of items behind a given cursor in its current checkpoint.
+     */
+    void setCursorOffset_UNLOCKED(CheckpointCursor &cursor, size_t offset) {
+        cursor.offset = offset;
+        cursor.replacedMark = (*(cursor.currentCheckpoint))->getNumReplaced();
+    }
+
     bool isLastMutationItemInCheckpoint(CheckpointCursor &cursor);
 
     bool isCheckpointCreationForHighMemUsage(const RCPtr<VBucket> &vbucket);
@@ -502,6 +848,40 @@ private:
 
     void resetCursors();
 
+    /**
+     * Report this vbucket to the checkpoint reclaim list if its oldest
+     * checkpoint is closed and no cursor refers to it any more.
+     */
+    void reportUnrefCheckpoint_UNLOCKED();
+
+    /**
+     * True if closed checkpoints are being kept around rather than
+     * removed once unreferenced.
+     */
+    bool keepsClosedCheckpoints_UNLOCKED();
+
+    /**
+     * Notify the checkpoint reclaim list if this manager made it
+     * non-empty.  Must be called without holding the queue lock.
+     */
+    void notifyReclaimList();
+
+    /**
+     * Notifies the reclaim list as it goes out of scope, so declared
+     * before the queue lock's LockHolder it runs after the lock is
+     * released.
+     */
+    class ReclaimNotifier {
+    public:
+        ReclaimNotifier(CheckpointManager &m) : manager(m) {}
+        ~ReclaimNotifier() {
+            manager.notifyReclaimList();
+        }
+    private:
+        CheckpointManager &manager;
+    };
+    friend class ReclaimNotifier;
+
     static queued_item createCheckpointItem(uint64_t id, uint16_t vbid,
                                             enum queue_operation checkpoint_op);
 
@@ -517,6 +897,11 @@ private:
     bool                     isCollapsedCheckpoint;
     bool                     checkpointExtension;
     uint64_t                 lastClosedCheckpointId;
+    // True while this vbucket is on the checkpoint reclaim list.
+    bool                     reclaimPending;
+    // True if our push made the reclaim list non-empty, and it still
+    // needs to be notified.
+    Atomic<bool>             reclaimNotify;
     std::map<const std::string, CheckpointCursor> tapCursors;
 };
 
@@ -532,7 +917,8 @@ public:
           maxCheckpoints(DEFAULT_MAX_CHECKPOINTS),
           inconsistentSlaveCheckpoint (false),
           itemNumBasedNewCheckpoint(true),
-          keepClosedCheckpoints(false)
+          keepClosedCheckpoints(false),
+          reclaimList(NULL)
     { /* empty */ }
 
     CheckpointConfig(EventuallyPersistentEngine &e);
@@ -561,6 +947,37 @@ public:
         return keepClosedCheckpoints;
     }
 
+    bool hasReclaimList() const {
+        return reclaimList != NULL;
+    }
+
+    /**
+     * Put a vbucket on the reclaim list, if there is one.
+     *
+     * @return true if the list needs a notifyReclaimList()
+     */
+    bool pushReclaim(uint16_t vbid) {
+        LockHolder lh(reclaimListLock);
+        return reclaimList != NULL && reclaimList->push(vbid);
+    }
+
+    void notifyReclaimList() {
+        LockHolder lh(reclaimListLock);
+        if (reclaimList != NULL) {
+            reclaimList->notify();
+        }
+    }
+
+    /**
+     * Set the list checkpoint managers report unreferenced closed
+     * checkpoints to, or NULL to leave them to the periodic scan.
+     * Once cleared, no manager touches the old list any more.
+     */
+    void setReclaimList(CheckpointReclaimList *list) {
+        LockHolder lh(reclaimListLock);
+        reclaimList = list;
+    }
+
 protected:
     friend class CheckpointConfigChangeListener;
     friend class EventuallyPersistentEngine;
@@ -603,6 +1020,10 @@ private:
     // Flag indicating if closed checkpoints should be kept in memory if the current memory usage
     // below the high water mark.
     bool keepClosedCheckpoints;
+    // Where closed checkpoints are reported as soon as they become unreferenced.
+    CheckpointReclaimList * volatile reclaimList;
+    // Keeps the reclaim list from going away under a push or notify.
+    Mutex                            reclaimListLock;
 };
 
 #endif /* CHECKPOINT_HH */
@@ -14,7 +14,8 @@ public:
     /**
      * Construct a CheckpointVisitor.
      */
-    CheckpointVisitor(EventuallyPersistentStore *s, EPStats &st, bool *sfin)
+    CheckpointVisitor(EventuallyPersistentStore *s, EPStats &st,
+                      Atomic<bool> *sfin)
         : store(s), stats(st), removed(0),
           stateFinalizer(sfin) {}
 
@@ -47,21 +48,47 @@ public:
         }
     }
 
+    /**
+     * Checkpoints are only removed under their manager's lock, which
+     * the flusher and the TAP connections already contend for.
+     */
+    bool isConcurrent() {
+        return true;
+    }
+
 private:
     EventuallyPersistentStore *store;
     EPStats                   &stats;
     size_t                     removed;
-    bool                      *stateFinalizer;
+    Atomic<bool>              *stateFinalizer;
 };
 
 bool ClosedUnrefCheckpointRemover::callback(Dispatcher &d, TaskId t) {
-    if (available) {
+    reclaimList.setTask(&d, t);
+
+    std::vector<uint16_t> vbids;
+    reclaimList.popAll(vbids);
+    if (!vbids.empty()) {
+        stats.checkpointReclaims.incr(vbids.size());
+        CheckpointVisitor visitor(store, stats, NULL);
+        std::vector<uint16_t>::iterator it;
+        for (it = vbids.begin(); it != vbids.end(); ++it) {
+            RCPtr<VBucket> vb = store->getVBucket(*it);
+            if (vb) {
+                visitor.visitBucket(vb);
+            }
+        }
+    }
+
+    rel_time_t now = ep_current_time();
+    if (available && now >= nextVisit) {
         ++stats.checkpointRemoverRuns;
 
         available = false;
+        nextVisit = now + sleepTime;
         shared_ptr<CheckpointVisitor> pv(new CheckpointVisitor(store, stats, &available));
         store->visit(pv, "Checkpoint Remover", &d, Priority::CheckpointRemoverPriority);
     }
-    d.snooze(t, sleepTime);
+    d.snooze(t, nextVisit > now ? nextVisit - now : sleepTime);
     return true;
 }
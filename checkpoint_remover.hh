@@ -6,13 +6,48 @@
 #include <set>
 
 #include "common.hh"
+#include "checkpoint.hh"
 #include "stats.hh"
 #include "dispatcher.hh"
 
 class EventuallyPersistentStore;
 
+/**
+ * The checkpoint reclaim list of the checkpoint remover, which wakes the
+ * remover up as soon as a vbucket is put on it.
+ */
+class CheckpointRemoverReclaimList : public CheckpointReclaimList {
+public:
+    CheckpointRemoverReclaimList() : dispatcher(NULL) {}
+
+    /**
+     * Record the task to wake up.
+     */
+    void setTask(Dispatcher *d, TaskId t) {
+        LockHolder lh(mutex);
+        dispatcher = d;
+        task = t;
+    }
+
+    void notify() {
+        LockHolder lh(mutex);
+        if (dispatcher != NULL && task) {
+            dispatcher->wake(task, &task);
+        }
+    }
+
+private:
+    Mutex       mutex;
+    Dispatcher *dispatcher;
+    TaskId      task;
+};
+
 /**
  * Dispatcher job responsible for removing closed unreferenced checkpoints from memory.
+ *
+ * Vbuckets are handled as soon as they are put on the reclaim list; all of
+ * them are still visited every interval, to catch whatever the list missed
+ * and to create new checkpoints on time.
  */
 class ClosedUnrefCheckpointRemover : public DispatcherCallback {
 public:
@@ -24,19 +59,34 @@ public:
      */
     ClosedUnrefCheckpointRemover(EventuallyPersistentStore *s, EPStats &st,
                                  size_t interval) :
-        store(s), stats(st), sleepTime(interval), available(true) {}
+        store(s), stats(st), sleepTime(interval), available(true),
+        nextVisit(0) {}
 
     bool callback(Dispatcher &d, TaskId t);
 
+    /**
+     * The list checkpoint managers should report unreferenced closed
+     * checkpoints to.
+     */
+    CheckpointReclaimList *getReclaimList() {
+        return &reclaimList;
+    }
+
     std::string description() {
         return std::string("Removing closed unreferenced checkpoints from memory");
     }
 
+    bool isConcurrent() {
+        return true;
+    }
+
 private:
     EventuallyPersistentStore *store;
     EPStats                   &stats;
     size_t                     sleepTime;
-    bool                       available;
+    Atomic<bool>               available;
+    rel_time_t                 nextVisit;
+    CheckpointRemoverReclaimList reclaimList;
 };
 
 #endif /* CHECKPOINT_REMOVER_HH */
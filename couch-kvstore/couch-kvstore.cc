@@ -4,10 +4,13 @@
 #include <cstdlib>
 #include <cctype>
 #include <algorithm>
+#include <deque>
+#include <set>
 #include <stdio.h>
 #include <dirent.h>
 #include <glob.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/uio.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -54,6 +57,11 @@ int recordDbDumpC(Db* db, DocInfo* docinfo, void *ctx) {
     return CouchKVStore::recordDbDump(db, docinfo, ctx);
 }
 
+extern "C" int getMultiCbC(Db *db, DocInfo *docinfo, void *ctx);
+int getMultiCbC(Db *db, DocInfo *docinfo, void *ctx) {
+    return CouchKVStore::getMultiCb(db, docinfo, ctx);
+}
+
 static const std::string getJSONObjString(cJSON *i) {
     if (i == NULL) {
         return "";
@@ -129,12 +137,218 @@ public:
     uint16_t vbId;
 };
 
+/**
+ * A copy of the docinfo of a document a multi-get has to read, so the
+ * reads can be done in the order of the documents in the file.
+ */
+struct DeferredFetch {
+    DeferredFetch(const DocInfo *docinfo) :
+        info(*docinfo), key(docinfo->id.buf, docinfo->id.size),
+        meta(docinfo->rev_meta.buf, docinfo->rev_meta.size) { }
+
+    bool operator<(const DeferredFetch &other) const {
+        return info.bp < other.info.bp;
+    }
+
+    DocInfo *getDocInfo() {
+        info.id.buf = const_cast<char *>(key.data());
+        info.id.size = key.size();
+        info.rev_meta.buf = const_cast<char *>(meta.data());
+        info.rev_meta.size = meta.size();
+        return &info;
+    }
+
+    DocInfo info;
+    std::string key;
+    std::string meta;
+};
+
+struct GetMultiCbCtx {
+    GetMultiCbCtx(CouchKVStore &c, uint16_t v, vb_bgfetch_queue_t &f) :
+        cks(c), vbId(v), fetches(f) { /* EMPTY */ }
+
+    CouchKVStore &cks;
+    uint16_t vbId;
+    vb_bgfetch_queue_t &fetches;
+    // The documents whose values have to be read
+    std::vector<DeferredFetch> deferred;
+};
+
+class CouchLoadPool;
+
 struct LoadResponseCtx {
+    LoadResponseCtx() : vbucketId(0), keysonly(false), pool(NULL) { }
+
     shared_ptr<LoadCallback> callback;
     uint16_t vbucketId;
     bool keysonly;
+    // Set when the items go through a pool of loading threads, which
+    // hands them over in batches instead of calling back right away.
+    CouchLoadPool *pool;
+    std::vector<Item*> batch;
+};
+
+// Loading threads hand their items over in batches, with at most
+// MAX_PENDING_LOAD_BATCHES of them waiting per thread.
+static const size_t MAX_PENDING_LOAD_BATCHES(4);
+
+/**
+ * Scans the vbucket files of a loadDB() call with a pool of threads,
+ * each reading whole files one after another.  The items read are
+ * queued up and fed to the load callback by the thread that called
+ * loadDB(), so the callback never runs concurrently with itself.
+ */
+class CouchLoadPool {
+public:
+    CouchLoadPool(CouchKVStore &st,
+                  const std::vector<std::pair<uint16_t, int> > &f,
+                  bool ko, size_t bs) :
+        store(st), files(f), keysOnly(ko), batchSize(bs), maxBatches(0),
+        nextFile(0), running(0) { }
+
+    ~CouchLoadPool() {
+        while (!batches.empty()) {
+            deleteBatch(batches.front());
+            batches.pop_front();
+        }
+    }
+
+    /**
+     * Scan all the files with up to the given number of threads.
+     *
+     * @return false if no thread could be started
+     */
+    bool run(shared_ptr<LoadCallback> cb, size_t nthreads);
+
+    /**
+     * Body of the loading threads.
+     */
+    void scan();
+
+    /**
+     * Add an item read by a loading thread to its current batch.
+     */
+    void add(LoadResponseCtx &ctx, Item *it) {
+        ctx.batch.push_back(it);
+        if (ctx.batch.size() >= batchSize) {
+            push(ctx.batch);
+        }
+    }
+
+private:
+    void push(std::vector<Item*> &items) {
+        std::vector<Item*> *b = new std::vector<Item*>();
+        b->swap(items);
+        LockHolder lh(sync);
+        while (batches.size() >= maxBatches) {
+            sync.wait();
+        }
+        batches.push_back(b);
+        sync.notify();
+    }
+
+    static void deleteBatch(std::vector<Item*> *b) {
+        std::vector<Item*>::iterator it;
+        for (it = b->begin(); it != b->end(); ++it) {
+            delete *it;
+        }
+        delete b;
+    }
+
+    CouchKVStore                                  &store;
+    const std::vector<std::pair<uint16_t, int> >  &files;
+    const bool                                     keysOnly;
+    const size_t                                   batchSize;
+    size_t                                         maxBatches;
+    SyncObject                                     sync;
+    std::deque<std::vector<Item*>*>                batches;
+    size_t                                         nextFile;
+    size_t                                         running;
+
+    DISALLOW_COPY_AND_ASSIGN(CouchLoadPool);
 };
 
+static void *launchCouchLoadThread(void *arg) {
+    static_cast<CouchLoadPool*>(arg)->scan();
+    return NULL;
+}
+
+bool CouchLoadPool::run(shared_ptr<LoadCallback> cb, size_t nthreads) {
+    std::vector<pthread_t> threads;
+    maxBatches = nthreads * MAX_PENDING_LOAD_BATCHES;
+
+    LockHolder lh(sync);
+    for (size_t i = 0; i < nthreads; ++i) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, launchCouchLoadThread, this) != 0) {
+            getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                             "Warning: failed to start a couch loading thread, "
+                             "running with %d\n", (int)i);
+            break;
+        }
+        threads.push_back(tid);
+        ++running;
+    }
+    if (threads.empty()) {
+        return false;
+    }
+
+    while (true) {
+        while (batches.empty() && running > 0) {
+            sync.wait();
+        }
+        if (batches.empty()) {
+            break;
+        }
+        std::vector<Item*> *b = batches.front();
+        batches.pop_front();
+        sync.notify();
+        lh.unlock();
+
+        std::vector<Item*>::iterator it;
+        for (it = b->begin(); it != b->end(); ++it) {
+            GetValue rv(*it, ENGINE_SUCCESS, -1, -1, NULL, keysOnly);
+            cb->cb->callback(rv);
+        }
+        delete b;
+        lh.lock();
+    }
+    lh.unlock();
+
+    std::vector<pthread_t>::iterator tit;
+    for (tit = threads.begin(); tit != threads.end(); ++tit) {
+        pthread_join(*tit, NULL);
+    }
+    return true;
+}
+
+void CouchLoadPool::scan() {
+    // The items are created here and freed by the engine.
+    ObjectRegistry::onSwitchThread(&store.engine);
+
+    LoadResponseCtx ctx;
+    ctx.keysonly = keysOnly;
+    ctx.pool = this;
+    while (true) {
+        LockHolder lh(sync);
+        if (nextFile == files.size()) {
+            break;
+        }
+        std::pair<uint16_t, int> file = files[nextFile++];
+        lh.unlock();
+
+        ctx.vbucketId = file.first;
+        store.loadVBucket(file.first, file.second, ctx);
+    }
+    if (!ctx.batch.empty()) {
+        push(ctx.batch);
+    }
+
+    LockHolder lh(sync);
+    --running;
+    sync.notify();
+}
+
 CouchRequest::CouchRequest(const Item &it, int rev, CouchRequestCallback &cb, bool del) :
                            value(it.getValue()), valuelen(it.getNBytes()),
                            vbucketId(it.getVBucketId()), fileRevNum(rev),
@@ -175,12 +389,166 @@ CouchRequest::CouchRequest(const Item &it, int rev, CouchRequestCallback &cb, bo
     start = gethrtime();
 }
 
+uint64_t CouchDbHandleCache::getGeneration() {
+    LockHolder lh(mutex);
+    return generation;
+}
+
+bool CouchDbHandleCache::isCurrent(const handle_key_t &key, Db *db,
+                                   uint64_t gen) {
+    std::map<uint16_t, uint64_t>::iterator iit = invalidated.find(key.first);
+    if (iit != invalidated.end() && gen <= iit->second) {
+        return false;
+    }
+    std::map<handle_key_t, uint64_t>::iterator hit = committedHeaders.find(key);
+    return hit == committedHeaders.end() ||
+           hit->second == couchstore_get_header_position(db);
+}
+
+Db *CouchDbHandleCache::checkout(uint16_t vbid, uint16_t rev, uint64_t &gen) {
+    handle_key_t key(vbid, rev);
+    LockHolder lh(mutex);
+    std::map<handle_key_t, std::list<Entry>::iterator>::iterator it;
+    it = index.find(key);
+    if (it == index.end()) {
+        ++misses;
+        return NULL;
+    }
+
+    Entry entry = *(it->second);
+    lru.erase(it->second);
+    index.erase(it);
+    bool current = isCurrent(key, entry.db, entry.gen);
+    lh.unlock();
+
+    if (!current) {
+        ++stale;
+        ++misses;
+        closeDatabaseHandle(entry.db);
+        return NULL;
+    }
+    ++hits;
+    gen = entry.gen;
+    return entry.db;
+}
+
+void CouchDbHandleCache::checkin(uint16_t vbid, uint16_t rev, Db *db,
+                                 uint64_t gen) {
+    if (capacity == 0) {
+        closeDatabaseHandle(db);
+        return;
+    }
+
+    Entry entry;
+    entry.db = db;
+    entry.vbid = vbid;
+    entry.rev = rev;
+    entry.gen = gen;
+
+    std::list<Db*> toClose;
+    LockHolder lh(mutex);
+    handle_key_t key(vbid, rev);
+    if (!isCurrent(key, db, gen)) {
+        lh.unlock();
+        ++stale;
+        closeDatabaseHandle(db);
+        return;
+    }
+    std::map<handle_key_t, std::list<Entry>::iterator>::iterator it;
+    it = index.find(key);
+    if (it != index.end()) {
+        // Only one handle per file is kept.
+        toClose.push_back(it->second->db);
+        lru.erase(it->second);
+        index.erase(it);
+    }
+    lru.push_front(entry);
+    index[key] = lru.begin();
+    while (lru.size() > capacity) {
+        toClose.push_back(lru.back().db);
+        index.erase(std::make_pair(lru.back().vbid, lru.back().rev));
+        lru.pop_back();
+        ++evictions;
+    }
+    lh.unlock();
+
+    std::list<Db*>::iterator dit;
+    for (dit = toClose.begin(); dit != toClose.end(); ++dit) {
+        closeDatabaseHandle(*dit);
+    }
+}
+
+void CouchDbHandleCache::setCommittedHeader(uint16_t vbid, uint16_t rev,
+                                            uint64_t pos) {
+    handle_key_t key(vbid, rev);
+    Db *staleDb = NULL;
+    LockHolder lh(mutex);
+    committedHeaders[key] = pos;
+    // Don't keep a handle that can't be used anymore.
+    std::map<handle_key_t, std::list<Entry>::iterator>::iterator it;
+    it = index.find(key);
+    if (it != index.end() && !isCurrent(key, it->second->db, it->second->gen)) {
+        staleDb = it->second->db;
+        lru.erase(it->second);
+        index.erase(it);
+    }
+    lh.unlock();
+
+    if (staleDb != NULL) {
+        ++stale;
+        closeDatabaseHandle(staleDb);
+    }
+}
+
+void CouchDbHandleCache::invalidate(uint16_t vbid) {
+    std::list<Db*> toClose;
+    LockHolder lh(mutex);
+    invalidated[vbid] = generation++;
+    std::map<handle_key_t, uint64_t>::iterator hit;
+    hit = committedHeaders.lower_bound(std::make_pair(vbid, (uint16_t)0));
+    while (hit != committedHeaders.end() && hit->first.first == vbid) {
+        committedHeaders.erase(hit++);
+    }
+    std::list<Entry>::iterator it = lru.begin();
+    while (it != lru.end()) {
+        if (it->vbid == vbid) {
+            toClose.push_back(it->db);
+            index.erase(std::make_pair(it->vbid, it->rev));
+            it = lru.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    lh.unlock();
+
+    std::list<Db*>::iterator dit;
+    for (dit = toClose.begin(); dit != toClose.end(); ++dit) {
+        closeDatabaseHandle(*dit);
+    }
+}
+
+void CouchDbHandleCache::clear() {
+    std::list<Entry> entries;
+    LockHolder lh(mutex);
+    entries.swap(lru);
+    index.clear();
+    lh.unlock();
+
+    std::list<Entry>::iterator it;
+    for (it = entries.begin(); it != entries.end(); ++it) {
+        closeDatabaseHandle(it->db);
+    }
+}
+
 CouchKVStore::CouchKVStore(EventuallyPersistentEngine &theEngine) :
                            KVStore(), engine(theEngine),
                            epStats(theEngine.getEpStats()),
                            configuration(theEngine.getConfiguration()),
                            mc(NULL), pendingCommitCnt(0),
-                           intransaction(false), docsCommitted(0) {
+                           intransaction(false),
+                           readHandles(configuration.getCouchDbHandleCacheSize()),
+                           writeHandles(configuration.getCouchDbHandleCacheSize()),
+                           commitThreadsStopping(false), docsCommitted(0) {
     open();
 }
 
@@ -189,12 +557,16 @@ CouchKVStore::CouchKVStore(const CouchKVStore &copyFrom) :
                            epStats(copyFrom.epStats),
                            configuration(copyFrom.configuration), mc(NULL),
                            pendingCommitCnt(0), intransaction(false),
-                           docsCommitted(0) {
+                           readHandles(configuration.getCouchDbHandleCacheSize()),
+                           writeHandles(configuration.getCouchDbHandleCacheSize()),
+                           commitThreadsStopping(false), docsCommitted(0) {
     open();
     dbFileMap = copyFrom.dbFileMap;
 }
 
 void CouchKVStore::reset() {
+    readHandles.clear();
+    writeHandles.clear();
     // TODO CouchKVStore::flush() when couchstore api ready
     RememberingCallback<bool> cb;
     mc->flush(cb);
@@ -227,10 +599,8 @@ void CouchKVStore::get(const std::string &key, uint64_t, uint16_t vb, uint16_t,
                        Callback<GetValue> &cb) {
     Db *db = NULL;
     DocInfo *docInfo = NULL;
-    Doc *doc = NULL;
     std::string dbFile;
     sized_buf id;
-    Item *it;
     GetValue rv;
 
     if (!(getDbFile(vb, dbFile))) {
@@ -242,7 +612,10 @@ void CouchKVStore::get(const std::string &key, uint64_t, uint16_t vb, uint16_t,
         return;
     }
 
-    couchstore_error_t errCode = openDB(vb, dbFileRev(dbFile), &db, 0, NULL);
+    uint16_t fileRev(0);
+    uint64_t dbGen(0);
+    couchstore_error_t errCode = openCachedDB(readHandles, vb, dbFileRev(dbFile),
+                                              &db, 0, &fileRev, dbGen);
     if (errCode != COUCHSTORE_SUCCESS) {
         getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                          "Warning: failed to open database, name=%s error=%s\n",
@@ -271,47 +644,174 @@ void CouchKVStore::get(const std::string &key, uint64_t, uint16_t vb, uint16_t,
         }
     } else {
         assert(docInfo);
-        uint32_t itemFlags;
-        void *valuePtr = NULL;
-        size_t valuelen = 0;
-        uint64_t cas;
-        sized_buf metadata;
-
-        metadata = docInfo->rev_meta;
-        assert(metadata.size == 16);
-        memcpy(&cas, (metadata.buf), 8);
-        cas = ntohll(cas);
-        memcpy(&itemFlags, (metadata.buf) + 12, 4);
-        itemFlags = ntohl(itemFlags);
-
-        if (getMetaOnly) {
-            it = new Item(key.c_str(), (size_t)key.length(), docInfo->size,
-                          itemFlags, (time_t)0, cas);
-            rv = GetValue(it);
-        } else {
-            errCode = couchstore_open_doc_with_docinfo(db, docInfo, &doc, 0);
-            if (errCode != COUCHSTORE_SUCCESS || docInfo->deleted) {
-                getLogger()->log(EXTENSION_LOG_WARNING, NULL,
-                                 "Warning: failed to retrieve key value from "
-                                 "database, name=%s key=%s error=%s deleted=%s\n",
-                                 dbFile.c_str(), id.buf,
-                                 couchstore_strerror(errCode),
-                                 docInfo->deleted ? "yes" : "no");
+        errCode = fetchDoc(db, docInfo, rv, vb, getMetaOnly);
+        if (errCode != COUCHSTORE_SUCCESS) {
+            getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                             "Warning: failed to retrieve key value from "
+                             "database, name=%s key=%s error=%s deleted=%s\n",
+                             dbFile.c_str(), id.buf,
+                             couchstore_strerror(errCode),
+                             docInfo->deleted ? "yes" : "no");
+        }
+    }
+    couchstore_free_docinfo(docInfo);
+    if (errCode == COUCHSTORE_SUCCESS || errCode == COUCHSTORE_ERROR_DOC_NOT_FOUND) {
+        releaseCachedDB(readHandles, vb, fileRev, db, dbGen);
+    } else {
+        closeDatabaseHandle(db);
+    }
+    cb.callback(rv);
+}
+
+void CouchKVStore::getMulti(uint16_t vb, uint16_t, vb_bgfetch_queue_t &itms) {
+    std::string dbFile;
+    int numItems = itms.size();
+
+    if (!(getDbFile(vb, dbFile))) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Warning: failed to retrieve %d keys from "
+                         "vBucketId = %d, cannot locate database file %s\n",
+                         numItems, vb, dbFile.c_str());
+        return;
+    }
+
+    Db *db = NULL;
+    uint16_t fileRev(0);
+    uint64_t dbGen(0);
+    couchstore_error_t errCode = openCachedDB(readHandles, vb, dbFileRev(dbFile),
+                                              &db, 0, &fileRev, dbGen);
+    if (errCode != COUCHSTORE_SUCCESS) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Warning: failed to open database for multi-get, "
+                         "name=%s error=%s\n",
+                         dbFile.c_str(), couchstore_strerror(errCode));
+        return;
+    }
+
+    // couchstore walks the by-id btree once for the whole batch, which
+    // requires the ids to be in sorted order.
+    std::vector<std::string> keys;
+    keys.reserve(numItems);
+    vb_bgfetch_queue_t::iterator itr = itms.begin();
+    for (; itr != itms.end(); ++itr) {
+        keys.push_back(itr->first);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    sized_buf *ids = new sized_buf[numItems];
+    for (int idx = 0; idx < numItems; ++idx) {
+        ids[idx].size = keys[idx].size();
+        ids[idx].buf = const_cast<char *>(keys[idx].data());
+    }
+
+    GetMultiCbCtx ctx(*this, vb, itms);
+    errCode = couchstore_docinfos_by_id(db, ids, numItems, 0, getMultiCbC,
+                                        static_cast<void *>(&ctx));
+    if (errCode != COUCHSTORE_SUCCESS) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Warning: failed to read database by docinfo, "
+                         "name=%s error=%s\n",
+                         dbFile.c_str(), couchstore_strerror(errCode));
+    }
+
+    std::sort(ctx.deferred.begin(), ctx.deferred.end());
+    std::vector<DeferredFetch>::iterator ditr;
+    for (ditr = ctx.deferred.begin(); ditr != ctx.deferred.end(); ++ditr) {
+        vb_bgfetch_item_ctx_t &bgItem = itms[ditr->key];
+        DocInfo *docinfo = ditr->getDocInfo();
+        couchstore_error_t fetchErr = fetchDoc(db, docinfo, bgItem.value, vb,
+                                               false);
+        if (fetchErr != COUCHSTORE_SUCCESS) {
+            getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                             "Warning: failed to fetch data from database, "
+                             "vBucket=%d key=%s error=%s deleted=%s\n",
+                             vb, ditr->key.c_str(),
+                             couchstore_strerror(fetchErr),
+                             docinfo->deleted ? "yes" : "no");
+        }
+    }
+
+    if (errCode == COUCHSTORE_SUCCESS) {
+        releaseCachedDB(readHandles, vb, fileRev, db, dbGen);
+    } else {
+        closeDatabaseHandle(db);
+    }
+    delete []ids;
+}
+
+couchstore_error_t CouchKVStore::fetchDoc(Db *db, DocInfo *docinfo,
+                                          GetValue &docValue, uint16_t vbId,
+                                          bool metaOnly) {
+    couchstore_error_t errCode = COUCHSTORE_SUCCESS;
+    sized_buf metadata = docinfo->rev_meta;
+    uint32_t itemFlags;
+    uint64_t cas;
+
+    assert(metadata.size == 16);
+    memcpy(&cas, (metadata.buf), 8);
+    cas = ntohll(cas);
+    memcpy(&itemFlags, (metadata.buf) + 12, 4);
+    itemFlags = ntohl(itemFlags);
+
+    if (metaOnly) {
+        Item *it = new Item(docinfo->id.buf, (size_t)docinfo->id.size,
+                            docinfo->size, itemFlags, (time_t)0, cas);
+        docValue = GetValue(it);
+    } else {
+        Doc *doc = NULL;
+        errCode = couchstore_open_doc_with_docinfo(db, docinfo, &doc, 0);
+        if (errCode == COUCHSTORE_SUCCESS) {
+            if (docinfo->deleted) {
+                errCode = COUCHSTORE_ERROR_DOC_NOT_FOUND;
             } else {
                 assert(doc && (doc->id.size <= UINT16_MAX));
-                assert(strncmp(doc->id.buf, key.c_str(), doc->id.size) == 0);
-
-                valuelen = doc->data.size;
-                valuePtr = doc->data.buf;
-                it = new Item(key, itemFlags, 0, valuePtr, valuelen, cas, -1, vb);
-                rv = GetValue(it);
+                Item *it = new Item(doc->id.buf, (uint16_t)doc->id.size,
+                                    itemFlags, 0, doc->data.buf,
+                                    doc->data.size, cas, -1, vbId);
+                docValue = GetValue(it);
             }
         }
+        couchstore_free_document(doc);
     }
-    couchstore_free_docinfo(docInfo);
-    couchstore_free_document(doc);
-    closeDatabaseHandle(db);
-    cb.callback(rv);
+    return errCode;
+}
+
+int CouchKVStore::getMultiCb(Db *db, DocInfo *docinfo, void *ctx) {
+    GetMultiCbCtx *cbCtx = static_cast<GetMultiCbCtx *>(ctx);
+    std::string key(docinfo->id.buf, docinfo->id.size);
+
+    vb_bgfetch_queue_t::iterator qitr = cbCtx->fetches.find(key);
+    if (qitr == cbCtx->fetches.end()) {
+        // this could be a serious race condition in couchstore,
+        // log a warning message and continue
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Warning: couchstore returned invalid docinfo, "
+                         "no pending bgfetch has been issued for key = %s\n",
+                         key.c_str());
+        return 0;
+    }
+
+    vb_bgfetch_item_ctx_t &bgItem = qitr->second;
+    if (!bgItem.isMetaOnly) {
+        // The by-id index is walked in key order, read the values once
+        // it's done, in file order.
+        cbCtx->deferred.push_back(DeferredFetch(docinfo));
+        return 0;
+    }
+
+    couchstore_error_t errCode = cbCtx->cks.fetchDoc(db, docinfo,
+                                                     bgItem.value,
+                                                     cbCtx->vbId,
+                                                     bgItem.isMetaOnly);
+    if (errCode != COUCHSTORE_SUCCESS && !bgItem.isMetaOnly) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Warning: failed to fetch data from database, "
+                         "vBucket=%d key=%s error=%s deleted=%s\n",
+                         cbCtx->vbId, key.c_str(),
+                         couchstore_strerror(errCode),
+                         docinfo->deleted ? "yes" : "no");
+    }
+    return 0;
 }
 
 void CouchKVStore::del(const Item &itm,
@@ -354,6 +854,29 @@ bool CouchKVStore::delVBucket(uint16_t vbucket, uint16_t) {
     return cb.val;
 }
 
+void CouchKVStore::delVBuckets(const std::vector<std::pair<uint16_t, uint16_t> > &vbuckets,
+                               std::vector<bool> &results) {
+    assert(mc);
+    std::vector<uint16_t> vbs;
+    std::vector<RememberingCallback<bool>*> rcbs;
+    std::vector<Callback<bool>*> cbs;
+    std::vector<std::pair<uint16_t, uint16_t> >::const_iterator it;
+    for (it = vbuckets.begin(); it != vbuckets.end(); ++it) {
+        vbs.push_back(it->first);
+        rcbs.push_back(new RememberingCallback<bool>());
+        cbs.push_back(rcbs.back());
+    }
+    mc->delVBuckets(vbs, cbs);
+
+    results.clear();
+    for (size_t i = 0; i < rcbs.size(); ++i) {
+        rcbs[i]->waitForValue();
+        remVBucketFromDbFileMap(vbs[i]);
+        results.push_back(rcbs[i]->val);
+        delete rcbs[i];
+    }
+}
+
 vbucket_map_t CouchKVStore::listPersistedVbuckets() {
     std::map<std::pair<uint16_t, uint16_t>, vbucket_state> rv;
     std::string dirname = configuration.getDbname();
@@ -456,8 +979,10 @@ bool CouchKVStore::setVBucketState(uint16_t vbucketId, vbucket_state_t state,
 
     id << vbucketId;
     dbFileName = configuration.getDbname() + "/" + id.str() + ".couch";
+    LockHolder lh(dbFileMapLock);
     mapItr = dbFileMap.find(vbucketId);
     if (mapItr == dbFileMap.end()) {
+        lh.unlock();
         rev = checkNewRevNum(dbFileName, true);
         if (rev == 0) {
             fileRev = 1; // file does not exist, create the db file with rev = 1
@@ -466,13 +991,16 @@ bool CouchKVStore::setVBucketState(uint16_t vbucketId, vbucket_state_t state,
         }
     } else {
         fileRev = mapItr->second;
+        lh.unlock();
     }
 
+    uint64_t dbGen(0);
     bool retry = true;
     while (retry) {
         retry = false;
-        errorCode = openDB(vbucketId, fileRev, &db,
-                           (uint64_t)COUCHSTORE_OPEN_FLAG_CREATE, &newFileRev);
+        errorCode = openCachedDB(writeHandles, vbucketId, fileRev, &db,
+                                 (uint64_t)COUCHSTORE_OPEN_FLAG_CREATE, &newFileRev,
+                                 dbGen);
         if (errorCode != COUCHSTORE_SUCCESS) {
             std::stringstream fileName;
             fileName << vbucketId << ".couch." << fileRev;
@@ -509,8 +1037,12 @@ bool CouchKVStore::setVBucketState(uint16_t vbucketId, vbucket_state_t state,
                              "Warning: commit failed, vbid=%u rev=%u error=%s",
                              vbucketId, fileRev, couchstore_strerror(errorCode));
             closeDatabaseHandle(db);
+            // Whatever the commit left behind, don't trust the handles.
+            readHandles.invalidate(vbucketId);
+            writeHandles.invalidate(vbucketId);
             return false;
         } else {
+            headerCommitted(vbucketId, fileRev, db);
             uint64_t newHeaderPos = couchstore_get_header_position(db);
             RememberingCallback<uint16_t> lcb;
 
@@ -531,7 +1063,11 @@ bool CouchKVStore::setVBucketState(uint16_t vbucketId, vbucket_state_t state,
                 }
             }
         }
-        closeDatabaseHandle(db);
+        if (retry) {
+            closeDatabaseHandle(db);
+        } else {
+            releaseCachedDB(writeHandles, vbucketId, fileRev, db, dbGen);
+        }
     }
     return true;
 }
@@ -554,8 +1090,8 @@ void CouchKVStore::dump(uint16_t vb, shared_ptr<Callback<GetValue> > cb) {
 void CouchKVStore::dumpKeys(const std::vector<uint16_t> &vbids,  shared_ptr<Callback<GetValue> > cb) {
     shared_ptr<RememberingCallback<bool> > wait(new RememberingCallback<bool>());
     shared_ptr<LoadCallback> callback(new LoadCallback(cb, wait));
-    (void)vbids;
-    loadDB(callback, true, NULL);
+    std::vector<uint16_t> ids(vbids);
+    loadDB(callback, true, &ids);
 }
 
 
@@ -581,6 +1117,19 @@ void CouchKVStore::addStats(const std::string &prefix,
     // add stat of # of docs commited
     addStat(prefix, "last_committed_docs", docsCommitted, add_stat, c);
     addStat(prefix, "backend_type", "couchdb", add_stat, c);
+    addStat(prefix, "db_read_handle_hits", readHandles.getHits(), add_stat, c);
+    addStat(prefix, "db_read_handle_misses", readHandles.getMisses(), add_stat, c);
+    addStat(prefix, "db_write_handle_hits", writeHandles.getHits(), add_stat, c);
+    addStat(prefix, "db_write_handle_misses", writeHandles.getMisses(), add_stat, c);
+    addStat(prefix, "db_handle_stale",
+            readHandles.getStale() + writeHandles.getStale(), add_stat, c);
+    addStat(prefix, "db_handle_evictions",
+            readHandles.getEvictions() + writeHandles.getEvictions(), add_stat, c);
+    addStat(prefix, "db_opens", numDbOpens.get(), add_stat, c);
+    addStat(prefix, "db_open_time", dbOpenTime.get(), add_stat, c);
+    addStat(prefix, "parallel_vbucket_commits", numParallelCommits.get(),
+            add_stat, c);
+    addStat(prefix, "notify_retries", numNotifyRetries.get(), add_stat, c);
     mc->addStats(prefix, add_stat, c);
 }
 
@@ -615,7 +1164,6 @@ void CouchKVStore::loadDB(shared_ptr<LoadCallback> cb, bool keysOnly,
                           std::vector<uint16_t> *vbids) {
     std::string dirname = configuration.getDbname();
     std::vector<std::string> files = std::vector<std::string>();
-    std::map<uint16_t, int> &filemap = dbFileMap;
     std::map<uint16_t, int> vbmap;
 
     if (dbFileMap.empty()) {
@@ -630,51 +1178,74 @@ void CouchKVStore::loadDB(shared_ptr<LoadCallback> cb, bool keysOnly,
         }
     }
 
+    LockHolder lh(dbFileMapLock);
     if (vbids) {
         // get entries for given vbucket(s) from dbFileMap
+        lh.unlock();
         getFileNameMap(vbids, dirname, vbmap);
-        filemap = vbmap;
+        lh.lock();
+        // Only the vbuckets being dumped are kept, getDbFile() finds
+        // the files of the others again when they're next used.
+        dbFileMap = vbmap;
+    } else {
+        vbmap = dbFileMap;
     }
-
-    Db *db = NULL;
-    couchstore_error_t errorCode;
-    int keyNum = 0;
-    std::map<uint16_t, int>::iterator itr = filemap.begin();
-    for (; itr != filemap.end(); itr++, keyNum++) {
-        errorCode = openDB(itr->first, itr->second, &db, 0);
-        if (errorCode != COUCHSTORE_SUCCESS) {
-            std::stringstream rev, vbid;
-            rev  << itr->second;
-            vbid << itr->first;
-            std::string dbName = dirname + "/" + vbid.str() + ".couch." +
-                                 rev.str();
-            getLogger()->log(EXTENSION_LOG_WARNING, NULL,
-                             "Warning: failed to open database, name=%s error=%s",
-                              dbName.c_str(),
-                              couchstore_strerror(errorCode));
-            remVBucketFromDbFileMap(itr->first);
-        } else {
-            LoadResponseCtx ctx;
-            ctx.vbucketId = itr->first;
-            ctx.keysonly = keysOnly;
-            ctx.callback = cb;
-            errorCode = couchstore_changes_since(db, 0, 0, recordDbDumpC,
-                                                 static_cast<void *>(&ctx));
-            if (errorCode != COUCHSTORE_SUCCESS) {
-                getLogger()->log(EXTENSION_LOG_WARNING, NULL,
-                                 "Warning: couchstore_changes_since failed, error=%s\n",
-                                 couchstore_strerror(errorCode));
-                remVBucketFromDbFileMap(itr->first);
-            }
-            closeDatabaseHandle(db);
+    lh.unlock();
+
+    // Work from a copy, the vbuckets that fail to load are dropped
+    // from dbFileMap as we go.
+    std::vector<std::pair<uint16_t, int> > filemap(vbmap.begin(), vbmap.end());
+    size_t nthreads = std::min(configuration.getCouchWarmupThreads(),
+                               filemap.size());
+    if (nthreads > 1) {
+        CouchLoadPool pool(*this, filemap, keysOnly,
+                           configuration.getWarmupBatchSize());
+        if (pool.run(cb, nthreads)) {
+            bool success = true;
+            cb->complete->callback(success);
+            return;
         }
-        db = NULL;
+    }
+
+    LoadResponseCtx ctx;
+    ctx.keysonly = keysOnly;
+    ctx.callback = cb;
+    std::vector<std::pair<uint16_t, int> >::iterator itr;
+    for (itr = filemap.begin(); itr != filemap.end(); ++itr) {
+        ctx.vbucketId = itr->first;
+        loadVBucket(itr->first, itr->second, ctx);
     }
 
     bool success = true;
     cb->complete->callback(success);
 }
 
+void CouchKVStore::loadVBucket(uint16_t vbucketId, int rev,
+                               LoadResponseCtx &ctx) {
+    Db *db = NULL;
+    couchstore_error_t errorCode = openDB(vbucketId, rev, &db, 0);
+    if (errorCode != COUCHSTORE_SUCCESS) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Warning: failed to open database, name=%s error=%s",
+                         getDbFileName(vbucketId, rev).c_str(),
+                         couchstore_strerror(errorCode));
+        remVBucketFromDbFileMap(vbucketId);
+        return;
+    }
+
+    // Walking the by-sequence index reads the file mostly front to
+    // back, which is what the kernel's readahead expects.
+    errorCode = couchstore_changes_since(db, 0, 0, recordDbDumpC,
+                                         static_cast<void *>(&ctx));
+    if (errorCode != COUCHSTORE_SUCCESS) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Warning: couchstore_changes_since failed, error=%s\n",
+                         couchstore_strerror(errorCode));
+        remVBucketFromDbFileMap(vbucketId);
+    }
+    closeDatabaseHandle(db);
+}
+
 void CouchKVStore::open() {
     // TODO intransaction, is it needed?
     intransaction = false;
@@ -684,6 +1255,9 @@ void CouchKVStore::open() {
 
 void CouchKVStore::close() {
     intransaction = false;
+    stopCommitThreads();
+    readHandles.clear();
+    writeHandles.clear();
     delete mc;
     mc = NULL;
 }
@@ -693,11 +1267,18 @@ bool CouchKVStore::getDbFile(uint16_t vbucketId,
     std::stringstream fileName;
     fileName << configuration.getDbname() << "/" << vbucketId << ".couch";
     std::map<uint16_t, int>::iterator itr;
+    int rev = 0;
 
+    LockHolder lh(dbFileMapLock);
     itr = dbFileMap.find(vbucketId);
-    if (itr == dbFileMap.end()) {
+    if (itr != dbFileMap.end()) {
+        rev = itr->second;
+    }
+    lh.unlock();
+
+    if (rev == 0) {
        dbFileName = fileName.str();
-       int rev = checkNewRevNum(dbFileName, true);
+       rev = checkNewRevNum(dbFileName, true);
        if (rev > 0) {
            updateDbFileMap(vbucketId, rev, true);
            fileName << "." << rev;
@@ -705,7 +1286,7 @@ bool CouchKVStore::getDbFile(uint16_t vbucketId,
            return false;
        }
     } else {
-           fileName  <<  "." << itr->second;
+           fileName  <<  "." << rev;
     }
 
     dbFileName = fileName.str();
@@ -755,6 +1336,7 @@ int CouchKVStore::checkNewRevNum(std::string &dbname, bool newFile) {
 
 void CouchKVStore::updateDbFileMap(uint16_t vbucketId, int newFileRev,
                                   bool insertImmediately) {
+    LockHolder lh(dbFileMapLock);
     if (insertImmediately) {
         dbFileMap.insert(std::pair<uint16_t, int>(vbucketId, newFileRev));
         return;
@@ -763,6 +1345,11 @@ void CouchKVStore::updateDbFileMap(uint16_t vbucketId, int newFileRev,
     std::map<uint16_t, int>::iterator itr;
     itr = dbFileMap.find(vbucketId);
     if (itr != dbFileMap.end()) {
+        if (itr->second != newFileRev) {
+            // The file was compacted, the handles on the old one are useless.
+            readHandles.invalidate(vbucketId);
+            writeHandles.invalidate(vbucketId);
+        }
         itr->second = newFileRev;
     } else {
         dbFileMap.insert(std::pair<uint16_t, int>(vbucketId, newFileRev));
@@ -812,6 +1399,53 @@ couchstore_error_t CouchKVStore::openDB(uint16_t vbucketId,
     return errorCode;
 }
 
+std::string CouchKVStore::getDbFileName(uint16_t vbucketId, uint16_t fileRev) {
+    std::stringstream fileName;
+    fileName << configuration.getDbname() << "/" << vbucketId << ".couch."
+             << fileRev;
+    return fileName.str();
+}
+
+couchstore_error_t CouchKVStore::openCachedDB(CouchDbHandleCache &handles,
+                                              uint16_t vbucketId,
+                                              uint16_t fileRev,
+                                              Db **db,
+                                              uint64_t options,
+                                              uint16_t *newFileRev,
+                                              uint64_t &gen) {
+    *db = handles.checkout(vbucketId, fileRev, gen);
+    if (*db != NULL) {
+        if (newFileRev != NULL) {
+            *newFileRev = fileRev;
+        }
+        return COUCHSTORE_SUCCESS;
+    }
+
+    // Taken before opening the file, so an invalidation in between
+    // makes the handle look stale rather than current.
+    gen = handles.getGeneration();
+    hrtime_t start = gethrtime();
+    couchstore_error_t errorCode = openDB(vbucketId, fileRev, db, options,
+                                          newFileRev);
+    ++numDbOpens;
+    dbOpenTime.incr((gethrtime() - start) / 1000);
+    return errorCode;
+}
+
+void CouchKVStore::releaseCachedDB(CouchDbHandleCache &handles,
+                                   uint16_t vbucketId, uint16_t fileRev,
+                                   Db *db, uint64_t gen) {
+    handles.checkin(vbucketId, fileRev, db, gen);
+}
+
+void CouchKVStore::headerCommitted(uint16_t vbucketId, uint16_t fileRev,
+                                   Db *db) {
+    // The handles that haven't read this header yet are stale.
+    uint64_t pos = couchstore_get_header_position(db);
+    readHandles.setCommittedHeader(vbucketId, fileRev, pos);
+    writeHandles.setCommittedHeader(vbucketId, fileRev, pos);
+}
+
 void CouchKVStore::getFileNameMap(std::vector<uint16_t> *vbids,
                                   std::string &dirname,
                                   std::map<uint16_t, int> &filemap) {
@@ -823,8 +1457,10 @@ void CouchKVStore::getFileNameMap(std::vector<uint16_t> *vbids,
     for (vbidItr = vbids->begin(); vbidItr != vbids->end(); vbidItr++) {
         nameKey << dirname << "/" << *vbidItr << ".couch";
         dbName = nameKey.str();
+        LockHolder lh(dbFileMapLock);
         dbFileItr = dbFileMap.find(*vbidItr);
         if (dbFileItr == dbFileMap.end()) {
+            lh.unlock();
             int rev = checkNewRevNum(dbName, true);
             if (rev > 0) {
                 filemap.insert(std::pair<uint16_t, int>(*vbidItr, rev));
@@ -837,7 +1473,7 @@ void CouchKVStore::getFileNameMap(std::vector<uint16_t> *vbids,
             filemap.insert(std::pair<uint16_t, int>(dbFileItr->first,
                                                     dbFileItr->second));
         }
-        nameKey.flush();
+        nameKey.str("");
     }
 }
 
@@ -915,6 +1551,11 @@ int CouchKVStore::recordDbDump(Db* db, DocInfo* docinfo, void *ctx) {
     }
 
     if (!loadCtx->keysonly) {
+        // couchstore_changes_since only hands out the doc info, and
+        // the body's on-disk framing belongs to couchstore, so it has
+        // to be read here.  The by-sequence walk visits the docs in the
+        // order they were appended, so these reads still move forward
+        // through the file.
         couchstore_error_t errCode ;
         errCode = couchstore_open_doc_with_docinfo(db, docinfo, &doc, 0);
 
@@ -941,24 +1582,72 @@ int CouchKVStore::recordDbDump(Db* db, DocInfo* docinfo, void *ctx) {
                   1,
                   vbucketId);
 
-    GetValue rv(it, ENGINE_SUCCESS, -1, -1, NULL, loadCtx->keysonly);
-    callback->cb->callback(rv);
+    if (loadCtx->pool != NULL) {
+        loadCtx->pool->add(*loadCtx, it);
+    } else {
+        GetValue rv(it, ENGINE_SUCCESS, -1, -1, NULL, loadCtx->keysonly);
+        callback->cb->callback(rv);
+    }
 
     couchstore_free_document(doc);
     return 0;
 }
 
+/**
+ * The docs of one vbucket in a commit.
+ *
+ * When the vbuckets of a commit are written side by side, this is also
+ * the callback receiving couchdb's reply to the header update.
+ */
+class CouchVBucketCommit : public Callback<uint16_t> {
+public:
+    CouchVBucketCommit(CouchKVStore &st, CouchRequest **r, Doc **d,
+                       DocInfo **di, int n) :
+        store(st), reqs(r), docs(d), docinfos(di), numDocs(n),
+        vbid(r[0]->getVBucketId()), rev(r[0]->getRevNum()), db(NULL),
+        fileRev(0), gen(0), errCode(COUCHSTORE_SUCCESS), retry(false) { }
+
+    void callback(uint16_t &status) {
+        store.notifyVBucketCommitted(*this, status);
+    }
+
+    CouchKVStore       &store;
+    CouchRequest      **reqs;
+    Doc               **docs;
+    DocInfo           **docinfos;
+    int                 numDocs;
+    uint16_t            vbid;
+    int                 rev;
+
+    // Set by the worker writing the docs out
+    Db                 *db;
+    uint16_t            fileRev;
+    uint64_t            gen;
+    couchstore_error_t  errCode;
+    // couchdb asked for the docs to be written again
+    bool                retry;
+};
+
+// How often the flusher looks for couchdb's replies while it waits for
+// the other vbuckets of a commit to be written out.
+static const double NOTIFY_REPLY_POLL_INTERVAL(0.001);
+
+void *launchCouchCommitThread(void *arg) {
+    static_cast<CouchKVStore*>(arg)->runCommitThread();
+    return NULL;
+}
+
 bool CouchKVStore::commit2couchstore(void) {
     Doc **docs;
     DocInfo **docinfos;
     uint16_t vbucket2flush, vbucketId;
     int reqIndex,  flushStartIndex, numDocs2save;
-    couchstore_error_t errCode;
     bool success = true;
 
     std::string dbName;
     CouchRequest *req = NULL;
     CouchRequest **committedReqs;
+    std::vector<CouchVBucketCommit*> commits;
 
     if (pendingCommitCnt == 0) {
         return success;
@@ -985,20 +1674,11 @@ bool CouchKVStore::commit2couchstore(void) {
         pendingReqsQ.pop_front();
 
         if (vbucketId != vbucket2flush) {
-            errCode = saveDocs(vbucket2flush,
-                               committedReqs[flushStartIndex]->getRevNum(),
-                               &docs[flushStartIndex],
-                               &docinfos[flushStartIndex],
-                               numDocs2save);
-            if (errCode) {
-                getLogger()->log(EXTENSION_LOG_WARNING, NULL,
-                                 "Warning: commit failed, cannot save CouchDB "
-                                 "docs for vbucket = %d rev = %d error = %d\n",
-                                 vbucket2flush,
-                                 committedReqs[flushStartIndex]->getRevNum(),
-                                 (int)errCode);
-            }
-            commitCallback(&committedReqs[flushStartIndex], numDocs2save, errCode);
+            commits.push_back(new CouchVBucketCommit(*this,
+                                                     &committedReqs[flushStartIndex],
+                                                     &docs[flushStartIndex],
+                                                     &docinfos[flushStartIndex],
+                                                     numDocs2save));
             numDocs2save = 0;
             flushStartIndex = reqIndex;
             vbucket2flush = vbucketId;
@@ -1007,30 +1687,217 @@ bool CouchKVStore::commit2couchstore(void) {
 
     if (reqIndex - flushStartIndex) {
         // flush the rest
-        errCode = saveDocs(vbucket2flush,
-                           committedReqs[flushStartIndex]->getRevNum(),
-                           &docs[flushStartIndex],
-                           &docinfos[flushStartIndex],
-                           numDocs2save);
-        if (errCode) {
-            getLogger()->log(EXTENSION_LOG_WARNING, NULL,
-                             "Warning: commit failed, cannot save CouchDB docs "
-                             "for vbucket = %d rev = %d error = %d\n",
-                             vbucket2flush,
-                             committedReqs[flushStartIndex]->getRevNum(),
-                             (int)errCode);
-        }
-        commitCallback(&committedReqs[flushStartIndex], numDocs2save, errCode);
+        commits.push_back(new CouchVBucketCommit(*this,
+                                                 &committedReqs[flushStartIndex],
+                                                 &docs[flushStartIndex],
+                                                 &docinfos[flushStartIndex],
+                                                 numDocs2save));
     }
 
+    commitVBuckets(commits);
+
+    std::vector<CouchVBucketCommit*>::iterator it;
+    for (it = commits.begin(); it != commits.end(); ++it) {
+        delete *it;
+    }
     while (reqIndex--) {
         delete committedReqs[reqIndex];
     }
+    delete [] committedReqs;
     delete [] docs;
     delete [] docinfos;
     return success;
 }
 
+void CouchKVStore::commitVBuckets(std::vector<CouchVBucketCommit*> &commits) {
+    bool parallel = commits.size() > 1 && startCommitThreads();
+    size_t begin = 0;
+    while (begin < commits.size()) {
+        size_t end = begin + 1;
+        if (parallel) {
+            // Two threads must never write to the same file, so a
+            // vbucket showing up again starts another round.
+            std::set<uint16_t> vbs;
+            vbs.insert(commits[begin]->vbid);
+            while (end < commits.size() && vbs.insert(commits[end]->vbid).second) {
+                ++end;
+            }
+        }
+
+        if (end - begin > 1) {
+            commitVBucketsInParallel(commits, begin, end);
+        } else {
+            CouchVBucketCommit &commit = *commits[begin];
+            couchstore_error_t errCode = saveDocs(commit.vbid, commit.rev,
+                                                  commit.docs, commit.docinfos,
+                                                  commit.numDocs);
+            if (errCode) {
+                getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                                 "Warning: commit failed, cannot save CouchDB "
+                                 "docs for vbucket = %d rev = %d error = %d\n",
+                                 commit.vbid, commit.rev, (int)errCode);
+            }
+            commitCallback(commit.reqs, commit.numDocs, errCode);
+        }
+        begin = end;
+    }
+}
+
+void CouchKVStore::commitVBucketsInParallel(std::vector<CouchVBucketCommit*> &commits,
+                                            size_t begin, size_t end) {
+    LockHolder lh(commitSync);
+    for (size_t i = begin; i < end; ++i) {
+        pendingCommits.push_back(commits[i]);
+    }
+    commitSync.notify();
+
+    // Tell couchdb about each vbucket as soon as it is on disk.  While
+    // the others are still being written, the replies that came in are
+    // read and their commit callbacks fired, rather than one round trip
+    // at a time or all of them at the end.
+    bool awaitingReplies = false;
+    for (size_t pending = end - begin; pending > 0; --pending) {
+        while (finishedCommits.empty()) {
+            if (!awaitingReplies) {
+                commitSync.wait();
+                continue;
+            }
+            lh.unlock();
+            awaitingReplies = mc->read_notifications();
+            lh.lock();
+            if (awaitingReplies && finishedCommits.empty()) {
+                commitSync.wait(NOTIFY_REPLY_POLL_INTERVAL);
+            }
+        }
+        CouchVBucketCommit *commit = finishedCommits.front();
+        finishedCommits.pop_front();
+        lh.unlock();
+
+        if (commit->errCode != COUCHSTORE_SUCCESS) {
+            getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                             "Warning: commit failed, cannot save CouchDB "
+                             "docs for vbucket = %d rev = %d error = %d\n",
+                             commit->vbid, commit->rev, (int)commit->errCode);
+            commitCallback(commit->reqs, commit->numDocs, commit->errCode);
+        } else {
+            uint64_t newHeaderPos = couchstore_get_header_position(commit->db);
+            mc->notify_headerpos_update_nowait(commit->vbid, commit->fileRev,
+                                               newHeaderPos, *commit);
+            awaitingReplies = true;
+        }
+        lh.lock();
+    }
+    lh.unlock();
+    mc->wait_for_notifications();
+    numParallelCommits.incr(end - begin);
+
+    // couchdb wasn't ready for some of them, write those again
+    for (size_t i = begin; i < end; ++i) {
+        CouchVBucketCommit &commit = *commits[i];
+        if (!commit.retry) {
+            continue;
+        }
+        couchstore_error_t errCode = saveDocs(commit.vbid, commit.fileRev,
+                                              commit.docs, commit.docinfos,
+                                              commit.numDocs);
+        if (errCode) {
+            getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                             "Warning: commit failed, cannot save CouchDB "
+                             "docs for vbucket = %d rev = %d error = %d\n",
+                             commit.vbid, commit.fileRev, (int)errCode);
+        }
+        commitCallback(commit.reqs, commit.numDocs, errCode);
+    }
+}
+
+void CouchKVStore::notifyVBucketCommitted(CouchVBucketCommit &commit,
+                                          uint16_t status) {
+    if (status == PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+        releaseCachedDB(writeHandles, commit.vbid, commit.fileRev, commit.db,
+                        commit.gen);
+        commit.db = NULL;
+        setDocsCommitted(commit.numDocs);
+        commitCallback(commit.reqs, commit.numDocs, 0);
+    } else if (status == PROTOCOL_BINARY_RESPONSE_ETMPFAIL) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Retry notify CouchDB of update, vbucket=%d rev=%d\n",
+                         commit.vbid, commit.fileRev);
+        closeDatabaseHandle(commit.db);
+        commit.db = NULL;
+        commit.retry = true;
+        ++numNotifyRetries;
+    } else {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Warning: failed to notify CouchDB of "
+                         "update for vbucket=%d, error=0x%x\n",
+                         commit.vbid, status);
+        abort();
+    }
+}
+
+bool CouchKVStore::startCommitThreads() {
+    size_t nthreads = configuration.getCouchCommitThreads();
+    if (!commitThreads.empty() || nthreads < 2) {
+        return !commitThreads.empty();
+    }
+
+    commitThreadsStopping = false;
+    for (size_t i = 0; i < nthreads; ++i) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, launchCouchCommitThread, this) != 0) {
+            getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                             "Warning: failed to start a couch commit thread, "
+                             "running with %d\n", (int)i);
+            break;
+        }
+        commitThreads.push_back(tid);
+    }
+    return !commitThreads.empty();
+}
+
+void CouchKVStore::stopCommitThreads() {
+    if (commitThreads.empty()) {
+        return;
+    }
+    LockHolder lh(commitSync);
+    commitThreadsStopping = true;
+    commitSync.notify();
+    lh.unlock();
+
+    std::vector<pthread_t>::iterator it;
+    for (it = commitThreads.begin(); it != commitThreads.end(); ++it) {
+        pthread_join(*it, NULL);
+    }
+    commitThreads.clear();
+}
+
+void CouchKVStore::runCommitThread() {
+    // The handles opened here are closed by the flusher, so account
+    // for them against this engine.
+    ObjectRegistry::onSwitchThread(&engine);
+    LockHolder lh(commitSync);
+    while (true) {
+        while (pendingCommits.empty() && !commitThreadsStopping) {
+            commitSync.wait();
+        }
+        if (pendingCommits.empty()) {
+            break;
+        }
+        CouchVBucketCommit *commit = pendingCommits.front();
+        pendingCommits.pop_front();
+        lh.unlock();
+
+        commit->errCode = writeDocs(commit->vbid, commit->rev, commit->docs,
+                                    commit->docinfos, commit->numDocs,
+                                    &commit->db, &commit->fileRev,
+                                    &commit->gen);
+
+        lh.lock();
+        finishedCommits.push_back(commit);
+        commitSync.notify();
+    }
+}
+
 couchstore_error_t CouchKVStore::saveDocs(uint16_t vbid, int rev, Doc **docs,
                                           DocInfo **docinfos, int docCount) {
     couchstore_error_t errCode;
@@ -1038,6 +1905,7 @@ couchstore_error_t CouchKVStore::saveDocs(uint16_t vbid, int rev, Doc **docs,
     uint16_t newFileRev;
     uint16_t vbucket2save = vbid;
     Db *db = NULL;
+    uint64_t dbGen(0);
     bool retry_save_docs;
 
     fileRev = rev;
@@ -1045,74 +1913,34 @@ couchstore_error_t CouchKVStore::saveDocs(uint16_t vbid, int rev, Doc **docs,
 
     do {
         retry_save_docs = false;
-        errCode = openDB(vbucket2save, fileRev, &db, 0, &newFileRev);
+        errCode = writeDocs(vbucket2save, fileRev, docs, docinfos, docCount,
+                            &db, &newFileRev, &dbGen);
         if (errCode != COUCHSTORE_SUCCESS) {
-            getLogger()->log(EXTENSION_LOG_WARNING, NULL,
-                             "Warning: failed to open database, vbucketId = %d "
-                             "fileRev = %d error = %d\n",
-                             vbucket2save, fileRev, errCode);
             return errCode;
-        } else {
-            uint32_t max = computeMaxDeletedSeqNum(docinfos, docCount);
-
-            // update max_deleted_seq in the local doc (vbstate)
-            // before save docs for the given vBucket
-            if (max > 0) {
-                vbucket_state vbState;
-                readVBState(db, vbucket2save, vbState);
-                assert(vbState.state != vbucket_state_dead);
-                if (vbState.maxDeletedSeqno < max) {
-                    vbState.maxDeletedSeqno = max;
-                    errCode = saveVBState(db, vbState);
-                    if (errCode != COUCHSTORE_SUCCESS) {
-                        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
-                                         "Warning: failed to save local doc for, "
-                                         "vBucket = %d error = %s\n",
-                                         vbucket2save, couchstore_strerror(errCode));
-                        closeDatabaseHandle(db);
-                        return errCode;
-                    }
-                }
-            }
+        }
 
-            errCode = couchstore_save_documents(db, docs, docinfos, docCount,
-                                                0 /* no options */);
-            if (errCode != COUCHSTORE_SUCCESS) {
+        RememberingCallback<uint16_t> cb;
+        uint64_t newHeaderPos = couchstore_get_header_position(db);
+        mc->notify_headerpos_update(vbucket2save, newFileRev, newHeaderPos, cb);
+        if (cb.val != PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+            if (cb.val == PROTOCOL_BINARY_RESPONSE_ETMPFAIL) {
                 getLogger()->log(EXTENSION_LOG_WARNING, NULL,
-                                 "Failed to save docs to database, error = %s\n",
-                                 couchstore_strerror(errCode));
-                closeDatabaseHandle(db);
-                return errCode;
-            }
-
-            errCode = couchstore_commit(db);
-            if (errCode) {
+                                 "Retry notify CouchDB of update, vbucket=%d rev=%d\n",
+                                 vbucket2save, newFileRev);
+                fileRev = newFileRev;
+                retry_save_docs = true;
+            } else {
                 getLogger()->log(EXTENSION_LOG_WARNING, NULL,
-                                 "Commit failed: %s",
-                                 couchstore_strerror(errCode));
-                closeDatabaseHandle(db);
-                return errCode;
-            }
-
-            RememberingCallback<uint16_t> cb;
-            uint64_t newHeaderPos = couchstore_get_header_position(db);
-            mc->notify_headerpos_update(vbucket2save, newFileRev, newHeaderPos, cb);
-            if (cb.val != PROTOCOL_BINARY_RESPONSE_SUCCESS) {
-                if (cb.val == PROTOCOL_BINARY_RESPONSE_ETMPFAIL) {
-                    getLogger()->log(EXTENSION_LOG_WARNING, NULL,
-                                     "Retry notify CouchDB of update, vbucket=%d rev=%d\n",
-                                     vbucket2save, newFileRev);
-                    fileRev = newFileRev;
-                    retry_save_docs = true;
-                } else {
-                    getLogger()->log(EXTENSION_LOG_WARNING, NULL,
-                                     "Warning: failed to notify CouchDB of "
-                                     "update for vbucket=%d, error=0x%x\n",
-                                     vbucket2save, cb.val);
-                    abort();
-                }
+                                 "Warning: failed to notify CouchDB of "
+                                 "update for vbucket=%d, error=0x%x\n",
+                                 vbucket2save, cb.val);
+                abort();
             }
+        }
+        if (retry_save_docs) {
             closeDatabaseHandle(db);
+        } else {
+            releaseCachedDB(writeHandles, vbucket2save, newFileRev, db, dbGen);
         }
     } while (retry_save_docs);
 
@@ -1120,6 +1948,79 @@ couchstore_error_t CouchKVStore::saveDocs(uint16_t vbid, int rev, Doc **docs,
     return errCode;
 }
 
+/**
+ * Write and commit a batch of docs to a vbucket's database, leaving
+ * couchdb to be told about the new header.
+ *
+ * On success *db is the handle that committed the docs, which the
+ * caller has to release with its generation *gen, and *newFileRev the
+ * revision of its file.
+ */
+couchstore_error_t CouchKVStore::writeDocs(uint16_t vbid, int rev, Doc **docs,
+                                           DocInfo **docinfos, int docCount,
+                                           Db **db, uint16_t *newFileRev,
+                                           uint64_t *gen) {
+    couchstore_error_t errCode;
+
+    errCode = openCachedDB(writeHandles, vbid, rev, db, 0, newFileRev, *gen);
+    if (errCode != COUCHSTORE_SUCCESS) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Warning: failed to open database, vbucketId = %d "
+                         "fileRev = %d error = %d\n",
+                         vbid, rev, errCode);
+        return errCode;
+    }
+
+    uint32_t max = computeMaxDeletedSeqNum(docinfos, docCount);
+
+    // update max_deleted_seq in the local doc (vbstate)
+    // before save docs for the given vBucket
+    if (max > 0) {
+        vbucket_state vbState;
+        readVBState(*db, vbid, vbState);
+        assert(vbState.state != vbucket_state_dead);
+        if (vbState.maxDeletedSeqno < max) {
+            vbState.maxDeletedSeqno = max;
+            errCode = saveVBState(*db, vbState);
+            if (errCode != COUCHSTORE_SUCCESS) {
+                getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                                 "Warning: failed to save local doc for, "
+                                 "vBucket = %d error = %s\n",
+                                 vbid, couchstore_strerror(errCode));
+                closeDatabaseHandle(*db);
+                *db = NULL;
+                return errCode;
+            }
+        }
+    }
+
+    errCode = couchstore_save_documents(*db, docs, docinfos, docCount,
+                                        0 /* no options */);
+    if (errCode != COUCHSTORE_SUCCESS) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Failed to save docs to database, error = %s\n",
+                         couchstore_strerror(errCode));
+        closeDatabaseHandle(*db);
+        *db = NULL;
+        return errCode;
+    }
+
+    errCode = couchstore_commit(*db);
+    if (errCode) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Commit failed: %s",
+                         couchstore_strerror(errCode));
+        closeDatabaseHandle(*db);
+        *db = NULL;
+        // Whatever the commit left behind, don't trust the handles.
+        readHandles.invalidate(vbid);
+        writeHandles.invalidate(vbid);
+        return errCode;
+    }
+    headerCommitted(vbid, *newFileRev, *db);
+    return COUCHSTORE_SUCCESS;
+}
+
 void CouchKVStore::queue(CouchRequest &req) {
 
     pendingReqsQ.push_back(&req);
@@ -1131,10 +2032,13 @@ void CouchKVStore::queue(CouchRequest &req) {
 void CouchKVStore::remVBucketFromDbFileMap(uint16_t vbucketId) {
     std::map<uint16_t, int>::iterator itr;
 
+    LockHolder lh(dbFileMapLock);
     itr = dbFileMap.find(vbucketId);
     if (itr != dbFileMap.end()) {
         dbFileMap.erase(itr);
     }
+    readHandles.invalidate(vbucketId);
+    writeHandles.invalidate(vbucketId);
 
     return;
 }
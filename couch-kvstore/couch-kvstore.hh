@@ -1,8 +1,14 @@
 #ifndef COUCH_KVSTORE_H
 #define COUCH_KVSTORE_H 1
 
+#include <sys/types.h>
+#include <list>
+#include <map>
+
 #include "libcouchstore/couch_db.h"
 #include "kvstore.hh"
+#include "locks.hh"
+#include "syncobject.hh"
 #include "item.hh"
 #include "stats.hh"
 #include "configuration.hh"
@@ -11,6 +17,8 @@
 
 class EventuallyPersistentEngine;
 class EPStats;
+class CouchVBucketCommit;
+struct LoadResponseCtx;
 
 typedef union {
     Callback <mutation_result> *setCb;
@@ -61,6 +69,102 @@ private :
     hrtime_t start;
 };
 
+/**
+ * An LRU cache of open database handles, keyed by vbucket and file
+ * revision.
+ *
+ * A handle is checked out of the cache while it is in use, so it is
+ * never shared.  A handle sees the file as of the header it last read
+ * or wrote.  The cache is told the position of every header committed
+ * to a file, and a handle that hasn't caught up with the latest one is
+ * stale: it is closed instead of being handed out.  Docs written but
+ * not committed yet don't make any handle stale.
+ *
+ * Invalidating a vbucket (its file was compacted or deleted) starts a
+ * new generation of its handles.  A handle opened before that is
+ * closed when it is given back.
+ */
+class CouchDbHandleCache {
+public:
+
+    CouchDbHandleCache(size_t cap) : capacity(cap), generation(1) { }
+
+    ~CouchDbHandleCache() {
+        clear();
+    }
+
+    /**
+     * Get the generation to give back with a handle opened now.
+     */
+    uint64_t getGeneration();
+
+    /**
+     * Take a handle for the given file out of the cache.
+     *
+     * @param gen set to the generation the handle was opened in
+     * @return the handle, or NULL if there is none that is up to date
+     */
+    Db *checkout(uint16_t vbid, uint16_t rev, uint64_t &gen);
+
+    /**
+     * Give a handle back to the cache, closing the least recently used
+     * one if the cache is full.  The handle is closed right away if it
+     * is already stale.
+     */
+    void checkin(uint16_t vbid, uint16_t rev, Db *db, uint64_t gen);
+
+    /**
+     * Record the position of the header just committed to a file.
+     */
+    void setCommittedHeader(uint16_t vbid, uint16_t rev, uint64_t pos);
+
+    /**
+     * Close all the cached handles of a vbucket.
+     */
+    void invalidate(uint16_t vbid);
+
+    /**
+     * Close all the cached handles.
+     */
+    void clear();
+
+    size_t getHits() const { return hits.get(); }
+    size_t getMisses() const { return misses.get(); }
+    size_t getStale() const { return stale.get(); }
+    size_t getEvictions() const { return evictions.get(); }
+
+private:
+    struct Entry {
+        Db        *db;
+        uint16_t   vbid;
+        uint16_t   rev;
+        uint64_t   gen;
+    };
+
+    typedef std::pair<uint16_t, uint16_t> handle_key_t;
+
+    bool isCurrent(const handle_key_t &key, Db *db, uint64_t gen);
+
+    const size_t capacity;
+    Mutex mutex;
+    // Most recently used first.
+    std::list<Entry> lru;
+    std::map<handle_key_t, std::list<Entry>::iterator> index;
+    // The latest header committed to each file.  Until one is, any
+    // handle of the current generation is up to date.
+    std::map<handle_key_t, uint64_t> committedHeaders;
+    // The generation each invalidated vbucket was last invalidated in
+    uint64_t generation;
+    std::map<uint16_t, uint64_t> invalidated;
+
+    Atomic<size_t> hits;
+    Atomic<size_t> misses;
+    Atomic<size_t> stale;
+    Atomic<size_t> evictions;
+
+    DISALLOW_COPY_AND_ASSIGN(CouchDbHandleCache);
+};
+
 /**
  * Couchstore kv-store
  */
@@ -124,6 +228,13 @@ public:
     void get(const std::string &key, uint64_t rowid,
              uint16_t vb, uint16_t vbver, Callback<GetValue> &cb);
 
+    /**
+     * Overrides getMulti().  The whole batch is looked up with a single
+     * sorted pass over the vbucket's by-id index, and the values are
+     * then read in the order they are laid out in the file.
+     */
+    void getMulti(uint16_t vb, uint16_t vbver, vb_bgfetch_queue_t &itms);
+
     /**
      * Overrides del().
      */
@@ -135,6 +246,13 @@ public:
     bool delVBucket(uint16_t vbucket, uint16_t vb_version,
                     std::pair<int64_t, int64_t> row_range);
 
+    /**
+     * Overrides delVBuckets() to send all the requests to the couch
+     * notifier before waiting for any of the responses.
+     */
+    void delVBuckets(const std::vector<std::pair<uint16_t, uint16_t> > &vbuckets,
+                     std::vector<bool> &results);
+
     vbucket_map_t listPersistedVbuckets(void);
 
     /**
@@ -175,6 +293,7 @@ public:
     }
 
     static int recordDbDump(Db* db, DocInfo* docinfo, void *ctx);
+    static int getMultiCb(Db *db, DocInfo *docinfo, void *ctx);
     static int recordDbStat(Db* db, DocInfo* docinfo, void *ctx);
     static void readVBState(Db *db, uint16_t vbId, vbucket_state &vbState);
 
@@ -187,6 +306,10 @@ protected:
                  ADD_STAT add_stat, const void *c);
 
 private:
+    friend class CouchVBucketCommit;
+    friend class CouchLoadPool;
+    friend void *launchCouchCommitThread(void *arg);
+
     void operator=(const CouchKVStore &from);
 
     void open();
@@ -204,10 +327,31 @@ private:
     void updateDbFileMap(uint16_t vbucketId, int newFileRev,
                         bool insertImmediately = false);
     void remVBucketFromDbFileMap(uint16_t vbucketId);
+    void loadVBucket(uint16_t vbucketId, int rev, LoadResponseCtx &ctx);
     couchstore_error_t  openDB(uint16_t vbucketId, uint16_t fileRev, Db **db,
                                uint64_t options, uint16_t *newFileRev = NULL);
+    couchstore_error_t openCachedDB(CouchDbHandleCache &handles,
+                                    uint16_t vbucketId, uint16_t fileRev,
+                                    Db **db, uint64_t options,
+                                    uint16_t *newFileRev, uint64_t &gen);
+    void releaseCachedDB(CouchDbHandleCache &handles, uint16_t vbucketId,
+                         uint16_t fileRev, Db *db, uint64_t gen);
+    void headerCommitted(uint16_t vbucketId, uint16_t fileRev, Db *db);
+    std::string getDbFileName(uint16_t vbucketId, uint16_t fileRev);
+    couchstore_error_t fetchDoc(Db *db, DocInfo *docinfo, GetValue &docValue,
+                                uint16_t vbId, bool metaOnly);
     couchstore_error_t saveDocs(uint16_t vbid, int rev, Doc **docs,
                                 DocInfo **docinfos, int docCount);
+    couchstore_error_t writeDocs(uint16_t vbid, int rev, Doc **docs,
+                                 DocInfo **docinfos, int docCount, Db **db,
+                                 uint16_t *newFileRev, uint64_t *gen);
+    void commitVBuckets(std::vector<CouchVBucketCommit*> &commits);
+    void commitVBucketsInParallel(std::vector<CouchVBucketCommit*> &commits,
+                                  size_t begin, size_t end);
+    void notifyVBucketCommitted(CouchVBucketCommit &commit, uint16_t status);
+    bool startCommitThreads();
+    void stopCommitThreads();
+    void runCommitThread();
     void commitCallback(CouchRequest **committedReqs, int numReqs, int errCode);
     couchstore_error_t saveVBState(Db *db, vbucket_state &vbState);
     void setDocsCommitted(uint16_t docs);
@@ -222,6 +366,30 @@ private:
     size_t pendingCommitCnt;
     bool intransaction;
 
+    // Open handles used by get() and getMulti(), and by the flusher.
+    CouchDbHandleCache readHandles;
+    CouchDbHandleCache writeHandles;
+    // stats: databases opened and the time (in usec) spent opening them
+    Atomic<size_t> numDbOpens;
+    Atomic<hrtime_t> dbOpenTime;
+
+    // Threads writing out the vbuckets of a commit side by side,
+    // started by the first commit that touches more than one vbucket.
+    std::vector<pthread_t> commitThreads;
+    bool commitThreadsStopping;
+    // The vbucket writes of the running commit waiting for a thread,
+    // and the ones done waiting for the flusher to notify couchdb.
+    SyncObject commitSync;
+    std::list<CouchVBucketCommit*> pendingCommits;
+    std::list<CouchVBucketCommit*> finishedCommits;
+    // Guards dbFileMap once more than one thread may use it: the commit
+    // workers and the loading threads may move a vbucket to a new file
+    // revision, or drop it, while reads look up its file.
+    Mutex dbFileMapLock;
+    // stats: vbucket writes run in parallel and notifications retried
+    Atomic<size_t> numParallelCommits;
+    Atomic<size_t> numNotifyRetries;
+
     // stat: the number of docs committed
     uint16_t  docsCommitted;
 };
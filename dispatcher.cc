@@ -23,27 +23,46 @@ extern "C" {
 }
 
 static void* launch_dispatcher_thread(void *arg) {
-    Dispatcher *dispatcher = (Dispatcher*) arg;
+    DispatcherWorker *worker = (DispatcherWorker*) arg;
     try {
-        dispatcher->run();
+        worker->run();
     } catch (std::exception& e) {
         getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                          "%s: Caught an exception: %s\n",
-                         dispatcher->getName().c_str(), e.what());
+                         worker->getName().c_str(), e.what());
     } catch(...) {
         getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                          "%s: Caught a fatal exception\n",
-                         dispatcher->getName().c_str());
+                         worker->getName().c_str());
     }
     return NULL;
 }
 
+void DispatcherWorker::run() {
+    dispatcher.run(*this);
+}
+
+std::string DispatcherWorker::getName() const {
+    if (id == 0) {
+        return dispatcher.getName();
+    }
+    std::stringstream ss;
+    ss << dispatcher.getName() << ":" << id;
+    return ss.str();
+}
+
 void Dispatcher::start() {
     assert(state == dispatcher_running);
-    if(pthread_create(&thread, NULL, launch_dispatcher_thread, this) != 0) {
-        std::stringstream ss;
-        ss << getName().c_str() << ": Initialization error!!!";
-        throw std::runtime_error(ss.str().c_str());
+    std::vector<DispatcherWorker*>::iterator it;
+    for (it = workers.begin(); it != workers.end(); ++it) {
+        LockHolder lh(mutex);
+        if(pthread_create(&(*it)->thread, NULL,
+                          launch_dispatcher_thread, *it) != 0) {
+            std::stringstream ss;
+            ss << (*it)->getName().c_str() << ": Initialization error!!!";
+            throw std::runtime_error(ss.str().c_str());
+        }
+        ++activeWorkers;
     }
 }
 
@@ -70,9 +89,10 @@ void Dispatcher::moveReadyTasks(const struct timeval &tv) {
     }
 }
 
-void Dispatcher::run() {
+void Dispatcher::run(DispatcherWorker &worker) {
     ObjectRegistry::onSwitchThread(&engine);
-    getLogger()->log(EXTENSION_LOG_INFO, NULL, "%s: Starting\n", getName().c_str());
+    getLogger()->log(EXTENSION_LOG_INFO, NULL, "%s: Starting\n",
+                     worker.getName().c_str());
     for (;;) {
         LockHolder lh(mutex);
         // Having acquired the lock, verify our state and break out if
@@ -85,7 +105,7 @@ void Dispatcher::run() {
             // Wait forever as long as the state didn't change while
             // we grabbed the lock.
             if (state == dispatcher_running) {
-                noTask();
+                worker.noTask();
                 mutex.wait();
             }
         } else {
@@ -103,50 +123,101 @@ void Dispatcher::run() {
                 continue;
             }
 
-            if (less_tv(tv, task->waketime)) {
-                idleTask->setWaketime(task->waketime);
-                idleTask->setDispatcherNotifications(notifications.get());
-                task = idleTask;
-                taskDesc = task->getName();
+            bool idle = less_tv(tv, task->waketime);
+            if (idle) {
+                worker.idleTask->setWaketime(task->waketime);
+                worker.idleTask->setDispatcherNotifications(notifications.get());
+                task = worker.idleTask;
             } else {
                 // Otherwise, do the normal thing.
                 popNext();
-                taskDesc = task->getName();
+                if (!claimCallback(task)) {
+                    // The task was woken while another worker is still
+                    // running it; hold it back until that run completes.
+                    blockedTasks.push_back(task);
+                    continue;
+                }
             }
+            worker.taskDesc = task->getName();
             tlh.unlock();
 
-            taskStart = gethrtime();
+            worker.taskStart = gethrtime();
+            worker.running_task = true;
             lh.unlock();
             rel_time_t startReltime = ep_current_time();
             try {
-                running_task = true;
                 if(task->run(*this, TaskId(task))) {
                     reschedule(task);
                 }
             } catch (std::exception& e) {
                 getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                                  "%s: Exception caught in task \"%s\": %s\n",
-                                 getName().c_str(), task->getName().c_str(), e.what());
+                                 worker.getName().c_str(), task->getName().c_str(),
+                                 e.what());
             } catch(...) {
                 getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                                  "%s: Fatal exception caught in task \"%s\"\n",
-                                 getName().c_str(), task->getName().c_str());
+                                 worker.getName().c_str(), task->getName().c_str());
             }
-            running_task = false;
 
-            hrtime_t runtime((gethrtime() - taskStart) / 1000);
-            JobLogEntry jle(taskDesc, runtime, startReltime);
-            joblog.add(jle);
+            hrtime_t runtime((gethrtime() - worker.taskStart) / 1000);
+            lh.lock();
+            worker.running_task = false;
+            if (!idle) {
+                releaseCallback(task);
+            }
+            JobLogEntry jle(worker.taskDesc, runtime, startReltime);
+            worker.joblog.add(jle);
             if (runtime > task->maxExpectedDuration()) {
-                slowjobs.add(jle);
+                worker.slowjobs.add(jle);
             }
         }
     }
 
-    completeNonDaemonTasks();
-    state = dispatcher_stopped;
-    notify();
-    getLogger()->log(EXTENSION_LOG_INFO, NULL, "%s: Exited\n", getName().c_str());
+    LockHolder lh(mutex);
+    assert(activeWorkers > 0);
+    if (--activeWorkers == 0) {
+        // The last worker out completes the remaining tasks.
+        while (!blockedTasks.empty()) {
+            futureQueue.push(blockedTasks.front());
+            blockedTasks.pop_front();
+        }
+        lh.unlock();
+        completeNonDaemonTasks();
+        lh.lock();
+        state = dispatcher_stopped;
+        notify();
+    }
+    lh.unlock();
+    getLogger()->log(EXTENSION_LOG_INFO, NULL, "%s: Exited\n",
+                     worker.getName().c_str());
+}
+
+void Dispatcher::releaseCallback(TaskId &task) {
+    DispatcherCallback *cb = task->callback.get();
+    runningCallbacks.erase(cb);
+    bool serial = !cb->isConcurrent();
+    if (serial) {
+        assert(runningSerial > 0);
+        --runningSerial;
+    }
+
+    bool requeued = false;
+    std::list<TaskId>::iterator it = blockedTasks.begin();
+    while (it != blockedTasks.end()) {
+        // Once a non-concurrent callback is done, anything it held
+        // back gets another go; the rest are waiting on this callback.
+        if (serial || (*it)->callback.get() == cb) {
+            futureQueue.push(*it);
+            it = blockedTasks.erase(it);
+            requeued = true;
+        } else {
+            ++it;
+        }
+    }
+    if (requeued) {
+        notify();
+    }
 }
 
 void Dispatcher::stop(bool force) {
@@ -159,7 +230,10 @@ void Dispatcher::stop(bool force) {
     state = dispatcher_stopping;
     notify();
     lh.unlock();
-    pthread_join(thread, NULL);
+    std::vector<DispatcherWorker*>::iterator it;
+    for (it = workers.begin(); it != workers.end(); ++it) {
+        pthread_join((*it)->thread, NULL);
+    }
     getLogger()->log(EXTENSION_LOG_INFO, NULL, "%s: Stopped\n", getName().c_str());
 }
 
@@ -198,7 +272,7 @@ void Dispatcher::wake(TaskId task, TaskId *outtid) {
     TaskId oldTask(task);
     TaskId newTask(new Task(*oldTask));
     if (outtid) {
-        *outtid = TaskId(task);
+        *outtid = TaskId(newTask);
     }
 
     getLogger()->log(EXTENSION_LOG_DEBUG, NULL,
@@ -4,6 +4,9 @@
 
 #include <stdexcept>
 #include <queue>
+#include <list>
+#include <set>
+#include <vector>
 
 #include "common.hh"
 #include "atomic.hh"
@@ -97,6 +100,15 @@ public:
         // Default == 1 second
         return 1 * 1000 * 1000;
     }
+
+    /**
+     * True if this callback may run while other callbacks are running
+     * on the same dispatcher.  Callbacks that don't say so are run one
+     * at a time even when the dispatcher has several workers.
+     */
+    virtual bool isConcurrent() {
+        return false;
+    }
 };
 
 class CompareTasksByDueDate;
@@ -127,6 +139,8 @@ protected:
         callback = task.callback;
         isDaemonTask = task.isDaemonTask;
         blockShutdown = task.blockShutdown;
+        // A copy is made to run the task right away.
+        gettimeofday(&waketime, NULL);
     }
 
     void snooze(const double secs) {
@@ -287,20 +301,79 @@ private:
 };
 
 /**
- * Schedule and run tasks in another thread.
+ * A thread serving a dispatcher's task queues, along with the record of
+ * what it has been running.
+ */
+class DispatcherWorker {
+public:
+    DispatcherWorker(Dispatcher &d, size_t i) :
+        dispatcher(d), id(i), taskStart(0), running_task(false),
+        joblog(JOB_LOG_SIZE), slowjobs(JOB_LOG_SIZE),
+        idleTask(new IdleTask) {
+        noTask();
+    }
+
+    /**
+     * Run the dispatcher's main loop on this worker.  Don't run this.
+     */
+    void run();
+
+    /**
+     * Get the name of this worker (the dispatcher's name, qualified by
+     * the worker's index for all but the first worker).
+     */
+    std::string getName() const;
+
+private:
+    friend class Dispatcher;
+
+    void noTask() {
+        taskDesc = "none";
+    }
+
+    Dispatcher &dispatcher;
+    const size_t id;
+    pthread_t thread;
+    std::string taskDesc;
+    hrtime_t taskStart;
+    bool running_task;
+    RingBuffer<JobLogEntry> joblog;
+    RingBuffer<JobLogEntry> slowjobs;
+    shared_ptr<IdleTask> idleTask;
+
+    DISALLOW_COPY_AND_ASSIGN(DispatcherWorker);
+};
+
+/**
+ * Schedule and run tasks in other threads.
+ *
+ * By default all tasks are run one after another by a single thread.  A
+ * dispatcher may instead be served by a number of worker threads.  Tasks
+ * are still started in priority order, and a callback is never run by
+ * more than one worker at a time.  Only callbacks that declare
+ * themselves concurrent run alongside other callbacks; the rest are
+ * still run one after another.
  */
 class Dispatcher {
 public:
-    Dispatcher(EventuallyPersistentEngine &e, const char *desc = NULL) :
-        notifications(0), joblog(JOB_LOG_SIZE), slowjobs(JOB_LOG_SIZE),
-        idleTask(new IdleTask), state(dispatcher_running),
+    Dispatcher(EventuallyPersistentEngine &e, const char *desc = NULL,
+               size_t nthreads = 1) :
+        notifications(0), runningSerial(0), state(dispatcher_running),
+        activeWorkers(0),
         forceTermination(false), engine(e), name(desc ? desc : "Dispatcher")
     {
-        noTask();
+        assert(nthreads > 0);
+        for (size_t i = 0; i < nthreads; ++i) {
+            workers.push_back(new DispatcherWorker(*this, i));
+        }
     }
 
     ~Dispatcher() {
         stop();
+        std::vector<DispatcherWorker*>::iterator it;
+        for (it = workers.begin(); it != workers.end(); ++it) {
+            delete *it;
+        }
     }
 
     /**
@@ -330,7 +403,7 @@ public:
     void wake(TaskId task, TaskId *outtid);
 
     /**
-     * Start this dispatcher's thread.
+     * Start this dispatcher's threads.
      */
     void start();
     /**
@@ -342,7 +415,7 @@ public:
     /**
      * Dispatcher's main loop.  Don't run this.
      */
-    void run();
+    void run(DispatcherWorker &worker);
 
     /**
      * Delay a task.
@@ -358,31 +431,84 @@ public:
     void cancel(TaskId t);
 
     /**
-     * Get the name of the currently executing task.
+     * Get the name of the task executing on the first worker.
      */
-    std::string getCurrentTaskName() { return taskDesc; }
+    std::string getCurrentTaskName() {
+        LockHolder lh(mutex);
+        return workers[0]->taskDesc;
+    }
 
     /**
      * Get the state of the dispatcher.
      */
     enum dispatcher_state getState() { return state; }
 
+    /**
+     * Get the state of the dispatcher as seen by its first worker.
+     */
     DispatcherState getDispatcherState() {
         LockHolder lh(mutex);
-        return DispatcherState(taskDesc, state, taskStart, running_task,
-                               joblog.contents(), slowjobs.contents());
+        return getWorkerState(*workers[0]);
+    }
+
+    /**
+     * Get the state of the dispatcher as seen by each of its workers.
+     */
+    std::vector<DispatcherState> getDispatcherStates() {
+        LockHolder lh(mutex);
+        std::vector<DispatcherState> rv;
+        std::vector<DispatcherWorker*>::iterator it;
+        for (it = workers.begin(); it != workers.end(); ++it) {
+            rv.push_back(getWorkerState(**it));
+        }
+        return rv;
     }
 
+    /**
+     * Get the number of worker threads serving this dispatcher.
+     */
+    size_t getNumWorkers() const { return workers.size(); }
+
     const std::string &getName() { return name; }
 
 private:
 
     friend class IdleTask;
 
-    void noTask() {
-        taskDesc = "none";
+    DispatcherState getWorkerState(DispatcherWorker &w) {
+        return DispatcherState(w.taskDesc, state, w.taskStart,
+                               w.running_task, w.joblog.contents(),
+                               w.slowjobs.contents());
     }
 
+    /**
+     * Mark the task's callback as running.
+     *
+     * @return false if another worker is already running the callback,
+     *         or if the callback isn't concurrent and another
+     *         non-concurrent callback is running
+     */
+    bool claimCallback(TaskId &task) {
+        DispatcherCallback *cb = task->callback.get();
+        bool serial = !cb->isConcurrent();
+        if (serial && runningSerial > 0) {
+            return false;
+        }
+        if (!runningCallbacks.insert(cb).second) {
+            return false;
+        }
+        if (serial) {
+            ++runningSerial;
+        }
+        return true;
+    }
+
+    /**
+     * Mark the task's callback as no longer running, and requeue any
+     * task that was held back waiting for it.
+     */
+    void releaseCallback(TaskId &task);
+
     void reschedule(TaskId task);
 
     void notify() {
@@ -410,20 +536,21 @@ private:
     //! Remove the next task.
     void popNext();
 
-    std::string taskDesc;
-    pthread_t thread;
     SyncObject mutex;
     Atomic<size_t> notifications;
     std::priority_queue<TaskId, std::deque<TaskId >,
                         CompareTasksByPriority> readyQueue;
     std::priority_queue<TaskId, std::deque<TaskId >,
                         CompareTasksByDueDate> futureQueue;
-    RingBuffer<JobLogEntry> joblog;
-    RingBuffer<JobLogEntry> slowjobs;
-    shared_ptr<IdleTask> idleTask;
+    std::vector<DispatcherWorker*> workers;
+    std::set<DispatcherCallback*> runningCallbacks;
+    // Number of the running callbacks that aren't concurrent
+    size_t runningSerial;
+    // Tasks that became ready while their callback, or another
+    // non-concurrent callback, was still running
+    std::list<TaskId> blockedTasks;
     enum dispatcher_state state;
-    hrtime_t taskStart;
-    bool running_task;
+    size_t activeWorkers;
     bool forceTermination;
 
     EventuallyPersistentEngine &engine;
@@ -26,9 +26,11 @@
 
 #include "ep.hh"
 #include "flusher.hh"
+#include "bgfetcher.hh"
 #include "warmup.hh"
 #include "statsnap.hh"
 #include "locks.hh"
+#include "epoch.hh"
 #include "dispatcher.hh"
 #include "kvstore.hh"
 #include "ep_engine.h"
@@ -109,7 +111,9 @@ public:
         } else if (key.compare("vb_chunk_del_time") == 0) {
             store.setVbChunkDelThresholdTime(value);
         } else if (key.compare("max_txn_size") == 0) {
-            store.setTxnSize(value);
+            store.setMaxTxnSize(value);
+        } else if (key.compare("persistence_lag_target") == 0) {
+            store.setPersistenceLagTarget(value);
         } else if (key.compare("exp_pager_stime") == 0) {
             store.setExpiryPagerSleeptime(value);
         } else if (key.compare("couch_vbucket_batch_count") == 0) {
@@ -132,42 +136,23 @@ private:
 };
 
 /**
- * Dispatcher job that performs disk fetches for non-resident get
- * requests.
+ * Fails the background fetches still queued against a vbucket when it
+ * is destroyed, so their clients aren't left waiting.
  */
-class BGFetchCallback : public DispatcherCallback {
+class BGFetchAbortCallback : public Callback<const void*> {
 public:
-    BGFetchCallback(EventuallyPersistentStore *e,
-                    const std::string &k, uint16_t vbid, uint16_t vbv,
-                    uint64_t r, const void *c, bg_fetch_type_t t) :
-        ep(e), key(k), vbucket(vbid), vbver(vbv), rowid(r), cookie(c), type(t),
-        counter(ep->bgFetchQueue), init(gethrtime()) {
+    BGFetchAbortCallback(EventuallyPersistentStore *e) : ep(e) {
         assert(ep);
-        assert(cookie);
     }
 
-    bool callback(Dispatcher &, TaskId) {
-        ep->completeBGFetch(key, vbucket, vbver, rowid, cookie, init, type);
-        return false;
-    }
-
-    std::string description() {
-        std::stringstream ss;
-        ss << "Fetching item from disk:  " << key;
-        return ss.str();
+    void callback(const void *&cookie) {
+        ep->getEPEngine().notifyIOComplete(cookie, ENGINE_NOT_MY_VBUCKET);
+        --ep->bgFetchQueue;
+        assert(ep->bgFetchQueue.get() < GIGANTOR);
     }
 
 private:
     EventuallyPersistentStore *ep;
-    std::string                key;
-    uint16_t                   vbucket;
-    uint16_t                   vbver;
-    uint64_t                   rowid;
-    const void                *cookie;
-    bg_fetch_type_t            type;
-    BGFetchCounter             counter;
-
-    hrtime_t init;
 };
 
 /**
@@ -237,42 +222,42 @@ private:
 };
 
 /**
- * Dispatcher job to perform fast vbucket deletion.
+ * Dispatcher job to drop all the vbuckets queued for fast deletion.
  */
 class FastVBucketDeletionCallback : public DispatcherCallback {
 public:
-    FastVBucketDeletionCallback(EventuallyPersistentStore *e, RCPtr<VBucket> vb,
-                                uint16_t vbv, EPStats &st) : ep(e),
-                                                             vbucket(vb->getId()),
-                                                             vbver(vbv),
-                                               stats(st) {}
+    FastVBucketDeletionCallback(EventuallyPersistentStore *e, EPStats &st) :
+        ep(e), stats(st) {}
 
-    bool callback(Dispatcher &, TaskId) {
-        bool rv(true); // try again by default
+    bool callback(Dispatcher &d, TaskId t) {
+        size_t dropped(0), failed(0);
         hrtime_t start_time(gethrtime());
-        vbucket_del_result result = ep->completeVBucketDeletion(vbucket, vbver);
-        if (result == vbucket_del_success || result == vbucket_del_invalid) {
+        bool rv = ep->completeVBucketDrops(dropped, failed);
+        if (dropped > 0) {
             hrtime_t spent(gethrtime() - start_time);
             hrtime_t wall_time = spent / 1000;
             BlockTimer::log(spent, "disk_vb_del", stats.timingLog);
-            stats.diskVBDelHisto.add(wall_time);
-            stats.vbucketDelMaxWalltime.setIfBigger(wall_time);
+            // The vbuckets were dropped together, so each one is
+            // accounted an equal share of the time spent.
+            hrtime_t per_vb = wall_time / dropped;
+            for (size_t i = 0; i < dropped; ++i) {
+                stats.diskVBDelHisto.add(per_vb);
+            }
+            stats.vbucketDelMaxWalltime.setIfBigger(per_vb);
             stats.vbucketDelTotWalltime.incr(wall_time);
-            rv = false;
+        }
+        if (rv && failed > 0) {
+            d.snooze(t, 10);
         }
         return rv;
     }
 
     std::string description() {
-        std::stringstream ss;
-        ss << "Removing vbucket " << vbucket << " from disk";
-        return ss.str();
+        return std::string("Removing vbuckets from disk");
     }
 
 private:
     EventuallyPersistentStore *ep;
-    uint16_t vbucket;
-    uint16_t vbver;
     EPStats &stats;
 };
 
@@ -411,8 +396,10 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
     accessLog(engine.getConfiguration().getAlogPath(),
               engine.getConfiguration().getAlogBlockSize()),
     diskFlushAll(false),
-    tctx(stats, t, mutationLog, theEngine.observeRegistry),
-    bgFetchDelay(0)
+    tctx(stats, t, mutationLog, mutationLogLock, theEngine.observeRegistry),
+    flushController(theEngine.getConfiguration().getMaxTxnSize(),
+                    static_cast<rel_time_t>(theEngine.getConfiguration().getPersistenceLagTarget())),
+    shardFlushesRunning(0), bgFetchDelay(0), vbDropScheduled(false)
 {
     getLogger()->log(EXTENSION_LOG_INFO, NULL,
                      "Storage props:  c=%d/r=%d/rw=%d\n",
@@ -432,8 +419,22 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
         roUnderlying = rwUnderlying;
         roDispatcher = dispatcher;
     }
-    nonIODispatcher = new Dispatcher(theEngine, "NONIO_Dispatcher");
+    nonIODispatcher = new Dispatcher(theEngine, "NONIO_Dispatcher",
+                                     theEngine.getConfiguration().getNonioThreads());
+    shardDispatcher = NULL;
+    size_t num_shards = rwUnderlying->getNumShards();
+    if (num_shards > 1
+        && theEngine.getConfiguration().isParallelShardFlush()) {
+        for (size_t i = 0; i < num_shards; ++i) {
+            shardFlushers.push_back(new ShardFlusher(i, stats, engine.newKVStore(),
+                                                     mutationLog, mutationLogLock,
+                                                     theEngine.observeRegistry));
+        }
+        shardDispatcher = new Dispatcher(theEngine, "Shard_Dispatcher", num_shards);
+        shardDispatcher->start();
+    }
     flusher = new Flusher(this, dispatcher);
+    bgFetcher = new BgFetcher(this, roDispatcher, stats);
 
     stats.memOverhead = sizeof(EventuallyPersistentStore);
 
@@ -443,13 +444,17 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
     config.addValueChangedListener("expiry_window",
                                    new EPStoreValueChangeListener(*this));
 
+    evictRefetchWindow = config.getEvictRefetchWindow();
+
     setTmpItemExpiryWindow(config.getTmpItemExpiryWindow());
     config.addValueChangedListener("tmp_item_expiry_window",
                                    new EPStoreValueChangeListener(*this));
 
-    setTxnSize(config.getMaxTxnSize());
+    setTxnSize(static_cast<int>(flushController.getTxnSize()));
     config.addValueChangedListener("max_txn_size",
                                    new EPStoreValueChangeListener(*this));
+    config.addValueChangedListener("persistence_lag_target",
+                                   new EPStoreValueChangeListener(*this));
 
     stats.min_data_age.set(config.getMinDataAge());
     config.addValueChangedListener("min_data_age",
@@ -493,6 +498,9 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
     config.addValueChangedListener("warmup_min_items_threshold",
                                    new EPStoreValueChangeListener(*this));
 
+    shared_ptr<Callback<const void*> > abortCb(new BGFetchAbortCallback(this));
+    vbuckets.setBGFetchAbortCallback(abortCb);
+
     if (startVb0) {
         RCPtr<VBucket> vb(new VBucket(0, vbucket_state_active, stats,
                                       engine.getCheckpointConfig()));
@@ -505,9 +513,11 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
         persistenceCheckpointIds[i] = 0;
     }
 
-    size_t num_shards = rwUnderlying->getNumShards();
     dbShardQueues = new std::vector<queued_item>[num_shards];
 
+    mutationLog.setDirectIO(config.isKlogDirectIo());
+    mutationLog.setPreallocSize(config.getKlogPreallocSize());
+    mutationLog.setGroupCommitWindow(config.getKlogCommitWindow());
     try {
         mutationLog.open();
         assert(theEngine.getConfiguration().getKlogPath() == ""
@@ -520,6 +530,8 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
 
     bool syncset(mutationLog.setSyncConfig(theEngine.getConfiguration().getKlogSync()));
     assert(syncset);
+    bool flushset(mutationLog.setFlushConfig(config.getKlogFlush()));
+    assert(flushset);
 
     mlogCompactorConfig.setMaxLogSize(config.getKlogMaxLogSize());
     config.addValueChangedListener("klog_max_log_size",
@@ -542,6 +554,9 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
     //         thread so that it won't block the flusher (in the write
     //         thread), but we can't put it in the RO dispatcher either,
     //         because that would block the background fetches..
+    //         Without a separate RO store the background fetches do
+    //         share this dispatcher, so warmup loads a few vbuckets per
+    //         step and runs below the background fetcher's priority.
     warmupTask = new Warmup(this, dispatcher);
 }
 
@@ -620,9 +635,10 @@ void EventuallyPersistentStore::initialize() {
     nonIODispatcher->schedule(htr, NULL, Priority::HTResizePriority, 10);
 
     size_t checkpointRemoverInterval = config.getChkRemoverStime();
-    shared_ptr<DispatcherCallback> chk_cb(new ClosedUnrefCheckpointRemover(this,
-                                                                           stats,
-                                                                           checkpointRemoverInterval));
+    ClosedUnrefCheckpointRemover *chkRemover =
+        new ClosedUnrefCheckpointRemover(this, stats, checkpointRemoverInterval);
+    shared_ptr<DispatcherCallback> chk_cb(chkRemover);
+    engine.getCheckpointConfig().setReclaimList(chkRemover->getReclaimList());
     nonIODispatcher->schedule(chk_cb, NULL,
                               Priority::CheckpointRemoverPriority,
                               checkpointRemoverInterval);
@@ -638,13 +654,20 @@ void EventuallyPersistentStore::initialize() {
     if (mutationLog.isEnabled()) {
         shared_ptr<MutationLogCompactor>
             compactor(new MutationLogCompactor(this, mutationLog, mlogCompactorConfig, stats));
-        dispatcher->schedule(compactor, NULL, Priority::MutationLogCompactorPriority,
-                             mlogCompactorConfig.getSleepTime());
+        // Off the flusher's dispatcher, so persistence keeps going
+        // while the compacted log is built.
+        nonIODispatcher->schedule(compactor, NULL,
+                                  Priority::MutationLogCompactorPriority,
+                                  mlogCompactorConfig.getSleepTime());
     }
 }
 
 EventuallyPersistentStore::~EventuallyPersistentStore() {
     bool forceShutdown = engine.isForceShutdown();
+    // The reclaim list goes away with the checkpoint remover.  Once
+    // this returns no checkpoint manager is pushing onto it or
+    // notifying it any more.
+    engine.getCheckpointConfig().setReclaimList(NULL);
     stopFlusher();
     dispatcher->stop(forceShutdown);
     if (hasSeparateRODispatcher()) {
@@ -652,10 +675,19 @@ EventuallyPersistentStore::~EventuallyPersistentStore() {
         delete roUnderlying;
     }
     nonIODispatcher->stop(forceShutdown);
+    if (shardDispatcher) {
+        shardDispatcher->stop(forceShutdown);
+    }
 
     delete flusher;
+    delete bgFetcher;
     delete dispatcher;
     delete nonIODispatcher;
+    delete shardDispatcher;
+    std::vector<ShardFlusher*>::iterator sit;
+    for (sit = shardFlushers.begin(); sit != shardFlushers.end(); ++sit) {
+        delete *sit;
+    }
     delete []persistenceCheckpointIds;
     delete []dbShardQueues;
     delete warmupTask;
@@ -769,8 +801,9 @@ EventuallyPersistentStore::deleteExpiredItems(std::list<std::pair<uint16_t, std:
 StoredValue *EventuallyPersistentStore::fetchValidValue(RCPtr<VBucket> vb,
                                                         const std::string &key,
                                                         int bucket_num,
-                                                        bool wantDeleted) {
-    StoredValue *v = vb->ht.unlocked_find(key, bucket_num, wantDeleted);
+                                                        bool wantDeleted,
+                                                        uint64_t keyHash) {
+    StoredValue *v = vb->ht.unlocked_find(key, keyHash, bucket_num, wantDeleted);
     if (v && !v->isDeleted()) { // In the deleted case, we ignore expiration time.
         if (v->isExpired(ep_real_time())) {
             ++stats.expired;
@@ -831,14 +864,13 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::processNeedMetaData(const RCPtr<VBu
                                                                  const void *cookie)
 {
     int bucket_num(0);
-    LockHolder lh = vb->ht.getLockedBucket(itm.getKey(), &bucket_num);
-    StoredValue *v = fetchValidValue(vb, itm.getKey(), bucket_num);
+    LockHolder lh = vb->ht.getLockedBucket(itm, &bucket_num);
+    StoredValue *v = fetchValidValue(vb, itm.getKey(), bucket_num, false,
+                                     itm.getKeyHash());
 
     ENGINE_ERROR_CODE ret = ENGINE_TMPFAIL;
     if (v && !v->isResident()) {
-        bgFetch(itm.getKey(), itm.getVBucketId(),
-                vbuckets.getBucketVersion(itm.getVBucketId()),
-                v->getId(), cookie);
+        bgFetch(itm.getKey(), itm.getVBucketId(), v->getId(), cookie);
         ret = ENGINE_EWOULDBLOCK;
     }
 
@@ -885,8 +917,7 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::set(const Item &itm,
     case WAS_DIRTY:
         // Even if the item was dirty, push it into the vbucket's open checkpoint.
     case WAS_CLEAN:
-        queueDirty(itm.getKey(), itm.getVBucketId(), queue_op_set,
-                   itm.getSeqno(), row_id);
+        queueDirty(itm, row_id);
         break;
     case INVALID_VBUCKET:
         ret = ENGINE_NOT_MY_VBUCKET;
@@ -925,8 +956,7 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::add(const Item &itm,
         return ENGINE_NOT_STORED;
     case ADD_SUCCESS:
     case ADD_UNDEL:
-        queueDirty(itm.getKey(), itm.getVBucketId(), queue_op_set,
-                   itm.getSeqno(), -1);
+        queueDirty(itm, -1);
     }
     return ENGINE_SUCCESS;
 }
@@ -966,8 +996,7 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::addTAPBackfillItem(const Item &itm,
     case NOT_FOUND:
         // FALLTHROUGH
     case WAS_CLEAN:
-        queueDirty(itm.getKey(), itm.getVBucketId(), queue_op_set,
-                   itm.getSeqno(), row_id, true);
+        queueDirty(itm, row_id, true);
         break;
     case INVALID_VBUCKET:
         ret = ENGINE_NOT_MY_VBUCKET;
@@ -1088,40 +1117,87 @@ EventuallyPersistentStore::completeVBucketDeletion(uint16_t vbid, uint16_t vb_ve
     return vbucket_del_invalid;
 }
 
-vbucket_del_result
-EventuallyPersistentStore::completeVBucketDeletion(uint16_t vbid, uint16_t vbver) {
+bool EventuallyPersistentStore::completeVBucketDrops(size_t &dropped, size_t &failed) {
+    std::vector<std::pair<uint16_t, uint16_t> > drops;
+    LockHolder dlh(vbDropMutex);
+    drops.swap(pendingVBDrops);
+    dlh.unlock();
+
+    // Leave out the vbuckets that came back since they were queued.
+    std::vector<std::pair<uint16_t, uint16_t> > todo;
     LockHolder lh(vbsetMutex);
+    std::vector<std::pair<uint16_t, uint16_t> >::iterator it;
+    for (it = drops.begin(); it != drops.end(); ++it) {
+        RCPtr<VBucket> vb = vbuckets.getBucket(it->first);
+        if (!vb || vb->getState() == vbucket_state_dead ||
+            vbuckets.isBucketDeletion(it->first)) {
+            todo.push_back(*it);
+        }
+    }
+    lh.unlock();
 
-    RCPtr<VBucket> vb = vbuckets.getBucket(vbid);
-    if (!vb || vb->getState() == vbucket_state_dead || vbuckets.isBucketDeletion(vbid)) {
-        lh.unlock();
-        if (rwUnderlying->delVBucket(vbid, vbver)) {
-            vbuckets.setBucketDeletion(vbid, false);
-            mutationLog.deleteAll(vbid);
+    std::vector<std::pair<uint16_t, uint16_t> > retry;
+    if (!todo.empty()) {
+        std::vector<bool> results;
+        rwUnderlying->delVBuckets(todo, results);
+        assert(results.size() == todo.size());
+
+        LockHolder mlh(mutationLogLock);
+        for (size_t i = 0; i < todo.size(); ++i) {
+            if (results[i]) {
+                vbuckets.setBucketDeletion(todo[i].first, false);
+                mutationLog.deleteAll(todo[i].first);
+                ++stats.vbucketDeletions;
+                ++dropped;
+            } else {
+                ++stats.vbucketDeletionFail;
+                retry.push_back(todo[i]);
+                ++failed;
+            }
+        }
+        if (dropped > 0) {
             // This is happening in an independent transaction, so
             // we're going go ahead and commit it out.
-            mutationLog.commit1();
-            mutationLog.commit2();
-            ++stats.vbucketDeletions;
-            return vbucket_del_success;
-        } else {
-            ++stats.vbucketDeletionFail;
-            return vbucket_del_fail;
+            bool needSync(mutationLog.logCommit1());
+            mlh.unlock();
+            if (needSync) {
+                mutationLog.syncCommit();
+            }
+            mlh.lock();
+            needSync = mutationLog.logCommit2();
+            mlh.unlock();
+            if (needSync) {
+                mutationLog.syncCommit();
+            }
         }
     }
-    return vbucket_del_invalid;
+
+    dlh.lock();
+    pendingVBDrops.insert(pendingVBDrops.end(), retry.begin(), retry.end());
+    if (pendingVBDrops.empty()) {
+        vbDropScheduled = false;
+        return false;
+    }
+    return true;
 }
 
 void EventuallyPersistentStore::scheduleVBDeletion(RCPtr<VBucket> vb, uint16_t vb_version,
                                                    double delay=0) {
     if (vbuckets.setBucketDeletion(vb->getId(), true)) {
         if (storageProperties.hasEfficientVBDeletion()) {
-            shared_ptr<DispatcherCallback> cb(new FastVBucketDeletionCallback(this, vb,
-                                                                              vb_version,
-                                                                              stats));
-            dispatcher->schedule(cb,
-                                 NULL, Priority::FastVBucketDeletionPriority,
-                                 delay, false);
+            // Vbuckets going away together (e.g. on rebalance out) are
+            // queued up and dropped by a single task, so the store can
+            // batch them and the flusher only gets interrupted once.
+            LockHolder lh(vbDropMutex);
+            pendingVBDrops.push_back(std::make_pair(vb->getId(), vb_version));
+            if (!vbDropScheduled) {
+                vbDropScheduled = true;
+                shared_ptr<DispatcherCallback> cb(new FastVBucketDeletionCallback(this,
+                                                                                  stats));
+                dispatcher->schedule(cb,
+                                     NULL, Priority::FastVBucketDeletionPriority,
+                                     delay, false);
+            }
         } else {
             size_t chunk_size = vbDelChunkSize;
             uint32_t vb_chunk_del_time = vbChunkDelThresholdTime;
@@ -1214,48 +1290,43 @@ void EventuallyPersistentStore::updateBGStats(const hrtime_t init,
     }
 }
 
-void EventuallyPersistentStore::completeBGFetch(const std::string &key,
-                                                uint16_t vbucket,
-                                                uint16_t vbver,
-                                                uint64_t rowid,
-                                                const void *cookie,
-                                                hrtime_t init,
-                                                bg_fetch_type_t type) {
-    hrtime_t start(gethrtime());
-    ++stats.bg_fetched;
+void EventuallyPersistentStore::completeBGFetchMulti(uint16_t vbId,
+                                                     vb_bgfetch_queue_t &fetched,
+                                                     hrtime_t start) {
     std::stringstream ss;
-    ss << "Completed a background fetch, now at " << bgFetchQueue.get()
-       << std::endl;
+    ss << "Completed a batch of " << fetched.size()
+       << " background fetches for vbucket " << vbId << ", now at "
+       << bgFetchQueue.get() << std::endl;
     getLogger()->log(EXTENSION_LOG_DEBUG, NULL, ss.str().c_str());
 
-    // Go find the data
-    RememberingCallback<GetValue> gcb;
-    if (BG_FETCH_METADATA == type) {
-        gcb.val.setPartial();
-    }
-    roUnderlying->get(key, rowid, vbucket, vbver, gcb);
-    gcb.waitForValue();
-    assert(gcb.fired);
-
     // Lock to prevent a race condition between a fetch for restore and delete
     LockHolder lh(vbsetMutex);
 
-    RCPtr<VBucket> vb = getVBucket(vbucket);
+    RCPtr<VBucket> vb = getVBucket(vbId);
+    vb_bgfetch_queue_t::iterator itr;
     if (vb && vb->getState() == vbucket_state_active) {
-        int bucket_num(0);
-        LockHolder hlh = vb->ht.getLockedBucket(key, &bucket_num);
-        StoredValue *v = fetchValidValue(vb, key, bucket_num, true);
-        if (BG_FETCH_METADATA == type) {
-            if (v) {
-                v->unlocked_restoreMeta(gcb.val.getValue(),
-                                        getTmpItemExpiryWindow(),
-                                        gcb.val.getStatus());
-            }
-        } else {
-            if (v && !v->isResident()) {
-                assert(gcb.val.getStatus() == ENGINE_SUCCESS);
-                v->unlocked_restoreValue(gcb.val.getValue(), stats, vb->ht);
-                assert(v->isResident());
+        for (itr = fetched.begin(); itr != fetched.end(); ++itr) {
+            const std::string &key = itr->first;
+            GetValue &value = itr->second.value;
+            int bucket_num(0);
+            LockHolder hlh = vb->ht.getLockedBucket(key, &bucket_num);
+            StoredValue *v = fetchValidValue(vb, key, bucket_num, true);
+            if (itr->second.isMetaOnly) {
+                if (v) {
+                    v->unlocked_restoreMeta(value.getValue(),
+                                            getTmpItemExpiryWindow(),
+                                            value.getStatus());
+                }
+            } else {
+                if (v && !v->isResident()) {
+                    assert(value.getStatus() == ENGINE_SUCCESS);
+                    if (v->wasEjected() &&
+                        ep_current_time() - v->getEvictedTime() <= evictRefetchWindow) {
+                        ++stats.numEjectsRefetched;
+                    }
+                    v->unlocked_restoreValue(value.getValue(), stats, vb->ht);
+                    assert(v->isResident());
+                }
             }
         }
     }
@@ -1263,27 +1334,39 @@ void EventuallyPersistentStore::completeBGFetch(const std::string &key,
     lh.unlock();
 
     hrtime_t stop = gethrtime();
-    updateBGStats(init, start, stop);
-
-    engine.notifyIOComplete(cookie, gcb.val.getStatus());
-    delete gcb.val.getValue();
+    for (itr = fetched.begin(); itr != fetched.end(); ++itr) {
+        ENGINE_ERROR_CODE status = itr->second.value.getStatus();
+        std::list<VBucketBGFetchItem *> &requests = itr->second.bgfetched_list;
+        std::list<VBucketBGFetchItem *>::iterator ritr;
+        for (ritr = requests.begin(); ritr != requests.end(); ++ritr) {
+            ++stats.bg_fetched;
+            updateBGStats((*ritr)->initTime, start, stop);
+            engine.notifyIOComplete((*ritr)->cookie, status);
+            --bgFetchQueue;
+            assert(bgFetchQueue.get() < GIGANTOR);
+        }
+    }
 }
 
 void EventuallyPersistentStore::bgFetch(const std::string &key,
                                         uint16_t vbucket,
-                                        uint16_t vbver,
                                         uint64_t rowid,
                                         const void *cookie,
                                         bg_fetch_type_t type) {
-    shared_ptr<BGFetchCallback> dcb(new BGFetchCallback(this, key,
-                                                        vbucket, vbver,
-                                                        rowid, cookie, type));
-    assert(bgFetchQueue > 0);
+    RCPtr<VBucket> vb = getVBucket(vbucket);
+    assert(vb);
+
+    ++bgFetchQueue;
+    VBucketBGFetchItem *fetch = new VBucketBGFetchItem(key, rowid, cookie,
+                                                       type == BG_FETCH_METADATA);
+    if (vb->queueBGFetchItem(fetch)) {
+        bgFetcher->notifyBGEvent(vb);
+    }
+
     std::stringstream ss;
     ss << "Queued a background fetch, now at " << bgFetchQueue.get()
        << std::endl;
     getLogger()->log(EXTENSION_LOG_DEBUG, NULL, ss.str().c_str());
-    roDispatcher->schedule(dcb, NULL, Priority::BgFetcherPriority, bgFetchDelay);
 }
 
 GetValue EventuallyPersistentStore::getInternal(const std::string &key,
@@ -1291,7 +1374,8 @@ GetValue EventuallyPersistentStore::getInternal(const std::string &key,
                                         const void *cookie,
                                         bool queueBG,
                                         bool honorStates,
-                                        vbucket_state_t allowedState) {
+                                        vbucket_state_t allowedState,
+                                        bool asView) {
     vbucket_state_t disallowedState = (allowedState == vbucket_state_active) ?
         vbucket_state_replica : vbucket_state_active;
     RCPtr<VBucket> vb = getVBucket(vbucket);
@@ -1310,6 +1394,38 @@ GetValue EventuallyPersistentStore::getInternal(const std::string &key,
         }
     }
 
+    if (vb->ht.hasLockFreeReads()) {
+        EpochGuard guard;
+        Item *itm(NULL);
+        ItemView *view(NULL);
+        StoredValue *sv(NULL);
+        switch (vb->ht.optimisticGet(key, 0, vbucket, &itm, &sv,
+                                     asView ? &view : NULL)) {
+        case HashTable::OPTIMISTIC_HIT:
+            ++stats.numLockFreeGets;
+            // sv may be reclaimed as soon as the guard goes, so it
+            // isn't handed out; callers needing it use the locked path.
+            if (asView) {
+                GetValue rv(NULL, ENGINE_SUCCESS, sv->getId(), -1);
+                rv.setView(view);
+                return rv;
+            }
+            return GetValue(itm, ENGINE_SUCCESS, itm->getId(), -1);
+        case HashTable::OPTIMISTIC_MISS:
+            ++stats.numLockFreeGets;
+            {
+                GetValue rv;
+                if (engine.isDegradedMode(vbucket)) {
+                    rv.setStatus(ENGINE_TMPFAIL);
+                }
+                return rv;
+            }
+        case HashTable::OPTIMISTIC_RETRY:
+            ++stats.numLockFreeGetRetries;
+            break;
+        }
+    }
+
     int bucket_num(0);
     LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
     StoredValue *v = fetchValidValue(vb, key, bucket_num);
@@ -1318,18 +1434,22 @@ GetValue EventuallyPersistentStore::getInternal(const std::string &key,
         // If the value is not resident, wait for it...
         if (!v->isResident()) {
             if (queueBG) {
-                bgFetch(key, vbucket, vbuckets.getBucketVersion(vbucket),
-                        v->getId(), cookie);
+                bgFetch(key, vbucket, v->getId(), cookie);
             }
             return GetValue(NULL, ENGINE_EWOULDBLOCK, v->getId(), -1, v);
         }
 
+        if (asView) {
+            GetValue rv(NULL, ENGINE_SUCCESS, v->getId(), -1, v);
+            rv.setView(v->toView(v->isLocked(ep_current_time())));
+            return rv;
+        }
         GetValue rv(v->toItem(v->isLocked(ep_current_time()), vbucket),
                     ENGINE_SUCCESS, v->getId(), -1, v);
         return rv;
     } else {
         GetValue rv;
-        if (engine.isDegradedMode()) {
+        if (engine.isDegradedMode(vbucket)) {
             rv.setStatus(ENGINE_TMPFAIL);
         }
         return rv;
@@ -1385,8 +1505,7 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::getMetaData(const std::string &key,
             // Since the hashtable bucket is locked, we should never get here
             abort();
         case ADD_SUCCESS:
-            bgFetch(key, vbucket, vbuckets.getBucketVersion(vbucket), -1,
-                    cookie, BG_FETCH_METADATA);
+            bgFetch(key, vbucket, -1, cookie, BG_FETCH_METADATA);
         }
         return ENGINE_EWOULDBLOCK;
     }
@@ -1429,8 +1548,7 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::setWithMeta(const Item &itm,
     case WAS_DIRTY:
     case WAS_CLEAN:
     case NOT_FOUND:
-        queueDirty(itm.getKey(), itm.getVBucketId(), queue_op_set,
-                   itm.getSeqno(), row_id);
+        queueDirty(itm, row_id);
         break;
     case NEED_METADATA:
         ret = processNeedMetaData(vb, itm, cookie);
@@ -1471,8 +1589,7 @@ GetValue EventuallyPersistentStore::getAndUpdateTtl(const std::string &key,
         // If the value is not resident, wait for it...
         if (!v->isResident()) {
             if (queueBG) {
-                bgFetch(key, vbucket, vbuckets.getBucketVersion(vbucket),
-                        v->getId(), cookie);
+                bgFetch(key, vbucket, v->getId(), cookie);
                 return GetValue(NULL, ENGINE_EWOULDBLOCK, v->getId());
             } else {
                 // You didn't want the item anyway...
@@ -1485,7 +1602,7 @@ GetValue EventuallyPersistentStore::getAndUpdateTtl(const std::string &key,
         return rv;
     } else {
         GetValue rv;
-        if (engine.isDegradedMode()) {
+        if (engine.isDegradedMode(vbucket)) {
             rv.setStatus(ENGINE_TMPFAIL);
         }
         return rv;
@@ -1524,7 +1641,7 @@ EventuallyPersistentStore::getFromUnderlying(const std::string &key,
         assert(bgFetchQueue > 0);
         roDispatcher->schedule(dcb, NULL, Priority::VKeyStatBgFetcherPriority, bgFetchDelay);
         return ENGINE_EWOULDBLOCK;
-    } else if (engine.isDegradedMode()) {
+    } else if (engine.isDegradedMode(vbucket)) {
         return ENGINE_TMPFAIL;
     } else {
         return ENGINE_KEY_ENOENT;
@@ -1562,8 +1679,7 @@ bool EventuallyPersistentStore::getLocked(const std::string &key,
         if (!v->isResident()) {
 
             if (cookie) {
-                bgFetch(key, vbucket, vbuckets.getBucketVersion(vbucket),
-                        v->getId(), cookie);
+                bgFetch(key, vbucket, v->getId(), cookie);
             }
             GetValue rv(NULL, ENGINE_EWOULDBLOCK, v->getId());
             cb.callback(rv);
@@ -1582,7 +1698,7 @@ bool EventuallyPersistentStore::getLocked(const std::string &key,
 
     } else {
         GetValue rv;
-        if (engine.isDegradedMode()) {
+        if (engine.isDegradedMode(vbucket)) {
             rv.setStatus(ENGINE_TMPFAIL);
         }
         cb.callback(rv);
@@ -1639,7 +1755,7 @@ EventuallyPersistentStore::unlockKey(const std::string &key,
         return ENGINE_TMPFAIL;
     }
 
-    if (engine.isDegradedMode()) {
+    if (engine.isDegradedMode(vbucket)) {
         return ENGINE_TMPFAIL;
     }
 
@@ -1827,6 +1943,10 @@ std::queue<queued_item>* EventuallyPersistentStore::beginFlush() {
             vbucket_state_t st = vb->getState();
             if (isVbCachedStateStale(vbid, st)) {
                 rwUnderlying->vbStateChanged(vbid, st);
+                std::vector<ShardFlusher*>::iterator sit;
+                for (sit = shardFlushers.begin(); sit != shardFlushers.end(); ++sit) {
+                    (*sit)->getUnderlying()->vbStateChanged(vbid, st);
+                }
             }
 
             // Grab all the items from online restore.
@@ -1945,6 +2065,10 @@ void EventuallyPersistentStore::completeFlush(rel_time_t flush_start) {
 
 int EventuallyPersistentStore::flushSome(std::queue<queued_item> *q,
                                          std::queue<queued_item> *rejectQueue) {
+    if (!shardFlushers.empty()) {
+        return flushShards(q, rejectQueue);
+    }
+
     if (!tctx.enter()) {
         ++stats.beginFailed;
         getLogger()->log(EXTENSION_LOG_WARNING, NULL,
@@ -1963,7 +2087,7 @@ int EventuallyPersistentStore::flushSome(std::queue<queued_item> *q,
          completed < tsz && !q->empty() && !shouldPreemptFlush(completed);
          ++completed) {
 
-        int n = flushOne(q, rejectQueue);
+        int n = flushOne(q, rejectQueue, tctx);
         if (n != 0 && n < oldest) {
             oldest = n;
         }
@@ -1972,11 +2096,225 @@ int EventuallyPersistentStore::flushSome(std::queue<queued_item> *q,
         ++stats.flusherPreempts;
     } else {
         tctx.commit();
+        adjustTxnSize(tctx.getLastCommitTime());
     }
     tctx.leave(completed);
     return oldest;
 }
 
+/**
+ * Dispatcher job flushing one shard's part of a parallel flush batch.
+ */
+class ShardFlushCallback : public DispatcherCallback {
+public:
+    ShardFlushCallback(EventuallyPersistentStore *st, ShardFlusher *sf) :
+        store(st), shard(sf) { }
+
+    bool callback(Dispatcher &, TaskId) {
+        store->flushShard(*shard);
+
+        LockHolder lh(store->shardFlushSync);
+        assert(store->shardFlushesRunning > 0);
+        --store->shardFlushesRunning;
+        store->shardFlushSync.notify();
+        return false;
+    }
+
+    std::string description() {
+        std::stringstream ss;
+        ss << "Flushing shard " << shard->getId();
+        return ss.str();
+    }
+
+private:
+    EventuallyPersistentStore *store;
+    ShardFlusher              *shard;
+};
+
+int EventuallyPersistentStore::flushShards(std::queue<queued_item> *q,
+                                           std::queue<queued_item> *rejectQueue) {
+    // Anything but a set or a delete (i.e. a flush_all or an explicit
+    // commit) acts as a barrier across the shards, and is processed
+    // here while no shard is being written.
+    while (!q->empty()) {
+        enum queue_operation op = q->front()->getOperation();
+        if (op == queue_op_set || op == queue_op_del) {
+            break;
+        }
+        q->pop();
+        stats.memOverhead.decr(sizeof(queued_item));
+        assert(stats.memOverhead.get() < GIGANTOR);
+        if (op == queue_op_flush) {
+            flushOneDeleteAll();
+        }
+        // Every batch is committed by the shards, so there is nothing
+        // else to do for a commit.
+        stats.flusher_todo--;
+    }
+
+    // Deal out the next batch, giving each shard up to a transaction's
+    // worth of items.  Items keep their relative order within a shard.
+    size_t txnSize = static_cast<size_t>(std::max(getTxnSize(), 1));
+    if (shouldPreemptFlush(txnSize)) {
+        // Background fetches are waiting behind us on this dispatcher,
+        // keep the batch short so the flusher gives it up sooner.
+        txnSize = std::max(flushController.getPreemptThreshold(),
+                           static_cast<size_t>(1));
+        ++stats.flusherPreempts;
+    }
+    while (!q->empty()) {
+        const queued_item &qi = q->front();
+        if (qi->getOperation() != queue_op_set &&
+            qi->getOperation() != queue_op_del) {
+            break;
+        }
+        std::queue<queued_item> &sq =
+            shardFlushers[rwUnderlying->getShardId(*qi)]->getQueue();
+        if (sq.size() >= txnSize) {
+            break;
+        }
+        sq.push(qi);
+        q->pop();
+    }
+
+    std::vector<ShardFlusher*> batch;
+    std::vector<ShardFlusher*>::iterator it;
+    for (it = shardFlushers.begin(); it != shardFlushers.end(); ++it) {
+        if (!(*it)->getQueue().empty()) {
+            batch.push_back(*it);
+        }
+    }
+    if (batch.empty()) {
+        return stats.min_data_age;
+    }
+
+    // The whole batch is bracketed by a single pair of commit records
+    // in the mutation log, so a crash in the middle of it rolls back
+    // the log entries of every shard.
+    LockHolder mlh(mutationLogLock);
+    bool needSync(mutationLog.logCommit1());
+    mlh.unlock();
+    if (needSync) {
+        mutationLog.syncCommit();
+    }
+    std::vector<ShardFlusher*> inlineShards;
+    LockHolder lh(shardFlushSync);
+    for (it = batch.begin(); it != batch.end(); ++it) {
+        TaskId tid;
+        shared_ptr<DispatcherCallback> cb(new ShardFlushCallback(this, *it));
+        shardDispatcher->schedule(cb, &tid, Priority::FlusherPriority, 0, false);
+        if (tid.get()) {
+            ++shardFlushesRunning;
+        } else {
+            // The dispatcher is shutting down and didn't take the
+            // job, write this shard out ourselves.
+            inlineShards.push_back(*it);
+        }
+    }
+    lh.unlock();
+    for (it = inlineShards.begin(); it != inlineShards.end(); ++it) {
+        flushShard(**it);
+    }
+    lh.lock();
+    while (shardFlushesRunning > 0) {
+        shardFlushSync.wait();
+    }
+    lh.unlock();
+    mlh.lock();
+    needSync = mutationLog.logCommit2();
+    mlh.unlock();
+    if (needSync) {
+        mutationLog.syncCommit();
+    }
+
+    // The shards commit side by side, so the batch is held up by the
+    // slowest of them.
+    hrtime_t commitTime(0);
+    for (it = batch.begin(); it != batch.end(); ++it) {
+        commitTime = std::max(commitTime, (*it)->getTransaction().getLastCommitTime());
+    }
+    adjustTxnSize(commitTime);
+
+    int oldest = stats.min_data_age;
+    for (it = batch.begin(); it != batch.end(); ++it) {
+        int n = (*it)->getOldest();
+        if (n != 0 && n < oldest) {
+            oldest = n;
+        }
+        std::queue<queued_item> &rejects = (*it)->getRejects();
+        while (!rejects.empty()) {
+            rejectQueue->push(rejects.front());
+            rejects.pop();
+        }
+    }
+    return oldest;
+}
+
+void EventuallyPersistentStore::flushShard(ShardFlusher &shard) {
+    TransactionContext &txn = shard.getTransaction();
+    std::queue<queued_item> &q = shard.getQueue();
+    std::queue<queued_item> &rejects = shard.getRejects();
+    int oldest = stats.min_data_age;
+
+    if (!txn.enter()) {
+        ++stats.beginFailed;
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Failed to start a transaction on shard %d.\n",
+                         shard.getId());
+        while (!q.empty()) {
+            rejects.push(q.front());
+            q.pop();
+        }
+        shard.setOldest(1); // This will cause us to jump out and delay a second
+        return;
+    }
+
+    while (!q.empty()) {
+        int n = flushOne(&q, &rejects, txn);
+        if (n != 0 && n < oldest) {
+            oldest = n;
+        }
+    }
+    txn.commit();
+    shard.setOldest(oldest);
+}
+
+size_t EventuallyPersistentStore::getNumUncommittedItems() {
+    size_t rv = tctx.getNumUncommittedItems();
+    std::vector<ShardFlusher*>::iterator it;
+    for (it = shardFlushers.begin(); it != shardFlushers.end(); ++it) {
+        rv += (*it)->getTransaction().getNumUncommittedItems();
+    }
+    return rv;
+}
+
+void EventuallyPersistentStore::setMaxTxnSize(size_t to) {
+    flushController.setMaxTxnSize(to);
+    setTxnSize(static_cast<int>(flushController.getTxnSize()));
+}
+
+void EventuallyPersistentStore::setPersistenceLagTarget(size_t to) {
+    flushController.setLagTarget(static_cast<rel_time_t>(to));
+    setTxnSize(static_cast<int>(flushController.getTxnSize()));
+}
+
+void EventuallyPersistentStore::adjustTxnSize(hrtime_t commitTime) {
+    size_t queueSize = stats.queue_size.get() + stats.flusher_todo.get();
+    size_t size = flushController.commitCompleted(commitTime, queueSize,
+                                                  stats.dirtyAge.get());
+    if (static_cast<int>(size) != getTxnSize()) {
+        setTxnSize(static_cast<int>(size));
+    }
+}
+
+void EventuallyPersistentStore::setTxnSize(int to) {
+    tctx.setTxnSize(to);
+    std::vector<ShardFlusher*>::iterator it;
+    for (it = shardFlushers.begin(); it != shardFlushers.end(); ++it) {
+        (*it)->getTransaction().setTxnSize(to);
+    }
+}
+
 size_t EventuallyPersistentStore::getWriteQueueSize(void) {
     size_t size = 0;
     size_t numOfVBuckets = vbuckets.getSize();
@@ -2043,18 +2381,25 @@ public:
         if (value.first == 1) {
             stats->totalPersisted++;
             if (value.second > 0) {
+                // Assign the id before logging it so a concurrent log
+                // compaction either sees the id in the hash table or
+                // replays the new entry from the live log.
+                setId(value.second);
+                LockHolder mlh(store->mutationLogLock);
                 mutationLog->newItem(queuedItem->getVBucketId(), queuedItem->getKey(),
                                      value.second);
+                mlh.unlock();
                 ++stats->newItems;
-                setId(value.second);
             }
 
             RCPtr<VBucket> vb = store->getVBucket(queuedItem->getVBucketId());
             if (vb) {
                 int bucket_num(0);
-                LockHolder lh = vb->ht.getLockedBucket(queuedItem->getKey(), &bucket_num);
+                LockHolder lh = vb->ht.getLockedBucket(queuedItem->getKeyHash(),
+                                                       &bucket_num);
                 StoredValue *v = store->fetchValidValue(vb, queuedItem->getKey(),
-                                                        bucket_num, true);
+                                                        bucket_num, true,
+                                                        queuedItem->getKeyHash());
                 if (v && cas == v->getCas()) {
                     // mark this item clean only if current and stored cas
                     // value match
@@ -2082,9 +2427,11 @@ public:
             RCPtr<VBucket> vb = store->getVBucket(queuedItem->getVBucketId());
             if (vb && value.first == 0) {
                 int bucket_num(0);
-                LockHolder lh = vb->ht.getLockedBucket(queuedItem->getKey(), &bucket_num);
+                LockHolder lh = vb->ht.getLockedBucket(queuedItem->getKeyHash(),
+                                                       &bucket_num);
                 StoredValue *v = store->fetchValidValue(vb, queuedItem->getKey(),
-                                                        bucket_num, true);
+                                                        bucket_num, true,
+                                                        queuedItem->getKeyHash());
                 if (v) {
                     std::stringstream ss;
                     ss << "Persisting ``" << queuedItem->getKey() << "'' on vb"
@@ -2120,15 +2467,19 @@ public:
                 ++vb->opsDelete;
             }
 
+            LockHolder mlh(store->mutationLogLock);
             mutationLog->delItem(queuedItem->getVBucketId(), queuedItem->getKey());
+            mlh.unlock();
 
             // We have succesfully removed an item from the disk, we
             // may now remove it from the hash table.
             if (vb) {
                 int bucket_num(0);
-                LockHolder lh = vb->ht.getLockedBucket(queuedItem->getKey(), &bucket_num);
+                LockHolder lh = vb->ht.getLockedBucket(queuedItem->getKeyHash(),
+                                                       &bucket_num);
                 StoredValue *v = store->fetchValidValue(vb, queuedItem->getKey(),
-                                                        bucket_num, true);
+                                                        bucket_num, true,
+                                                        queuedItem->getKeyHash());
                 if (v && v->isDeleted()) {
                     if (store->getEPEngine().isDegradedMode()) {
                         LockHolder rlh(store->restore.mutex);
@@ -2182,15 +2533,29 @@ private:
 
 int EventuallyPersistentStore::flushOneDeleteAll() {
     rwUnderlying->reset();
+    std::vector<ShardFlusher*>::iterator sit;
+    for (sit = shardFlushers.begin(); sit != shardFlushers.end(); ++sit) {
+        (*sit)->getUnderlying()->reset();
+    }
     // Log a flush of every known vbucket.
     std::vector<int> vbs(vbuckets.getBuckets());
+    LockHolder mlh(mutationLogLock);
     for (std::vector<int>::iterator it(vbs.begin()); it != vbs.end(); ++it) {
         mutationLog.deleteAll(static_cast<uint16_t>(*it));
     }
     // This is happening in an independent transaction, so we're going
     // go ahead and commit it out.
-    mutationLog.commit1();
-    mutationLog.commit2();
+    bool needSync(mutationLog.logCommit1());
+    mlh.unlock();
+    if (needSync) {
+        mutationLog.syncCommit();
+    }
+    mlh.lock();
+    needSync = mutationLog.logCommit2();
+    mlh.unlock();
+    if (needSync) {
+        mutationLog.syncCommit();
+    }
     diskFlushAll.cas(true, false);
     return 1;
 }
@@ -2199,7 +2564,8 @@ int EventuallyPersistentStore::flushOneDeleteAll() {
 // still a bit better off running the older code that figures it out
 // based on what's in memory.
 int EventuallyPersistentStore::flushOneDelOrSet(const queued_item &qi,
-                                           std::queue<queued_item> *rejectQueue) {
+                                                std::queue<queued_item> *rejectQueue,
+                                                TransactionContext &txn) {
 
     RCPtr<VBucket> vb = getVBucket(qi->getVBucketId());
     if (!vb) {
@@ -2207,8 +2573,9 @@ int EventuallyPersistentStore::flushOneDelOrSet(const queued_item &qi,
     }
 
     int bucket_num(0);
-    LockHolder lh = vb->ht.getLockedBucket(qi->getKey(), &bucket_num);
-    StoredValue *v = fetchValidValue(vb, qi->getKey(), bucket_num, true);
+    LockHolder lh = vb->ht.getLockedBucket(qi->getKeyHash(), &bucket_num);
+    StoredValue *v = fetchValidValue(vb, qi->getKey(), bucket_num, true,
+                                     qi->getKeyHash());
 
     size_t itemBytes = qi->size();
     vb->doStatsForFlushing(*qi, itemBytes);
@@ -2302,8 +2669,8 @@ int EventuallyPersistentStore::flushOneDelOrSet(const queued_item &qi,
                 PersistenceCallback *cb;
                 cb = new PersistenceCallback(qi, rejectQueue, this, &mutationLog,
                                              queued, dirtied, &stats, itm.getCas());
-                tctx.addCallback(cb);
-                rwUnderlying->set(itm, qi->getVBucketVersion(), *cb);
+                txn.addCallback(cb);
+                txn.getUnderlying()->set(itm, qi->getVBucketVersion(), *cb);
                 if (rowid == -1)  {
                     ++vb->opsCreate;
                 } else {
@@ -2329,8 +2696,8 @@ int EventuallyPersistentStore::flushOneDelOrSet(const queued_item &qi,
             // specified in the delete-with-meta command.
             uint16_t vbid(qi->getVBucketId());
             uint16_t vbver(vbuckets.getBucketVersion(vbid));
-            tctx.addCallback(cb);
-            rwUnderlying->del(itm, rowid, vbver, *cb);
+            txn.addCallback(cb);
+            txn.getUnderlying()->del(itm, rowid, vbver, *cb);
         } else {
             // bypass deletion if missing items, but still call the
             // deletion callback for clean cleanup.
@@ -2344,7 +2711,8 @@ int EventuallyPersistentStore::flushOneDelOrSet(const queued_item &qi,
 }
 
 int EventuallyPersistentStore::flushOne(std::queue<queued_item> *q,
-                                        std::queue<queued_item> *rejectQueue) {
+                                        std::queue<queued_item> *rejectQueue,
+                                        TransactionContext &txn) {
 
     queued_item qi = q->front();
     q->pop();
@@ -2360,19 +2728,19 @@ int EventuallyPersistentStore::flushOne(std::queue<queued_item> *q,
         if (qi->getVBucketVersion() == vbuckets.getBucketVersion(qi->getVBucketId())) {
             size_t prevRejectCount = rejectQueue->size();
 
-            rv = flushOneDelOrSet(qi, rejectQueue);
+            rv = flushOneDelOrSet(qi, rejectQueue, txn);
             if (rejectQueue->size() == prevRejectCount) {
                 // flush operation was not rejected
-                tctx.addUncommittedItem(qi);
+                txn.addUncommittedItem(qi);
             }
         }
         break;
     case queue_op_del:
-        rv = flushOneDelOrSet(qi, rejectQueue);
+        rv = flushOneDelOrSet(qi, rejectQueue, txn);
         break;
     case queue_op_commit:
-        tctx.commit();
-        tctx.enter();
+        txn.commit();
+        txn.enter();
         break;
     case queue_op_empty:
         assert(false);
@@ -2391,13 +2759,14 @@ void EventuallyPersistentStore::queueDirty(const std::string &key,
                                            enum queue_operation op,
                                            uint32_t seqno,
                                            int64_t rowid,
-                                           bool tapBackfill) {
+                                           bool tapBackfill,
+                                           uint64_t keyHash) {
     if (doPersistence) {
         RCPtr<VBucket> vb = vbuckets.getBucket(vbid);
         if (vb) {
             QueuedItem *qi = new QueuedItem(key, vbid, op,
                                             vbuckets.getBucketVersion(vbid),
-                                            rowid, seqno);
+                                            rowid, seqno, keyHash);
 
             queued_item itm(qi);
             bool rv = tapBackfill ?
@@ -2488,9 +2857,37 @@ void EventuallyPersistentStore::warmupCompleted() {
     }
 }
 
+/**
+ * State shared by the mutation log warmup callbacks.
+ */
+struct WarmupLogCookie {
+    WarmupLogCookie(EventuallyPersistentStore *s, shared_ptr<Callback<GetValue> > c)
+        : store(s), cb(c) {}
+
+    EventuallyPersistentStore       *store;
+    shared_ptr<Callback<GetValue> >  cb;
+};
+
 static void warmupLogCallback(void *arg, uint16_t vb, uint16_t vbver,
                               const std::string &key, uint64_t rowid) {
-    shared_ptr<Callback<GetValue> > *cb = reinterpret_cast<shared_ptr<Callback<GetValue> >*>(arg);
+    WarmupLogCookie *cookie = reinterpret_cast<WarmupLogCookie*>(arg);
+
+    // A key committed again in a later transaction just moves to its
+    // newer rowid, as it did when the whole log was loaded first.  A
+    // vbucket is only ever streamed by one thread, so the key can't
+    // show up concurrently.
+    RCPtr<VBucket> vbucket = cookie->store->getVBucket(vb);
+    if (vbucket) {
+        int bucket_num(0);
+        LockHolder lh = vbucket->ht.getLockedBucket(key, &bucket_num);
+        StoredValue *v = vbucket->ht.unlocked_find(key, bucket_num);
+        if (v) {
+            v->clearId();
+            v->setId(rowid);
+            return;
+        }
+    }
+
     Item *itm = new Item(key.data(), key.size(),
                          0, // flags
                          0, // exp
@@ -2501,7 +2898,43 @@ static void warmupLogCallback(void *arg, uint16_t vb, uint16_t vbver,
 
     GetValue gv(itm, ENGINE_SUCCESS, rowid, vbver, NULL, true /* partial */);
 
-    (*cb)->callback(gv);
+    cookie->cb->callback(gv);
+}
+
+static void warmupLogDelCallback(void *arg, uint16_t vbid, const std::string &key) {
+    WarmupLogCookie *cookie = reinterpret_cast<WarmupLogCookie*>(arg);
+    RCPtr<VBucket> vb = cookie->store->getVBucket(vbid);
+    if (!vb) {
+        return;
+    }
+    if (key.empty()) {
+        vb->ht.clear();
+    } else {
+        vb->ht.del(key);
+    }
+}
+
+/**
+ * Drop what a failed mutation log warmup loaded, before falling back to
+ * another warmup method.
+ */
+static void discardLogWarmup(EventuallyPersistentStore *store,
+                             const std::map<std::pair<uint16_t, uint16_t>,
+                                            vbucket_state> &state) {
+    std::map<std::pair<uint16_t, uint16_t>, vbucket_state>::const_iterator it;
+    for (it = state.begin(); it != state.end(); ++it) {
+        RCPtr<VBucket> vb = store->getVBucket(it->first.first);
+        if (vb) {
+            vb->ht.clear();
+        }
+    }
+
+    // The next warmup method counts from scratch.
+    EPStats &stats = store->getEPEngine().getEpStats();
+    stats.warmedUp.set(0);
+    stats.warmedUpMeta.set(0);
+    stats.warmDups.set(0);
+    stats.warmOOM.set(0);
 }
 
 bool EventuallyPersistentStore::warmupFromLog(const std::map<std::pair<uint16_t, uint16_t>,
@@ -2521,11 +2954,22 @@ bool EventuallyPersistentStore::warmupFromLog(const std::map<std::pair<uint16_t,
         harvester.setVbVer(it->first.first, it->first.second);
     }
 
+    // Committed entries go straight to the hash tables as the log is
+    // read, rather than being collected for the whole log first.
+    WarmupLogCookie cookie(this, cb);
+    size_t numThreads(engine.getConfiguration().getWarmupLogThreads());
     hrtime_t start(gethrtime());
-    rv = harvester.load();
+    try {
+        rv = harvester.stream(&cookie, &warmupLogCallback, &warmupLogDelCallback,
+                              numThreads);
+    } catch (MutationLog::ReadException &e) {
+        discardLogWarmup(this, state);
+        throw;
+    }
     hrtime_t end1(gethrtime());
 
     if (!rv) {
+        discardLogWarmup(this, state);
         getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                          "Failed to read mutation log: %s",
                          mutationLog.getLogFile().c_str());
@@ -2543,17 +2987,13 @@ bool EventuallyPersistentStore::warmupFromLog(const std::map<std::pair<uint16_t,
     warmupTask->setEstimatedItemCount(harvester.total());
 
     getLogger()->log(EXTENSION_LOG_DEBUG, NULL,
-                     "Completed log read in %s with %d entries\n",
-                     hrtime2text(end1 - start).c_str(), harvester.total());
+                     "Completed repopulation from log in %s with %d entries "
+                     "using %d threads\n",
+                     hrtime2text(end1 - start).c_str(), harvester.total(),
+                     numThreads);
 
-    harvester.apply(&cb, &warmupLogCallback);
     mutationLog.resetCounts(harvester.getItemsSeen());
 
-    hrtime_t end2(gethrtime());
-    getLogger()->log(EXTENSION_LOG_DEBUG, NULL,
-                     "Completed repopulation from log in %dms\n",
-                     ((end2 - end1) / 1000000));
-
     // Anything left in the "loading" map at this point is uncommitted.
     std::vector<mutation_log_uncommitted_t> uitems;
     harvester.getUncommitted(uitems);
@@ -2671,13 +3111,30 @@ void TransactionContext::leave(int completed) {
 
 void TransactionContext::commit() {
     BlockTimer timer(&stats.diskCommitHisto, "disk_commit", stats.timingLog);
+    hrtime_t start = gethrtime();
     rel_time_t cstart = ep_current_time();
-    mutationLog.commit1();
+    if (logsCommits) {
+        // The syncs are left out of the lock so concurrent commits can
+        // share them.
+        LockHolder mlh(mutationLogLock);
+        bool needSync(mutationLog.logCommit1());
+        mlh.unlock();
+        if (needSync) {
+            mutationLog.syncCommit();
+        }
+    }
     while (!underlying->commit()) {
         sleep(1);
         ++stats.commitFailed;
     }
-    mutationLog.commit2();
+    if (logsCommits) {
+        LockHolder mlh(mutationLogLock);
+        bool needSync(mutationLog.logCommit2());
+        mlh.unlock();
+        if (needSync) {
+            mutationLog.syncCommit();
+        }
+    }
     ++stats.flusherCommits;
 
     std::list<PersistenceCallback*>::iterator iter;
@@ -2691,6 +3148,7 @@ void TransactionContext::commit() {
 
     stats.commit_time.set(complete_time - cstart);
     stats.cumulativeCommitTime.incr(complete_time - cstart);
+    lastCommitTime = gethrtime() - start;
     intxn = false;
     uncommittedItems.clear();
     numUncommittedItems = 0;
@@ -2707,15 +3165,25 @@ VBCBAdaptor::VBCBAdaptor(EventuallyPersistentStore *s,
     store(s), visitor(v), label(l), sleepTime(sleep), currentvb(0)
 {
     const VBucketFilter &vbFilter = visitor->getVBucketFilter();
+    uint16_t first = visitor->getFirstVBucket();
+    std::vector<uint16_t> wrapped;
     size_t maxSize = store->vbuckets.getSize();
     for (size_t i = 0; i <= maxSize; ++i) {
         assert(i <= std::numeric_limits<uint16_t>::max());
         uint16_t vbid = static_cast<uint16_t>(i);
         RCPtr<VBucket> vb = store->vbuckets.getBucket(vbid);
         if (vb && vbFilter(vbid)) {
-            vbList.push(vbid);
+            if (vbid < first) {
+                wrapped.push_back(vbid);
+            } else {
+                vbList.push(vbid);
+            }
         }
     }
+    std::vector<uint16_t>::iterator it;
+    for (it = wrapped.begin(); it != wrapped.end(); ++it) {
+        vbList.push(*it);
+    }
 }
 
 bool VBCBAdaptor::callback(Dispatcher & d, TaskId t) {
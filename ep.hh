@@ -43,6 +43,7 @@
 #include "observe_registry.hh"
 #include "atomic.hh"
 #include "dispatcher.hh"
+#include "flush_controller.hh"
 #include "vbucket.hh"
 #include "vbucketmap.hh"
 #include "item_pager.hh"
@@ -87,6 +88,14 @@ public:
         return vBucketFilter;
     }
 
+    /**
+     * Get the vbucket to start visiting from.  The vbuckets before it
+     * are visited last.
+     */
+    virtual uint16_t getFirstVBucket() {
+        return 0;
+    }
+
     /**
      * Called after all vbuckets have been visited.
      */
@@ -99,6 +108,14 @@ public:
         return false;
     }
 
+    /**
+     * Return true if this visitor may run while other dispatcher
+     * callbacks are running.
+     */
+    virtual bool isConcurrent() {
+        return false;
+    }
+
 protected:
     VBucketFilter vBucketFilter;
     RCPtr<VBucket> currentBucket;
@@ -287,6 +304,7 @@ public:
 
 // Forward declaration
 class Flusher;
+class BgFetcher;
 class Warmup;
 class TapBGFetchCallback;
 class EventuallyPersistentStore;
@@ -300,10 +318,17 @@ class PersistenceCallback;
 class TransactionContext {
 public:
 
+    /**
+     * @param logCommits false if the caller brackets this transaction's
+     *                   commits in the mutation log itself (as the
+     *                   parallel shard flush does)
+     */
     TransactionContext(EPStats &st, KVStore *ks, MutationLog &log,
-                       ObserveRegistry &obsReg)
-        : stats(st), underlying(ks), mutationLog(log), _remaining(0), intxn(false),
-        observeRegistry(obsReg) {}
+                       Mutex &logLock, ObserveRegistry &obsReg,
+                       bool logCommits=true)
+        : stats(st), underlying(ks), mutationLog(log), mutationLogLock(logLock),
+        _remaining(0), intxn(false), observeRegistry(obsReg),
+        logsCommits(logCommits), lastCommitTime(0) {}
 
     /**
      * Call this whenever entering a transaction.
@@ -333,6 +358,13 @@ public:
      */
     void commit();
 
+    /**
+     * Get how long the last commit took, in nanoseconds.
+     */
+    hrtime_t getLastCommitTime() {
+        return lastCommitTime;
+    }
+
     /**
      * Get the number of updates permitted by this transaction.
      */
@@ -372,10 +404,18 @@ public:
         transactionCallbacks.push_back(cb);
     }
 
+    /**
+     * Get the KVStore this transaction is running on.
+     */
+    KVStore *getUnderlying() {
+        return underlying;
+    }
+
 private:
     EPStats     &stats;
     KVStore     *underlying;
     MutationLog &mutationLog;
+    Mutex       &mutationLogLock;
     int          _remaining;
     Atomic<int>  txnSize;
     Atomic<size_t> numUncommittedItems;
@@ -383,6 +423,79 @@ private:
     std::list<queued_item>     uncommittedItems;
     ObserveRegistry           &observeRegistry;
     std::list<PersistenceCallback*> transactionCallbacks;
+    bool                       logsCommits;
+    hrtime_t                   lastCommitTime;
+};
+
+/**
+ * The state of one database shard's persistence worker.
+ *
+ * When the underlying store is sharded, the flusher hands each shard's
+ * items to its own worker so the shards are written and committed
+ * concurrently.  Every worker owns a private KVStore connection and
+ * transaction; the items it couldn't persist are collected in its own
+ * reject queue and merged back by the flusher once all the shards are
+ * done.
+ */
+class ShardFlusher {
+public:
+
+    ShardFlusher(size_t i, EPStats &st, KVStore *ks, MutationLog &log,
+                 Mutex &logLock, ObserveRegistry &obsReg)
+        : id(i), underlying(ks), tctx(st, ks, log, logLock, obsReg, false),
+          oldest(0) {}
+
+    ~ShardFlusher() {
+        delete underlying;
+    }
+
+    size_t getId() const {
+        return id;
+    }
+
+    KVStore *getUnderlying() {
+        return underlying;
+    }
+
+    TransactionContext &getTransaction() {
+        return tctx;
+    }
+
+    /**
+     * The items of the current batch belonging to this shard.
+     */
+    std::queue<queued_item> &getQueue() {
+        return items;
+    }
+
+    /**
+     * The items of the current batch that must be retried.
+     */
+    std::queue<queued_item> &getRejects() {
+        return rejects;
+    }
+
+    /**
+     * The smallest non-zero data age delay reported while flushing the
+     * current batch.
+     */
+    int getOldest() const {
+        return oldest;
+    }
+
+    void setOldest(int to) {
+        oldest = to;
+    }
+
+private:
+    size_t                  id;
+    KVStore                *underlying;
+    TransactionContext      tctx;
+    std::queue<queued_item> items;
+    std::queue<queued_item> rejects;
+    int                     oldest;
+
+    DISALLOW_COPY_AND_ASSIGN(ShardFlusher);
 };
 
 /**
@@ -402,6 +515,10 @@ public:
 
     bool callback(Dispatcher &d, TaskId t);
 
+    bool isConcurrent() {
+        return visitor->isConcurrent();
+    }
+
 private:
     std::queue<uint16_t>        vbList;
     EventuallyPersistentStore  *store;
@@ -474,6 +591,23 @@ public:
                            vbucket_state_active);
     }
 
+    /**
+     * Retrieve a value for a GET response.  Same as get(), but a hit
+     * comes back as an ItemView (GetValue::getView()) sharing the
+     * stored value rather than as a copy in a new Item.
+     *
+     * @param key the key to fetch
+     * @param vbucket the vbucket from which to retrieve the key
+     * @param cookie the connection cookie
+     *
+     * @return a GetValue representing the result of the request
+     */
+    GetValue getView(const std::string &key, uint16_t vbucket,
+                     const void *cookie) {
+        return getInternal(key, vbucket, cookie, true, true,
+                           vbucket_state_active, true);
+    }
+
     /**
      * Retrieve a value from a vbucket in replica state.
      *
@@ -595,6 +729,10 @@ public:
         bgFetchDelay = to;
     }
 
+    uint32_t getBGFetchDelay(void) {
+        return bgFetchDelay;
+    }
+
     void startDispatcher(void);
 
     void startNonIODispatcher(void);
@@ -647,7 +785,6 @@ public:
      *
      * @param key the key to be bg fetched
      * @param vbucket the vbucket in which the key lives
-     * @param vbver the version of the vbucket
      * @param rowid the rowid of the record within its shard
      * @param cookie the cookie of the requestor
      * @param type whether the fetch is for a non-resident value or metadata of
@@ -655,30 +792,21 @@ public:
      */
     void bgFetch(const std::string &key,
                  uint16_t vbucket,
-                 uint16_t vbver,
                  uint64_t rowid,
                  const void *cookie,
                  bg_fetch_type_t type = BG_FETCH_VALUE);
 
     /**
-     * Complete a background fetch of a non resident value or metadata.
+     * Complete a batch of background fetches of non resident values or
+     * metadata from a single vbucket.
      *
-     * @param key the key that was fetched
-     * @param vbucket the vbucket in which the key lived
-     * @param vbver the vbucket version
-     * @param rowid the rowid of the record within its shard
-     * @param cookie the cookie of the requestor
-     * @param init the timestamp of when the request came in
-     * @param type whether the fetch is for a non-resident value or metadata of
-     *             a (possibly) deleted item
+     * @param vbId the vbucket in which the keys lived
+     * @param fetched the fetched keys, along with the requests waiting on them
+     * @param start the time when the batch was started
      */
-    void completeBGFetch(const std::string &key,
-                         uint16_t vbucket,
-                         uint16_t vbver,
-                         uint64_t rowid,
-                         const void *cookie,
-                         hrtime_t init,
-                         bg_fetch_type_t type);
+    void completeBGFetchMulti(uint16_t vbId,
+                              vb_bgfetch_queue_t &fetched,
+                              hrtime_t start);
 
     /**
      * Helper function to update stats after completion of a background fetch
@@ -713,9 +841,13 @@ public:
                                                std::pair<int64_t, int64_t> row_range,
                                                bool isLastChunk);
     /**
-     * Perform a fast vbucket deletion.
+     * Drop all the vbuckets queued for fast deletion.
+     *
+     * @param dropped incremented for every vbucket dropped
+     * @param failed incremented for every vbucket that has to be retried
+     * @return true if there are vbuckets left to drop
      */
-    vbucket_del_result completeVBucketDeletion(uint16_t vbid, uint16_t vbver);
+    bool completeVBucketDrops(size_t &dropped, size_t &failed);
     bool deleteVBucket(uint16_t vbid);
 
     void firePendingVBucketOps();
@@ -743,14 +875,25 @@ public:
         return tctx.getTxnSize();
     }
 
-    void setTxnSize(int to) {
-        tctx.setTxnSize(to);
-    }
+    void setTxnSize(int to);
 
-    size_t getNumUncommittedItems() {
-        return tctx.getNumUncommittedItems();
+    /**
+     * Set the largest number of mutations per transaction.
+     */
+    void setMaxTxnSize(size_t to);
+
+    /**
+     * Set the persistence lag (in seconds) the transaction size adapts
+     * to, 0 to always use the max_txn_size.
+     */
+    void setPersistenceLagTarget(size_t to);
+
+    const FlushController &getFlushController() {
+        return flushController;
     }
 
+    size_t getNumUncommittedItems();
+
     const Flusher* getFlusher();
     Warmup* getWarmup(void) const;
 
@@ -901,7 +1044,14 @@ private:
                     enum queue_operation op,
                     uint32_t seqno,
                     int64_t rowid,
-                    bool tapBackfill = false);
+                    bool tapBackfill = false,
+                    uint64_t keyHash = 0);
+
+    /* Queue a set of an item to be written to persistent layer. */
+    void queueDirty(const Item &itm, int64_t rowid, bool tapBackfill = false) {
+        queueDirty(itm.getKey(), itm.getVBucketId(), queue_op_set,
+                   itm.getSeqno(), rowid, tapBackfill, itm.getKeyHash());
+    }
 
     /**
      * Retrieve a StoredValue and invoke a method on it.
@@ -945,20 +1095,32 @@ private:
     void enqueueCommit();
     int flushSome(std::queue<queued_item> *q,
                   std::queue<queued_item> *rejectQueue);
+    int flushShards(std::queue<queued_item> *q,
+                    std::queue<queued_item> *rejectQueue);
+    void flushShard(ShardFlusher &shard);
     int flushOne(std::queue<queued_item> *q,
-                 std::queue<queued_item> *rejectQueue);
+                 std::queue<queued_item> *rejectQueue,
+                 TransactionContext &txn);
     int flushOneDeleteAll(void);
-    int flushOneDelOrSet(const queued_item &qi, std::queue<queued_item> *rejectQueue);
+    int flushOneDelOrSet(const queued_item &qi, std::queue<queued_item> *rejectQueue,
+                         TransactionContext &txn);
 
     StoredValue *fetchValidValue(RCPtr<VBucket> vb, const std::string &key,
-                                 int bucket_num, bool wantsDeleted=false);
+                                 int bucket_num, bool wantsDeleted=false,
+                                 uint64_t keyHash=0);
 
     bool shouldPreemptFlush(size_t completed) {
-        return (completed > 100
+        return (completed > flushController.getPreemptThreshold()
                 && bgFetchQueue > 0
                 && !hasSeparateRODispatcher());
     }
 
+    /**
+     * Let the flush controller adjust the transaction size after a
+     * commit that took the given number of nanoseconds.
+     */
+    void adjustTxnSize(hrtime_t commitTime);
+
     size_t getWriteQueueSize(void);
 
     bool isVbCachedStateStale(uint16_t vb, vbucket_state_t state);
@@ -968,7 +1130,8 @@ private:
     GetValue getInternal(const std::string &key, uint16_t vbucket,
                          const void *cookie, bool queueBG,
                          bool honorStates,
-                         vbucket_state_t allowedState);
+                         vbucket_state_t allowedState,
+                         bool asView = false);
 
     /**
      * Process NEED_METADATA response from hash table set call in order to figure
@@ -980,13 +1143,15 @@ private:
 
     friend class Warmup;
     friend class Flusher;
-    friend class BGFetchCallback;
     friend class VKeyStatBGFetchCallback;
+    friend class BGFetchAbortCallback;
     friend class TapBGFetchCallback;
     friend class TapConnection;
     friend class PersistenceCallback;
+    friend class ShardFlushCallback;
     friend class Deleter;
     friend class VBCBAdaptor;
+    friend class MutationLogCompactor;
 
     EventuallyPersistentEngine     &engine;
     EPStats                        &stats;
@@ -997,13 +1162,18 @@ private:
     Dispatcher                     *dispatcher;
     Dispatcher                     *roDispatcher;
     Dispatcher                     *nonIODispatcher;
+    Dispatcher                     *shardDispatcher;
     Flusher                        *flusher;
+    BgFetcher                      *bgFetcher;
     Warmup                         *warmupTask;
     shared_ptr<InvalidItemDbPager>  invalidItemDbPager;
     VBucketMap                      vbuckets;
     SyncObject                      mutex;
 
     MutationLog                     mutationLog;
+    // Serializes the mutation log writes of the shard flushers and
+    // the vbucket deletions against the log compactor's swap.
+    Mutex                           mutationLogLock;
     MutationLogCompactorConfig      mlogCompactorConfig;
     MutationLog                     accessLog;
 
@@ -1018,8 +1188,18 @@ private:
     Atomic<size_t>                       bgFetchQueue;
     Atomic<bool>                         diskFlushAll;
     TransactionContext                   tctx;
+    FlushController                      flushController;
+    // One persistence worker per shard when flushing shards in
+    // parallel, empty otherwise.
+    std::vector<ShardFlusher*>           shardFlushers;
+    SyncObject                           shardFlushSync;
+    size_t                               shardFlushesRunning;
     Mutex                                vbsetMutex;
     uint32_t                             bgFetchDelay;
+    // The (vbucket, version) pairs waiting for the fast deletion task.
+    Mutex                                vbDropMutex;
+    std::vector<std::pair<uint16_t, uint16_t> > pendingVBDrops;
+    bool                                 vbDropScheduled;
     uint64_t                            *persistenceCheckpointIds;
     // During restore we're bypassing the checkpoint lists with the
     // objects we're restoring, but we need them to be persisted.
@@ -1042,6 +1222,9 @@ private:
     size_t vbDelChunkSize;
     size_t vbChunkDelThresholdTime;
     size_t tmpItemExpiryWindow;
+    // Values fetched back within this many seconds of being ejected
+    // count against the pager's efficiency.
+    size_t evictRefetchWindow;
 
     DISALLOW_COPY_AND_ASSIGN(EventuallyPersistentStore);
 };
@@ -33,6 +33,7 @@
 #include "backfill.hh"
 #include "warmup.hh"
 #include "memory_tracker.hh"
+#include "slab_allocator.hh"
 #include "stats-info.h"
 
 #define STATWRITER_NAMESPACE core_engine
@@ -131,7 +132,7 @@ extern "C" {
                                     const int nkey,
                                     uint16_t vbucket)
     {
-        return getHandle(handle)->get(cookie, itm, key, nkey, vbucket);
+        return getHandle(handle)->getForResponse(cookie, itm, key, nkey, vbucket);
     }
 
     static ENGINE_ERROR_CODE EvpGetStats(ENGINE_HANDLE* handle,
@@ -283,6 +284,8 @@ extern "C" {
                 e->getConfiguration().setQueueAgeCap(v);
             } else if (strcmp(keyz, "max_txn_size") == 0) {
                 e->getConfiguration().setMaxTxnSize(v);
+            } else if (strcmp(keyz, "persistence_lag_target") == 0) {
+                e->getConfiguration().setPersistenceLagTarget(v);
             } else if (strcmp(keyz, "couch_vbucket_batch_count") == 0) {
                 e->getConfiguration().setCouchVbucketBatchCount(v);
             } else if (strcmp(keyz, "bg_fetch_delay") == 0) {
@@ -911,7 +914,10 @@ extern "C" {
 
     static void EvpItemSetCas(ENGINE_HANDLE* , const void *,
                               item *itm, uint64_t cas) {
-        static_cast<Item*>(itm)->setCas(cas);
+        // Only items from allocate() get a new CAS, never GET responses.
+        Item *it = toItem(itm);
+        assert(it);
+        it->setCas(cas);
     }
 
     static ENGINE_ERROR_CODE EvpTapNotify(ENGINE_HANDLE* handle,
@@ -1019,10 +1025,24 @@ extern "C" {
     static bool EvpGetItemInfo(ENGINE_HANDLE *, const void *,
                                const item* itm, item_info *itm_info)
     {
-        const Item *it = reinterpret_cast<const Item*>(itm);
         if (itm_info->nvalue < 1) {
             return false;
         }
+        const ItemView *view = toItemView(itm);
+        if (view) {
+            itm_info->cas = view->getCas();
+            itm_info->exptime = view->getExptime();
+            itm_info->nbytes = view->getNBytes();
+            itm_info->flags = view->getFlags();
+            itm_info->clsid = 0;
+            itm_info->nkey = view->getNKey();
+            itm_info->nvalue = 1;
+            itm_info->key = view->getKey();
+            itm_info->value[0].iov_base = const_cast<char*>(view->getData());
+            itm_info->value[0].iov_len = view->getNBytes();
+            return true;
+        }
+        const Item *it = toItem(itm);
         itm_info->cas = it->getCas();
         itm_info->exptime = it->getExptime();
         itm_info->nbytes = it->getNBytes();
@@ -1154,8 +1174,15 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::initialize(const char* config) {
     // Start updating the variables from the config!
     HashTable::setDefaultNumBuckets(configuration.getHtSize());
     HashTable::setDefaultNumLocks(configuration.getHtLocks());
+    HashTable::setDefaultIncrementalResize(configuration.isHtIncrementalResize());
+    HashTable::setDefaultResizeBatch(configuration.getHtResizeBatch());
+    HashTable::setDefaultTagIndex(configuration.isHtTagIndex());
+    HashTable::setDefaultLockFreeReads(configuration.isHtLockfreeReads());
     stats.setMaxDataSize(configuration.getMaxSize());
     StoredValue::setMutationMemoryThreshold(configuration.getMutationMemThreshold());
+    if (configuration.isSlabAllocator()) {
+        stats.slabAllocator = new SlabAllocator(this);
+    }
     std::string storedValType = configuration.getStoredValType();
     if (storedValType.length() > 0) {
         if (!HashTable::setDefaultStorageValueType(storedValType.c_str())) {
@@ -1310,9 +1337,14 @@ ENGINE_ERROR_CODE  EventuallyPersistentEngine::store(const void *cookie,
                                                      uint16_t vbucket)
 {
     ENGINE_ERROR_CODE ret;
-    Item *it = static_cast<Item*>(itm);
+    Item *it = toItem(itm);
     item *i = NULL;
 
+    if (it == NULL) {
+        // A GET response handed back to us; it carries no value to store.
+        return ENGINE_EINVAL;
+    }
+
     it->setVBucketId(vbucket);
 
     switch (operation) {
@@ -1382,7 +1414,7 @@ ENGINE_ERROR_CODE  EventuallyPersistentEngine::store(const void *cookie,
         do {
             if ((ret = get(cookie, &i, it->getKey().c_str(),
                            it->getNKey(), vbucket)) == ENGINE_SUCCESS) {
-                Item *old = reinterpret_cast<Item*>(i);
+                Item *old = toItem(i);
 
                 if (old->getCas() == (uint64_t) -1) {
                     // item is locked against updates
@@ -1414,7 +1446,7 @@ ENGINE_ERROR_CODE  EventuallyPersistentEngine::store(const void *cookie,
 
                 ret = store(cookie, old, cas, OPERATION_CAS, vbucket);
                 if (ret == ENGINE_SUCCESS) {
-                    addMutationEvent(static_cast<Item*>(i));
+                    addMutationEvent(old);
                 }
                 itemRelease(cookie, i);
             }
@@ -2232,6 +2264,15 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                     epstats.commit_time, add_stat, cookie);
     add_casted_stat("ep_commit_time_total",
                     epstats.cumulativeCommitTime, add_stat, cookie);
+    const FlushController &fc = epstore->getFlushController();
+    add_casted_stat("ep_txn_size", fc.getTxnSize(), add_stat, cookie);
+    add_casted_stat("ep_txn_size_decision",
+                    FlushController::decisionName(fc.getLastDecision()),
+                    add_stat, cookie);
+    add_casted_stat("ep_txn_size_grows", fc.getNumGrows(), add_stat, cookie);
+    add_casted_stat("ep_txn_size_shrinks", fc.getNumShrinks(), add_stat, cookie);
+    add_casted_stat("ep_flush_preempt_threshold",
+                    fc.getPreemptThreshold(), add_stat, cookie);
     add_casted_stat("ep_vbucket_del",
                     epstats.vbucketDeletions, add_stat, cookie);
     add_casted_stat("ep_vbucket_del_fail",
@@ -2375,6 +2416,7 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                     add_stat, cookie);
     add_casted_stat("ep_oom_errors", stats.oom_errors, add_stat, cookie);
     add_casted_stat("ep_tmp_oom_errors", stats.tmp_oom_errors, add_stat, cookie);
+    addSlabStats(cookie, add_stat);
     add_casted_stat("ep_storage_type",
                     HashTable::getDefaultStorageValueTypeStr(),
                     add_stat, cookie);
@@ -2389,16 +2431,31 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                     cookie);
     add_casted_stat("ep_num_checkpoint_remover_runs", epstats.checkpointRemoverRuns,
                     add_stat, cookie);
+    add_casted_stat("ep_num_checkpoint_reclaims", epstats.checkpointReclaims,
+                    add_stat, cookie);
     add_casted_stat("ep_items_rm_from_checkpoints", epstats.itemsRemovedFromCheckpoints,
                     add_stat, cookie);
     add_casted_stat("ep_num_value_ejects", epstats.numValueEjects, add_stat,
                     cookie);
+    add_casted_stat("ep_num_pager_ejects", epstats.numPagerEjects, add_stat,
+                    cookie);
+    size_t ejects = epstats.numPagerEjects.get();
+    size_t refetched = std::min(epstats.numEjectsRefetched.get(), ejects);
+    add_casted_stat("ep_num_value_ejects_refetched", refetched, add_stat,
+                    cookie);
+    add_casted_stat("ep_eviction_efficiency",
+                    ejects > 0 ? 100 * (ejects - refetched) / ejects : 100,
+                    add_stat, cookie);
     add_casted_stat("ep_num_eject_replicas", epstats.numReplicaEjects, add_stat,
                     cookie);
     add_casted_stat("ep_num_eject_failures", epstats.numFailedEjects, add_stat,
                     cookie);
     add_casted_stat("ep_num_not_my_vbuckets", epstats.numNotMyVBuckets, add_stat,
                     cookie);
+    add_casted_stat("ep_lockfree_gets", epstats.numLockFreeGets, add_stat,
+                    cookie);
+    add_casted_stat("ep_lockfree_get_retries", epstats.numLockFreeGetRetries,
+                    add_stat, cookie);
     add_casted_stat("ep_db_cleaner_status",
                     epstats.dbCleanerComplete.get() ? "complete" : "running",
                     add_stat, cookie);
@@ -2515,6 +2572,17 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
     return ENGINE_SUCCESS;
 }
 
+void EventuallyPersistentEngine::addSlabStats(const void *cookie,
+                                              ADD_STAT add_stat) {
+    SlabAllocator *slabs = stats.slabAllocator;
+    add_casted_stat("ep_slab_allocator", slabs ? "enabled" : "disabled",
+                    add_stat, cookie);
+    add_casted_stat("ep_slab_reserved_bytes",
+                    slabs ? slabs->getReservedBytes() : 0, add_stat, cookie);
+    add_casted_stat("ep_slab_used_bytes",
+                    slabs ? slabs->getUsedBytes() : 0, add_stat, cookie);
+}
+
 ENGINE_ERROR_CODE EventuallyPersistentEngine::doMemoryStats(const void *cookie,
                                                            ADD_STAT add_stat) {
 
@@ -2528,6 +2596,8 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doMemoryStats(const void *cookie,
     add_casted_stat("ep_oom_errors", stats.oom_errors, add_stat, cookie);
     add_casted_stat("ep_tmp_oom_errors", stats.tmp_oom_errors, add_stat, cookie);
 
+    addSlabStats(cookie, add_stat);
+
     std::map<std::string, size_t> allocator_stats;
     MemoryTracker::getInstance()->getAllocatorStats(allocator_stats);
     std::map<std::string, size_t>::iterator it = allocator_stats.begin();
@@ -2611,6 +2681,15 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doHashStats(const void *cookie,
             snprintf(buf, sizeof(buf), "vb_%d:mem_size_counted", vbid);
             add_casted_stat(buf, depthVisitor.memUsed, add_stat, cookie);
 
+            size_t moved(0);
+            size_t oldSize(vb->ht.getResizeProgress(moved));
+            snprintf(buf, sizeof(buf), "vb_%d:resize_old_size", vbid);
+            add_casted_stat(buf, oldSize, add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:resize_moved", vbid);
+            add_casted_stat(buf, moved, add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:resize_time", vbid);
+            add_casted_stat(buf, vb->ht.getLastResizeTime(), add_stat, cookie);
+
             return false;
         }
 
@@ -3035,6 +3114,8 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doTimingStats(const void *cookie,
                                                             ADD_STAT add_stat) {
     add_casted_stat("bg_wait", stats.bgWaitHisto, add_stat, cookie);
     add_casted_stat("bg_load", stats.bgLoadHisto, add_stat, cookie);
+    add_casted_stat("bg_batch_size", stats.bgBatchSizeHisto, add_stat, cookie);
+    add_casted_stat("bg_batch_load", stats.bgBatchLoadHisto, add_stat, cookie);
     add_casted_stat("bg_tap_wait", stats.tapBgWaitHisto, add_stat, cookie);
     add_casted_stat("bg_tap_load", stats.tapBgLoadHisto, add_stat, cookie);
     add_casted_stat("pending_ops", stats.pendingOpsHisto, add_stat, cookie);
@@ -3081,8 +3162,14 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doTimingStats(const void *cookie,
                         add_stat, cookie);
         add_casted_stat("klogSyncTime", mutationLog->syncTimeHisto,
                         add_stat, cookie);
+        add_casted_stat("klogSyncWaitTime", mutationLog->syncWaitHisto,
+                        add_stat, cookie);
+        add_casted_stat("klogGroupCommitSize", mutationLog->groupCommitHisto,
+                        add_stat, cookie);
         add_casted_stat("klogCompactorTime", stats.mlogCompactorHisto,
                         add_stat, cookie);
+        add_casted_stat("klogCompactorStallTime", stats.mlogCompactorStallHisto,
+                        add_stat, cookie);
     }
 
     return ENGINE_SUCCESS;
@@ -3142,8 +3229,17 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doDispatcherStats(const void *cook
         doDispatcherStat("ro_dispatcher", rods, cookie, add_stat);
     }
 
-    DispatcherState nds(epstore->getNonIODispatcher()->getDispatcherState());
-    doDispatcherStat("nio_dispatcher", nds, cookie, add_stat);
+    std::vector<DispatcherState> nds(epstore->getNonIODispatcher()->getDispatcherStates());
+    for (size_t i = 0; i < nds.size(); ++i) {
+        char prefix[32];
+        if (i == 0) {
+            snprintf(prefix, sizeof(prefix), "nio_dispatcher");
+        } else {
+            snprintf(prefix, sizeof(prefix), "nio_dispatcher_%d",
+                     static_cast<int>(i));
+        }
+        doDispatcherStat(prefix, nds[i], cookie, add_stat);
+    }
 
     return ENGINE_SUCCESS;
 }
@@ -3167,6 +3263,13 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doKlogStats(const void* cookie,
                                                           ADD_STAT add_stat) {
     const MutationLog *mutationLog(epstore->getMutationLog());
     add_casted_stat("size", mutationLog->logSize, add_stat, cookie);
+    add_casted_stat("compactor_runs", stats.mlogCompactorRuns, add_stat, cookie);
+    add_casted_stat("compactor_last_time", stats.mlogCompactorLastTime,
+                    add_stat, cookie);
+    add_casted_stat("compactor_last_stall", stats.mlogCompactorLastStall,
+                    add_stat, cookie);
+    add_casted_stat("compactor_tail_entries", stats.mlogCompactorTailEntries,
+                    add_stat, cookie);
     for (int i(0); i < MUTATION_LOG_TYPES; ++i) {
         size_t v(mutationLog->itemsLogged[i]);
         if (v > 0) {
@@ -3215,6 +3318,11 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::getStats(const void* cookie,
         rv = doDispatcherStats(cookie, add_stat);
     } else if (nkey == 6 && strncmp(stat_key, "memory", 6) == 0) {
         rv = doMemoryStats(cookie, add_stat);
+    } else if (nkey == 5 && strncmp(stat_key, "slabs", 5) == 0) {
+        if (stats.slabAllocator) {
+            stats.slabAllocator->addStats(add_stat, cookie);
+        }
+        rv = ENGINE_SUCCESS;
     } else if (nkey == 7 && strncmp(stat_key, "restore", 7) == 0) {
         rv = ENGINE_SUCCESS;
         LockHolder lh(restore.mutex);
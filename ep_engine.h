@@ -50,7 +50,6 @@ extern "C" {
 typedef void (*NOTIFY_IO_COMPLETE_T)(const void *cookie,
                                      ENGINE_ERROR_CODE status);
 
-
 // Forward decl
 class EventuallyPersistentEngine;
 class TapConnMap;
@@ -213,7 +212,12 @@ public:
     void itemRelease(const void* cookie, item *itm)
     {
         (void)cookie;
-        delete (Item*)itm;
+        ItemView *view = toItemView(itm);
+        if (view) {
+            delete view;
+        } else {
+            delete toItem(itm);
+        }
     }
 
     ENGINE_ERROR_CODE get(const void* cookie,
@@ -222,18 +226,21 @@ public:
                           const int nkey,
                           uint16_t vbucket)
     {
-        BlockTimer timer(&stats.getCmdHisto);
-        std::string k(static_cast<const char*>(key), nkey);
-
-        GetValue gv(epstore->get(k, vbucket, cookie, serverApi->core));
-
-        if (gv.getStatus() == ENGINE_SUCCESS) {
-            *itm = gv.getValue();
-        } else if (gv.getStatus() == ENGINE_KEY_ENOENT && isDegradedMode()) {
-            return ENGINE_TMPFAIL;
-        }
+        return doGet(cookie, itm, key, nkey, vbucket, false);
+    }
 
-        return gv.getStatus();
+    /**
+     * Get an item for the core to send in a GET response.  Unlike get()
+     * a hit is returned as an ItemView (see toEngineItem()), so only
+     * itemRelease() and getItemInfo() may be used on it.
+     */
+    ENGINE_ERROR_CODE getForResponse(const void* cookie,
+                                     item** itm,
+                                     const void* key,
+                                     const int nkey,
+                                     uint16_t vbucket)
+    {
+        return doGet(cookie, itm, key, nkey, vbucket, true);
     }
 
     ENGINE_ERROR_CODE getStats(const void* cookie,
@@ -270,7 +277,8 @@ public:
 
         ENGINE_ERROR_CODE ret = get(cookie, &it, key, nkey, vbucket);
         if (ret == ENGINE_SUCCESS) {
-            Item *itm = static_cast<Item*>(it);
+            Item *itm = toItem(it);
+            assert(itm);
             char *endptr = NULL;
             char data[24];
             size_t len = std::min(static_cast<uint32_t>(sizeof(data) - 1),
@@ -562,6 +570,20 @@ public:
         return warmingUp.get() || restore.enabled.get();
     }
 
+    /**
+     * Like isDegradedMode(), but a vbucket whose keys warmup has
+     * already loaded is out of degraded mode as far as reads go: a
+     * miss there means the key doesn't exist, and non-resident values
+     * are fetched from disk.
+     */
+    bool isDegradedMode(uint16_t vbucket) const {
+        if (restore.enabled.get()) {
+            return true;
+        }
+        return warmingUp.get() &&
+            !epstore->getVBuckets().isBucketTrafficEnabled(vbucket);
+    }
+
 protected:
     friend class EpEngineValueChangeListener;
 
@@ -592,6 +614,38 @@ private:
                                     uint16_t status,
                                     const std::string &msg);
 
+    /**
+     * The lookup behind get() and getForResponse().
+     *
+     * @param asView true to return a hit as an ItemView tagged with
+     *               toEngineItem(), false to return a full Item
+     */
+    ENGINE_ERROR_CODE doGet(const void* cookie,
+                            item** itm,
+                            const void* key,
+                            const int nkey,
+                            uint16_t vbucket,
+                            bool asView)
+    {
+        BlockTimer timer(&stats.getCmdHisto);
+        std::string k(static_cast<const char*>(key), nkey);
+
+        GetValue gv(asView ? epstore->getView(k, vbucket, cookie) :
+                    epstore->get(k, vbucket, cookie, serverApi->core));
+
+        if (gv.getStatus() == ENGINE_SUCCESS) {
+            if (asView) {
+                *itm = toEngineItem(gv.getView());
+            } else {
+                *itm = gv.getValue();
+            }
+        } else if (gv.getStatus() == ENGINE_KEY_ENOENT && isDegradedMode(vbucket)) {
+            return ENGINE_TMPFAIL;
+        }
+
+        return gv.getStatus();
+    }
+
     /**
      * Report the state of a memory condition when out of memory.
      *
@@ -678,6 +732,7 @@ private:
     ENGINE_ERROR_CODE doEngineStats(const void *cookie, ADD_STAT add_stat);
     ENGINE_ERROR_CODE doKlogStats(const void *cookie, ADD_STAT add_stat);
     ENGINE_ERROR_CODE doMemoryStats(const void *cookie, ADD_STAT add_stat);
+    void addSlabStats(const void *cookie, ADD_STAT add_stat);
     ENGINE_ERROR_CODE doVBucketStats(const void *cookie, ADD_STAT add_stat,
                                      bool prevStateRequested,
                                      bool details);
@@ -110,6 +110,7 @@ bool abort_msg(const char *expr, const char *msg, int line) {
 static void rmdb(void) {
     remove("/tmp/test.db");
     remove("/tmp/mutation.log");
+    remove("/tmp/access.log");
     remove("/tmp/test.db-0.sqlite");
     remove("/tmp/test.db-1.sqlite");
     remove("/tmp/test.db-2.sqlite");
@@ -2419,6 +2420,50 @@ static enum test_result test_db_shards(ENGINE_HANDLE *h,
     return SUCCESS;
 }
 
+static enum test_result test_parallel_shard_flush(ENGINE_HANDLE *h,
+                                                  ENGINE_HANDLE_V1 *h1) {
+    check(get_int_stat(h, h1, "ep_db_shards") == 4,
+          "Expected four shards for db store");
+    const int num_keys = 200;
+    for (int j = 0; j < num_keys; ++j) {
+        std::stringstream ss;
+        ss << "key" << j;
+        item *i;
+        check(store(h, h1, NULL, OPERATION_SET, ss.str().c_str(),
+                    ss.str().c_str(), &i) == ENGINE_SUCCESS,
+              "Failed to store a value");
+        h1->release(h, NULL, i);
+    }
+    wait_for_flusher_to_settle(h, h1);
+
+    // Every shard's items went through their persistence callbacks...
+    check(get_int_stat(h, h1, "ep_total_persisted") == num_keys,
+          "Expected every item to be persisted");
+    // ... and each batch was bracketed by one pair of commit records.
+    int commit1 = get_int_stat(h, h1, "count_commit1", "klog");
+    check(commit1 > 0, "Expected commit records in the klog");
+    check(get_int_stat(h, h1, "count_commit2", "klog") == commit1,
+          "Expected a commit2 for every commit1 in the klog");
+    check(get_int_stat(h, h1, "count_new", "klog") == num_keys,
+          "Expected a klog entry for every item");
+
+    // Every shard committed its part of the data.
+    testHarness.reload_engine(&h, &h1,
+                              testHarness.engine_path,
+                              testHarness.get_current_testcase()->cfg,
+                              true, false);
+    check(get_int_stat(h, h1, "curr_items") == num_keys,
+          "Expected every item back after restart");
+    for (int j = 0; j < num_keys; j += 37) {
+        std::stringstream ss;
+        ss << "key" << j;
+        check(check_key_value(h, h1, ss.str().c_str(), ss.str().data(),
+                              ss.str().size()) == SUCCESS,
+              "Lost a value across restart");
+    }
+    return SUCCESS;
+}
+
 static enum test_result test_single_db_strategy(ENGINE_HANDLE *h,
                                                 ENGINE_HANDLE_V1 *h1) {
     vals.clear();
@@ -2649,6 +2694,69 @@ static enum test_result test_vbucket_destroy_restart(ENGINE_HANDLE *h, ENGINE_HA
     return SUCCESS;
 }
 
+static enum test_result test_vbucket_destroy_batch(ENGINE_HANDLE *h,
+                                                   ENGINE_HANDLE_V1 *h1) {
+    item *i = NULL;
+    for (int vb = 1; vb < 4; ++vb) {
+        check(set_vbucket_state(h, h1, vb, vbucket_state_active),
+              "Failed to set vbucket state.");
+        for (int j = 0; j < 10; ++j) {
+            std::stringstream key;
+            key << "key-" << vb << "-" << j;
+            check(store(h, h1, NULL, OPERATION_SET, key.str().c_str(),
+                        "somevalue", &i, 0, vb) == ENGINE_SUCCESS,
+                  "Failed to store a value");
+            h1->release(h, NULL, i);
+        }
+    }
+    wait_for_flusher_to_settle(h, h1);
+
+    // Delete them back to back, so that they're queued up and dropped
+    // from disk together.
+    int vbucketDel = get_int_stat(h, h1, "ep_vbucket_del");
+    for (int vb = 1; vb < 4; ++vb) {
+        check(set_vbucket_state(h, h1, vb, vbucket_state_dead),
+              "Failed set set vbucket state.");
+    }
+    for (int vb = 1; vb < 4; ++vb) {
+        protocol_binary_request_header *pkt =
+            createPacket(PROTOCOL_BINARY_CMD_DEL_VBUCKET, vb);
+        check(h1->unknown_command(h, NULL, pkt, add_response) == ENGINE_SUCCESS,
+              "Failed to delete dead bucket.");
+        check(last_status == PROTOCOL_BINARY_RESPONSE_SUCCESS,
+              "Expected success deleting a dead bucket.");
+    }
+    useconds_t sleepTime = 128;
+    while (get_int_stat(h, h1, "ep_vbucket_del") < vbucketDel + 3) {
+        decayingSleep(&sleepTime);
+    }
+
+    testHarness.reload_engine(&h, &h1,
+                              testHarness.engine_path,
+                              testHarness.get_current_testcase()->cfg,
+                              true, false);
+
+    for (int vb = 1; vb < 4; ++vb) {
+        check(verify_vbucket_missing(h, h1, vb),
+              "vbucket was not missing after restart.");
+    }
+    check(get_int_stat(h, h1, "curr_items") == 0,
+          "Expected no items of the dropped vbuckets after restart");
+
+    // A vbucket created again with the same id doesn't see the old data.
+    check(set_vbucket_state(h, h1, 2, vbucket_state_active),
+          "Failed to set vbucket state.");
+    for (int j = 0; j < 10; ++j) {
+        std::stringstream key;
+        key << "key-2-" << j;
+        check(h1->get(h, NULL, &i, key.str().c_str(), key.str().size(), 2)
+              == ENGINE_KEY_ENOENT,
+              "Expected the recreated vbucket to be empty");
+    }
+
+    return SUCCESS;
+}
+
 static enum test_result test_vb_set_pending(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
     return test_pending_vb_mutation(h, h1, OPERATION_SET);
 }
@@ -3800,6 +3908,8 @@ static enum test_result test_warmup_stats(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1
     check(vals.find("ep_warmup_count") != vals.end(), "Found no ep_warmup_count");
     check(vals.find("ep_warmup_dups") != vals.end(), "Found no ep_warmup_dups");
     check(vals.find("ep_warmup_oom") != vals.end(), "Found no ep_warmup_oom");
+    check(vals.find("ep_warmup_vbuckets_ready") != vals.end(),
+          "Found no ep_warmup_vbuckets_ready");
     check(vals.find("ep_warmup_time") != vals.end(), "Found no ep_warmup_time");
     std::string warmup_time = vals["ep_warmup_time"];
     assert(atoi(warmup_time.c_str()) > 0);
@@ -3817,6 +3927,266 @@ static enum test_result test_warmup_stats(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1
     return SUCCESS;
 }
 
+static bool warmup_running(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    vals.clear();
+    check(h1->get_stats(h, NULL, "warmup", 6, add_stats) == ENGINE_SUCCESS,
+          "Failed to get the warmup stats");
+    return vals["ep_warmup_thread"] != "complete";
+}
+
+static enum test_result test_warmup_vbuckets_ready(ENGINE_HANDLE *h,
+                                                   ENGINE_HANDLE_V1 *h1) {
+    item *it = NULL;
+    check(set_vbucket_state(h, h1, 1, vbucket_state_active),
+          "Failed to set VB1 state.");
+    check(store(h, h1, NULL, OPERATION_SET, "key", "somevalue", &it, 0, 0)
+          == ENGINE_SUCCESS, "Error setting.");
+    h1->release(h, NULL, it);
+    // Enough keys in vb 1 for its key dump to take a while after vb 0
+    // is serving reads.
+    for (int i = 0; i < 10000; ++i) {
+        std::stringstream key;
+        key << "key-" << i;
+        check(store(h, h1, NULL, OPERATION_SET, key.str().c_str(), "somevalue",
+                    &it, 0, 1) == ENGINE_SUCCESS, "Error setting.");
+        h1->release(h, NULL, it);
+    }
+    wait_for_flusher_to_settle(h, h1);
+
+    std::string config(testHarness.get_current_testcase()->cfg);
+    config.append(";waitforwarmup=false");
+    testHarness.reload_engine(&h, &h1, testHarness.engine_path,
+                              config.c_str(), true, false);
+
+    // vb 0 is dumped first, on its own.  Once it's ready a miss there
+    // is a miss, while vb 1 returns a temporary failure until its own
+    // keys are loaded.
+    int readyMisses(0), pendingMisses(0);
+    bool running(true);
+    while (running) {
+        int before = get_int_stat(h, h1, "ep_warmup_vbuckets_ready", "warmup");
+        ENGINE_ERROR_CODE rv0 = h1->get(h, NULL, &it, "missing", 7, 0);
+        ENGINE_ERROR_CODE rv1 = h1->get(h, NULL, &it, "missing", 7, 1);
+        running = warmup_running(h, h1);
+        int after = atoi(vals["ep_warmup_vbuckets_ready"].c_str());
+        if (before >= 1) {
+            check(rv0 == ENGINE_KEY_ENOENT,
+                  "Expected a miss on a ready vbucket to return ENOENT");
+            if (running) {
+                ++readyMisses;
+            }
+            if (running && after < 2) {
+                check(rv1 == ENGINE_TMPFAIL,
+                      "Expected a miss on a vbucket not ready yet to return TMPFAIL");
+                ++pendingMisses;
+            }
+        }
+    }
+    check(readyMisses > 0, "Never saw a ready vbucket during warmup");
+    check(pendingMisses > 0, "Never saw a vbucket waiting for its keys");
+    check(get_int_stat(h, h1, "ep_warmup_vbuckets_ready", "warmup") == 2,
+          "Expected both vbuckets to have been flagged ready");
+    check(h1->get(h, NULL, &it, "missing", 7, 1) == ENGINE_KEY_ENOENT,
+          "Expected a miss after warmup to return ENOENT");
+
+    return SUCCESS;
+}
+
+static enum test_result test_warmup_oom_vbuckets(ENGINE_HANDLE *h,
+                                                 ENGINE_HANDLE_V1 *h1) {
+    item *it = NULL;
+    for (int i = 0; i < 5000; ++i) {
+        std::stringstream key;
+        key << "key-" << i;
+        check(store(h, h1, NULL, OPERATION_SET, key.str().c_str(), "somevalue",
+                    &it) == ENGINE_SUCCESS, "Error setting.");
+        h1->release(h, NULL, it);
+    }
+    wait_for_flusher_to_settle(h, h1);
+
+    // Too little memory for all the keys: some are dropped, so the
+    // vbucket must not claim that a miss is a miss.
+    std::string config(testHarness.get_current_testcase()->cfg);
+    config.append(";max_size=100000;failpartialwarmup=false");
+    testHarness.reload_engine(&h, &h1, testHarness.engine_path,
+                              config.c_str(), true, false);
+
+    useconds_t sleepTime = 128;
+    while (warmup_running(h, h1)) {
+        decayingSleep(&sleepTime);
+    }
+    check(get_int_stat(h, h1, "ep_warmup_oom", "warmup") > 0,
+          "Expected warmup to run out of memory");
+    check(get_int_stat(h, h1, "ep_warmup_vbuckets_ready", "warmup") == 0,
+          "Expected no vbucket to be flagged ready after an OOM");
+
+    return SUCCESS;
+}
+
+static void copy_file(const char *from, const char *to) {
+    FILE *in = fopen(from, "rb");
+    check(in != NULL, "Failed to open the file to copy");
+    FILE *out = fopen(to, "wb");
+    check(out != NULL, "Failed to create the copy");
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        check(fwrite(buf, 1, n, out) == n, "Failed to write the copy");
+    }
+    fclose(in);
+    fclose(out);
+}
+
+static enum test_result test_access_log_warmup(ENGINE_HANDLE *h,
+                                               ENGINE_HANDLE_V1 *h1) {
+    check(set_vbucket_state(h, h1, 1, vbucket_state_active),
+          "Failed to set VB1 state.");
+    item *it = NULL;
+    for (int vb = 0; vb < 2; ++vb) {
+        for (int i = 0; i < 50; ++i) {
+            std::stringstream key;
+            key << "key-" << vb << "-" << i;
+            check(store(h, h1, NULL, OPERATION_SET, key.str().c_str(),
+                        key.str().c_str(), &it, 0, vb) == ENGINE_SUCCESS,
+                  "Error setting.");
+            h1->release(h, NULL, it);
+        }
+    }
+    wait_for_flusher_to_settle(h, h1);
+
+    // The access log has the same format as the mutation log, which
+    // now holds every key.  Warm up from it without the mutation log,
+    // in batches that don't divide the number of keys.
+    copy_file("/tmp/mutation.log", "/tmp/access.log");
+    std::string config(testHarness.get_current_testcase()->cfg);
+    size_t pos = config.find("klog_path=/tmp/mutation.log");
+    check(pos != std::string::npos, "Expected a mutation log in the config");
+    config.replace(pos, strlen("klog_path=/tmp/mutation.log"),
+                   "alog_path=/tmp/access.log");
+    testHarness.reload_engine(&h, &h1, testHarness.engine_path,
+                              config.c_str(), true, false);
+
+    check(get_int_stat(h, h1, "ep_warmup_count", "warmup") == 100,
+          "Expected the access log warmup to load every value");
+    for (int vb = 0; vb < 2; ++vb) {
+        for (int i = 0; i < 50; ++i) {
+            std::stringstream key;
+            key << "key-" << vb << "-" << i;
+            check_key_value(h, h1, key.str().c_str(), key.str().data(),
+                            key.str().size(), vb);
+        }
+    }
+    check(get_int_stat(h, h1, "ep_bg_fetched") == 0,
+          "Expected every value to be resident after warmup");
+
+    return SUCCESS;
+}
+
+static enum test_result test_couch_warmup_threads(ENGINE_HANDLE *h,
+                                                  ENGINE_HANDLE_V1 *h1) {
+    item *it = NULL;
+    for (int vb = 1; vb < 4; ++vb) {
+        check(set_vbucket_state(h, h1, vb, vbucket_state_active),
+              "Failed to set vbucket state.");
+    }
+    for (int vb = 0; vb < 4; ++vb) {
+        for (int i = 0; i < 25; ++i) {
+            std::stringstream key;
+            key << "key-" << vb << "-" << i;
+            check(store(h, h1, NULL, OPERATION_SET, key.str().c_str(),
+                        key.str().c_str(), &it, 0, vb) == ENGINE_SUCCESS,
+                  "Error setting.");
+            h1->release(h, NULL, it);
+        }
+    }
+    wait_for_flusher_to_settle(h, h1);
+
+    // A vbucket file that can't be opened, next to the good ones.
+    FILE *fp = fopen("/tmp/test.db/7.couch.1", "w");
+    check(fp != NULL, "Failed to create the broken vbucket file");
+    fputs("this is not a couchstore file", fp);
+    fclose(fp);
+
+    testHarness.reload_engine(&h, &h1, testHarness.engine_path,
+                              testHarness.get_current_testcase()->cfg,
+                              true, false);
+    remove("/tmp/test.db/7.couch.1");
+
+    // The loading threads shared the good files out between them and
+    // skipped the broken one.
+    check(get_int_stat(h, h1, "curr_items") == 100,
+          "Expected every item of the good files after warmup");
+    for (int vb = 0; vb < 4; ++vb) {
+        for (int i = 0; i < 25; ++i) {
+            std::stringstream key;
+            key << "key-" << vb << "-" << i;
+            check_key_value(h, h1, key.str().c_str(), key.str().data(),
+                            key.str().size(), vb);
+        }
+    }
+    check(verify_vbucket_missing(h, h1, 7),
+          "Expected the vbucket of the broken file not to be created");
+
+    return SUCCESS;
+}
+
+static enum test_result test_couch_parallel_commit(ENGINE_HANDLE *h,
+                                                   ENGINE_HANDLE_V1 *h1) {
+    for (int vb = 1; vb < 4; ++vb) {
+        check(set_vbucket_state(h, h1, vb, vbucket_state_active),
+              "Failed to set vbucket state.");
+    }
+    wait_for_flusher_to_settle(h, h1);
+
+    // Queue up mutations for all four vbuckets so that they go out in
+    // the same commit.
+    protocol_binary_request_header *pkt = createPacket(CMD_STOP_PERSISTENCE, 0);
+    check(h1->unknown_command(h, NULL, pkt, add_response) == ENGINE_SUCCESS,
+          "Failed to stop persistence.");
+    check(last_status == PROTOCOL_BINARY_RESPONSE_SUCCESS,
+          "Expected persistence to stop.");
+    free(pkt);
+
+    item *it = NULL;
+    for (int vb = 0; vb < 4; ++vb) {
+        for (int i = 0; i < 25; ++i) {
+            std::stringstream key;
+            key << "key-" << vb << "-" << i;
+            check(store(h, h1, NULL, OPERATION_SET, key.str().c_str(),
+                        key.str().c_str(), &it, 0, vb) == ENGINE_SUCCESS,
+                  "Error setting.");
+            h1->release(h, NULL, it);
+        }
+    }
+
+    pkt = createPacket(CMD_START_PERSISTENCE, 0);
+    check(h1->unknown_command(h, NULL, pkt, add_response) == ENGINE_SUCCESS,
+          "Failed to start persistence.");
+    check(last_status == PROTOCOL_BINARY_RESPONSE_SUCCESS,
+          "Expected persistence to start.");
+    free(pkt);
+    wait_for_flusher_to_settle(h, h1);
+
+    check(get_int_stat(h, h1, "rw:parallel_vbucket_commits", "kvstore") > 0,
+          "Expected the vbuckets to be written side by side");
+
+    testHarness.reload_engine(&h, &h1, testHarness.engine_path,
+                              testHarness.get_current_testcase()->cfg,
+                              true, false);
+    check(get_int_stat(h, h1, "curr_items") == 100,
+          "Expected every item of the parallel commit after restart");
+    for (int vb = 0; vb < 4; ++vb) {
+        for (int i = 0; i < 25; ++i) {
+            std::stringstream key;
+            key << "key-" << vb << "-" << i;
+            check_key_value(h, h1, key.str().c_str(), key.str().data(),
+                            key.str().size(), vb);
+        }
+    }
+
+    return SUCCESS;
+}
+
 static enum test_result test_curr_items(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
     item *i = NULL;
 
@@ -3944,6 +4314,77 @@ static enum test_result test_value_eviction(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *
     return SUCCESS;
 }
 
+static enum test_result test_pager_clock_hand(ENGINE_HANDLE *h,
+                                              ENGINE_HANDLE_V1 *h1) {
+    const int num_vbuckets = 4;
+    const int per_vbucket = 100;
+    std::string value(1024, 'x');
+    for (int vb = 1; vb < num_vbuckets; ++vb) {
+        check(set_vbucket_state(h, h1, vb, vbucket_state_active),
+              "Failed to set vbucket state.");
+    }
+
+    item *i = NULL;
+    for (int vb = 0; vb < num_vbuckets; ++vb) {
+        for (int j = 0; j < per_vbucket; ++j) {
+            std::stringstream key;
+            key << "key_" << vb << "_" << j;
+            check(store(h, h1, NULL, OPERATION_SET, key.str().c_str(),
+                        value.c_str(), &i, 0, vb) == ENGINE_SUCCESS,
+                  "Failed to store a value");
+            h1->release(h, NULL, i);
+        }
+    }
+    wait_for_flusher_to_settle(h, h1);
+    h1->reset_stats(h, NULL);
+
+    // Have the pager eject about a vbucket and a half worth of values.
+    // New values are spared on the first pass, which therefore visits
+    // every vbucket and leaves the clock hand on the last one; the
+    // ejections start from there rather than from vbucket 0.
+    int mem_used = get_int_stat(h, h1, "mem_used");
+    int low_wat = mem_used - (3 * per_vbucket * static_cast<int>(value.size())) / 2;
+    std::stringstream ss;
+    ss << low_wat;
+    set_param(h, h1, engine_param_flush, "mem_low_wat", ss.str().c_str());
+    ss.str("");
+    ss << mem_used - 1;
+    set_param(h, h1, engine_param_flush, "mem_high_wat", ss.str().c_str());
+
+    useconds_t sleepTime = 128;
+    while (get_int_stat(h, h1, "mem_used") > low_wat) {
+        decayingSleep(&sleepTime);
+    }
+    check(get_int_stat(h, h1, "vb_3:num_ejects", "vbucket-details") > 0,
+          "Expected the pager to eject from the vbucket it stopped in");
+    check(get_int_stat(h, h1, "vb_1:num_ejects", "vbucket-details") == 0,
+          "Expected the pager not to restart from vbucket 0");
+    int pager_ejects = get_int_stat(h, h1, "ep_num_pager_ejects");
+    check(pager_ejects > 0, "Expected the pager to eject values");
+    check(get_int_stat(h, h1, "ep_num_value_ejects_refetched") == 0,
+          "Expected no value to be fetched back yet");
+    check(get_int_stat(h, h1, "ep_eviction_efficiency") == 100,
+          "Expected a perfect eviction efficiency");
+
+    // Fetching back a value the pager ejected counts against it...
+    check_key_value(h, h1, "key_3_0", value.data(), value.size(), 3);
+    check(get_int_stat(h, h1, "ep_num_value_ejects_refetched") == 1,
+          "Expected a value ejected by the pager to be refetched");
+    check(get_int_stat(h, h1, "ep_eviction_efficiency") ==
+          100 * (pager_ejects - 1) / pager_ejects,
+          "Expected the refetch to lower the eviction efficiency");
+
+    // ... but one ejected on request doesn't.
+    evict_key(h, h1, "key_1_0", 1, "Ejected.");
+    check_key_value(h, h1, "key_1_0", value.data(), value.size(), 1);
+    check(get_int_stat(h, h1, "ep_num_value_ejects_refetched") == 1,
+          "Expected a value ejected on request not to count as refetched");
+    check(get_int_stat(h, h1, "ep_num_pager_ejects") == pager_ejects,
+          "Expected an ejection on request not to count as the pager's");
+
+    return SUCCESS;
+}
+
 static enum test_result test_mb3169(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
     item *i = NULL;
     uint64_t cas(0);
@@ -4110,6 +4551,64 @@ static enum test_result test_disk_gt_ram_golden(ENGINE_HANDLE *h,
     return SUCCESS;
 }
 
+static enum test_result test_bg_fetch_multi(ENGINE_HANDLE *h,
+                                            ENGINE_HANDLE_V1 *h1) {
+    const int num_keys = 50;
+    item *it = NULL;
+    // Stored in reverse, so the values are laid out in the file in the
+    // opposite order of their keys.
+    for (int i = num_keys - 1; i >= 0; --i) {
+        std::stringstream key, value;
+        key << "key-" << i;
+        value << "value-" << i;
+        check(store(h, h1, NULL, OPERATION_SET, key.str().c_str(),
+                    value.str().c_str(), &it) == ENGINE_SUCCESS,
+              "Error setting.");
+        h1->release(h, NULL, it);
+    }
+    wait_for_flusher_to_settle(h, h1);
+
+    for (int i = 0; i < num_keys; ++i) {
+        std::stringstream key;
+        key << "key-" << i;
+        evict_key(h, h1, key.str().c_str(), 0, "Ejected.");
+    }
+
+    // Queue all the fetches before the (delayed) fetcher runs, so they
+    // are read with a single multi-get.
+    std::vector<const void*> cookies;
+    for (int i = 0; i < num_keys; ++i) {
+        std::stringstream key;
+        key << "key-" << i;
+        const void *cookie = testHarness.create_cookie();
+        testHarness.set_ewouldblock_handling(cookie, false);
+        check(h1->get(h, cookie, &it, key.str().c_str(), key.str().size(), 0)
+              == ENGINE_EWOULDBLOCK, "Expected a background fetch");
+        cookies.push_back(cookie);
+    }
+
+    useconds_t sleepTime = 128;
+    while (get_int_stat(h, h1, "ep_bg_fetched") < num_keys) {
+        decayingSleep(&sleepTime);
+    }
+
+    for (int i = 0; i < num_keys; ++i) {
+        std::stringstream key, value;
+        key << "key-" << i;
+        value << "value-" << i;
+        check_key_value(h, h1, key.str().c_str(), value.str().data(),
+                        value.str().size());
+    }
+    check(get_int_stat(h, h1, "ep_bg_fetched") == num_keys,
+          "Expected every value to have been fetched once");
+
+    std::vector<const void*>::iterator cit;
+    for (cit = cookies.begin(); cit != cookies.end(); ++cit) {
+        testHarness.destroy_cookie(*cit);
+    }
+    return SUCCESS;
+}
+
 static enum test_result test_disk_gt_ram_paged_rm(ENGINE_HANDLE *h,
                                                   ENGINE_HANDLE_V1 *h1) {
     // Check/grab initial state.
@@ -5262,6 +5761,11 @@ engine_test_t* get_tests(void) {
         TestCase("test db shards", test_db_shards, NULL, teardown,
                  "db_shards=5;db_strategy=multiDB", prepare, cleanup,
                  BACKEND_ALL),
+        TestCase("test parallel shard flush", test_parallel_shard_flush,
+                 NULL, teardown,
+                 "db_shards=4;db_strategy=multiDB;parallel_shard_flush=true;"
+                 "klog_path=/tmp/mutation.log",
+                 prepare, cleanup, BACKEND_SQLITE),
         TestCase("test single db strategy", test_single_db_strategy,
                  NULL, teardown, "db_strategy=singleDB", prepare, cleanup,
                  BACKEND_ALL),
@@ -5389,11 +5893,32 @@ engine_test_t* get_tests(void) {
                  prepare, cleanup, BACKEND_ALL),
         TestCase("warmup stats", test_warmup_stats, NULL, teardown, NULL,
                  prepare, cleanup, BACKEND_ALL),
+        TestCase("warmup vbuckets ready", test_warmup_vbuckets_ready, NULL,
+                 teardown,
+                 "warmup_vbucket_batch_count=1;warmup_min_items_threshold=100;"
+                 "warmup_min_memory_threshold=100",
+                 prepare, cleanup, BACKEND_COUCH),
+        TestCase("warmup oom vbuckets", test_warmup_oom_vbuckets, NULL,
+                 teardown, NULL, prepare, cleanup, BACKEND_COUCH),
+        TestCase("access log warmup", test_access_log_warmup, NULL, teardown,
+                 "klog_path=/tmp/mutation.log;warmup_batch_size=7",
+                 prepare, cleanup, BACKEND_COUCH),
+        TestCase("couch warmup threads", test_couch_warmup_threads, NULL,
+                 teardown, "couch_warmup_threads=3;warmup_batch_size=10",
+                 prepare, cleanup, BACKEND_COUCH),
+        TestCase("couch parallel commit", test_couch_parallel_commit, NULL,
+                 teardown, "couch_commit_threads=4", prepare, cleanup,
+                 BACKEND_COUCH),
         TestCase("stats curr_items", test_curr_items, NULL, teardown, NULL,
                  prepare, cleanup, BACKEND_ALL),
         // eviction
         TestCase("value eviction", test_value_eviction, NULL, teardown, NULL,
                  prepare, cleanup, BACKEND_ALL),
+        TestCase("pager clock hand", test_pager_clock_hand, NULL, teardown,
+                 NULL, prepare, cleanup, BACKEND_ALL),
+        TestCase("pager clock hand on a non-IO pool", test_pager_clock_hand,
+                 NULL, teardown, "nonio_threads=4;chk_remover_stime=1",
+                 prepare, cleanup, BACKEND_ALL),
         // duplicate items on disk
         TestCase("duplicate items on disk", test_duplicate_items_disk, NULL,
                  teardown, NULL, prepare, cleanup, BACKEND_ALL),
@@ -5519,6 +6044,9 @@ engine_test_t* get_tests(void) {
         TestCase("disk>RAM delete bgfetch race (wal)", test_disk_gt_ram_rm_race,
                  NULL, teardown, MULTI_DISPATCHER_CONFIG, prepare, cleanup,
                  BACKEND_ALL),
+        TestCase("disk>RAM multi-get bgfetch", test_bg_fetch_multi, NULL,
+                 teardown, "bg_fetch_delay=1", prepare, cleanup,
+                 BACKEND_COUCH),
         // vbucket negative tests
         TestCase("vbucket incr (dead)", test_wrong_vb_incr, NULL, teardown,
                  NULL, prepare, cleanup, BACKEND_ALL),
@@ -5600,6 +6128,10 @@ engine_test_t* get_tests(void) {
                  prepare, cleanup, BACKEND_ALL),
         TestCase("test vbucket destroy restart", test_vbucket_destroy_restart,
                  NULL, teardown, NULL, prepare, cleanup, BACKEND_ALL),
+        TestCase("test vbucket destroy batch", test_vbucket_destroy_batch,
+                 NULL, teardown,
+                 "db_strategy=multiMTVBDB;max_vbuckets=16;ht_size=7;ht_locks=3",
+                 prepare, cleanup, BACKEND_ALL),
 
         // checkpoint tests
         TestCase("checkpoint: create a new checkpoint",
@@ -0,0 +1,168 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+
+#include <unistd.h>
+
+#include "epoch.hh"
+#include "locks.hh"
+#include "objectregistry.hh"
+
+// Try to advance the epoch and release memory every this many retires.
+static const size_t RECLAIM_INTERVAL = 64;
+
+extern "C" {
+    void release_epoch_participant(void *p) {
+        EpochManager *em = EpochManager::getInstance();
+        EpochManager::Participant *part = static_cast<EpochManager::Participant*>(p);
+        LockHolder lh(em->mutex);
+        // Records stay on the list forever and are handed to the next
+        // thread that registers.
+        part->active = false;
+        part->depth = 0;
+        part->inUse = false;
+    }
+}
+
+EpochManager *EpochManager::getInstance() {
+    // Never destroyed: threads may still leave their critical sections
+    // while the process is tearing down its statics.
+    static EpochManager *instance = new EpochManager();
+    return instance;
+}
+
+EpochManager::EpochManager() : globalEpoch(2), participants(NULL),
+                               self(release_epoch_participant) {
+}
+
+EpochManager::Participant *EpochManager::getParticipant() {
+    Participant *p = self.get();
+    if (p != NULL) {
+        return p;
+    }
+
+    LockHolder lh(mutex);
+    for (p = participants; p != NULL; p = p->next) {
+        if (!p->inUse) {
+            p->inUse = true;
+            break;
+        }
+    }
+    if (p == NULL) {
+        p = new Participant();
+        p->next = participants;
+        participants = p;
+    }
+    lh.unlock();
+    self.set(p);
+    return p;
+}
+
+void EpochManager::enter() {
+    Participant *p = getParticipant();
+    if (p->depth++ == 0) {
+        p->epoch = globalEpoch.get();
+        p->active = true;
+        // Publish that we're active before reading anything shared.
+        ep_sync_synchronize();
+        // The epoch may have moved on in between; running in the older
+        // one only delays reclamation.
+    }
+}
+
+void EpochManager::exit() {
+    Participant *p = self.get();
+    assert(p != NULL && p->depth > 0);
+    if (--p->depth == 0) {
+        // Everything read in the critical section must be done before
+        // we're seen as gone.
+        ep_sync_synchronize();
+        p->active = false;
+    }
+}
+
+bool EpochManager::tryAdvance() {
+    assert(mutex.ownsLock());
+    uint64_t current = globalEpoch.get();
+    ep_sync_synchronize();
+    for (Participant *p = participants; p != NULL; p = p->next) {
+        if (p->active && p->epoch != current) {
+            return false;
+        }
+    }
+    globalEpoch.set(current + 1);
+    return true;
+}
+
+void EpochManager::collect(std::deque<Retired> &out) {
+    assert(mutex.ownsLock());
+    tryAdvance();
+    uint64_t current = globalEpoch.get();
+    while (!limbo.empty() && limbo.front().epoch + 2 <= current) {
+        out.push_back(limbo.front());
+        limbo.pop_front();
+    }
+}
+
+void EpochManager::release(std::deque<Retired> &ready) {
+    assert(reclaimMutex.ownsLock());
+    if (ready.empty()) {
+        return;
+    }
+    EventuallyPersistentEngine *caller = ObjectRegistry::getCurrentEngine();
+    std::deque<Retired>::iterator it;
+    for (it = ready.begin(); it != ready.end(); ++it) {
+        ObjectRegistry::onSwitchThread(it->engine);
+        it->fn(it->ptr);
+        --numPending;
+    }
+    ObjectRegistry::onSwitchThread(caller);
+}
+
+void EpochManager::retire(void *p, Reclaimer fn) {
+    LockHolder lh(mutex);
+    limbo.push_back(Retired(p, fn, globalEpoch.get(),
+                            ObjectRegistry::getCurrentEngine()));
+    ++numPending;
+    bool due = limbo.size() % RECLAIM_INTERVAL == 0;
+    lh.unlock();
+
+    if (due) {
+        reclaim();
+    }
+}
+
+uint64_t EpochManager::reclaim() {
+    std::deque<Retired> ready;
+    LockHolder rlh(reclaimMutex);
+    LockHolder lh(mutex);
+    collect(ready);
+    uint64_t rv = globalEpoch.get();
+    lh.unlock();
+
+    release(ready);
+    return rv;
+}
+
+void EpochManager::synchronize() {
+    // We'd be waiting for ourselves.
+    assert(self.get() == NULL || self.get()->depth == 0);
+    uint64_t target = globalEpoch.get() + 2;
+    while (reclaim() < target) {
+        usleep(100);
+    }
+}
@@ -0,0 +1,160 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#ifndef EPOCH_HH
+#define EPOCH_HH 1
+
+#include "config.h"
+
+#include <deque>
+
+#include "common.hh"
+#include "atomic.hh"
+#include "mutex.hh"
+
+class EventuallyPersistentEngine;
+
+extern "C" {
+    void release_epoch_participant(void *p);
+}
+
+/**
+ * Epoch based reclamation of memory read without locks.
+ *
+ * Readers bracket their lock free accesses with an EpochGuard.  Writers
+ * unlink an object under their usual locks and hand it to retire()
+ * instead of freeing it; it is released once every reader that might
+ * have seen it has left its critical section.
+ *
+ * The global epoch only moves forward when every thread inside a
+ * critical section has observed its current value, so anything retired
+ * during epoch e can be released once the global epoch reaches e + 2.
+ *
+ * Objects are released on behalf of the engine that retired them, so
+ * the memory accounting of whatever they free goes to the right bucket.
+ */
+class EpochManager {
+public:
+
+    //! Releases a retired object.
+    typedef void (*Reclaimer)(void *);
+
+    static EpochManager *getInstance();
+
+    /**
+     * Enter a read side critical section.  May be nested.
+     */
+    void enter();
+
+    /**
+     * Leave the critical section entered by the matching enter().
+     */
+    void exit();
+
+    /**
+     * Have fn(p) called once no reader can hold a reference to p any
+     * more.  p must already be unreachable for new readers.
+     */
+    void retire(void *p, Reclaimer fn);
+
+    /**
+     * Try to move the epoch on and release whatever became safe.
+     *
+     * @return the epoch things were released up to
+     */
+    uint64_t reclaim();
+
+    /**
+     * Wait until everything retired so far has been released.
+     */
+    void synchronize();
+
+    /**
+     * The number of retired objects not released yet.
+     */
+    size_t getNumPending() const {
+        return numPending.get();
+    }
+
+    uint64_t getEpoch() const {
+        return globalEpoch.get();
+    }
+
+private:
+
+    struct Participant {
+        Participant() : epoch(0), active(false), depth(0),
+                        inUse(true), next(NULL) {}
+
+        volatile uint64_t  epoch;
+        volatile bool      active;
+        int                depth;
+        bool               inUse;
+        Participant       *next;
+    };
+
+    struct Retired {
+        Retired(void *p, Reclaimer f, uint64_t e,
+                EventuallyPersistentEngine *eng) :
+            ptr(p), fn(f), epoch(e), engine(eng) {}
+
+        void                       *ptr;
+        Reclaimer                   fn;
+        uint64_t                    epoch;
+        EventuallyPersistentEngine *engine;
+    };
+
+    EpochManager();
+
+    Participant *getParticipant();
+    bool tryAdvance();
+    void collect(std::deque<Retired> &out);
+    void release(std::deque<Retired> &ready);
+
+    friend void release_epoch_participant(void *p);
+
+    Atomic<uint64_t>          globalEpoch;
+    Mutex                     mutex;
+    // Held while releasing objects, so synchronize() knows when
+    // they're all gone.
+    Mutex                     reclaimMutex;
+    Participant              *participants;
+    std::deque<Retired>       limbo;
+    Atomic<size_t>            numPending;
+    ThreadLocal<Participant*> self;
+
+    DISALLOW_COPY_AND_ASSIGN(EpochManager);
+};
+
+/**
+ * Keeps the calling thread in an epoch critical section for its
+ * lifetime.
+ */
+class EpochGuard {
+public:
+    EpochGuard() {
+        EpochManager::getInstance()->enter();
+    }
+
+    ~EpochGuard() {
+        EpochManager::getInstance()->exit();
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(EpochGuard);
+};
+
+#endif /* EPOCH_HH */
@@ -0,0 +1,104 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+#include "config.h"
+
+#include <algorithm>
+
+#include "flush_controller.hh"
+
+const size_t FlushController::MIN_SIZE_DIVISOR;
+const size_t FlushController::MIN_PREEMPT_THRESHOLD;
+
+FlushController::FlushController(size_t maxSize, rel_time_t target) :
+    maxTxnSize(maxSize), lagTarget(target), txnSize(maxSize),
+    lastDecision(target == 0 ? fixed : hold), behind(false),
+    numGrows(0), numShrinks(0), lastQueueSize(0) {
+}
+
+size_t FlushController::getMinTxnSize() const {
+    return std::max(static_cast<size_t>(1), maxTxnSize.get() / MIN_SIZE_DIVISOR);
+}
+
+size_t FlushController::commitCompleted(hrtime_t commitTime, size_t queueSize,
+                                        rel_time_t dirtyAge) {
+    bool growing = queueSize > lastQueueSize;
+    lastQueueSize = queueSize;
+
+    rel_time_t target = lagTarget.get();
+    if (target == 0) {
+        behind = false;
+        lastDecision = fixed;
+        return txnSize.get();
+    }
+
+    // A commit lasting a quarter of the target leaves little room for
+    // anything else, and past half of it the commit is the lag.
+    hrtime_t targetNs = static_cast<hrtime_t>(target) * 1000000000;
+    bool slowCommit = commitTime > targetNs / 2;
+    bool fastCommit = commitTime < targetNs / 4;
+
+    behind = dirtyAge > target;
+    size_t size = txnSize.get();
+    size_t maxSize = maxTxnSize.get();
+    size_t minSize = getMinTxnSize();
+    decision_t decision = hold;
+
+    if (slowCommit && size > minSize) {
+        size = std::max(minSize, size - std::max(static_cast<size_t>(1), size / 4));
+        decision = shrink;
+    } else if ((behind || growing) && fastCommit && size < maxSize) {
+        size = std::min(maxSize, size + std::max(static_cast<size_t>(1), size / 4));
+        decision = grow;
+    } else if (!growing && dirtyAge * 2 <= target && size > minSize) {
+        size = std::max(minSize, size - std::max(static_cast<size_t>(1), size / 8));
+        decision = shrink;
+    }
+
+    if (decision == grow) {
+        ++numGrows;
+    } else if (decision == shrink) {
+        ++numShrinks;
+    }
+    txnSize = size;
+    lastDecision = decision;
+    return size;
+}
+
+void FlushController::setMaxTxnSize(size_t to) {
+    maxTxnSize = to;
+    if (lagTarget.get() == 0) {
+        txnSize = to;
+    } else {
+        txnSize = std::max(getMinTxnSize(), std::min(txnSize.get(), to));
+    }
+}
+
+void FlushController::setLagTarget(rel_time_t to) {
+    lagTarget = to;
+    if (to == 0) {
+        txnSize = maxTxnSize.get();
+        behind = false;
+        lastDecision = fixed;
+    }
+}
+
+size_t FlushController::getPreemptThreshold() const {
+    if (!behind.get()) {
+        return MIN_PREEMPT_THRESHOLD;
+    }
+    return std::max(MIN_PREEMPT_THRESHOLD, txnSize.get() / 4);
+}
+
+const char *FlushController::decisionName(decision_t d) {
+    switch (d) {
+    case fixed:
+        return "fixed";
+    case hold:
+        return "hold";
+    case grow:
+        return "grow";
+    case shrink:
+        return "shrink";
+    }
+    return "unknown";
+}
@@ -0,0 +1,121 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef FLUSH_CONTROLLER_HH
+#define FLUSH_CONTROLLER_HH 1
+
+#include "config.h"
+
+#include <string>
+
+#include "atomic.hh"
+#include "common.hh"
+
+/**
+ * Adjusts the flusher's transaction size to the observed persistence
+ * lag.
+ *
+ * After each commit the controller is told how long the commit took,
+ * how big the write queue is and how long the items it has just
+ * persisted had been waiting for it.  While items stay on the queue
+ * for longer than the lag target, or the queue keeps growing, the
+ * transactions are made larger so each sync covers more items.  Once
+ * the flusher is well within the target the transactions are shrunk
+ * back, which keeps commits (and the reads stalled behind them) short.
+ * Commits taking a sizeable part of the target are always shrunk, as
+ * they are then the cause of the lag.
+ *
+ * The transaction size moves between max_txn_size / MIN_SIZE_DIVISOR
+ * and max_txn_size.  With a lag target of 0 the controller is disabled
+ * and max_txn_size is used as is.
+ *
+ * Only the flusher drives the controller; the getters may be called
+ * from any thread.
+ */
+class FlushController {
+public:
+
+    //! The smallest transaction is max_txn_size divided by this.
+    static const size_t MIN_SIZE_DIVISOR = 16;
+    //! Items flushed before a pending background fetch preempts the flusher.
+    static const size_t MIN_PREEMPT_THRESHOLD = 100;
+
+    enum decision_t {
+        fixed,                  //!< adaptation is disabled
+        hold,                   //!< the size was left as is
+        grow,                   //!< the size was increased
+        shrink                  //!< the size was decreased
+    };
+
+    FlushController(size_t maxSize, rel_time_t target);
+
+    /**
+     * Record the outcome of a commit and compute the transaction size
+     * to use from now on.
+     *
+     * @param commitTime how long the commit took, in nanoseconds
+     * @param queueSize the number of items waiting to be persisted
+     * @param dirtyAge the time the items just persisted spent queued,
+     *                 in seconds
+     * @return the new transaction size
+     */
+    size_t commitCompleted(hrtime_t commitTime, size_t queueSize,
+                           rel_time_t dirtyAge);
+
+    /**
+     * Change the upper bound of the transaction size.
+     */
+    void setMaxTxnSize(size_t to);
+
+    /**
+     * Change the lag target (in seconds, 0 to disable adaptation).
+     */
+    void setLagTarget(rel_time_t to);
+
+    rel_time_t getLagTarget() const {
+        return lagTarget.get();
+    }
+
+    /**
+     * The number of mutations the next transactions should hold.
+     */
+    size_t getTxnSize() const {
+        return txnSize.get();
+    }
+
+    /**
+     * The number of items the flusher should persist before yielding
+     * to pending background fetches.  This stays low unless the
+     * flusher is falling behind its target.
+     */
+    size_t getPreemptThreshold() const;
+
+    decision_t getLastDecision() const {
+        return lastDecision.get();
+    }
+
+    size_t getNumGrows() const {
+        return numGrows.get();
+    }
+
+    size_t getNumShrinks() const {
+        return numShrinks.get();
+    }
+
+    static const char *decisionName(decision_t d);
+
+private:
+
+    size_t getMinTxnSize() const;
+
+    Atomic<size_t>     maxTxnSize;
+    Atomic<rel_time_t> lagTarget;
+    Atomic<size_t>     txnSize;
+    Atomic<decision_t> lastDecision;
+    Atomic<bool>       behind;
+    Atomic<size_t>     numGrows;
+    Atomic<size_t>     numShrinks;
+    size_t             lastQueueSize;
+
+    DISALLOW_COPY_AND_ASSIGN(FlushController);
+};
+
+#endif /* FLUSH_CONTROLLER_HH */
@@ -50,6 +50,14 @@ bool Flusher::resume(void) {
     return transition_state(running);
 }
 
+enum flusher_state Flusher::waitWhile(enum flusher_state st) const {
+    LockHolder lh(stateSync);
+    while (_state == st) {
+        stateSync.wait();
+    }
+    return _state;
+}
+
 static bool validTransition(enum flusher_state from,
                             enum flusher_state to)
 {
@@ -101,7 +109,11 @@ bool Flusher::transition_state(enum flusher_state to) {
                      "Transitioning from %s to %s\n",
                      stateName(_state), stateName(to));
 
-    _state = to;
+    {
+        LockHolder slh(stateSync);
+        _state = to;
+        stateSync.notify();
+    }
     //Reschedule the task
     LockHolder lh(taskMutex);
     assert(task.get());
@@ -139,6 +151,7 @@ void Flusher::start(void) {
 void Flusher::wake(void) {
     LockHolder lh(taskMutex);
     assert(task.get());
+    // Track the woken copy, it's the task transition_state() cancels.
     dispatcher->wake(task, &task);
 }
 
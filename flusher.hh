@@ -6,6 +6,7 @@
 #include "ep.hh"
 #include "dispatcher.hh"
 #include "mutation_log.hh"
+#include "syncobject.hh"
 
 enum flusher_state {
     initializing,
@@ -76,6 +77,13 @@ public:
     bool pause();
     bool resume();
 
+    /**
+     * Block until the flusher leaves the given state.
+     *
+     * @return the state the flusher moved to
+     */
+    enum flusher_state waitWhile(enum flusher_state st) const;
+
     void initialize(TaskId);
 
     void start(void);
@@ -100,6 +108,7 @@ private:
 
     EventuallyPersistentStore   *store;
     volatile enum flusher_state  _state;
+    mutable SyncObject           stateSync;
     Mutex                        taskMutex;
     TaskId                       task;
     Dispatcher                  *dispatcher;
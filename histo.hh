@@ -355,6 +355,199 @@ private:
     DISALLOW_COPY_AND_ASSIGN(Histogram);
 };
 
+// log2 of the number of bins each power of two range of a
+// LogLinearHistogram is split into.
+#define LOG_LINEAR_SUB_BITS 3
+
+/**
+ * A histogram of non-negative values with log-linear bins, meant for
+ * timings and sizes recorded by many threads at once.
+ *
+ * Values below 2^(LOG_LINEAR_SUB_BITS + 1) get a bin each; every power of
+ * two range above that is split into 2^LOG_LINEAR_SUB_BITS bins of equal
+ * width, so a bin is never wider than 1/8th of the values it holds.  The
+ * bin of a value is computed from its highest set bit rather than searched
+ * for.
+ *
+ * Every counter stripe (see getCounterStripe()) records into its own set of
+ * bins, allocated the first time it is used; reading the histogram adds
+ * them up.
+ */
+template <typename T>
+class LogLinearHistogram {
+public:
+
+    //! Number of bins covering all the values of T.
+    static const size_t NUM_BINS = (sizeof(T) * 8 - 2) << LOG_LINEAR_SUB_BITS;
+
+    LogLinearHistogram() {
+        for (size_t i = 0; i < NUM_COUNTER_STRIPES; ++i) {
+            shards[i] = NULL;
+        }
+    }
+
+    ~LogLinearHistogram() {
+        for (size_t i = 0; i < NUM_COUNTER_STRIPES; ++i) {
+            delete shards[i].get();
+        }
+    }
+
+    /**
+     * Add a value to this histogram.
+     *
+     * @param amount the size of the thing being added
+     * @param count the quantity at this size being added
+     */
+    void add(T amount, size_t count=1) {
+        size_t stripe = getCounterStripe();
+        Shard *shard = shards[stripe].get();
+        if (shard == NULL) {
+            shard = createShard(stripe);
+        }
+        shard->counts[getBinIndex(amount)].incr(count);
+    }
+
+    /**
+     * Set all bins to 0.
+     */
+    void reset() {
+        for (size_t i = 0; i < NUM_COUNTER_STRIPES; ++i) {
+            Shard *shard = shards[i].get();
+            if (shard != NULL) {
+                for (size_t j = 0; j < NUM_BINS; ++j) {
+                    shard->counts[j].set(0);
+                }
+            }
+        }
+    }
+
+    /**
+     * Get the count of every bin, added up over all the stripes.
+     */
+    void getCounts(std::vector<size_t> &counts) const {
+        counts.assign(NUM_BINS, 0);
+        for (size_t i = 0; i < NUM_COUNTER_STRIPES; ++i) {
+            Shard *shard = shards[i].get();
+            if (shard != NULL) {
+                for (size_t j = 0; j < NUM_BINS; ++j) {
+                    counts[j] += shard->counts[j].get();
+                }
+            }
+        }
+    }
+
+    /**
+     * Get the total number of samples counted.
+     */
+    size_t total() const {
+        std::vector<size_t> counts;
+        getCounts(counts);
+        return std::accumulate(counts.begin(), counts.end(), static_cast<size_t>(0));
+    }
+
+    /**
+     * Get the highest value of the bin holding the given fraction of the
+     * samples at or below it, or 0 if there are no samples.
+     *
+     * @param fraction the fraction of samples, e.g. 0.99 for the 99th percentile
+     */
+    T getPercentile(double fraction) const {
+        std::vector<size_t> counts;
+        getCounts(counts);
+        return getPercentile(counts, fraction);
+    }
+
+    /**
+     * Like getPercentile(double), over counts obtained from getCounts().
+     */
+    static T getPercentile(const std::vector<size_t> &counts, double fraction) {
+        size_t sum = std::accumulate(counts.begin(), counts.end(), static_cast<size_t>(0));
+        if (sum == 0) {
+            return 0;
+        }
+        size_t rank = static_cast<size_t>(std::ceil(fraction * static_cast<double>(sum)));
+        rank = std::max(rank, static_cast<size_t>(1));
+        size_t seen = 0;
+        for (size_t i = 0; i < NUM_BINS; ++i) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return getBinEnd(i) == std::numeric_limits<T>::max()
+                    ? getBinEnd(i) : getBinEnd(i) - 1;
+            }
+        }
+        return std::numeric_limits<T>::max();
+    }
+
+    /**
+     * Get the index of the bin holding the given value.
+     */
+    static size_t getBinIndex(T value) {
+        uint64_t v = static_cast<uint64_t>(value);
+        if (v < (2 << LOG_LINEAR_SUB_BITS)) {
+            return static_cast<size_t>(v);
+        }
+        size_t shift = highestBit(v) - LOG_LINEAR_SUB_BITS;
+        return (shift << LOG_LINEAR_SUB_BITS) + static_cast<size_t>(v >> shift);
+    }
+
+    /**
+     * The starting value of the given bin (inclusive).
+     */
+    static T getBinStart(size_t idx) {
+        if (idx < (2 << LOG_LINEAR_SUB_BITS)) {
+            return static_cast<T>(idx);
+        }
+        size_t shift = (idx >> LOG_LINEAR_SUB_BITS) - 1;
+        uint64_t sub = (idx & ((1 << LOG_LINEAR_SUB_BITS) - 1)) + (1 << LOG_LINEAR_SUB_BITS);
+        return static_cast<T>(sub << shift);
+    }
+
+    /**
+     * The ending value of the given bin (exclusive), except for the last
+     * bin, which ends with (and includes) the largest value of T.
+     */
+    static T getBinEnd(size_t idx) {
+        if (idx + 1 == NUM_BINS) {
+            return std::numeric_limits<T>::max();
+        }
+        return getBinStart(idx + 1);
+    }
+
+private:
+
+    struct Shard {
+        Atomic<size_t> counts[NUM_BINS];
+    };
+
+    static size_t highestBit(uint64_t v) {
+#ifdef __GNUC__
+        return 63 - __builtin_clzll(v);
+#else
+        size_t rv = 0;
+        while (v >>= 1) {
+            ++rv;
+        }
+        return rv;
+#endif
+    }
+
+    Shard *createShard(size_t stripe) {
+        Shard *shard = new Shard;
+        if (!shards[stripe].cas(NULL, shard)) {
+            delete shard;
+            shard = shards[stripe].get();
+        }
+        return shard;
+    }
+
+    AtomicPtr<Shard> shards[NUM_COUNTER_STRIPES];
+
+    DISALLOW_COPY_AND_ASSIGN(LogLinearHistogram);
+};
+
+template <typename T>
+const size_t LogLinearHistogram<T>::NUM_BINS;
+
 /**
  * Times blocks automatically and records the values in a histogram.
  */
@@ -368,11 +561,18 @@ public:
      * @param d the histogram that will hold the result
      */
     BlockTimer(Histogram<hrtime_t> *d, const char *n=NULL, std::ostream *o=NULL)
-        : dest(d), start(gethrtime()), name(n), out(o) {}
+        : dest(d), logLinearDest(NULL), start(gethrtime()), name(n), out(o) {}
+
+    BlockTimer(LogLinearHistogram<hrtime_t> *d, const char *n=NULL, std::ostream *o=NULL)
+        : dest(NULL), logLinearDest(d), start(gethrtime()), name(n), out(o) {}
 
     ~BlockTimer() {
         hrtime_t spent(gethrtime() - start);
-        dest->add(spent / 1000);
+        if (dest) {
+            dest->add(spent / 1000);
+        } else {
+            logLinearDest->add(spent / 1000);
+        }
         log(spent, name, out);
     }
 
@@ -383,10 +583,11 @@ public:
     }
 
 private:
-    Histogram<hrtime_t> *dest;
-    hrtime_t             start;
-    const char          *name;
-    std::ostream        *out;
+    Histogram<hrtime_t>          *dest;
+    LogLinearHistogram<hrtime_t> *logLinearDest;
+    hrtime_t                      start;
+    const char                   *name;
+    std::ostream                 *out;
 };
 
 // How to print a bin.
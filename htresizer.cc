@@ -8,23 +8,66 @@
 
 static const double FREQUENCY(60.0);
 
+/**
+ * Move an incremental resize's old buckets over a batch at a time,
+ * rescheduling itself until they're all moved.
+ */
+class ResizeStepper : public DispatcherCallback {
+public:
+
+    ResizeStepper(RCPtr<VBucket> &b) : vb(b) { }
+
+    bool callback(Dispatcher &, TaskId) {
+        return vb->ht.continueResize();
+    }
+
+    std::string description() {
+        std::stringstream ss;
+        ss << "Moving hash table buckets of vb " << vb->getId();
+        return ss.str();
+    }
+
+    bool isConcurrent() {
+        return true;
+    }
+
+private:
+    RCPtr<VBucket> vb;
+};
+
 /**
  * Look at all the hash tables and make sure they're sized appropriately.
  */
 class ResizingVisitor : public VBucketVisitor {
 public:
 
-    ResizingVisitor() { }
+    ResizingVisitor(Dispatcher *d) : dispatcher(d) { }
 
     bool visitBucket(RCPtr<VBucket> &vb) {
+        bool wasResizing = vb->ht.isResizing();
         vb->ht.resize();
+        if (!wasResizing && vb->ht.isResizing()) {
+            shared_ptr<DispatcherCallback> cb(new ResizeStepper(vb));
+            dispatcher->schedule(cb, NULL, Priority::HTResizePriority);
+        }
         return false;
     }
 
+    /**
+     * A resize backs off while the table is being visited, and moves
+     * the old buckets one bucket lock at a time, so it doesn't need
+     * the pagers to stand still.
+     */
+    bool isConcurrent() {
+        return true;
+    }
+
+private:
+    Dispatcher *dispatcher;
 };
 
 bool HashtableResizer::callback(Dispatcher &d, TaskId t) {
-    shared_ptr<ResizingVisitor> pv(new ResizingVisitor);
+    shared_ptr<ResizingVisitor> pv(new ResizingVisitor(&d));
     store->visit(pv, "Hashtable resizer", &d, Priority::ItemPagerPriority);
 
     d.snooze(t, FREQUENCY);
@@ -23,6 +23,10 @@ public:
         return std::string("Adjusting hash table sizes.");
     }
 
+    bool isConcurrent() {
+        return true;
+    }
+
 private:
     EventuallyPersistentStore *store;
 };
@@ -11,7 +11,9 @@
 #include "mutex.hh"
 #include "locks.hh"
 #include "atomic.hh"
+#include "keyhash.hh"
 #include "objectregistry.hh"
+#include "slab_allocator.hh"
 #include "stats.hh"
 
 /**
@@ -32,7 +34,7 @@ public:
      */
     static Blob* New(const char *start, const size_t len) {
         size_t total_len = len + sizeof(Blob);
-        Blob *t = new (::operator new(total_len)) Blob(start, len);
+        Blob *t = new (SlabAllocator::allocate(total_len)) Blob(start, len);
         assert(t->length() == len);
         return t;
     }
@@ -57,7 +59,7 @@ public:
      */
     static Blob* New(const size_t len) {
         size_t total_len = len + sizeof(Blob);
-        Blob *t = new (::operator new(total_len)) Blob(len);
+        Blob *t = new (SlabAllocator::allocate(total_len)) Blob(len);
         assert(t->length() == len);
         return t;
     }
@@ -95,7 +97,7 @@ public:
     // This is necessary for making C++ happy when I'm doing a
     // placement new on fairly "normal" c++ heap allocations, just
     // with variable-sized objects.
-    void operator delete(void* p) { ::operator delete(p); }
+    void operator delete(void* p) { SlabAllocator::deallocate(p); }
 
     ~Blob() {
         ObjectRegistry::onDeleteBlob(this);
@@ -124,6 +126,99 @@ private:
 
 typedef RCPtr<Blob> value_t;
 
+/**
+ * A read only snapshot of a stored value handed to the memcached core
+ * for GET responses.
+ *
+ * It shares the value's Blob and keeps a copy of the key in the same
+ * (slab) allocation, so a hit costs a single allocation instead of an
+ * Item and its key string.
+ */
+class ItemView {
+public:
+
+    /**
+     * Create a new view.
+     *
+     * @param k the key
+     * @param nk the length of the key
+     * @param val the value to share
+     * @param fl the item's flags
+     * @param exp the item's expiry time
+     * @param theCas the item's CAS
+     *
+     * @return the new ItemView instance
+     */
+    static ItemView* New(const char *k, const size_t nk, const value_t &val,
+                         const uint32_t fl, const uint32_t exp,
+                         const uint64_t theCas) {
+        size_t total_len = nk + sizeof(ItemView);
+        return new (SlabAllocator::allocate(total_len))
+            ItemView(k, nk, val, fl, exp, theCas);
+    }
+
+    const char *getKey() const {
+        return key;
+    }
+
+    uint16_t getNKey() const {
+        return nkey;
+    }
+
+    const char *getData() const {
+        return value.get() ? value->getData() : NULL;
+    }
+
+    uint32_t getNBytes() const {
+        return value.get() ? static_cast<uint32_t>(value->length()) : 0;
+    }
+
+    uint64_t getCas() const {
+        return cas;
+    }
+
+    uint32_t getFlags() const {
+        return flags;
+    }
+
+    time_t getExptime() const {
+        return exptime;
+    }
+
+    /**
+     * Get the size of this instance, not counting the shared value.
+     */
+    size_t getSize() const {
+        return sizeof(ItemView) + nkey;
+    }
+
+    void operator delete(void* p) { SlabAllocator::deallocate(p); }
+
+    ~ItemView() {
+        ObjectRegistry::onDeleteItemView(this);
+    }
+
+private:
+
+    ItemView(const char *k, const size_t nk, const value_t &val,
+             const uint32_t fl, const uint32_t exp, const uint64_t theCas) :
+        value(val), cas(theCas), exptime(exp), flags(fl),
+        nkey(static_cast<uint16_t>(nk))
+    {
+        std::memcpy(key, k, nk);
+        ObjectRegistry::onCreateItemView(this);
+    }
+
+    value_t  value;
+    uint64_t cas;
+    uint32_t exptime;
+    uint32_t flags;
+    uint16_t nkey;
+    char     key[1];
+
+    DISALLOW_COPY_AND_ASSIGN(ItemView);
+};
+
 /**
  * The Item structure we use to pass information between the memcached
  * core and the backend. Please note that the kvstore don't store these
@@ -134,7 +229,8 @@ public:
     Item(const void* k, const size_t nk, const size_t nb,
          const uint32_t fl, const time_t exp, uint64_t theCas = 0,
          int64_t i = -1, uint16_t vbid = 0) :
-        cas(theCas), id(i), exptime(exp), flags(fl), seqno(1), vbucketId(vbid)
+        cas(theCas), id(i), exptime(exp), flags(fl), seqno(1), vbucketId(vbid),
+        keyHash(0)
     {
         key.assign(static_cast<const char*>(k), nk);
         assert(id != 0);
@@ -145,7 +241,8 @@ public:
     Item(const std::string &k, const uint32_t fl, const time_t exp,
          const void *dta, const size_t nb, uint64_t theCas = 0,
          int64_t i = -1, uint16_t vbid = 0) :
-        cas(theCas), id(i), exptime(exp), flags(fl), seqno(1), vbucketId(vbid)
+        cas(theCas), id(i), exptime(exp), flags(fl), seqno(1), vbucketId(vbid),
+        keyHash(0)
     {
         key.assign(k);
         assert(id != 0);
@@ -156,7 +253,8 @@ public:
     Item(const std::string &k, const uint32_t fl, const time_t exp,
          const value_t &val, uint64_t theCas = 0,  int64_t i = -1, uint16_t vbid = 0,
          uint32_t sno = 1) :
-         value(val), cas(theCas), id(i), exptime(exp), flags(fl), seqno(sno), vbucketId(vbid)
+         value(val), cas(theCas), id(i), exptime(exp), flags(fl), seqno(sno), vbucketId(vbid),
+         keyHash(0)
     {
         assert(id != 0);
         key.assign(k);
@@ -166,7 +264,8 @@ public:
     Item(const void *k, uint16_t nk, const uint32_t fl, const time_t exp,
          const void *dta, const size_t nb, uint64_t theCas = 0,
          int64_t i = -1, uint16_t vbid = 0) :
-        cas(theCas), id(i), exptime(exp), flags(fl), seqno(1), vbucketId(vbid)
+        cas(theCas), id(i), exptime(exp), flags(fl), seqno(1), vbucketId(vbid),
+        keyHash(0)
     {
         assert(id != 0);
         key.assign(static_cast<const char*>(k), nk);
@@ -190,6 +289,17 @@ public:
         return key;
     }
 
+    /**
+     * Get the hash of the key (see hashKey()), computed on first use
+     * and reused by everything indexing the item by key after that.
+     */
+    uint64_t getKeyHash() const {
+        if (keyHash == 0) {
+            keyHash = hashKey(key);
+        }
+        return keyHash;
+    }
+
     int64_t getId() const {
         return id;
     }
@@ -383,6 +493,7 @@ private:
     uint32_t flags;
     uint32_t seqno;
     uint16_t vbucketId;
+    mutable uint64_t keyHash;
 
     static uint64_t nextCas(void) {
         uint64_t ret = gethrtime();
@@ -402,4 +513,40 @@ private:
     DISALLOW_COPY_AND_ASSIGN(Item);
 };
 
+/*
+ * GET responses are handed to the core as ItemViews rather than Items.
+ * Both are opaque item pointers to the core; views are told apart by
+ * their lowest bit, which is otherwise clear as both are pointer
+ * aligned.  Never cast a core item pointer directly: decode it with
+ * toItemView() or toItem().
+ */
+inline item *toEngineItem(ItemView *view) {
+    return reinterpret_cast<item*>(reinterpret_cast<uintptr_t>(view) | 1);
+}
+
+/**
+ * Get the ItemView behind an item pointer, or NULL if it is an Item.
+ */
+inline ItemView *toItemView(const item *itm) {
+    uintptr_t p = reinterpret_cast<uintptr_t>(itm);
+    if ((p & 1) == 0) {
+        return NULL;
+    }
+    return reinterpret_cast<ItemView*>(p & ~static_cast<uintptr_t>(1));
+}
+
+/**
+ * Get the Item behind an item pointer, or NULL if it is an ItemView.
+ */
+inline Item *toItem(item *itm) {
+    if (toItemView(itm) != NULL) {
+        return NULL;
+    }
+    return static_cast<Item*>(itm);
+}
+
+inline const Item *toItem(const item *itm) {
+    return toItem(const_cast<item*>(itm));
+}
+
 #endif
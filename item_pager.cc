@@ -12,29 +12,38 @@
 
 static const double EJECTION_RATIO_THRESHOLD(0.1);
 static const size_t MAX_PERSISTENCE_QUEUE_SIZE = 1000000;
+// How many values the pager looks at between checks of the memory usage.
+static const size_t MEMORY_CHECK_INTERVAL = 1000;
 
 /**
- * As part of the ItemPager, visit all of the objects in memory and
- * eject some within a constrained probability
+ * As part of the ItemPager, visit all of the objects in memory, purge
+ * the expired ones and possibly eject values.
+ *
+ * Values are picked for ejection with a CLOCK policy: a value that was
+ * referenced since the last pass has its reference count aged and is
+ * spared, the others are ejected until memory usage drops to the low
+ * water mark.  The pass then stops, and the next one starts over where
+ * this one left off.
  */
 class PagingVisitor : public VBucketVisitor {
 public:
 
     /**
-     * Construct a PagingVisitor that will attempt to evict the given
-     * percentage of objects.
+     * Construct a PagingVisitor.
      *
      * @param s the store that will handle the bulk removal
      * @param st the stats where we'll track what we've done
-     * @param pcnt percentage of objects to attempt to evict (0-1)
-     * @param sfin pointer to a bool to be set to true after run completes
+     * @param sfin pointer to a flag to be set to true after run completes
+     * @param hand if not NULL, eject values starting with this vbucket,
+     *             and store the vbucket the pass stopped in there
      * @param pause flag indicating if PagingVisitor can pause between vbucket visits
      */
-    PagingVisitor(EventuallyPersistentStore *s, EPStats &st, double pcnt,
-                  bool *sfin, bool pause = false)
-        : store(s), stats(st), percent(pcnt), ejected(0),
-          totalEjected(0), totalEjectionAttempts(0),
-          startTime(ep_real_time()), stateFinalizer(sfin), canPause(pause) {}
+    PagingVisitor(EventuallyPersistentStore *s, EPStats &st, Atomic<bool> *sfin,
+                  uint16_t *hand = NULL, bool pause = false)
+        : store(s), stats(st), ejected(0), totalEjected(0),
+          totalEjectionAttempts(0), visited(0), startTime(ep_real_time()),
+          stateFinalizer(sfin), clockHand(hand), canPause(pause),
+          done(false) {}
 
     void visit(StoredValue *v) {
         // Remember expired objects -- we're going to delete them.
@@ -43,28 +52,54 @@ public:
             return;
         }
 
-        double r = static_cast<double>(std::rand()) / static_cast<double>(RAND_MAX);
-        if (percent >= r) {
-            ++totalEjectionAttempts;
-            if (!v->eligibleForEviction()) {
-                ++stats.numFailedEjects;
-                return;
-            }
-            // Check if the key was already visited by all the cursors.
-            bool can_evict =
-                currentBucket->checkpointManager.eligibleForEviction(v->getKey());
-            if (can_evict && v->ejectValue(stats, currentBucket->ht)) {
-                if (currentBucket->getState() == vbucket_state_replica) {
-                    ++stats.numReplicaEjects;
-                }
-                ++ejected;
+        if (clockHand == NULL || done) {
+            return;
+        }
+        if (++visited % MEMORY_CHECK_INTERVAL == 0 && belowLowWatermark()) {
+            done = true;
+            return;
+        }
+        if (v->ageReferences()) {
+            return;
+        }
+
+        ++totalEjectionAttempts;
+        if (!v->eligibleForEviction()) {
+            ++stats.numFailedEjects;
+            return;
+        }
+        // Check if the key was already visited by all the cursors.
+        bool can_evict =
+            currentBucket->checkpointManager.eligibleForEviction(v->getKey());
+        if (can_evict && v->ejectValue(stats, currentBucket->ht, true)) {
+            ++stats.numPagerEjects;
+            if (currentBucket->getState() == vbucket_state_replica) {
+                ++stats.numReplicaEjects;
             }
+            ++ejected;
         }
     }
 
+    bool shouldContinue() {
+        return !done;
+    }
+
     bool visitBucket(RCPtr<VBucket> &vb) {
-         update();
-         return VBucketVisitor::visitBucket(vb);
+        update();
+        if (clockHand != NULL && !done && belowLowWatermark()) {
+            done = true;
+        }
+        if (done) {
+            return false;
+        }
+        if (clockHand != NULL) {
+            *clockHand = vb->getId();
+        }
+        return VBucketVisitor::visitBucket(vb);
+    }
+
+    uint16_t getFirstVBucket() {
+        return clockHand != NULL ? *clockHand : 0;
     }
 
     void update() {
@@ -92,6 +127,15 @@ public:
         return canPause && queueSize >= MAX_PERSISTENCE_QUEUE_SIZE;
     }
 
+    /**
+     * Expired items are deleted the way a front end delete would, and
+     * only after checking again under the bucket lock, so two pagers
+     * may go over the same keys.
+     */
+    bool isConcurrent() {
+        return true;
+    }
+
     void complete() {
         update();
         if (stateFinalizer) {
@@ -116,40 +160,43 @@ public:
     size_t getTotalEjectionAttempts() { return totalEjectionAttempts; }
 
 private:
+
+    bool belowLowWatermark() {
+        return stats.getTotalMemoryUsed() <= stats.mem_low_wat.get();
+    }
+
     std::list<std::pair<uint16_t, std::string> > expired;
 
     EventuallyPersistentStore *store;
     EPStats                   &stats;
-    double                     percent;
     size_t                     ejected;
     size_t                     totalEjected;
     size_t                     totalEjectionAttempts;
+    size_t                     visited;
     time_t                     startTime;
-    bool                      *stateFinalizer;
+    Atomic<bool>              *stateFinalizer;
+    uint16_t                  *clockHand;
     bool                       canPause;
+    bool                       done;
 };
 
 bool ItemPager::callback(Dispatcher &d, TaskId t) {
     double current = static_cast<double>(stats.getTotalMemoryUsed());
     double upper = static_cast<double>(stats.mem_high_wat);
-    double lower = static_cast<double>(stats.mem_low_wat);
     if (available && current > upper) {
 
         ++stats.pagerRuns;
 
-        double toKill = (current - static_cast<double>(lower)) / current;
-
         std::stringstream ss;
         ss << "Using " << stats.getTotalMemoryUsed()
-           << " bytes of memory, paging out %0f%% of items." << std::endl;
-        getLogger()->log(EXTENSION_LOG_INFO, NULL, ss.str().c_str(),
-                         (toKill*100.0));
+           << " bytes of memory, paging out values down to "
+           << stats.mem_low_wat.get() << " bytes." << std::endl;
+        getLogger()->log(EXTENSION_LOG_INFO, NULL, ss.str().c_str());
 
         available = false;
         shared_ptr<PagingVisitor> pv(new PagingVisitor(store, stats,
-                                                       toKill, &available));
+                                                       &available, &clockHand));
         store->visit(pv, "Item pager", &d, Priority::ItemPagerPriority);
-
         double total_eject_attms = static_cast<double>(pv->getTotalEjectionAttempts());
         double total_ejected = static_cast<double>(pv->getTotalEjected());
         double ejection_ratio =
@@ -182,7 +229,7 @@ bool ExpiredItemPager::callback(Dispatcher &d, TaskId t) {
 
         available = false;
         shared_ptr<PagingVisitor> pv(new PagingVisitor(store, stats,
-                                                       -1, &available, true));
+                                                       &available, NULL, true));
         store->visit(pv, "Expired item remover", &d, Priority::ItemPagerPriority,
                      true, 10);
     }
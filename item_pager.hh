@@ -29,16 +29,26 @@ public:
      * @param st the stats
      */
     ItemPager(EventuallyPersistentStore *s, EPStats &st) :
-        store(s), stats(st), available(true) {}
+        store(s), stats(st), available(true), clockHand(0) {}
 
     bool callback(Dispatcher &d, TaskId t);
 
     std::string description() { return std::string("Paging out items."); }
 
+    /**
+     * Ejections happen under the hash table locks, like the front end
+     * ones, so the pager may run beside the other housekeeping tasks.
+     */
+    bool isConcurrent() { return true; }
+
 private:
     EventuallyPersistentStore *store;
     EPStats                   &stats;
-    bool                       available;
+    // Set by the visitor, which runs on another worker, once its pass
+    // is done.
+    Atomic<bool>               available;
+    // The vbucket the last eviction pass stopped in.
+    uint16_t                   clockHand;
 };
 
 /**
@@ -64,11 +74,13 @@ public:
 
     std::string description() { return std::string("Paging expired items."); }
 
+    bool isConcurrent() { return true; }
+
 private:
     EventuallyPersistentStore *store;
     EPStats                   &stats;
     double                     sleepTime;
-    bool                       available;
+    Atomic<bool>               available;
 };
 
 /**
@@ -0,0 +1,78 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#ifndef KEYHASH_HH
+#define KEYHASH_HH 1
+
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+/**
+ * Compute the 64 bit hash of a document key.
+ *
+ * This is MurmurHash64A, which consumes the key a word at a time.  The
+ * result depends on the byte order of the host, so it must only be used
+ * for in-memory structures (hash tables, the checkpoint index), never
+ * for anything persisted.
+ *
+ * 0 is never returned so it can mark a hash that hasn't been computed.
+ */
+inline uint64_t hashKey(const char *key, size_t len) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t h = 0x5bd1e9955bd1e995ULL ^ (len * m);
+
+    const char *p = key;
+    const char *end = key + (len & ~static_cast<size_t>(7));
+    while (p != end) {
+        uint64_t k;
+        memcpy(&k, p, sizeof(k));
+        p += sizeof(k);
+
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+
+    const unsigned char *tail = reinterpret_cast<const unsigned char*>(p);
+    switch (len & 7) {
+    case 7: h ^= static_cast<uint64_t>(tail[6]) << 48;
+    case 6: h ^= static_cast<uint64_t>(tail[5]) << 40;
+    case 5: h ^= static_cast<uint64_t>(tail[4]) << 32;
+    case 4: h ^= static_cast<uint64_t>(tail[3]) << 24;
+    case 3: h ^= static_cast<uint64_t>(tail[2]) << 16;
+    case 2: h ^= static_cast<uint64_t>(tail[1]) << 8;
+    case 1: h ^= static_cast<uint64_t>(tail[0]);
+        h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+
+    return h == 0 ? 1 : h;
+}
+
+inline uint64_t hashKey(const std::string &key) {
+    return hashKey(key.data(), key.length());
+}
+
+#endif /* KEYHASH_HH */
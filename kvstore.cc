@@ -1,8 +1,11 @@
 /* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
 #include "config.h"
 
+#include <algorithm>
 #include <string>
 #include <map>
+#include <set>
+#include <vector>
 
 #include "common.hh"
 #include "ep_engine.h"
@@ -43,32 +46,71 @@ KVStore *KVStoreFactory::create(EventuallyPersistentEngine &theEngine) {
     return ret;
 }
 
+/**
+ * Collects the access log keys of the vbucket being warmed up, and
+ * loads their values a batch at a time, so no more than one batch of
+ * keys is ever buffered.
+ */
 struct WarmupCookie {
-    WarmupCookie(KVStore *s, Callback<GetValue>&c) :
-        store(s), cb(c), loaded(0), skipped(0), error(0)
-    { /* EMPTY */ }
+    WarmupCookie(KVStore *s, Callback<GetValue>&c, EPStats *st, size_t batch) :
+        store(s), cb(c), stats(st), vbucket(0), vbver(0), batchSize(batch),
+        loaded(0), skipped(0), error(0)
+    {
+        keys.reserve(batchSize);
+    }
+
+    /**
+     * Load the values of the keys collected so far.
+     */
+    void flush() {
+        if (keys.empty()) {
+            return;
+        }
+        // Values read past the low water mark would be ejected right
+        // away, their keys are loaded already.
+        if (stats && stats->getTotalMemoryUsed() >= stats->mem_low_wat) {
+            skipped += keys.size();
+        } else {
+            store->warmupBatch(vbucket, vbver, keys, cb, loaded, error);
+        }
+        keys.clear();
+    }
+
     KVStore *store;
     Callback<GetValue> &cb;
+    EPStats *stats;
+    uint16_t vbucket;
+    uint16_t vbver;
+    size_t batchSize;
+    // The keys of the current batch and their row ids
+    std::vector<std::pair<std::string, uint64_t> > keys;
     size_t loaded;
     size_t skipped;
     size_t error;
 };
 
-static void warmupCallback(void *arg, uint16_t vb, uint16_t vbver,
+static void warmupCallback(void *arg, uint16_t, uint16_t,
                            const std::string &key, uint64_t rowid)
 {
     WarmupCookie *cookie = static_cast<WarmupCookie*>(arg);
+    cookie->keys.push_back(std::make_pair(key, rowid));
+    if (cookie->keys.size() >= cookie->batchSize) {
+        cookie->flush();
+    }
+}
 
-    /* @todo check if we should start skipping items!!! */
-    RememberingCallback<GetValue> cb;
-    cookie->store->get(key, rowid, vb, vbver, cb);
-    cb.waitForValue();
-
-    if (cb.getStatus() == ENGINE_SUCCESS) {
-        cookie->cb.callback(cb.val);
-        cookie->loaded++;
-    } else {
-        cookie->error++;
+/**
+ * Order in which the vbuckets are warmed up: the active vbuckets,
+ * which take the traffic, before the replicas and the rest.
+ */
+static int warmupRank(vbucket_state_t state) {
+    switch (state) {
+    case vbucket_state_active:
+        return 0;
+    case vbucket_state_replica:
+        return 1;
+    default:
+        return 2;
     }
 }
 
@@ -95,9 +137,33 @@ size_t KVStore::warmup(MutationLog &lf,
                      "Completed log read in %s with %d entries\n",
                      hrtime2text(end - start).c_str(), total);
 
-    WarmupCookie cookie(this, cb);
+    EPStats *stats(NULL);
+    size_t batchSize(1000);
+    if (engine) {
+        stats = &engine->getEpStats();
+        batchSize = std::max(static_cast<size_t>(1),
+                             engine->getConfiguration().getWarmupBatchSize());
+    }
+
+    std::vector<std::pair<int, std::pair<uint16_t, uint16_t> > > order;
+    for (it = vbmap.begin(); it != vbmap.end(); ++it) {
+        order.push_back(std::make_pair(warmupRank(it->second.state), it->first));
+    }
+    std::sort(order.begin(), order.end());
+
+    WarmupCookie cookie(this, cb, stats, batchSize);
     start = gethrtime();
-    harvester.apply(&cookie, &warmupCallback);
+    std::set<uint16_t> seen;
+    std::vector<std::pair<int, std::pair<uint16_t, uint16_t> > >::iterator oit;
+    for (oit = order.begin(); oit != order.end(); ++oit) {
+        if (!seen.insert(oit->second.first).second) {
+            continue;
+        }
+        cookie.vbucket = oit->second.first;
+        cookie.vbver = oit->second.second;
+        harvester.apply(&cookie, &warmupCallback, cookie.vbucket);
+        cookie.flush();
+    }
     end = gethrtime();
 
     getLogger()->log(EXTENSION_LOG_DEBUG, NULL,
@@ -108,6 +174,56 @@ size_t KVStore::warmup(MutationLog &lf,
     return cookie.loaded;
 }
 
+void KVStore::warmupBatch(uint16_t vb, uint16_t vbver,
+                          const std::vector<std::pair<std::string, uint64_t> > &keys,
+                          Callback<GetValue> &cb, size_t &loaded, size_t &error) {
+    vb_bgfetch_queue_t fetches;
+    std::vector<std::pair<std::string, uint64_t> >::const_iterator kit;
+    for (kit = keys.begin(); kit != keys.end(); ++kit) {
+        vb_bgfetch_item_ctx_t &ctx = fetches[kit->first];
+        if (ctx.bgfetched_list.empty()) {
+            ctx.isMetaOnly = false;
+            ctx.bgfetched_list.push_back(new VBucketBGFetchItem(kit->first,
+                                                                kit->second,
+                                                                NULL, false));
+        }
+    }
+
+    getMulti(vb, vbver, fetches);
+
+    vb_bgfetch_queue_t::iterator it;
+    for (it = fetches.begin(); it != fetches.end(); ++it) {
+        vb_bgfetch_item_ctx_t &ctx = it->second;
+        if (ctx.value.getStatus() == ENGINE_SUCCESS && ctx.value.getValue()) {
+            // The callback takes the item over.
+            cb.callback(ctx.value);
+            ++loaded;
+        } else {
+            delete ctx.value.getValue();
+            ++error;
+        }
+        std::list<VBucketBGFetchItem *>::iterator iit;
+        for (iit = ctx.bgfetched_list.begin(); iit != ctx.bgfetched_list.end(); ++iit) {
+            delete *iit;
+        }
+    }
+}
+
+void KVStore::getMulti(uint16_t vb, uint16_t vbver, vb_bgfetch_queue_t &itms) {
+    vb_bgfetch_queue_t::iterator it;
+    for (it = itms.begin(); it != itms.end(); ++it) {
+        vb_bgfetch_item_ctx_t &ctx = it->second;
+        RememberingCallback<GetValue> gcb;
+        if (ctx.isMetaOnly) {
+            gcb.val.setPartial();
+        }
+        get(it->first, ctx.bgfetched_list.front()->rowid, vb, vbver, gcb);
+        gcb.waitForValue();
+        assert(gcb.fired);
+        ctx.value = gcb.val;
+    }
+}
+
 bool KVStore::getEstimatedItemCount(size_t &) {
     // Not supported
     return false;
@@ -5,6 +5,7 @@
 #include <map>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <cstring>
 
@@ -12,6 +13,7 @@
 #include "item.hh"
 #include "queueditem.hh"
 #include "mutation_log.hh"
+#include "vbucket.hh"
 
 /**
  * Result of database mutation operations.
@@ -167,6 +169,19 @@ public:
                      uint16_t vb, uint16_t vbver,
                      Callback<GetValue> &cb) = 0;
 
+    /**
+     * Get a batch of items belonging to a single vbucket from the kv
+     * store.  On return the value of every entry in the queue has been
+     * filled in; the caller owns the fetched items.
+     *
+     * The default implementation performs a get() per key.
+     *
+     * @param vb the vbucket all of the keys belong to
+     * @param vbver the version of the vbucket
+     * @param itms the keys to fetch, each with the requests waiting on it
+     */
+    virtual void getMulti(uint16_t vb, uint16_t vbver, vb_bgfetch_queue_t &itms);
+
     /**
      * Delete an item from the kv store.
      */
@@ -184,6 +199,26 @@ public:
     virtual bool delVBucket(uint16_t vbucket, uint16_t vb_version,
                             std::pair<int64_t, int64_t> row_range) = 0;
 
+    /**
+     * Drop several whole vbuckets at once.
+     *
+     * results[i] is set to the outcome of dropping vbuckets[i].  Stores
+     * able to drop many vbuckets in a single round trip or transaction
+     * should override this; by default each one goes through
+     * delVBucket().
+     *
+     * @param vbuckets the (vbucket, version) pairs to drop
+     * @param results receives whether each vbucket was dropped
+     */
+    virtual void delVBuckets(const std::vector<std::pair<uint16_t, uint16_t> > &vbuckets,
+                             std::vector<bool> &results) {
+        results.clear();
+        std::vector<std::pair<uint16_t, uint16_t> >::const_iterator it;
+        for (it = vbuckets.begin(); it != vbuckets.end(); ++it) {
+            results.push_back(delVBucket(it->first, it->second));
+        }
+    }
+
     /**
      * Invoked whenever vbucket states change.
      *
@@ -281,9 +316,10 @@ public:
 
     /**
      * Warm up the cache by using the given mutation log (this is actually an access log),
-     * The default implementaiton of the warmup warmup will scan the access file and load
-     * each key in a sequence. Each backend may overload this function with a more optimal
-     * version.
+     * The default implementaiton of the warmup will scan the access file and load the
+     * keys of each vbucket in batches with getMulti(), active vbuckets first, until the
+     * memory use reaches the low water mark. Each backend may overload this function
+     * with a more optimal version.
      *
      * NOTE: this operation block until all warmup is complete
      *
@@ -304,6 +340,16 @@ public:
     }
 
 protected:
+    friend struct WarmupCookie;
+
+    /**
+     * Load the values of the given keys of a vbucket with a single
+     * getMulti() and hand them to the given callback.
+     */
+    void warmupBatch(uint16_t vb, uint16_t vbver,
+                     const std::vector<std::pair<std::string, uint64_t> > &keys,
+                     Callback<GetValue> &cb, size_t &loaded, size_t &error);
+
     EventuallyPersistentEngine *engine;
 
 };
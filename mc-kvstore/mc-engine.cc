@@ -1274,6 +1274,22 @@ void MemcachedEngine::snapshotVBuckets(const vbucket_map_t &m, Callback<bool> &c
 }
 
 void MemcachedEngine::delVBucket(uint16_t vb, Callback<bool> &cb) {
+    sendDelVBucket(vb, cb);
+    wait();
+}
+
+void MemcachedEngine::delVBuckets(const std::vector<uint16_t> &vbs,
+                                  std::vector<Callback<bool>*> &cbs) {
+    assert(vbs.size() == cbs.size());
+    // Pipeline all the requests and wait for the responses together,
+    // rather than paying one round trip per vbucket.
+    for (size_t i = 0; i < vbs.size(); ++i) {
+        sendDelVBucket(vbs[i], *cbs[i]);
+    }
+    wait();
+}
+
+void MemcachedEngine::sendDelVBucket(uint16_t vb, Callback<bool> &cb) {
     protocol_binary_request_del_vbucket req;
     memset(req.bytes, 0, sizeof(req.bytes));
     req.message.header.request.magic = PROTOCOL_BINARY_REQ;
@@ -1286,7 +1302,6 @@ void MemcachedEngine::delVBucket(uint16_t vb, Callback<bool> &cb) {
     sendIov[0].iov_len = sizeof(req.bytes);
     numiovec = 1;
     sendCommand(new DelVBucketResponseHandler(seqno++, epStats, cb));
-    wait();
 }
 
 void MemcachedEngine::flush(Callback<bool> &cb) {
@@ -1430,6 +1445,42 @@ void MemcachedEngine::notify_update(uint16_t vbucket,
                                     uint32_t state,
                                     uint64_t checkpoint,
                                     Callback<uint16_t> &cb)
+{
+    sendNotifyUpdate(vbucket, file_version, header_offset,
+                     vbucket_state_updated, state, checkpoint, cb);
+    // Wait for response!!
+    wait();
+}
+
+void MemcachedEngine::notify_headerpos_update_nowait(uint16_t vbucket,
+                                                     uint64_t file_version,
+                                                     uint64_t header_offset,
+                                                     Callback<uint16_t> &cb)
+{
+    sendNotifyUpdate(vbucket, file_version, header_offset, false, 0, 0, cb);
+}
+
+bool MemcachedEngine::read_notifications()
+{
+    if (!connected) {
+        return false;
+    }
+    maybeProcessInput();
+    return !responseHandler.empty();
+}
+
+void MemcachedEngine::wait_for_notifications()
+{
+    wait();
+}
+
+void MemcachedEngine::sendNotifyUpdate(uint16_t vbucket,
+                                       uint64_t file_version,
+                                       uint64_t header_offset,
+                                       bool vbucket_state_updated,
+                                       uint32_t state,
+                                       uint64_t checkpoint,
+                                       Callback<uint16_t> &cb)
 {
     protocol_binary_request_notify_vbucket_update req;
     memset(req.bytes, 0, sizeof(req.bytes));
@@ -1452,8 +1503,6 @@ void MemcachedEngine::notify_update(uint16_t vbucket,
     numiovec = 1;
 
     sendCommand(new NotifyVbucketUpdateResponseHandler(seqno++, epStats, cb));
-    // Wait for response!!
-    wait();
 }
 
 void MemcachedEngine::setVBucketBatchCount(size_t batch_count, Callback<bool> *cb) {
@@ -101,6 +101,10 @@ public:
     void setVBucket(uint16_t vb, vbucket_state_t state, Callback<bool> &cb);
     void delVBucket(uint16_t vb, Callback<bool> &cb);
 
+    // Delete a bunch of vbuckets, pipelining the requests
+    void delVBuckets(const std::vector<uint16_t> &vbs,
+                     std::vector<Callback<bool>*> &cbs);
+
     // Set a bunch of vbuckets in a single operation
     void snapshotVBuckets(const vbucket_map_t &m, Callback<bool> &cb);
 
@@ -127,6 +131,22 @@ public:
                       false, 0, 0, cb);
     }
 
+    // Send a header position update without waiting for the reply.
+    // The callback is fired as the reply is read, at the latest by
+    // wait_for_notifications().
+    void notify_headerpos_update_nowait(uint16_t vbucket,
+                                        uint64_t file_version,
+                                        uint64_t header_offset,
+                                        Callback<uint16_t> &cb);
+
+    // Read the replies to the outstanding notifications that have
+    // already come in, without blocking.  Returns true while some are
+    // still outstanding.
+    bool read_notifications();
+
+    // Wait for the replies to all the outstanding notifications
+    void wait_for_notifications();
+
     void addStats(const std::string &prefix,
                   ADD_STAT add_stat,
                   const void *c);
@@ -141,6 +161,14 @@ private:
 
     void sendSingleChunk(const char *ptr, size_t nb);
     void sendCommand(BinaryPacketHandler *rh);
+    void sendDelVBucket(uint16_t vb, Callback<bool> &cb);
+    void sendNotifyUpdate(uint16_t vbucket,
+                          uint64_t file_version,
+                          uint64_t header_offset,
+                          bool vbucket_state_updated,
+                          uint32_t state,
+                          uint64_t checkpoint,
+                          Callback<uint16_t> &cb);
     void processInput();
     void maybeProcessInput();
     void wait();
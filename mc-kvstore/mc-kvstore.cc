@@ -87,6 +87,27 @@ bool MCKVStore::delVBucket(uint16_t vbucket, uint16_t) {
     return cb.val;
 }
 
+void MCKVStore::delVBuckets(const std::vector<std::pair<uint16_t, uint16_t> > &vbuckets,
+                            std::vector<bool> &results) {
+    std::vector<uint16_t> vbs;
+    std::vector<RememberingCallback<bool>*> rcbs;
+    std::vector<Callback<bool>*> cbs;
+    std::vector<std::pair<uint16_t, uint16_t> >::const_iterator it;
+    for (it = vbuckets.begin(); it != vbuckets.end(); ++it) {
+        vbs.push_back(it->first);
+        rcbs.push_back(new RememberingCallback<bool>());
+        cbs.push_back(rcbs.back());
+    }
+    mc->delVBuckets(vbs, cbs);
+
+    results.clear();
+    for (size_t i = 0; i < rcbs.size(); ++i) {
+        rcbs[i]->waitForValue();
+        results.push_back(rcbs[i]->val);
+        delete rcbs[i];
+    }
+}
+
 vbucket_map_t MCKVStore::listPersistedVbuckets() {
     RememberingCallback<std::map<std::string, std::string> > cb;
     mc->stats("vbucket", cb);
@@ -95,6 +95,12 @@ public:
     bool delVBucket(uint16_t vbucket, uint16_t vb_version,
                     std::pair<int64_t, int64_t> row_range);
 
+    /**
+     * Overrides delVBuckets() to pipeline the requests.
+     */
+    void delVBuckets(const std::vector<std::pair<uint16_t, uint16_t> > &vbuckets,
+                     std::vector<bool> &results);
+
     vbucket_map_t listPersistedVbuckets(void);
 
     void vbStateChanged(uint16_t vbucket, vbucket_state_t newState);
@@ -2,10 +2,12 @@
 
 #include "config.h"
 #include <algorithm>
+#include <deque>
 
 #include <sys/stat.h>
 
 #include "mutation_log.hh"
+#include "syncobject.hh"
 
 extern "C" {
 #include "crc32.h"
@@ -33,12 +35,34 @@ static inline int doClose(int fd) {
 
 static inline int doFsync(int fd) {
     int ret;
+#ifdef HAVE_FDATASYNC
+    // Only the data and the file size matter to a reader of the log.
+    while ((ret = fdatasync(fd)) == -1 && (errno == EINTR)) {
+#else
     while ((ret = fsync(fd)) == -1 && (errno == EINTR)) {
+#endif
         /* Retry */
     }
     return ret;
 }
 
+/**
+ * Allocate a zeroed buffer for whole log blocks, aligned well enough
+ * to be used for direct I/O.
+ */
+static uint8_t *allocateBlocks(size_t size) {
+#ifdef HAVE_POSIX_MEMALIGN
+    void *rv(NULL);
+    if (posix_memalign(&rv, LOG_DIRECT_IO_ALIGNMENT, size) != 0) {
+        return NULL;
+    }
+    memset(rv, 0, size);
+    return static_cast<uint8_t*>(rv);
+#else
+    return static_cast<uint8_t*>(calloc(size, 1));
+#endif
+}
+
 static void writeFully(int fd, const uint8_t *buf, size_t nbytes) {
     while (nbytes > 0) {
         ssize_t written = doWrite(fd, buf, nbytes);
@@ -56,17 +80,26 @@ uint64_t MutationLogEntry::rowid() const {
 MutationLog::MutationLog(const std::string &path,
                          const size_t bs)
     : paddingHisto(GrowingWidthGenerator<uint32_t>(0, 8, 1.5), 32),
+    groupCommitHisto(GrowingWidthGenerator<uint32_t>(1, 2, 1.5), 16),
     logPath(path),
     blockSize(bs),
     blockPos(HEADER_RESERVED),
     file(-1),
     entries(0),
-    entryBuffer(static_cast<uint8_t*>(calloc(MutationLogEntry::len(256), 1))),
-    blockBuffer(static_cast<uint8_t*>(calloc(bs, 1))),
+    blockBuffer(allocateBlocks(bs)),
     syncConfig(DEFAULT_SYNC_CONF),
-    readOnly(false)
+    readOnly(false),
+    directIO(false),
+    preallocSize(0),
+    allocatedSize(0),
+    groupCommitWindow(0),
+    bytesWritten(0),
+    syncedBytes(0),
+    syncTarget(0),
+    syncRequests(0),
+    syncGroup(0),
+    syncing(false)
 {
-    assert(entryBuffer);
     assert(blockBuffer);
     if (logPath == "") {
         file = DISABLED_FD;
@@ -76,7 +109,6 @@ MutationLog::MutationLog(const std::string &path,
 MutationLog::~MutationLog() {
     flush();
     close();
-    free(entryBuffer);
     free(blockBuffer);
 }
 
@@ -89,25 +121,19 @@ void MutationLog::disable() {
 
 void MutationLog::newItem(uint16_t vbucket, const std::string &key, uint64_t rowid) {
     if (isEnabled()) {
-        MutationLogEntry *mle = MutationLogEntry::newEntry(entryBuffer,
-                                                           rowid, ML_NEW, vbucket, key);
-        writeEntry(mle);
+        writeEntry(rowid, ML_NEW, vbucket, key);
     }
 }
 
 void MutationLog::delItem(uint16_t vbucket, const std::string &key) {
     if (isEnabled()) {
-        MutationLogEntry *mle = MutationLogEntry::newEntry(entryBuffer,
-                                                           0, ML_DEL, vbucket, key);
-        writeEntry(mle);
+        writeEntry(0, ML_DEL, vbucket, key);
     }
 }
 
 void MutationLog::deleteAll(uint16_t vbucket) {
     if (isEnabled()) {
-        MutationLogEntry *mle = MutationLogEntry::newEntry(entryBuffer,
-                                                           0, ML_DEL_ALL, vbucket, "");
-        writeEntry(mle);
+        writeEntry(0, ML_DEL_ALL, vbucket, "");
     }
 }
 
@@ -118,31 +144,78 @@ void MutationLog::sync() {
     assert(fsyncResult != -1);
 }
 
-void MutationLog::commit1() {
-    if (isEnabled()) {
-        MutationLogEntry *mle = MutationLogEntry::newEntry(entryBuffer,
-                                                           0, ML_COMMIT1, 0, "");
-        writeEntry(mle);
-        if ((getSyncConfig() & FLUSH_COMMIT_1) != 0) {
-            flush();
+void MutationLog::syncCommit() {
+    BlockTimer timer(&syncWaitHisto);
+    size_t target(bytesWritten);
+
+    LockHolder lh(syncState);
+    if (syncedBytes >= target) {
+        return;
+    }
+    if (syncing && syncTarget >= target) {
+        ++syncGroup;
+    } else {
+        ++syncRequests;
+    }
+    while (syncedBytes < target) {
+        if (syncing) {
+            syncState.wait();
+            continue;
         }
-        if ((getSyncConfig() & SYNC_COMMIT_1) != 0) {
-            sync();
+
+        // Lead a sync for everyone waiting, giving the commits under
+        // way a chance to get their blocks written first.
+        syncing = true;
+        if (groupCommitWindow > 0) {
+            syncState.wait(static_cast<double>(groupCommitWindow) / 1000000.0);
         }
+        syncTarget = bytesWritten;
+        syncGroup = syncRequests;
+        syncRequests = 0;
+        lh.unlock();
+
+        sync();
+
+        lh.lock();
+        syncedBytes = syncTarget;
+        groupCommitHisto.add(syncGroup);
+        syncTarget = 0;
+        syncing = false;
+        syncState.notify();
+    }
+}
+
+bool MutationLog::logCommit1() {
+    if (!isEnabled()) {
+        return false;
+    }
+    writeEntry(0, ML_COMMIT1, 0, "");
+    if ((getFlushConfig() & FLUSH_COMMIT_1) != 0) {
+        flush();
+    }
+    return (getSyncConfig() & SYNC_COMMIT_1) != 0;
+}
+
+bool MutationLog::logCommit2() {
+    if (!isEnabled()) {
+        return false;
+    }
+    writeEntry(0, ML_COMMIT2, 0, "");
+    if ((getFlushConfig() & FLUSH_COMMIT_2) != 0) {
+        flush();
+    }
+    return (getSyncConfig() & SYNC_COMMIT_2) != 0;
+}
+
+void MutationLog::commit1() {
+    if (logCommit1()) {
+        syncCommit();
     }
 }
 
 void MutationLog::commit2() {
-    if (isEnabled()) {
-        MutationLogEntry *mle = MutationLogEntry::newEntry(entryBuffer,
-                                                           0, ML_COMMIT2, 0, "");
-        writeEntry(mle);
-        if ((getSyncConfig() & FLUSH_COMMIT_2) != 0) {
-            flush();
-        }
-        if ((getSyncConfig() & SYNC_COMMIT_2) != 0) {
-            sync();
-        }
+    if (logCommit2()) {
+        syncCommit();
     }
 }
 
@@ -206,7 +279,49 @@ void MutationLog::prepareWrites() {
             throw ShortReadException();
         }
         logSize = static_cast<size_t>(lseek_result);
+        allocatedSize = logSize;
+    }
+}
+
+void MutationLog::setDirectIOFlag(bool on) {
+#ifdef O_DIRECT
+    int flags = fcntl(file, F_GETFL);
+    if (flags != -1) {
+        flags = on ? (flags | O_DIRECT) : (flags & ~O_DIRECT);
+        if (fcntl(file, F_SETFL, flags) == 0) {
+            return;
+        }
+    }
+    if (on) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Can't use direct I/O for the log \"%s\": %s\n",
+                         logPath.c_str(), strerror(errno));
+        directIO = false;
     }
+#else
+    (void)on;
+    directIO = false;
+#endif
+}
+
+void MutationLog::preallocate() {
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+    if (preallocSize == 0 || logSize + blockSize <= allocatedSize) {
+        return;
+    }
+    // The file size is left alone: readers take its end as the end of
+    // the log.
+    off_t from(std::max(allocatedSize, static_cast<size_t>(logSize)));
+    if (fallocate(file, FALLOC_FL_KEEP_SIZE, from, preallocSize) == 0) {
+        allocatedSize = from + preallocSize;
+    } else {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Can't preallocate space for the log \"%s\": %s "
+                         "(disabling preallocation)\n",
+                         logPath.c_str(), strerror(errno));
+        preallocSize = 0;
+    }
+#endif
 }
 
 static uint8_t parseConfigString(const std::string &s) {
@@ -287,6 +402,17 @@ void MutationLog::open(bool _readOnly) {
 
     prepareWrites();
     assert(isOpen());
+
+    if (directIO && !readOnly) {
+        if (blockSize % LOG_DIRECT_IO_ALIGNMENT == 0) {
+            setDirectIOFlag(true);
+        } else {
+            getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                             "Block size %d of the log \"%s\" doesn't allow "
+                             "direct I/O\n", blockSize, logPath.c_str());
+            directIO = false;
+        }
+    }
 }
 
 void MutationLog::close() {
@@ -294,9 +420,21 @@ void MutationLog::close() {
         return;
     }
 
+    // A sync under way must finish before the file goes, and none may
+    // start until it's reopened.
+    LockHolder lh(syncState);
+    while (syncing) {
+        syncState.wait();
+    }
+
     if (!readOnly) {
         flush();
         sync();
+        syncedBytes = bytesWritten;
+        if (directIO) {
+            // The header isn't written in whole aligned blocks.
+            setDirectIOFlag(false);
+        }
         headerBlock.setRdwr(0);
         updateInitialBlock();
     }
@@ -356,6 +494,39 @@ bool MutationLog::replaceWith(MutationLog &mlog) {
     return true;
 }
 
+size_t MutationLog::replay(MutationLog &mlog, size_t start, size_t stop) {
+    size_t rv(0);
+    if (start >= stop) {
+        return rv;
+    }
+
+    MutationLog::iterator it(mlog.range(start, stop));
+    for (; it != mlog.end(); ++it) {
+        const MutationLogEntry *le = *it;
+        switch (le->type()) {
+        case ML_NEW:
+            newItem(le->vbucket(), le->key(), le->rowid());
+            break;
+        case ML_DEL:
+            delItem(le->vbucket(), le->key());
+            break;
+        case ML_DEL_ALL:
+            deleteAll(le->vbucket());
+            break;
+        case ML_COMMIT1:
+            commit1();
+            break;
+        case ML_COMMIT2:
+            commit2();
+            break;
+        default:
+            abort();
+        }
+        ++rv;
+    }
+    return rv;
+}
+
 void MutationLog::flush() {
     if (isEnabled() && blockPos > HEADER_RESERVED) {
         assert(isOpen());
@@ -375,32 +546,34 @@ void MutationLog::flush() {
         uint16_t crc16(htons(crc32 & 0xffff));
         memcpy(blockBuffer, &crc16, sizeof(crc16));
 
+        preallocate();
         writeFully(file, blockBuffer, blockSize);
         logSize += blockSize;
+        bytesWritten += blockSize;
 
         blockPos = HEADER_RESERVED;
         entries = 0;
     }
 }
 
-void MutationLog::writeEntry(MutationLogEntry *mle) {
+void MutationLog::writeEntry(uint64_t rowid, mutation_log_type_t type,
+                             uint16_t vbucket, const std::string &key) {
     assert(isEnabled());
     assert(isOpen());
     needWriteAccess();
 
-    size_t len(mle->len());
+    size_t len(MutationLogEntry::len(key.length()));
     if (blockPos + len > blockSize) {
         flush();
     }
     assert(len < blockSize);
 
-    memcpy(blockBuffer + blockPos, mle, len);
+    // Built right where it goes in the block.
+    MutationLogEntry::newEntry(blockBuffer + blockPos, rowid, type, vbucket, key);
     blockPos += len;
     ++entries;
 
-    ++itemsLogged[mle->type()];
-
-    delete mle;
+    ++itemsLogged[type];
 }
 
 static const char* logType(uint8_t t) {
@@ -432,28 +605,56 @@ MutationLog::iterator::iterator(const MutationLog *l, bool e)
   : log(l),
     entryBuf(NULL),
     buf(NULL),
-    p(buf),
+    bufSize(0),
+    bufFill(0),
+    block(NULL),
+    p(NULL),
     offset(l->header().blockSize() * l->header().blockCount()),
+    limit(std::numeric_limits<off_t>::max()),
     items(0),
     isEnd(e)
 {
     assert(log);
 }
 
+MutationLog::iterator::iterator(const MutationLog *l, off_t start, off_t stop)
+  : log(l),
+    entryBuf(NULL),
+    buf(NULL),
+    bufSize(0),
+    bufFill(0),
+    block(NULL),
+    p(NULL),
+    offset(start),
+    limit(stop),
+    items(0),
+    isEnd(false)
+{
+    assert(log);
+    assert(start >= static_cast<off_t>(l->header().blockSize()
+                                       * l->header().blockCount()));
+    assert(start % l->header().blockSize() == 0);
+}
+
 MutationLog::iterator::iterator(const MutationLog::iterator& mit)
   : log(mit.log),
     entryBuf(NULL),
     buf(NULL),
+    bufSize(mit.bufSize),
+    bufFill(mit.bufFill),
+    block(NULL),
     p(NULL),
     offset(mit.offset),
+    limit(mit.limit),
     items(mit.items),
     isEnd(mit.isEnd)
 {
     assert(log);
     if (mit.buf != NULL) {
-        buf = static_cast<uint8_t*>(calloc(1, log->header().blockSize()));
+        buf = allocateBlocks(bufSize);
         assert(buf);
-        memcpy(buf, mit.buf, log->header().blockSize());
+        memcpy(buf, mit.buf, bufFill);
+        block = buf + (mit.block - mit.buf);
         p = buf + (mit.p - mit.buf);
     }
 
@@ -513,37 +714,68 @@ const MutationLogEntry* MutationLog::iterator::operator*() {
 }
 
 size_t MutationLog::iterator::bufferBytesRemaining() {
-    return log->header().blockSize() - (p - buf);
+    return log->header().blockSize() - (p - block);
 }
 
-void MutationLog::iterator::nextBlock() {
-    assert(!log->isEnabled() || log->isOpen());
+bool MutationLog::iterator::readAhead() {
+    if (!log->isOpen()) {
+        return false;
+    }
+    size_t bs(log->header().blockSize());
     if (buf == NULL) {
-        buf = static_cast<uint8_t*>(calloc(1, log->header().blockSize()));
+        bufSize = std::max(static_cast<size_t>(1), LOG_READ_AHEAD / bs) * bs;
+        buf = allocateBlocks(bufSize);
         assert(buf);
+#ifdef POSIX_FADV_SEQUENTIAL
+        (void)posix_fadvise(log->fd(), offset, 0, POSIX_FADV_SEQUENTIAL);
+#endif
     }
-    p = buf;
 
-    ssize_t bytesread = pread(log->fd(), buf, log->header().blockSize(), offset);
+    if (offset >= limit) {
+        return false;
+    }
+    size_t want(bufSize);
+    if (limit - offset < static_cast<off_t>(want)) {
+        want = static_cast<size_t>(limit - offset);
+    }
+
+    ssize_t bytesread = pread(log->fd(), buf, want, offset);
     if (bytesread < 1) {
-        isEnd = true;
-        return;
+        return false;
     }
-    if (bytesread != (ssize_t)(log->header().blockSize())) {
+    // Only whole blocks are served; a trailing partial block is read
+    // again (and reported) once everything before it was consumed.
+    if (static_cast<size_t>(bytesread) < bs) {
         throw ShortReadException();
     }
-    offset += bytesread;
+    bufFill = (static_cast<size_t>(bytesread) / bs) * bs;
+    offset += bufFill;
+    block = buf;
+    return true;
+}
 
-    uint32_t crc32(crc32buf(buf + 2, log->header().blockSize() - 2));
+void MutationLog::iterator::nextBlock() {
+    assert(!log->isEnabled() || log->isOpen());
+    size_t bs(log->header().blockSize());
+
+    if (block != NULL && block + bs < buf + bufFill) {
+        block += bs;
+    } else if (!readAhead()) {
+        isEnd = true;
+        return;
+    }
+    p = block;
+
+    uint32_t crc32(crc32buf(block + 2, bs - 2));
     uint16_t computed_crc16(crc32 & 0xffff);
     uint16_t retrieved_crc16;
-    memcpy(&retrieved_crc16, buf, sizeof(retrieved_crc16));
+    memcpy(&retrieved_crc16, block, sizeof(retrieved_crc16));
     retrieved_crc16 = ntohs(retrieved_crc16);
     if (computed_crc16 != retrieved_crc16) {
         throw CRCReadException();
     }
 
-    memcpy(&items, buf + 2, 2);
+    memcpy(&items, block + 2, 2);
     items = ntohs(items);
 
     p = p + 4;
@@ -625,18 +857,246 @@ bool MutationLogHarvester::load() {
     return clean;
 }
 
+// Committed entries are handed to the stream threads in batches of
+// about this many, with at most MAX_PENDING_BATCHES waiting per thread
+// so the reader can't run away with the memory.
+static const size_t STREAM_BATCH_SIZE(4096);
+static const size_t MAX_PENDING_BATCHES(4);
+
+extern "C" {
+    static void *harvestStreamMain(void *arg);
+}
+
+/**
+ * A thread applying the committed entries of the vbuckets assigned to
+ * it, on behalf of MutationLogHarvester::stream().
+ */
+class HarvestStream {
+public:
+    struct Entry {
+        std::string key;
+        uint64_t    rowid;
+        uint16_t    vbucket;
+        uint16_t    vbver;
+        uint8_t     type;
+    };
+
+    HarvestStream(void *a, mlCallback c, mlDelCallback d)
+        : arg(a), mlc(c), mld(d), done(false), running(false) {}
+
+    ~HarvestStream() {
+        finish();
+        while (!queue.empty()) {
+            delete queue.front();
+            queue.pop_front();
+        }
+    }
+
+    void start() {
+        if (pthread_create(&thread, NULL, harvestStreamMain, this) != 0) {
+            throw std::runtime_error("Failed to create a harvest stream thread");
+        }
+        running = true;
+    }
+
+    /**
+     * Queue up the given entries, leaving the vector empty.
+     */
+    void push(std::vector<Entry> &entries) {
+        std::vector<Entry> *batch = new std::vector<Entry>();
+        batch->swap(entries);
+        LockHolder lh(sync);
+        while (queue.size() >= MAX_PENDING_BATCHES) {
+            sync.wait();
+        }
+        queue.push_back(batch);
+        sync.notify();
+    }
+
+    /**
+     * Wait for every queued entry to be applied and stop the thread.
+     */
+    void finish() {
+        if (!running) {
+            return;
+        }
+        LockHolder lh(sync);
+        done = true;
+        sync.notify();
+        lh.unlock();
+        pthread_join(thread, NULL);
+        running = false;
+    }
+
+    void run() {
+        LockHolder lh(sync);
+        while (true) {
+            while (queue.empty() && !done) {
+                sync.wait();
+            }
+            if (queue.empty()) {
+                break;
+            }
+            std::vector<Entry> *batch = queue.front();
+            queue.pop_front();
+            sync.notify();
+            lh.unlock();
+
+            std::vector<Entry>::const_iterator it;
+            for (it = batch->begin(); it != batch->end(); ++it) {
+                switch (it->type) {
+                case ML_NEW:
+                    mlc(arg, it->vbucket, it->vbver, it->key, it->rowid);
+                    break;
+                case ML_DEL:
+                    // FALLTHROUGH
+                case ML_DEL_ALL:
+                    mld(arg, it->vbucket, it->key);
+                    break;
+                default:
+                    abort();
+                }
+            }
+            delete batch;
+            lh.lock();
+        }
+    }
+
+private:
+    void                            *arg;
+    mlCallback                       mlc;
+    mlDelCallback                    mld;
+    SyncObject                       sync;
+    std::deque<std::vector<Entry>*>  queue;
+    bool                             done;
+    bool                             running;
+    pthread_t                        thread;
+
+    DISALLOW_COPY_AND_ASSIGN(HarvestStream);
+};
+
+static void *harvestStreamMain(void *arg) {
+    static_cast<HarvestStream*>(arg)->run();
+    return NULL;
+}
+
+bool MutationLogHarvester::stream(void *arg, mlCallback mlc, mlDelCallback mld,
+                                  size_t numThreads) {
+    numThreads = std::max(static_cast<size_t>(1), numThreads);
+    std::vector<HarvestStream*> streams;
+    std::vector<std::vector<HarvestStream::Entry> > pending(numThreads);
+    for (size_t i = 0; i < numThreads; ++i) {
+        streams.push_back(new HarvestStream(arg, mlc, mld));
+    }
+
+    bool clean(false);
+    try {
+        std::vector<HarvestStream*>::iterator sit;
+        for (sit = streams.begin(); sit != streams.end(); ++sit) {
+            (*sit)->start();
+        }
+
+        std::set<uint16_t> shouldClear;
+        HarvestStream::Entry entry;
+        for (MutationLog::iterator it(mlog.begin()); it != mlog.end(); ++it) {
+            const MutationLogEntry *le = *it;
+            ++itemsSeen[le->type()];
+            clean = false;
+
+            switch (le->type()) {
+            case ML_DEL:
+                // FALLTHROUGH
+            case ML_NEW:
+                if (vbid_set.find(le->vbucket()) != vbid_set.end()) {
+                    loading[le->vbucket()][le->key()] = std::make_pair(le->rowid(), le->type());
+                }
+                break;
+            case ML_COMMIT2: {
+                clean = true;
+                std::set<uint16_t>::iterator vit;
+                for (vit = shouldClear.begin(); vit != shouldClear.end(); ++vit) {
+                    entry.key.clear();
+                    entry.rowid = 0;
+                    entry.vbucket = *vit;
+                    entry.vbver = vbids[*vit];
+                    entry.type = ML_DEL_ALL;
+                    pending[*vit % numThreads].push_back(entry);
+                }
+                shouldClear.clear();
+
+                unordered_map<uint16_t, unordered_map<std::string, mutation_log_event_t> >::iterator lit;
+                for (lit = loading.begin(); lit != loading.end(); ++lit) {
+                    std::vector<HarvestStream::Entry> &out = pending[lit->first % numThreads];
+                    unordered_map<std::string, mutation_log_event_t>::iterator eit;
+                    for (eit = lit->second.begin(); eit != lit->second.end(); ++eit) {
+                        entry.key = eit->first;
+                        entry.rowid = eit->second.first;
+                        entry.vbucket = lit->first;
+                        entry.vbver = vbids[lit->first];
+                        entry.type = eit->second.second;
+                        out.push_back(entry);
+                    }
+                }
+                loading.clear();
+
+                for (size_t i = 0; i < numThreads; ++i) {
+                    if (pending[i].size() >= STREAM_BATCH_SIZE) {
+                        streams[i]->push(pending[i]);
+                    }
+                }
+            }
+                break;
+            case ML_COMMIT1:
+                // nothing in particular
+                break;
+            case ML_DEL_ALL:
+                if (vbid_set.find(le->vbucket()) != vbid_set.end()) {
+                    loading[le->vbucket()].clear();
+                    shouldClear.insert(le->vbucket());
+                }
+                break;
+            default:
+                abort();
+            }
+        }
+
+        for (size_t i = 0; i < numThreads; ++i) {
+            if (!pending[i].empty()) {
+                streams[i]->push(pending[i]);
+            }
+        }
+    } catch (...) {
+        std::vector<HarvestStream*>::iterator sit;
+        for (sit = streams.begin(); sit != streams.end(); ++sit) {
+            delete *sit;
+        }
+        throw;
+    }
+
+    std::vector<HarvestStream*>::iterator sit;
+    for (sit = streams.begin(); sit != streams.end(); ++sit) {
+        delete *sit;
+    }
+    return clean;
+}
+
 void MutationLogHarvester::apply(void *arg, mlCallback mlc) {
     for (std::set<uint16_t>::const_iterator it = vbid_set.begin();
          it != vbid_set.end(); ++it) {
-        uint16_t vb(*it);
+        apply(arg, mlc, *it);
+    }
+}
 
-        for (unordered_map<std::string, uint64_t>::iterator it2 = committed[vb].begin();
-             it2 != committed[vb].end(); ++it2) {
-            const std::string key(it2->first);
-            uint64_t rowid(it2->second);
+void MutationLogHarvester::apply(void *arg, mlCallback mlc, uint16_t vb) {
+    if (vbid_set.find(vb) == vbid_set.end()) {
+        return;
+    }
+    for (unordered_map<std::string, uint64_t>::iterator it2 = committed[vb].begin();
+         it2 != committed[vb].end(); ++it2) {
+        const std::string key(it2->first);
+        uint64_t rowid(it2->second);
 
-            mlc(arg, vb, vbids[vb], key, rowid);
-        }
+        mlc(arg, vb, vbids[vb], key, rowid);
     }
 }
 
@@ -19,6 +19,7 @@
 #include "common.hh"
 #include "atomic.hh"
 #include "histo.hh"
+#include "syncobject.hh"
 
 #define ML_BUFLEN (128 * 1024 * 1024)
 
@@ -27,6 +28,8 @@ const uint8_t MUTATION_LOG_MAGIC(0x45);
 const size_t HEADER_RESERVED(4);
 const uint32_t LOG_VERSION(1);
 const size_t LOG_ENTRY_BUF_SIZE(512);
+const size_t LOG_READ_AHEAD(1024 * 1024);
+const size_t LOG_DIRECT_IO_ALIGNMENT(4096);
 const int DISABLED_FD(-3);
 
 const uint8_t SYNC_COMMIT_1(1);
@@ -231,6 +234,33 @@ public:
 
     void commit2();
 
+    /**
+     * Log the first half of a commit, flushing it if so configured,
+     * but leave syncing it to syncCommit().
+     *
+     * @return true if the commit needs a syncCommit()
+     */
+    bool logCommit1();
+
+    /**
+     * Log the second half of a commit, flushing it if so configured,
+     * but leave syncing it to syncCommit().
+     *
+     * @return true if the commit needs a syncCommit()
+     */
+    bool logCommit2();
+
+    /**
+     * Wait until everything written to the log so far is synced.
+     *
+     * Call this after logCommit1() or logCommit2() without holding the
+     * lock that serializes the log's writers, so that commits made
+     * meanwhile can share the sync: the first caller to find no sync
+     * under way waits out the group commit window, then syncs once on
+     * behalf of everyone who has joined.
+     */
+    void syncCommit();
+
     void flush();
 
     void sync();
@@ -265,6 +295,35 @@ public:
         return blockSize;
     }
 
+    /**
+     * Set how long (µs) a commit leading a sync waits for concurrent
+     * commits to share it.  0 syncs right away.
+     */
+    void setGroupCommitWindow(hrtime_t usecs) {
+        groupCommitWindow = usecs;
+    }
+
+    /**
+     * Write blocks bypassing the page cache.  Takes effect when the
+     * log is (re)opened, and only if the file system and block size
+     * allow it.
+     */
+    void setDirectIO(bool to) {
+        directIO = to;
+    }
+
+    bool isDirectIO() const {
+        return directIO;
+    }
+
+    /**
+     * Reserve disk space for the log this many bytes at a time, ahead
+     * of the writes.  0 disables preallocation.
+     */
+    void setPreallocSize(size_t size) {
+        preallocSize = size;
+    }
+
     bool exists() const;
 
     const std::string &getLogFile() const { return logPath; }
@@ -291,6 +350,20 @@ public:
      */
     bool replaceWith(MutationLog &mlog);
 
+    /**
+     * Append to this log the entries another log holds between two
+     * block aligned offsets of its file.
+     *
+     * Only blocks already flushed to the source file may be replayed;
+     * entries still buffered in the source aren't visible.
+     *
+     * @param mlog the log to read from
+     * @param start offset of the first block to replay
+     * @param stop offset past the last block to replay
+     * @return the number of entries appended
+     */
+    size_t replay(MutationLog &mlog, size_t start, size_t stop);
+
     bool setSyncConfig(const std::string &s);
     bool setFlushConfig(const std::string &s);
 
@@ -366,16 +439,22 @@ public:
         friend class MutationLog;
 
         iterator(const MutationLog *l, bool e=false);
+        iterator(const MutationLog *l, off_t start, off_t stop);
 
         void nextBlock();
+        bool readAhead();
         size_t bufferBytesRemaining();
         void prepItem();
 
         const MutationLog *log;
         uint8_t           *entryBuf;
         uint8_t           *buf;
+        size_t             bufSize;
+        size_t             bufFill;
+        uint8_t           *block;
         uint8_t           *p;
         off_t              offset;
+        off_t              limit;
         uint16_t           items;
         bool               isEnd;
     };
@@ -389,6 +468,17 @@ public:
         return it;
     }
 
+    /**
+     * An iterator over the blocks found between two block aligned
+     * offsets of the log file.
+     */
+    iterator range(size_t start, size_t stop) {
+        iterator it(iterator(this, static_cast<off_t>(start),
+                             static_cast<off_t>(stop)));
+        it.nextBlock();
+        return it;
+    }
+
     /**
      * An iterator pointing at the end of the log file.
      */
@@ -404,6 +494,10 @@ public:
     Histogram<hrtime_t> flushTimeHisto;
     //! Sync time histogram.
     Histogram<hrtime_t> syncTimeHisto;
+    //! Time commits waited for their data to be synced.
+    Histogram<hrtime_t> syncWaitHisto;
+    //! Number of commits covered by each sync.
+    Histogram<uint32_t> groupCommitHisto;
     //! Size of the log
     Atomic<size_t> logSize;
 
@@ -413,7 +507,10 @@ private:
             throw WriteException("Invalid access (file opened read only)");
         }
     }
-    void writeEntry(MutationLogEntry *mle);
+    void writeEntry(uint64_t rowid, mutation_log_type_t type,
+                    uint16_t vbucket, const std::string &key);
+    void preallocate();
+    void setDirectIOFlag(bool on);
 
     void writeInitialBlock();
     void readInitialBlock();
@@ -429,10 +526,27 @@ private:
     size_t             blockPos;
     int                file;
     uint16_t           entries;
-    uint8_t           *entryBuffer;
     uint8_t           *blockBuffer;
     uint8_t            syncConfig;
     bool               readOnly;
+    bool               directIO;
+    size_t             preallocSize;
+    size_t             allocatedSize;
+
+    // Group commit state.  Sync positions count every byte written
+    // since the log object was created, so they stay ordered across a
+    // reopen of the file.
+    hrtime_t           groupCommitWindow;
+    Atomic<size_t>     bytesWritten;
+    SyncObject         syncState;
+    size_t             syncedBytes;
+    // Position the sync under way covers, or 0 while it's gathering
+    size_t             syncTarget;
+    // Commits waiting for the next sync
+    uint32_t           syncRequests;
+    // Commits covered by the sync under way
+    uint32_t           syncGroup;
+    bool               syncing;
 
     DISALLOW_COPY_AND_ASSIGN(MutationLog);
 };
@@ -449,6 +563,13 @@ typedef std::pair<uint64_t, uint8_t> mutation_log_event_t;
  */
 typedef void (*mlCallback)(void*, uint16_t, uint16_t, const std::string &, uint64_t);
 
+/**
+ * MutationLogHarvester::stream callback type for committed removals.
+ *
+ * An empty key stands for every key of the vbucket.
+ */
+typedef void (*mlDelCallback)(void*, uint16_t, const std::string &);
+
 /**
  * Type for mutation log leftovers.
  */
@@ -492,6 +613,29 @@ public:
      */
     void apply(void *arg, mlCallback mlc);
 
+    /**
+     * Apply the processed log entries of a single vbucket through the
+     * given function.
+     */
+    void apply(void *arg, mlCallback mlc, uint16_t vb);
+
+    /**
+     * Load the entries from the file and apply each transaction as
+     * soon as its commit is read, instead of collecting the whole
+     * log for apply().
+     *
+     * The vbuckets are spread over a number of threads, so the
+     * callbacks run concurrently, but any given vbucket sees its
+     * entries in log order from a single thread.
+     *
+     * @param arg the argument given to the callbacks
+     * @param mlc called for every committed new item
+     * @param mld called for every committed deletion
+     * @param numThreads the number of threads applying entries
+     * @return true if the file was clean and can likely be trusted.
+     */
+    bool stream(void *arg, mlCallback mlc, mlDelCallback mld, size_t numThreads);
+
     /**
      * Get the total number of entries found in the log.
      */
@@ -3,6 +3,8 @@
 #include "config.h"
 #include "mutation_log_compactor.hh"
 #include "ep.hh"
+#include "ep_engine.h"
+#include "flusher.hh"
 
 /**
  * Visit all the items in memory and dump them into a new mutation log file.
@@ -52,6 +54,32 @@ private:
     size_t       totalItemsLogged;
 };
 
+/**
+ * Make sure the flusher is paused, so it won't touch the mutation log
+ * until resumed.  A running flusher is paused and waited for; one that
+ * is starting up, stopping or being paused by someone else can't be
+ * held off.
+ *
+ * @param mustResume set to true if we paused the flusher ourselves and
+ *                   have to resume it
+ * @return true if the flusher is paused
+ */
+static bool holdFlusher(EventuallyPersistentStore *store, bool &mustResume) {
+    const Flusher *flusher = store->getFlusher();
+    mustResume = false;
+    if (flusher->state() == paused) {
+        return true;
+    }
+    if (flusher->state() != running || !store->pauseFlusher()) {
+        return false;
+    }
+    if (flusher->waitWhile(pausing) != paused) {
+        return false;
+    }
+    mustResume = true;
+    return true;
+}
+
 bool MutationLogCompactor::callback(Dispatcher &d, TaskId t) {
     size_t num_new_items = mutationLog.itemsLogged[ML_NEW];
     size_t num_del_items = mutationLog.itemsLogged[ML_DEL];
@@ -63,7 +91,8 @@ bool MutationLogCompactor::callback(Dispatcher &d, TaskId t) {
     bool schedule_compactor =
         mutationLog.logSize > compactorConfig.getMaxLogSize() &&
         num_logged_items > (num_unique_items * compactorConfig.getMaxEntryRatio()) &&
-        queue_size < compactorConfig.getQueueCap();
+        queue_size < compactorConfig.getQueueCap() &&
+        !epStore->getEPEngine().isDegradedMode();
 
     if (schedule_compactor) {
         std::string compact_file = mutationLog.getLogFile() + ".compact";
@@ -76,16 +105,45 @@ bool MutationLogCompactor::callback(Dispatcher &d, TaskId t) {
         }
 
         BlockTimer timer(&stats.mlogCompactorHisto, "klogCompactorTime", stats.timingLog);
-        epStore->pauseFlusher();
+        hrtime_t start(gethrtime());
+        hrtime_t stallStart(0);
+        bool paused(false);
         try {
             MutationLog new_log(compact_file, mutationLog.getBlockSize());
             new_log.open();
             assert(new_log.isEnabled());
             new_log.setSyncConfig(mutationLog.getSyncConfig());
 
+            // The flusher keeps logging while the hash tables are
+            // dumped.  Whatever reaches the log file past this point
+            // is replayed on top of the dump, so it doesn't matter
+            // whether the walk saw those mutations or not.
+            size_t snapshot(mutationLog.logSize);
             LogCompactionVisitor compact_visitor(new_log, stats);
-            epStore->visit(compact_visitor); 
-            mutationLog.replaceWith(new_log);
+            epStore->visit(compact_visitor);
+
+            // Catch up with the blocks flushed during the walk first,
+            // so only a short tail is left to copy with the writers
+            // held off.
+            size_t caughtUp(mutationLog.logSize);
+            size_t replayed(new_log.replay(mutationLog, snapshot, caughtUp));
+
+            stallStart = gethrtime();
+            if (holdFlusher(epStore, paused)) {
+                LockHolder lh(epStore->mutationLogLock);
+                mutationLog.flush();
+                replayed += new_log.replay(mutationLog, caughtUp,
+                                           mutationLog.logSize);
+                mutationLog.replaceWith(new_log);
+                lh.unlock();
+                stats.mlogCompactorTailEntries.set(replayed);
+            } else {
+                // The flusher could still be committing, so the log
+                // can't be swapped now; the next run starts over.
+                getLogger()->log(EXTENSION_LOG_INFO, NULL,
+                                 "Mutation log compactor: Flusher is not "
+                                 "running, will retry later\n");
+            }
         } catch (MutationLog::ReadException e) {
             getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                              "Error in creating a new mutation log for compaction:  %s\n",
@@ -99,7 +157,15 @@ bool MutationLogCompactor::callback(Dispatcher &d, TaskId t) {
             mutationLog.disable();
             rv = false;
         }
-        epStore->resumeFlusher();
+        if (paused) {
+            epStore->resumeFlusher();
+        }
+
+        hrtime_t end(gethrtime());
+        hrtime_t stall(stallStart != 0 ? (end - stallStart) / 1000 : 0);
+        stats.mlogCompactorStallHisto.add(stall);
+        stats.mlogCompactorLastStall.set(stall);
+        stats.mlogCompactorLastTime.set((end - start) / 1000);
         ++stats.mlogCompactorRuns;
     }
 
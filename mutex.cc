@@ -16,8 +16,9 @@
  */
 #include "config.h"
 #include "mutex.hh"
+#include "atomic.hh"
 
-Mutex::Mutex() : held(false)
+Mutex::Mutex() : version(0), held(false), versioned(false)
 {
     pthread_mutexattr_t *attr = NULL;
     int e=0;
@@ -73,12 +74,20 @@ void Mutex::acquire() {
         abort();
     }
     setHolder(true);
+    if (versioned) {
+        // Full barrier: the bump must be visible before anything written
+        // under the lock.
+        ep_sync_add_and_fetch(&version, 1);
+    }
 
     EP_MUTEX_ACQUIRED(this);
 }
 
 void Mutex::release() {
     assert(held && pthread_equal(holder, pthread_self()));
+    if (versioned) {
+        ep_sync_add_and_fetch(&version, 1);
+    }
     setHolder(false);
     int e;
     if ((e = pthread_mutex_unlock(&mutex)) != 0) {
@@ -30,6 +30,23 @@ public:
         return held && pthread_equal(holder, pthread_self());
     }
 
+    /**
+     * Make this lock count its acquisitions and releases, so a reader
+     * that doesn't take it can tell whether it was held meanwhile: the
+     * version is odd while the lock is held and changes every time it
+     * is taken.
+     */
+    void setVersioned(bool to) {
+        versioned = to;
+    }
+
+    /**
+     * Get the current version of a versioned lock (see setVersioned()).
+     */
+    uint32_t getVersion() const {
+        return version;
+    }
+
 protected:
 
     // The holders of locks twiddle these flags.
@@ -46,7 +63,9 @@ protected:
 
     pthread_mutex_t mutex;
     pthread_t holder;
+    volatile uint32_t version;
     bool held;
+    bool versioned;
 
     DISALLOW_COPY_AND_ASSIGN(Mutex);
 };
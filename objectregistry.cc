@@ -107,11 +107,42 @@ void ObjectRegistry::onDeleteItem(Item *pItem)
    }
 }
 
+void ObjectRegistry::onCreateItemView(ItemView *view)
+{
+   EventuallyPersistentEngine *engine = th->get();
+   if (verifyEngine(engine)) {
+       EPStats &stats = engine->getEpStats();
+       stats.memOverhead.incr(view->getSize());
+       assert(stats.memOverhead.get() < GIGANTOR);
+   }
+}
+
+void ObjectRegistry::onDeleteItemView(ItemView *view)
+{
+   EventuallyPersistentEngine *engine = th->get();
+   if (verifyEngine(engine)) {
+       EPStats &stats = engine->getEpStats();
+       stats.memOverhead.decr(view->getSize());
+       assert(stats.memOverhead.get() < GIGANTOR);
+   }
+}
+
 void ObjectRegistry::onSwitchThread(EventuallyPersistentEngine *engine)
 {
    th->set(engine);
 }
 
+EventuallyPersistentEngine *ObjectRegistry::getCurrentEngine()
+{
+   return th->get();
+}
+
+SlabAllocator *ObjectRegistry::getSlabAllocator()
+{
+   EventuallyPersistentEngine *engine = th->get();
+   return engine ? engine->getEpStats().slabAllocator : NULL;
+}
+
 bool ObjectRegistry::memoryAllocated(size_t mem) {
    EventuallyPersistentEngine *engine = th->get();
    if (!engine) {
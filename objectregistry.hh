@@ -19,7 +19,10 @@
 
 class EventuallyPersistentEngine;
 class Blob;
+class Item;
+class ItemView;
 class QueuedItem;
+class SlabAllocator;
 
 class ObjectRegistry {
 public:
@@ -32,7 +35,17 @@ public:
     static void onCreateItem(Item *pItem);
     static void onDeleteItem(Item *pItem);
 
+    static void onCreateItemView(ItemView *view);
+    static void onDeleteItemView(ItemView *view);
+
     static void onSwitchThread(EventuallyPersistentEngine *engine);
+    static EventuallyPersistentEngine *getCurrentEngine();
+
+    /**
+     * Get the slab allocator of the current engine, or NULL if it
+     * allocates from the heap.
+     */
+    static SlabAllocator *getSlabAllocator();
 
     static bool memoryAllocated(size_t mem);
     static bool memoryDeallocated(size_t mem);
@@ -29,8 +29,9 @@ class QueuedItem : public RCValue {
 public:
     QueuedItem(const std::string &k, const uint16_t vb,
                enum queue_operation o, const uint16_t vb_version = -1,
-               const int64_t rid = -1, const uint32_t seqno = 1)
-        : key(k), rowId(rid), seqNum(seqno), queued(ep_current_time()),
+               const int64_t rid = -1, const uint32_t seqno = 1,
+               const uint64_t kh = 0)
+        : key(k), keyHash(kh), rowId(rid), seqNum(seqno), queued(ep_current_time()),
           op(o), vbucket(vb), vbucketVersion(vb_version)
     {
         ObjectRegistry::onCreateQueuedItem(this);
@@ -41,6 +42,18 @@ public:
     }
 
     const std::string &getKey(void) const { return key; }
+
+    /**
+     * Get the hash of the key, either handed over from the Item this
+     * was queued for or computed on first use.
+     */
+    uint64_t getKeyHash(void) const {
+        if (keyHash == 0) {
+            keyHash = hashKey(key);
+        }
+        return keyHash;
+    }
+
     uint16_t getVBucketId(void) const { return vbucket; }
     uint16_t getVBucketVersion(void) const { return vbucketVersion; }
     uint32_t getQueuedTime(void) const { return queued; }
@@ -67,6 +80,7 @@ public:
 
 private:
     std::string key;
+    mutable uint64_t keyHash;
     int64_t  rowId;
     uint32_t seqNum;
     uint32_t queued;
@@ -60,6 +60,13 @@ static void display(const char *name, const Histogram<T> &histo) {
     std::for_each(histo.begin(), histo.end(), histo_for_inner<T>());
 }
 
+template <typename T>
+static void display(const char *name, const LogLinearHistogram<T> &) {
+    std::cout << name << std::endl;
+    std::cout << "   " << LogLinearHistogram<T>::NUM_BINS << " log-linear bins"
+              << std::endl;
+}
+
 int main(int, char **) {
     std::string s();
 
@@ -87,6 +94,7 @@ int main(int, char **) {
     display("HistogramBin<size_t>", sizeof(HistogramBin<size_t>));
     display("HistogramBin<hrtime_t>", sizeof(HistogramBin<hrtime_t>));
     display("HistogramBin<int>", sizeof(HistogramBin<int>));
+    display("LogLinearHistogram<hrtime_t>", sizeof(LogLinearHistogram<hrtime_t>));
 
     std::cout << std::endl << "Histogram Ranges" << std::endl << std::endl;
 
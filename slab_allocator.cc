@@ -0,0 +1,493 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+
+#include "locks.hh"
+#include "objectregistry.hh"
+#include "slab_allocator.hh"
+#include "statwriter.hh"
+
+// Every slab starts with a header linking it into its size class,
+// padded so the chunks following it stay cache line aligned.
+static const size_t SLAB_HEADER_SIZE = 64;
+
+struct SlabAllocator::Slab {
+    SlabAllocator *allocator;
+    //! The block to hand back to free().
+    void          *block;
+    Slab          *prev;
+    Slab          *next;
+    FreeChunk     *freeList;
+    uint32_t       classId;
+    uint32_t       numFree;
+};
+
+// Chunks released by a thread are kept in its cache up to roughly this
+// many bytes per size class before going back to their slabs.
+static const size_t THREAD_CACHE_BYTES = 64 * 1024;
+static const size_t MAX_THREAD_CACHE_CHUNKS = 64;
+
+// Empty slabs kept per size class rather than returned to the system.
+static const size_t MAX_EMPTY_SLABS = 1;
+
+// The page map records which SLAB_SIZE aligned regions of the address
+// space are slabs, so deallocate() can tell our chunks from heap
+// memory without touching them.  It is a two level radix tree over the
+// (at most 48 bit) address space; leaves are created on demand and
+// kept once created.
+//
+// Updates are made under pageMapMutex, but owns() sits on every
+// deallocate() and reads the map without it.  A leaf is therefore only
+// published once its zeroed contents are visible, so a lock-free reader
+// sees either no leaf or a valid one.  A slab's own entry is set before
+// any of its chunks is handed out, and the chunk reaching the reader
+// orders the two.
+static const size_t ADDRESS_BITS = sizeof(void*) * 8 > 48 ? 48 : sizeof(void*) * 8;
+static const size_t INDEX_BITS = ADDRESS_BITS - SlabAllocator::SLAB_SHIFT;
+static const size_t LEAF_BITS = 12;
+static const size_t ROOT_BITS = INDEX_BITS - LEAF_BITS;
+static const uintptr_t LEAF_MASK = (1 << LEAF_BITS) - 1;
+
+static volatile uint8_t * volatile pageMap[1 << ROOT_BITS];
+static Mutex pageMapMutex;
+
+static bool registerSlab(void *slab) {
+    uintptr_t idx = reinterpret_cast<uintptr_t>(slab) >> SlabAllocator::SLAB_SHIFT;
+    if ((idx >> INDEX_BITS) != 0) {
+        return false;
+    }
+    LockHolder lh(pageMapMutex);
+    volatile uint8_t *leaf = pageMap[idx >> LEAF_BITS];
+    if (leaf == NULL) {
+        leaf = static_cast<uint8_t*>(calloc(1 << LEAF_BITS, sizeof(uint8_t)));
+        if (leaf == NULL) {
+            return false;
+        }
+        ep_sync_synchronize();
+        pageMap[idx >> LEAF_BITS] = leaf;
+    }
+    leaf[idx & LEAF_MASK] = 1;
+    return true;
+}
+
+static void unregisterSlab(void *slab) {
+    uintptr_t idx = reinterpret_cast<uintptr_t>(slab) >> SlabAllocator::SLAB_SHIFT;
+    LockHolder lh(pageMapMutex);
+    volatile uint8_t *leaf = pageMap[idx >> LEAF_BITS];
+    assert(leaf != NULL);
+    leaf[idx & LEAF_MASK] = 0;
+}
+
+static uintptr_t slabBase(const void *p) {
+    return reinterpret_cast<uintptr_t>(p)
+        & ~(static_cast<uintptr_t>(SlabAllocator::SLAB_SIZE) - 1);
+}
+
+/**
+ * Makes the calling thread account its allocations to the given engine
+ * for as long as it lives, so carving or freeing a slab is charged to
+ * the bucket owning it whichever bucket the thread is serving.
+ */
+class AccountTo {
+public:
+    AccountTo(EventuallyPersistentEngine *engine)
+        : previous(ObjectRegistry::getCurrentEngine()) {
+        ObjectRegistry::onSwitchThread(engine);
+    }
+
+    ~AccountTo() {
+        ObjectRegistry::onSwitchThread(previous);
+    }
+
+private:
+    EventuallyPersistentEngine *previous;
+};
+
+extern "C" {
+    void destroy_slab_thread_cache(void *p) {
+        SlabAllocator::ThreadCache *tc = static_cast<SlabAllocator::ThreadCache*>(p);
+        tc->allocator->destroyThreadCache(tc);
+    }
+}
+
+void *SlabAllocator::allocate(size_t size) {
+    SlabAllocator *sa = ObjectRegistry::getSlabAllocator();
+    if (sa != NULL) {
+        return sa->allocateChunk(size);
+    }
+    return ::operator new(size);
+}
+
+void SlabAllocator::deallocate(void *p) {
+    if (owns(p)) {
+        reinterpret_cast<Slab*>(slabBase(p))->allocator->releaseChunk(p);
+    } else {
+        ::operator delete(p);
+    }
+}
+
+bool SlabAllocator::owns(const void *p) {
+    uintptr_t idx = reinterpret_cast<uintptr_t>(p) >> SLAB_SHIFT;
+    if ((idx >> INDEX_BITS) != 0) {
+        return false;
+    }
+    volatile uint8_t *leaf = pageMap[idx >> LEAF_BITS];
+    return leaf != NULL && leaf[idx & LEAF_MASK] != 0;
+}
+
+SlabAllocator::SlabAllocator(EventuallyPersistentEngine *e) :
+    owner(e), numClasses(0),
+    threadCache(new ThreadLocal<ThreadCache*>(destroy_slab_thread_cache)) {
+    // Size classes grow by 25%, in multiples of the pointer alignment.
+    size_t size = MIN_CHUNK_SIZE;
+    while (numClasses < MAX_CLASSES) {
+        SlabClass &sc = classes[numClasses++];
+        sc.chunkSize = size;
+        sc.perSlab = (SLAB_SIZE - SLAB_HEADER_SIZE) / size;
+        sc.cacheSize = std::max(static_cast<size_t>(2),
+                                std::min(MAX_THREAD_CACHE_CHUNKS,
+                                         THREAD_CACHE_BYTES / size));
+        if (size >= MAX_CHUNK_SIZE) {
+            break;
+        }
+        size_t next = (size + size / 4 + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+        size = std::min(next, MAX_CHUNK_SIZE);
+    }
+    assert(classes[numClasses - 1].chunkSize == MAX_CHUNK_SIZE);
+    assert(sizeof(Slab) <= SLAB_HEADER_SIZE);
+}
+
+SlabAllocator::~SlabAllocator() {
+    assert(getUsedBytes() == 0);
+    // The other threads' slots still point at their caches, so the key
+    // goes first: once deleted no exiting thread can run
+    // destroy_slab_thread_cache() on a cache freed below.
+    threadCache->set(NULL);
+    delete threadCache;
+    threadCache = NULL;
+
+    // No thread uses this allocator any more, so the chunks cached by
+    // every thread can go back to their slabs, leaving them all empty.
+    LockHolder lh(cachesMutex);
+    std::list<ThreadCache*>::iterator it;
+    for (it = caches.begin(); it != caches.end(); ++it) {
+        for (size_t i = 0; i < numClasses; ++i) {
+            drain(static_cast<int>(i), (*it)->lists[i], (*it)->lists[i].count);
+        }
+        delete *it;
+    }
+    caches.clear();
+    lh.unlock();
+
+    for (size_t i = 0; i < numClasses; ++i) {
+        SlabClass &sc = classes[i];
+        while (sc.partial != NULL) {
+            Slab *slab = sc.partial;
+            sc.partial = slab->next;
+            freeSlab(slab);
+        }
+    }
+}
+
+bool SlabAllocator::destroy(SlabAllocator *sa) {
+    if (sa == NULL) {
+        return false;
+    }
+    size_t used = sa->getUsedBytes();
+    if (used != 0) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Leaking the slab allocator: %llu bytes are still in use\n",
+                         static_cast<unsigned long long>(used));
+        return false;
+    }
+    delete sa;
+    return true;
+}
+
+int SlabAllocator::getClassId(size_t size) const {
+    if (size > MAX_CHUNK_SIZE) {
+        return -1;
+    }
+    size_t lo(0), hi(numClasses - 1);
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (classes[mid].chunkSize < size) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return static_cast<int>(lo);
+}
+
+size_t SlabAllocator::getChunkSize(size_t size) const {
+    int id = getClassId(size);
+    return id < 0 ? 0 : classes[id].chunkSize;
+}
+
+SlabAllocator::ThreadCache *SlabAllocator::getThreadCache() {
+    ThreadCache *tc = threadCache->get();
+    if (tc == NULL) {
+        tc = new ThreadCache();
+        tc->allocator = this;
+        threadCache->set(tc);
+        LockHolder lh(cachesMutex);
+        caches.push_back(tc);
+    }
+    return tc;
+}
+
+void SlabAllocator::destroyThreadCache(ThreadCache *tc) {
+    for (size_t i = 0; i < numClasses; ++i) {
+        drain(static_cast<int>(i), tc->lists[i], tc->lists[i].count);
+    }
+    LockHolder lh(cachesMutex);
+    caches.remove(tc);
+    lh.unlock();
+    delete tc;
+}
+
+void *SlabAllocator::allocateChunk(size_t size) {
+    int id = getClassId(size);
+    if (id < 0) {
+        return ::operator new(size);
+    }
+
+    FreeList &fl = getThreadCache()->lists[id];
+    if (fl.head == NULL && !refill(id, fl)) {
+        return ::operator new(size);
+    }
+    FreeChunk *chunk = fl.head;
+    fl.head = chunk->next;
+    --fl.count;
+    ++classes[id].used;
+    return chunk;
+}
+
+void SlabAllocator::releaseChunk(void *p) {
+    assert(owns(p));
+    Slab *slab = reinterpret_cast<Slab*>(slabBase(p));
+    assert(slab->allocator == this);
+    int id = static_cast<int>(slab->classId);
+    SlabClass &sc = classes[id];
+
+    FreeList &fl = getThreadCache()->lists[id];
+    FreeChunk *chunk = static_cast<FreeChunk*>(p);
+    chunk->next = fl.head;
+    fl.head = chunk;
+    ++fl.count;
+    --sc.used;
+
+    if (fl.count > sc.cacheSize) {
+        drain(id, fl, fl.count - sc.cacheSize / 2);
+    }
+}
+
+void SlabAllocator::flushThreadCache() {
+    ThreadCache *tc = threadCache->get();
+    if (tc != NULL) {
+        for (size_t i = 0; i < numClasses; ++i) {
+            drain(static_cast<int>(i), tc->lists[i], tc->lists[i].count);
+        }
+    }
+}
+
+bool SlabAllocator::refill(int id, FreeList &fl) {
+    SlabClass &sc = classes[id];
+    LockHolder lh(sc.mutex);
+    if (sc.partial == NULL && !grow(sc, id)) {
+        return false;
+    }
+
+    size_t batch = std::max(static_cast<size_t>(1), sc.cacheSize / 2);
+    while (batch > 0 && sc.partial != NULL) {
+        Slab *slab = sc.partial;
+        if (slab->numFree == sc.perSlab) {
+            --sc.numEmpty;
+        }
+        while (batch > 0 && slab->freeList != NULL) {
+            FreeChunk *chunk = slab->freeList;
+            slab->freeList = chunk->next;
+            --slab->numFree;
+            --sc.numFree;
+            chunk->next = fl.head;
+            fl.head = chunk;
+            ++fl.count;
+            --batch;
+        }
+        if (slab->freeList == NULL) {
+            // Full: it goes back on the list when a chunk comes back.
+            sc.partial = slab->next;
+            if (sc.partial != NULL) {
+                sc.partial->prev = NULL;
+            }
+            slab->next = NULL;
+        }
+    }
+    return true;
+}
+
+void SlabAllocator::drain(int id, FreeList &fl, size_t n) {
+    if (n == 0) {
+        return;
+    }
+    SlabClass &sc = classes[id];
+    std::list<Slab*> emptied;
+    LockHolder lh(sc.mutex);
+    while (n > 0 && fl.head != NULL) {
+        FreeChunk *chunk = fl.head;
+        fl.head = chunk->next;
+        --fl.count;
+        --n;
+
+        Slab *slab = reinterpret_cast<Slab*>(slabBase(chunk));
+        if (slab->freeList == NULL) {
+            slab->prev = NULL;
+            slab->next = sc.partial;
+            if (sc.partial != NULL) {
+                sc.partial->prev = slab;
+            }
+            sc.partial = slab;
+        }
+        chunk->next = slab->freeList;
+        slab->freeList = chunk;
+        ++slab->numFree;
+        ++sc.numFree;
+
+        if (slab->numFree == sc.perSlab && ++sc.numEmpty > MAX_EMPTY_SLABS) {
+            if (slab->prev != NULL) {
+                slab->prev->next = slab->next;
+            } else {
+                sc.partial = slab->next;
+            }
+            if (slab->next != NULL) {
+                slab->next->prev = slab->prev;
+            }
+            --sc.numEmpty;
+            --sc.numSlabs;
+            sc.numFree -= sc.perSlab;
+            emptied.push_back(slab);
+        }
+    }
+    lh.unlock();
+
+    std::list<Slab*>::iterator it;
+    for (it = emptied.begin(); it != emptied.end(); ++it) {
+        freeSlab(*it);
+    }
+}
+
+void *SlabAllocator::allocateSlab() {
+    AccountTo accountTo(owner);
+#ifdef HAVE_POSIX_MEMALIGN
+    void *slab(NULL);
+    if (posix_memalign(&slab, SLAB_SIZE, SLAB_SIZE) != 0) {
+        return NULL;
+    }
+    reinterpret_cast<Slab*>(slab)->block = slab;
+    return slab;
+#else
+    char *block = static_cast<char*>(malloc(2 * SLAB_SIZE));
+    if (block == NULL) {
+        return NULL;
+    }
+    void *slab = reinterpret_cast<void*>(slabBase(block + SLAB_SIZE - 1));
+    reinterpret_cast<Slab*>(slab)->block = block;
+    return slab;
+#endif
+}
+
+void SlabAllocator::freeSlab(Slab *slab) {
+    unregisterSlab(slab);
+    reservedBytes.decr(SLAB_SIZE);
+    AccountTo accountTo(owner);
+    free(slab->block);
+}
+
+bool SlabAllocator::grow(SlabClass &sc, int id) {
+    char *mem = static_cast<char*>(allocateSlab());
+    if (mem == NULL) {
+        return false;
+    }
+    Slab *slab = reinterpret_cast<Slab*>(mem);
+    if (!registerSlab(slab)) {
+        AccountTo accountTo(owner);
+        free(slab->block);
+        return false;
+    }
+
+    slab->allocator = this;
+    slab->classId = static_cast<uint32_t>(id);
+    slab->freeList = NULL;
+    char *chunks = mem + SLAB_HEADER_SIZE;
+    for (size_t i = sc.perSlab; i > 0; --i) {
+        FreeChunk *chunk = reinterpret_cast<FreeChunk*>(chunks + (i - 1) * sc.chunkSize);
+        chunk->next = slab->freeList;
+        slab->freeList = chunk;
+    }
+    slab->numFree = static_cast<uint32_t>(sc.perSlab);
+    slab->prev = NULL;
+    slab->next = sc.partial;
+    if (sc.partial != NULL) {
+        sc.partial->prev = slab;
+    }
+    sc.partial = slab;
+    sc.numFree += sc.perSlab;
+    ++sc.numSlabs;
+    ++sc.numEmpty;
+    reservedBytes.incr(SLAB_SIZE);
+    return true;
+}
+
+size_t SlabAllocator::getUsedBytes() const {
+    size_t rv(0);
+    for (size_t i = 0; i < numClasses; ++i) {
+        rv += classes[i].used.get() * classes[i].chunkSize;
+    }
+    return rv;
+}
+
+void SlabAllocator::addStats(ADD_STAT add_stat, const void *cookie) {
+    char buf[64];
+    for (size_t i = 0; i < numClasses; ++i) {
+        SlabClass &sc = classes[i];
+        LockHolder lh(sc.mutex);
+        if (sc.numSlabs == 0) {
+            continue;
+        }
+        size_t numSlabs(sc.numSlabs), numFree(sc.numFree), numEmpty(sc.numEmpty);
+        lh.unlock();
+
+        snprintf(buf, sizeof(buf), "slab_%d:chunk_size", static_cast<int>(i));
+        add_casted_stat(buf, sc.chunkSize, add_stat, cookie);
+        snprintf(buf, sizeof(buf), "slab_%d:slabs", static_cast<int>(i));
+        add_casted_stat(buf, numSlabs, add_stat, cookie);
+        snprintf(buf, sizeof(buf), "slab_%d:empty_slabs", static_cast<int>(i));
+        add_casted_stat(buf, numEmpty, add_stat, cookie);
+        snprintf(buf, sizeof(buf), "slab_%d:total_chunks", static_cast<int>(i));
+        add_casted_stat(buf, numSlabs * sc.perSlab, add_stat, cookie);
+        snprintf(buf, sizeof(buf), "slab_%d:used_chunks", static_cast<int>(i));
+        add_casted_stat(buf, sc.used, add_stat, cookie);
+        snprintf(buf, sizeof(buf), "slab_%d:free_chunks", static_cast<int>(i));
+        add_casted_stat(buf, numFree, add_stat, cookie);
+    }
+}
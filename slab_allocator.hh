@@ -0,0 +1,209 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#ifndef SLAB_ALLOCATOR_HH
+#define SLAB_ALLOCATOR_HH 1
+
+#include "config.h"
+
+#include <list>
+#include <memcached/engine.h>
+
+#include "common.hh"
+#include "atomic.hh"
+#include "mutex.hh"
+
+class EventuallyPersistentEngine;
+
+extern "C" {
+    void destroy_slab_thread_cache(void *p);
+}
+
+/**
+ * A size class slab allocator for the small, variable length objects
+ * the hash tables are made of (StoredValue and Blob instances).
+ *
+ * Each engine with slab allocation enabled owns its own allocator
+ * (EPStats::slabAllocator), so slabs are charged to, and only ever
+ * reused by, the bucket that carved them.  Memory is carved out of
+ * aligned slabs of SLAB_SIZE bytes, each slab being dedicated to a
+ * single size class and keeping its own free list.  A slab whose
+ * chunks have all come back is returned to the system, keeping at most
+ * one empty slab per class around to absorb churn.  Every thread keeps
+ * a small cache of free chunks per class so the common allocation and
+ * release paths don't take any lock.
+ *
+ * Requests larger than the biggest size class, or made on behalf of an
+ * engine without an allocator, are served by the regular heap.
+ * deallocate() tells the two apart by looking the chunk's slab up in a
+ * page map, and hands slab chunks back to the allocator that owns them.
+ */
+class SlabAllocator {
+public:
+
+    //! log2 of the slab size.
+    static const size_t SLAB_SHIFT = 20;
+    //! The size of a slab (and its alignment).
+    static const size_t SLAB_SIZE = 1 << SLAB_SHIFT;
+    //! The smallest chunk handed out.
+    static const size_t MIN_CHUNK_SIZE = 32;
+    //! The largest chunk handed out; anything bigger comes from the heap.
+    static const size_t MAX_CHUNK_SIZE = SLAB_SIZE / 16;
+    //! Upper bound on the number of size classes.
+    static const size_t MAX_CLASSES = 64;
+
+    /**
+     * Create an allocator whose slabs are accounted to the given engine.
+     */
+    SlabAllocator(EventuallyPersistentEngine *owner);
+
+    /**
+     * Return all the slabs to the system.  No chunk may be in use, and
+     * no other thread may be using the allocator; see destroy().
+     */
+    ~SlabAllocator();
+
+    /**
+     * Delete the given allocator if none of its chunks are in use.
+     *
+     * A chunk still handed out must find its allocator when it's
+     * released, so an allocator with chunks in use is leaked (and
+     * logged) rather than freed under them.
+     *
+     * @return true if the allocator was deleted
+     */
+    static bool destroy(SlabAllocator *sa);
+
+    /**
+     * Allocate memory for an object of the given size, from the slabs
+     * of the current engine's allocator if it has one.
+     */
+    static void *allocate(size_t size);
+
+    /**
+     * Release memory obtained from allocate().
+     */
+    static void deallocate(void *p);
+
+    /**
+     * True if the given pointer lives in one of the slabs.
+     */
+    static bool owns(const void *p);
+
+    /**
+     * Allocate a chunk of at least the given size.
+     */
+    void *allocateChunk(size_t size);
+
+    /**
+     * Return a chunk to the allocator.
+     */
+    void releaseChunk(void *p);
+
+    /**
+     * Get the size of the chunk that would hold an object of the given
+     * size, or 0 if it would come from the heap.
+     */
+    size_t getChunkSize(size_t size) const;
+
+    /**
+     * Give all the chunks cached by the calling thread back to their
+     * slabs.
+     */
+    void flushThreadCache();
+
+    /**
+     * The number of bytes held in slabs.
+     */
+    size_t getReservedBytes() const {
+        return reservedBytes.get();
+    }
+
+    /**
+     * The number of bytes in chunks currently handed out.
+     */
+    size_t getUsedBytes() const;
+
+    /**
+     * The number of slabs currently held.
+     */
+    size_t getNumSlabs() const {
+        return reservedBytes.get() / SLAB_SIZE;
+    }
+
+    /**
+     * Add the per size class stats.
+     */
+    void addStats(ADD_STAT add_stat, const void *cookie);
+
+private:
+
+    struct FreeChunk {
+        FreeChunk *next;
+    };
+
+    struct FreeList {
+        FreeChunk *head;
+        size_t     count;
+    };
+
+    struct ThreadCache {
+        SlabAllocator *allocator;
+        FreeList       lists[MAX_CLASSES];
+    };
+
+    struct Slab;
+
+    class SlabClass {
+    public:
+        SlabClass() : chunkSize(0), perSlab(0), cacheSize(0), partial(NULL),
+                      numFree(0), numSlabs(0), numEmpty(0) {}
+
+        size_t         chunkSize;
+        size_t         perSlab;
+        size_t         cacheSize;
+        Mutex          mutex;
+        //! Slabs with at least one free chunk.
+        Slab          *partial;
+        size_t         numFree;
+        size_t         numSlabs;
+        size_t         numEmpty;
+        Atomic<size_t> used;
+    };
+
+    int getClassId(size_t size) const;
+    ThreadCache *getThreadCache();
+    void destroyThreadCache(ThreadCache *tc);
+    bool refill(int id, FreeList &fl);
+    void drain(int id, FreeList &fl, size_t n);
+    bool grow(SlabClass &sc, int id);
+    void *allocateSlab();
+    void freeSlab(Slab *slab);
+
+    friend void destroy_slab_thread_cache(void *p);
+
+    EventuallyPersistentEngine *owner;
+    SlabClass                   classes[MAX_CLASSES];
+    size_t                      numClasses;
+    ThreadLocal<ThreadCache*>  *threadCache;
+    Mutex                       cachesMutex;
+    std::list<ThreadCache*>     caches;
+    Atomic<size_t>              reservedBytes;
+
+    DISALLOW_COPY_AND_ASSIGN(SlabAllocator);
+};
+
+#endif /* SLAB_ALLOCATOR_HH */
@@ -182,21 +182,45 @@ bool StrategicSqlite3::delVBucket(uint16_t vbucket, uint16_t vb_version,
     return rv;
 }
 
+void StrategicSqlite3::swapVBTable(uint16_t vbucket) {
+    std::stringstream tmp_table_name;
+    tmp_table_name << "invalid_kv_" << vbucket << "_" << gethrtime();
+    strategy->renameVBTable(vbucket, tmp_table_name.str());
+    strategy->createVBTable(vbucket);
+}
+
 bool StrategicSqlite3::delVBucket(uint16_t vbucket, uint16_t vb_version) {
     (void) vb_version;
     assert(strategy->hasEfficientVBDeletion());
-    bool rv = true;
-    std::stringstream tmp_table_name;
-    tmp_table_name << "invalid_kv_" << vbucket << "_" << gethrtime();
-    rv = begin();
+    bool rv = begin();
     if (rv) {
-        strategy->renameVBTable(vbucket, tmp_table_name.str());
-        strategy->createVBTable(vbucket);
+        swapVBTable(vbucket);
         rv = commit();
     }
     return rv;
 }
 
+void StrategicSqlite3::delVBuckets(const std::vector<std::pair<uint16_t, uint16_t> > &vbuckets,
+                                   std::vector<bool> &results) {
+    if (!strategy->hasEfficientVBDeletion()) {
+        KVStore::delVBuckets(vbuckets, results);
+        return;
+    }
+
+    // The tables are only renamed here, so swapping all of them in a
+    // single transaction costs one sync instead of one per vbucket.
+    // The invalid tables are dropped later on.
+    bool rv = begin();
+    if (rv) {
+        std::vector<std::pair<uint16_t, uint16_t> >::const_iterator it;
+        for (it = vbuckets.begin(); it != vbuckets.end(); ++it) {
+            swapVBTable(it->first);
+        }
+        rv = commit();
+    }
+    results.assign(vbuckets.size(), rv);
+}
+
 bool StrategicSqlite3::snapshotVBuckets(const vbucket_map_t &m) {
     return storeMap(strategy->getClearVBucketStateST(),
                     strategy->getInsVBucketStateST(), m);
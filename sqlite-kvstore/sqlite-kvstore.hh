@@ -148,6 +148,13 @@ public:
     bool delVBucket(uint16_t vbucket, uint16_t vb_version,
                     std::pair<int64_t, int64_t> row_range);
 
+    /**
+     * Overrides delVBuckets() to swap out the tables of all the
+     * vbuckets in one transaction.
+     */
+    void delVBuckets(const std::vector<std::pair<uint16_t, uint16_t> > &vbuckets,
+                     std::vector<bool> &results);
+
     vbucket_map_t listPersistedVbuckets(void);
 
     /**
@@ -198,6 +205,12 @@ public:
                           Callback<size_t> &estimate);
 
 private:
+    /**
+     * Move a vbucket's table aside for later removal and give the
+     * vbucket a fresh one.  Must be called within a transaction.
+     */
+    void swapVBTable(uint16_t vbucket);
+
     size_t warmupSingleShard(const std::string &table,
                              std::list<uint64_t> &ids,
                              Callback<GetValue> &cb);
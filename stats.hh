@@ -9,6 +9,7 @@
 #include "atomic.hh"
 #include "histo.hh"
 #include "memory_tracker.hh"
+#include "slab_allocator.hh"
 
 #ifndef DEFAULT_MAX_DATA_SIZE
 /* Something something something ought to be enough for anybody */
@@ -19,18 +20,20 @@ static const hrtime_t ONE_SECOND(1000000);
 
 /**
  * Global engine stats container.
+ *
+ * Counters bumped by the front end threads on every operation, but only
+ * read for reporting, are StripedCounters, and the timing histograms are
+ * LogLinearHistograms for the same reason.
  */
 class EPStats {
 public:
 
-    EPStats() : dirtyAgeHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
-                dataAgeHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
-                diskCommitHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
-                mlogCompactorHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
-                timingLog(NULL), maxDataSize(DEFAULT_MAX_DATA_SIZE) {}
+    EPStats() : timingLog(NULL), slabAllocator(NULL),
+                maxDataSize(DEFAULT_MAX_DATA_SIZE) {}
 
     ~EPStats() {
         delete timingLog;
+        SlabAllocator::destroy(slabAllocator);
     }
 
     size_t getMaxDataSize() {
@@ -92,7 +95,7 @@ public:
     //! Number of items persisted.
     Atomic<size_t> totalPersisted;
     //! Cumulative number of items added to the queue.
-    Atomic<size_t> totalEnqueued;
+    StripedCounter<size_t> totalEnqueued;
     //! Number of new items created in the DB.
     Atomic<size_t> newItems;
     //! Number of items removed from the DB.
@@ -102,7 +105,7 @@ public:
     //! Number of times an item is not flushed due to the item's expiry
     Atomic<size_t> flushExpired;
     //! Number of times an object was expired on access.
-    Atomic<size_t> expired;
+    StripedCounter<size_t> expired;
     //! Number of times we failed to start a transaction
     Atomic<size_t> beginFailed;
     //! Number of times a commit failed.
@@ -131,23 +134,35 @@ public:
     //! Maximum data age before a record is forced to be persisted
     Atomic<int> queue_age_cap;
     //! Number of times background fetches occurred.
-    Atomic<size_t> bg_fetched;
+    StripedCounter<size_t> bg_fetched;
     //! Number of times we needed to kick in the pager
     Atomic<size_t> pagerRuns;
     //! Number of times the expiry pager runs for purging expired items
     Atomic<size_t> expiryPagerRuns;
     //! Number of times the checkpoint remover runs for removing closed unreferenced checkpoints.
     Atomic<size_t> checkpointRemoverRuns;
+    //! Number of vbuckets the checkpoint remover handled as soon as a closed checkpoint
+    //! became unreferenced.
+    Atomic<size_t> checkpointReclaims;
     //! Number of items removed from closed unreferenced checkpoints.
     Atomic<size_t> itemsRemovedFromCheckpoints;
     //! Number of times a value is ejected
     Atomic<size_t> numValueEjects;
+    //! Number of times the item pager ejected a value
+    Atomic<size_t> numPagerEjects;
+    //! Number of values ejected by the item pager and fetched back soon
+    //! after (see evict_refetch_window)
+    Atomic<size_t> numEjectsRefetched;
     //! Number of times a replica value is ejected
     Atomic<size_t> numReplicaEjects;
     //! Number of times a value could not be ejected
     Atomic<size_t> numFailedEjects;
     //! Number of times "Not my bucket" happened
-    Atomic<size_t> numNotMyVBuckets;
+    StripedCounter<size_t> numNotMyVBuckets;
+    //! Number of gets served without taking a hash table lock
+    StripedCounter<size_t> numLockFreeGets;
+    //! Number of lock free gets that had to be retried under the lock
+    StripedCounter<size_t> numLockFreeGetRetries;
     //! Whether the DB cleaner completes cleaning up invalid items with old vb versions
     Atomic<bool> dbCleanerComplete;
     //! Number of deleted items reverted from hot reload
@@ -194,7 +209,7 @@ public:
     Atomic<hrtime_t> pendingOpsMaxDuration;
 
     //! Histogram of pending operation wait times.
-    Histogram<hrtime_t> pendingOpsHisto;
+    LogLinearHistogram<hrtime_t> pendingOpsHisto;
 
     //! The number of samples the bgWaitDelta and bgLoadDelta contains of
     Atomic<size_t> bgNumOperations;
@@ -208,7 +223,7 @@ public:
     Atomic<hrtime_t> bgMaxWait;
 
     //! Histogram of background wait times.
-    Histogram<hrtime_t> bgWaitHisto;
+    LogLinearHistogram<hrtime_t> bgWaitHisto;
 
     /** The sum of the deltas (in usec) from the dispatcher started to load
      *  item until was done
@@ -225,14 +240,19 @@ public:
     Atomic<hrtime_t> vbucketDelTotWalltime;
 
     //! Histogram of background wait loads.
-    Histogram<hrtime_t> bgLoadHisto;
+    LogLinearHistogram<hrtime_t> bgLoadHisto;
+
+    //! Histogram of the number of keys read per background fetch batch.
+    LogLinearHistogram<size_t> bgBatchSizeHisto;
+    //! Histogram of the time taken to read a background fetch batch.
+    LogLinearHistogram<hrtime_t> bgBatchLoadHisto;
 
     //! Histogram of time an item spends non-resident.
     Histogram<rel_time_t> pagedOutTimeHisto;
 
     /* TAP related stats */
     //! The total number of tap events sent (not including noops)
-    Atomic<size_t> numTapFetched;
+    StripedCounter<size_t> numTapFetched;
     //! Number of background fetched tap items
     Atomic<size_t> numTapBGFetched;
     //! Number of times a tap background fetch task is requeued
@@ -258,7 +278,7 @@ public:
     Atomic<hrtime_t> tapBgMaxWait;
 
     //! Histogram of tap background wait loads.
-    Histogram<hrtime_t> tapBgWaitHisto;
+    LogLinearHistogram<hrtime_t> tapBgWaitHisto;
 
     /** The sum of the deltas (in usec) from the dispatcher started to load
      *  a tap item until was done
@@ -290,91 +310,99 @@ public:
 
     //! The number of tiems the mutation log compactor is exectued
     Atomic<size_t> mlogCompactorRuns;
+    //! Duration (µs) of the last mutation log compaction
+    Atomic<hrtime_t> mlogCompactorLastTime;
+    //! Time (µs) the last mutation log compaction held the flusher
+    Atomic<hrtime_t> mlogCompactorLastStall;
+    //! Entries logged during the last compaction and replayed into it
+    Atomic<size_t> mlogCompactorTailEntries;
 
     //! Histogram of tap background wait loads.
-    Histogram<hrtime_t> tapBgLoadHisto;
+    LogLinearHistogram<hrtime_t> tapBgLoadHisto;
 
     //! Histogram of queue processing dirty age.
-    Histogram<hrtime_t> dirtyAgeHisto;
+    LogLinearHistogram<hrtime_t> dirtyAgeHisto;
     //! Histogram of queue processing data age.
-    Histogram<hrtime_t> dataAgeHisto;
+    LogLinearHistogram<hrtime_t> dataAgeHisto;
 
     //! Histogram of item allocation sizes.
-    Histogram<size_t> itemAllocSizeHisto;
+    LogLinearHistogram<size_t> itemAllocSizeHisto;
 
     //
     // Command timers
     //
 
     //! Histogram of getvbucket timings
-    Histogram<hrtime_t> getVbucketCmdHisto;
+    LogLinearHistogram<hrtime_t> getVbucketCmdHisto;
 
     //! Histogram of setvbucket timings
-    Histogram<hrtime_t> setVbucketCmdHisto;
+    LogLinearHistogram<hrtime_t> setVbucketCmdHisto;
 
     //! Histogram of delvbucket timings
-    Histogram<hrtime_t> delVbucketCmdHisto;
+    LogLinearHistogram<hrtime_t> delVbucketCmdHisto;
 
     //! Histogram of get commands.
-    Histogram<hrtime_t> getCmdHisto;
+    LogLinearHistogram<hrtime_t> getCmdHisto;
 
     //! Histogram of arithmetic commands.
-    Histogram<hrtime_t> arithCmdHisto;
+    LogLinearHistogram<hrtime_t> arithCmdHisto;
 
     //! Histogram of tap VBucket reset timings
-    Histogram<hrtime_t> tapVbucketResetHisto;
+    LogLinearHistogram<hrtime_t> tapVbucketResetHisto;
 
     //! Histogram of tap mutation timings.
-    Histogram<hrtime_t> tapMutationHisto;
+    LogLinearHistogram<hrtime_t> tapMutationHisto;
 
     //! Histogram of tap vbucket set timings.
-    Histogram<hrtime_t> tapVbucketSetHisto;
+    LogLinearHistogram<hrtime_t> tapVbucketSetHisto;
 
     //! Time spent notifying completion of IO.
-    Histogram<hrtime_t> notifyIOHisto;
+    LogLinearHistogram<hrtime_t> notifyIOHisto;
 
     //
     // DB timers.
     //
 
     //! Histogram of insert disk writes
-    Histogram<hrtime_t> diskInsertHisto;
+    LogLinearHistogram<hrtime_t> diskInsertHisto;
 
     //! Histogram of update disk writes
-    Histogram<hrtime_t> diskUpdateHisto;
+    LogLinearHistogram<hrtime_t> diskUpdateHisto;
 
     //! Histogram of delete disk writes
-    Histogram<hrtime_t> diskDelHisto;
+    LogLinearHistogram<hrtime_t> diskDelHisto;
 
     //! Histogram of execution time of disk vbucket chunk deletions
-    Histogram<hrtime_t> diskVBChunkDelHisto;
+    LogLinearHistogram<hrtime_t> diskVBChunkDelHisto;
 
     //! Histogram of execution time of disk vbucket deletions
-    Histogram<hrtime_t> diskVBDelHisto;
+    LogLinearHistogram<hrtime_t> diskVBDelHisto;
 
     //! Histogram of execution time of invalid vbucket table deletions from disk
-    Histogram<hrtime_t> diskInvalidVBTableDelHisto;
+    LogLinearHistogram<hrtime_t> diskInvalidVBTableDelHisto;
 
     //! Histogram of disk commits
-    Histogram<hrtime_t> diskCommitHisto;
+    LogLinearHistogram<hrtime_t> diskCommitHisto;
 
     //! Histogram of purging a chunk of items with the old vbucket version from disk
-    Histogram<hrtime_t> diskInvaidItemDelHisto;
+    LogLinearHistogram<hrtime_t> diskInvaidItemDelHisto;
 
-    Histogram<hrtime_t> checkpointRevertHisto;
+    LogLinearHistogram<hrtime_t> checkpointRevertHisto;
 
     //! Histogram of setting vbucket state
-    Histogram<hrtime_t> setVbucketStateHisto;
-    Histogram<hrtime_t> snapshotVbucketHisto;
-    Histogram<hrtime_t> couchDelqHisto;
+    LogLinearHistogram<hrtime_t> setVbucketStateHisto;
+    LogLinearHistogram<hrtime_t> snapshotVbucketHisto;
+    LogLinearHistogram<hrtime_t> couchDelqHisto;
 
-    Histogram<hrtime_t> couchGetHisto;
-    Histogram<hrtime_t> couchGetFailHisto;
-    Histogram<hrtime_t> couchSetHisto;
-    Histogram<hrtime_t> couchSetFailHisto;
+    LogLinearHistogram<hrtime_t> couchGetHisto;
+    LogLinearHistogram<hrtime_t> couchGetFailHisto;
+    LogLinearHistogram<hrtime_t> couchSetHisto;
+    LogLinearHistogram<hrtime_t> couchSetFailHisto;
 
     //! Histogram of mutation log compactor
-    Histogram<hrtime_t> mlogCompactorHisto;
+    LogLinearHistogram<hrtime_t> mlogCompactorHisto;
+    //! Histogram of the time the mutation log compactor held the flusher
+    LogLinearHistogram<hrtime_t> mlogCompactorStallHisto;
 
 
     //! Reset all stats to reasonable values.
@@ -388,10 +416,15 @@ public:
         commit_time.set(0);
         pagerRuns.set(0);
         checkpointRemoverRuns.set(0);
+        checkpointReclaims.set(0);
         itemsRemovedFromCheckpoints.set(0);
         numValueEjects.set(0);
+        numPagerEjects.set(0);
+        numEjectsRefetched.set(0);
         numFailedEjects.set(0);
         numNotMyVBuckets.set(0);
+        numLockFreeGets.set(0);
+        numLockFreeGetRetries.set(0);
         io_num_read.set(0);
         io_num_write.set(0);
         io_read_bytes.set(0);
@@ -425,10 +458,15 @@ public:
         obsErrors.set(0);
         obsCleanerRuns.set(0);
         mlogCompactorRuns.set(0);
+        mlogCompactorLastTime.set(0);
+        mlogCompactorLastStall.set(0);
+        mlogCompactorTailEntries.set(0);
 
         pendingOpsHisto.reset();
         bgWaitHisto.reset();
         bgLoadHisto.reset();
+        bgBatchSizeHisto.reset();
+        bgBatchLoadHisto.reset();
         pagedOutTimeHisto.reset();
         tapBgWaitHisto.reset();
         tapBgLoadHisto.reset();
@@ -454,11 +492,15 @@ public:
         itemAllocSizeHisto.reset();
         dirtyAgeHisto.reset();
         mlogCompactorHisto.reset();
+        mlogCompactorStallHisto.reset();
     }
 
     // Used by stats logging infrastructure.
     std::ostream *timingLog;
 
+    //! The slabs this engine's items and values come from, if enabled.
+    SlabAllocator *slabAllocator;
+
 private:
 
     //! Max allowable memory size.
@@ -29,6 +29,12 @@ void add_casted_stat(const char *k, const Atomic<T> &v,
     add_casted_stat(k, v.get(), add_stat, cookie);
 }
 
+template <typename T>
+void add_casted_stat(const char *k, const StripedCounter<T> &v,
+                            ADD_STAT add_stat, const void *cookie) {
+    add_casted_stat(k, v.get(), add_stat, cookie);
+}
+
 /// @cond DETAILS
 /**
  * Convert a histogram into a bunch of calls to add stats.
@@ -57,6 +63,39 @@ void add_casted_stat(const char *k, const Histogram<T> &v,
     std::for_each(v.begin(), v.end(), a);
 }
 
+/**
+ * Add the non-empty bins of a log-linear histogram, followed by its 50th,
+ * 99th and 99.9th percentiles as k_p50, k_p99 and k_p999.
+ */
+template <typename T>
+void add_casted_stat(const char *k, const LogLinearHistogram<T> &v,
+                            ADD_STAT add_stat, const void *cookie) {
+    std::vector<size_t> counts;
+    v.getCounts(counts);
+    bool empty(true);
+    for (size_t i = 0; i < counts.size(); ++i) {
+        if (counts[i]) {
+            std::stringstream ss;
+            ss << k << "_" << v.getBinStart(i) << "," << v.getBinEnd(i);
+            add_casted_stat(ss.str().c_str(), counts[i], add_stat, cookie);
+            empty = false;
+        }
+    }
+    if (empty) {
+        return;
+    }
+
+    const char *names[] = { "p50", "p99", "p999" };
+    const double fractions[] = { 0.5, 0.99, 0.999 };
+    for (size_t i = 0; i < sizeof(fractions) / sizeof(fractions[0]); ++i) {
+        std::stringstream ss;
+        ss << k << "_" << names[i];
+        add_casted_stat(ss.str().c_str(),
+                        LogLinearHistogram<T>::getPercentile(counts, fractions[i]),
+                        add_stat, cookie);
+    }
+}
+
 template <typename P, typename T>
 void add_prefixed_stat(P prefix, const char *nm, T val,
                   ADD_STAT add_stat, const void *cookie) {
@@ -3,6 +3,7 @@
 #include <cassert>
 #include <limits>
 
+#include "epoch.hh"
 #include "stored-value.hh"
 
 #ifndef DEFAULT_HT_SIZE
@@ -12,11 +13,16 @@
 size_t HashTable::defaultNumBuckets = DEFAULT_HT_SIZE;
 size_t HashTable::defaultNumLocks = 193;
 enum stored_value_type HashTable::defaultStoredValueType = featured;
+bool HashTable::defaultIncrementalResize = false;
+size_t HashTable::defaultResizeBatch = 1024;
+bool HashTable::defaultTagIndex = false;
+bool HashTable::defaultLockFreeReads = false;
 double StoredValue::mutation_mem_threshold = 0.9;
 const int64_t StoredValue::state_id_cleared = -1;
 const int64_t StoredValue::state_id_pending = -2;
 const int64_t StoredValue::state_deleted_key = -3;
 const int64_t StoredValue::state_non_existent_key = -4;
+const uint8_t StoredValue::MAX_REFERENCES;
 
 static ssize_t prime_size_table[] = {
     3, 7, 13, 23, 47, 97, 193, 383, 769, 1531, 3067, 6143, 12289, 24571, 49157,
@@ -25,7 +31,7 @@ static ssize_t prime_size_table[] = {
     1610612741, -1
 };
 
-bool StoredValue::ejectValue(EPStats &stats, HashTable &ht) {
+bool StoredValue::ejectValue(EPStats &stats, HashTable &ht, bool byPager) {
     if (eligibleForEviction()) {
         size_t oldsize = size();
         size_t old_valsize = value->length();
@@ -33,6 +39,7 @@ bool StoredValue::ejectValue(EPStats &stats, HashTable &ht) {
         uval.len = valLength();
         RCPtr<Blob> sp(Blob::New(uval.chlen, sizeof(uval)));
         extra.feature.resident = false;
+        extra.feature.ejected = byPager;
         timestampEviction();
         value = sp;
         size_t newsize = size();
@@ -125,8 +132,8 @@ mutation_type_t HashTable::insert(const Item &itm, bool eject, bool partial) {
     assert(itm.getCas() != static_cast<uint64_t>(-1));
 
     int bucket_num(0);
-    LockHolder lh = getLockedBucket(itm.getKey(), &bucket_num);
-    StoredValue *v = unlocked_find(itm.getKey(), bucket_num, true);
+    LockHolder lh = getLockedBucket(itm, &bucket_num);
+    StoredValue *v = unlocked_find(itm, bucket_num, true);
 
     if (v == NULL) {
         v = valFact(itm, values[bucket_num], *this);
@@ -134,7 +141,7 @@ mutation_type_t HashTable::insert(const Item &itm, bool eject, bool partial) {
         if (partial) {
             v->extra.feature.resident = false;
         }
-        values[bucket_num] = v;
+        unlocked_link(v, bucket_num, itm.getKeyHash());
         ++numItems;
     } else {
         if (partial) {
@@ -244,7 +251,20 @@ HashTableStatVisitor HashTable::clear(bool deactivate) {
             StoredValue *v = values[i];
             rv.visit(v);
             values[i] = v->next;
-            delete v;
+            release(v);
+        }
+    }
+    if (tags) {
+        memset(tags, 0, size * sizeof(uint64_t));
+    }
+    // Buckets not moved yet by an incremental resize.  The (then
+    // empty) old array is released once the resize completes.
+    for (int i = 0; oldValues && i < (int)oldSize; i++) {
+        while (oldValues[i]) {
+            StoredValue *v = oldValues[i];
+            rv.visit(v);
+            oldValues[i] = v->next;
+            release(v);
         }
     }
 
@@ -265,6 +285,11 @@ void HashTable::resize(size_t newSize) {
         return;
     }
 
+    if (incremental) {
+        resizeIncrementally(newSize);
+        return;
+    }
+
     // Don't resize to the same size, either.
     if (newSize == size) {
         return;
@@ -282,8 +307,14 @@ void HashTable::resize(size_t newSize) {
     // Get a place for the new items.
     StoredValue **newValues = static_cast<StoredValue**>(calloc(newSize,
                                                                 sizeof(StoredValue*)));
+    uint64_t *newTags = NULL;
+    if (tags) {
+        newTags = static_cast<uint64_t*>(calloc(newSize, sizeof(uint64_t)));
+    }
     // If we can't allocate memory, don't move stuff around.
-    if (!newValues) {
+    if (!newValues || (tags && !newTags)) {
+        free(newValues);
+        free(newTags);
         return;
     }
 
@@ -291,30 +322,277 @@ void HashTable::resize(size_t newSize) {
     ++numResizes;
 
     // Set the new size so all the hashy stuff works.
-    size_t oldSize = size;
+    ++generation;
+    size_t prevSize = size;
     size = newSize;
     ep_sync_synchronize();
 
     // Move existing records into the new space.
-    for (size_t i = 0; i < oldSize; i++) {
+    for (size_t i = 0; i < prevSize; i++) {
         while (values[i]) {
             StoredValue *v = values[i];
             values[i] = v->next;
 
-            int newBucket = getBucketForHash(hash(v->getKeyBytes(), v->getKeyLen()));
+            uint64_t h = hash(v->getKeyBytes(), v->getKeyLen());
+            int newBucket = getBucketForHash(h);
             v->next = newValues[newBucket];
             newValues[newBucket] = v;
+            if (newTags) {
+                newTags[newBucket] = pushTag(newTags[newBucket], fingerprint(h));
+            }
         }
     }
 
     // values still points to the old (now empty) table.
-    free(values);
+    releaseBuckets(values);
     values = newValues;
+    ++generation;
+    free(tags);
+    tags = newTags;
 
     stats.memOverhead.incr(memorySize());
     assert(stats.memOverhead.get() < GIGANTOR);
 }
 
+void HashTable::resizeIncrementally(size_t newSize) {
+    LockHolder rlh(resizeMutex);
+
+    // Keep moving what an earlier resize left behind before sizing
+    // the table again.
+    if (oldValues != NULL) {
+        moveOldBuckets();
+        return;
+    }
+
+    newSize = roundToLocks(newSize);
+    if (newSize == size) {
+        return;
+    }
+
+    StoredValue **newValues = static_cast<StoredValue**>(calloc(newSize,
+                                                                sizeof(StoredValue*)));
+    uint64_t *newTags = NULL;
+    if (tags) {
+        newTags = static_cast<uint64_t*>(calloc(newSize, sizeof(uint64_t)));
+    }
+    if (!newValues || (tags && !newTags)) {
+        free(newValues);
+        free(newTags);
+        return;
+    }
+
+    MultiLockHolder mlh(mutexes, n_locks);
+    if (visitors.get() > 0) {
+        // Same as a blocking resize, the visitors expect the number
+        // of buckets to stay put.
+        free(newValues);
+        free(newTags);
+        return;
+    }
+
+    stats.memOverhead.decr(memorySize());
+    ++numResizes;
+
+    // From here on every operation moves the key's old bucket over
+    // (under its lock) before touching the new one.
+    ++generation;
+    oldValues = values;
+    oldSize = size;
+    resizeCursor.set(0);
+    resizeStart = gethrtime();
+    values = newValues;
+    // The old buckets' fingerprints aren't needed, every value gets
+    // fingerprinted again as it's moved.
+    free(tags);
+    tags = newTags;
+    size = newSize;
+    ++generation;
+
+    stats.memOverhead.incr(memorySize());
+    assert(stats.memOverhead.get() < GIGANTOR);
+    mlh.unlock();
+
+    moveOldBuckets();
+}
+
+bool HashTable::continueResize() {
+    LockHolder rlh(resizeMutex);
+    return moveOldBuckets();
+}
+
+bool HashTable::moveOldBuckets() {
+    if (oldValues == NULL) {
+        return false;
+    }
+
+    // Sweep through the next batch of old buckets holding a single
+    // lock at a time, so front end operations only ever wait for one
+    // bucket's move.
+    size_t end = std::min(oldSize, resizeCursor.get() + resizeBatch);
+    for (size_t i = resizeCursor.get(); i < end; i = ++resizeCursor) {
+        LockHolder lh(mutexes[mutexForBucket(static_cast<int>(i))]);
+        unlocked_moveOldBucket(static_cast<int>(i));
+    }
+    if (end < oldSize) {
+        return true;
+    }
+
+    MultiLockHolder mlh(mutexes, n_locks);
+    stats.memOverhead.decr(memorySize());
+    releaseBuckets(oldValues);
+    oldValues = NULL;
+    oldSize = 0;
+    stats.memOverhead.incr(memorySize());
+    lastResizeTime.set((gethrtime() - resizeStart) / 1000);
+    return false;
+}
+
+void HashTable::unlocked_moveOldBuckets(int lock) {
+    for (int i = lock; oldValues && i < static_cast<int>(oldSize); i+= n_locks) {
+        unlocked_moveOldBucket(i);
+    }
+}
+
+void HashTable::unlocked_moveOldBucket(int old_bucket) {
+    while (oldValues[old_bucket]) {
+        StoredValue *v = oldValues[old_bucket];
+        oldValues[old_bucket] = v->next;
+
+        uint64_t h = hash(v->getKeyBytes(), v->getKeyLen());
+        int newBucket = getBucketForHash(h);
+        assert(mutexForBucket(newBucket) == mutexForBucket(old_bucket));
+        v->next = values[newBucket];
+        values[newBucket] = v;
+        if (tags) {
+            tags[newBucket] = pushTag(tags[newBucket], fingerprint(h));
+        }
+    }
+}
+
+static void deleteStoredValue(void *p) {
+    delete static_cast<StoredValue*>(p);
+}
+
+static void freeBuckets(void *p) {
+    free(p);
+}
+
+void HashTable::release(StoredValue *v) {
+    if (lockFreeReads) {
+        EpochManager::getInstance()->retire(v, deleteStoredValue);
+    } else {
+        delete v;
+    }
+}
+
+void HashTable::releaseBuckets(StoredValue **buckets) {
+    if (lockFreeReads) {
+        EpochManager::getInstance()->retire(buckets, freeBuckets);
+    } else {
+        free(buckets);
+    }
+}
+
+void HashTable::waitForReleases() {
+    EpochManager::getInstance()->synchronize();
+}
+
+HashTable::optimistic_get_t HashTable::optimisticGet(const std::string &key,
+                                                     uint64_t h,
+                                                     uint16_t vbucket,
+                                                     Item **itm,
+                                                     StoredValue **sv,
+                                                     ItemView **view) {
+    assert(lockFreeReads);
+    // Longer chains than this are left to the locked path, which also
+    // bounds the walk should a racing writer send us round in circles.
+    static const int MAX_STEPS = 64;
+
+    if (!isActive()) {
+        return OPTIMISTIC_RETRY;
+    }
+    if (h == 0) {
+        h = hashKey(key);
+    }
+
+    // Get a consistent view of the bucket array.
+    uint32_t gen = generation.get();
+    if ((gen & 1) || oldValues != NULL) {
+        return OPTIMISTIC_RETRY;
+    }
+    size_t currSize = size;
+    StoredValue **buckets = values;
+    ep_sync_synchronize();
+    if (generation.get() != gen) {
+        return OPTIMISTIC_RETRY;
+    }
+
+    int bucket_num = static_cast<int>(h % currSize);
+    Mutex &lock = mutexes[mutexForBucket(bucket_num)];
+    uint32_t version = lock.getVersion();
+    if (version & 1) {
+        return OPTIMISTIC_RETRY;
+    }
+    ep_sync_synchronize();
+
+    StoredValue *v = buckets[bucket_num];
+    for (int steps = 0; v && !v->hasKey(key); v = v->next) {
+        if (++steps == MAX_STEPS) {
+            return OPTIMISTIC_RETRY;
+        }
+    }
+
+    Item *rv(NULL);
+    ItemView *rview(NULL);
+    optimistic_get_t result = OPTIMISTIC_MISS;
+    if (v && !v->isDeleted()) {
+        if (!v->isResident() || v->isLockFlagSet() || v->isTempItem()
+            || v->isExpired(ep_real_time())) {
+            return OPTIMISTIC_RETRY;
+        }
+        if (view) {
+            rview = v->toView(false);
+        } else {
+            rv = v->toItem(false, vbucket);
+        }
+        result = OPTIMISTIC_HIT;
+    }
+
+    // Nobody may have held the bucket's lock, nor replaced the array,
+    // while we looked.
+    ep_sync_synchronize();
+    if (lock.getVersion() != version || generation.get() != gen) {
+        delete rv;
+        delete rview;
+        return OPTIMISTIC_RETRY;
+    }
+
+    if (v) {
+        v->referenced();
+    }
+    *itm = rv;
+    if (view) {
+        *view = rview;
+    }
+    *sv = v;
+    return result;
+}
+
+void HashTable::unlocked_rebuildTags(int bucket_num) {
+    uint64_t len(0);
+    uint64_t word(0);
+    for (StoredValue *v = values[bucket_num]; v; v = v->next) {
+        if (len < TAG_SLOTS) {
+            uint8_t fp = fingerprint(hash(v->getKeyBytes(), v->getKeyLen()));
+            word |= static_cast<uint64_t>(fp) << (8 * len);
+        }
+        if (len < 255) {
+            ++len;
+        }
+    }
+    tags[bucket_num] = (len << 56) | word;
+}
+
 static size_t distance(size_t a, size_t b) {
     return std::max(a, b) - std::min(a, b);
 }
@@ -345,7 +623,9 @@ void HashTable::resize() {
     } else if (prime_size_table[i] < static_cast<ssize_t>(defaultNumBuckets)) {
         // Was going to be smaller than the configured ht_size.
         new_size = defaultNumBuckets;
-    } else if (isCurrently(size, prime_size_table[i-1], prime_size_table[i])) {
+    } else if (isCurrently(size,
+                           static_cast<ssize_t>(roundToLocks(prime_size_table[i-1])),
+                           static_cast<ssize_t>(roundToLocks(prime_size_table[i])))) {
         // If one of the candidate sizes is the current size, maintain
         // the current size in order to remain stable.
         new_size = size;
@@ -366,6 +646,7 @@ void HashTable::visit(HashTableVisitor &visitor) {
     size_t visited = 0;
     for (int l = 0; isActive() && !aborted && l < static_cast<int>(n_locks); l++) {
         LockHolder lh(mutexes[l]);
+        unlocked_moveOldBuckets(l);
         for (int i = l; i < static_cast<int>(size); i+= n_locks) {
             assert(l == mutexForBucket(i));
             StoredValue *v = values[i];
@@ -392,6 +673,7 @@ void HashTable::visitDepth(HashTableDepthVisitor &visitor) {
 
     for (int l = 0; l < static_cast<int>(n_locks); l++) {
         LockHolder lh(mutexes[l]);
+        unlocked_moveOldBuckets(l);
         for (int i = l; i < static_cast<int>(size); i+= n_locks) {
             size_t depth = 0;
             StoredValue *p = values[i];
@@ -446,7 +728,7 @@ add_type_t HashTable::unlocked_add(int &bucket_num,
                                    bool isDirty,
                                    bool storeVal,
                                    bool resetVal) {
-    StoredValue *v = unlocked_find(val.getKey(), bucket_num, true);
+    StoredValue *v = unlocked_find(val, bucket_num, true);
     add_type_t rv = ADD_SUCCESS;
     if (v && !v->isDeleted() && !v->isExpired(ep_real_time())) {
         rv = ADD_EXISTS;
@@ -466,7 +748,7 @@ add_type_t HashTable::unlocked_add(int &bucket_num,
             }
         } else {
             v = valFact(itm, values[bucket_num], *this, isDirty);
-            values[bucket_num] = v;
+            unlocked_link(v, bucket_num, itm.getKeyHash());
             ++numItems;
 
             /**
@@ -562,3 +844,16 @@ Item* StoredValue::toItem(bool locked, uint16_t vbucket) const {
 
     return ret;
 }
+
+ItemView* StoredValue::toView(bool locked) const {
+    uint64_t theCas = locked ? static_cast<uint64_t>(-1) : 0;
+    if (_isSmall) {
+        return ItemView::New(getKeyBytes(), getKeyLen(), value, flags, 0,
+                             theCas);
+    }
+    if (!locked) {
+        theCas = extra.feature.cas;
+    }
+    return ItemView::New(getKeyBytes(), getKeyLen(), value, flags,
+                         extra.feature.exptime, theCas);
+}
@@ -43,7 +43,11 @@ struct feature_data {
     rel_time_t lock_expiry;     //!< getl lock expiration
     bool       locked : 1;      //!< True if this item is locked
     bool       resident : 1;    //!< True if this object's value is in memory.
-    bool       nru : 1;         //!< True if referenced since last sweep
+    bool       ejected : 1;     //!< True if the value was ever ejected.
+    //! True if referenced since last sweep.  Not a bit field, as lock
+    //! free readers set it without the bucket lock.
+    bool       nru;
+    uint8_t    refs;            //!< Recent references, aged by the item pager
     uint8_t    keylen;          //!< Length of the key
     char       keybytes[1];     //!< The key itself.
 };
@@ -71,7 +75,7 @@ class StoredValue {
 public:
 
     void operator delete(void* p) {
-        ::operator delete(p);
+        SlabAllocator::deallocate(p);
      }
 
     /**
@@ -96,7 +100,25 @@ public:
     void referenced() {
         if (!_isSmall) {
             extra.feature.nru = true;
+            if (extra.feature.refs < MAX_REFERENCES) {
+                ++extra.feature.refs;
+            }
+        }
+    }
+
+    /**
+     * Give this value a second chance under the item pager's CLOCK
+     * eviction policy: if it was referenced since the pager last came
+     * by, age its reference count and spare it.
+     *
+     * @return true if the value should be spared this time
+     */
+    bool ageReferences() {
+        if (_isSmall || extra.feature.refs == 0) {
+            return false;
         }
+        --extra.feature.refs;
+        return true;
     }
 
     /**
@@ -303,8 +325,11 @@ public:
      * Eject an item value from memory.
      * @param stats the global stat instance
      * @param ht the hashtable that contains this StoredValue instance
+     * @param byPager true if the item pager picked this value, so that
+     *                fetching it back counts against the eviction
+     *                efficiency
      */
-    bool ejectValue(EPStats &stats, HashTable &ht);
+    bool ejectValue(EPStats &stats, HashTable &ht, bool byPager = false);
 
     /**
      * Restore the value for this item.
@@ -351,6 +376,15 @@ public:
         return dirtiness << 2;
     }
 
+    /**
+     * True if this object's value went non-resident by being ejected
+     * by the item pager (rather than not having been loaded yet, or
+     * being ejected on request).
+     */
+    bool wasEjected() const {
+        return !_isSmall && extra.feature.ejected;
+    }
+
     /**
      * Get the timestamp at which time this object went non-resident.
      */
@@ -534,6 +568,15 @@ public:
         }
     }
 
+    /**
+     * True if this item's lock flag is set, even if the lock expired.
+     * Unlike isLocked() this never writes, so it may be called without
+     * the bucket lock.
+     */
+    bool isLockFlagSet() const {
+        return !_isSmall && extra.feature.locked;
+    }
+
     /**
      * True if this value is resident in memory currently.
      */
@@ -609,6 +652,11 @@ public:
      */
     Item *toItem(bool locked, uint16_t vbucket) const;
 
+    /**
+     * Generate a new ItemView sharing this object's value
+     */
+    ItemView *toView(bool locked) const;
+
     /**
      * Get the size of a StoredValue object.
      *
@@ -644,6 +692,10 @@ public:
     static const int64_t state_deleted_key;
     static const int64_t state_non_existent_key;
 
+    //! The number of references counted for CLOCK eviction, so a value
+    //! survives at most this many passes of the pager without use.
+    static const uint8_t MAX_REFERENCES = 3;
+
 private:
 
     StoredValue(const Item &itm, StoredValue *n, EPStats &stats, HashTable &ht,
@@ -659,6 +711,10 @@ private:
             extra.feature.exptime = itm.getExptime();
             extra.feature.locked = false;
             extra.feature.resident = true;
+            extra.feature.ejected = false;
+            extra.feature.nru = false;
+            // New values get one chance, as in any CLOCK.
+            extra.feature.refs = 1;
             extra.feature.lock_expiry = 0;
             extra.feature.keylen = itm.getKey().length();
             extra.feature.seqno = itm.getSeqno();
@@ -910,7 +966,7 @@ private:
         assert(key.length() < 256);
         size_t len = key.length() + base;
 
-        StoredValue *t = new (::operator new(len))
+        StoredValue *t = new (SlabAllocator::allocate(len))
             StoredValue(itm, n, *stats, ht, setDirty, small);
         if (small) {
             std::memcpy(t->extra.small.keybytes, key.data(), key.length());
@@ -942,14 +998,27 @@ public:
      */
     HashTable(EPStats &st, size_t s = 0, size_t l = 0,
               enum stored_value_type t = featured) : stats(st), valFact(st, t) {
-        size = HashTable::getNumBuckets(s);
         n_locks = HashTable::getNumLocks(l);
+        incremental = defaultIncrementalResize;
+        resizeBatch = defaultResizeBatch;
+        size = roundToLocks(HashTable::getNumBuckets(s));
         valFact = StoredValueFactory(st, getDefaultStorageValueType());
         assert(size > 0);
         assert(n_locks > 0);
         assert(visitors == 0);
         values = static_cast<StoredValue**>(calloc(size, sizeof(StoredValue*)));
+        oldValues = NULL;
+        oldSize = 0;
+        resizeStart = 0;
+        tags = NULL;
+        if (defaultTagIndex) {
+            tags = static_cast<uint64_t*>(calloc(size, sizeof(uint64_t)));
+        }
         mutexes = new Mutex[n_locks];
+        lockFreeReads = defaultLockFreeReads;
+        for (size_t i = 0; lockFreeReads && i < n_locks; ++i) {
+            mutexes[i].setVersioned(true);
+        }
         activeState = true;
     }
 
@@ -959,14 +1028,24 @@ public:
         while (visitors > 0) {
             usleep(100);
         }
+        if (lockFreeReads) {
+            // Our values are released on behalf of the engine, which may
+            // go away with us.
+            waitForReleases();
+        }
         delete []mutexes;
         free(values);
         values = NULL;
+        free(oldValues);
+        oldValues = NULL;
+        free(tags);
+        tags = NULL;
     }
 
     size_t memorySize() {
         return sizeof(HashTable)
-            + (size * sizeof(StoredValue*))
+            + ((size + oldSize) * sizeof(StoredValue*))
+            + (tags ? size * sizeof(uint64_t) : 0)
             + (n_locks * sizeof(Mutex));
     }
 
@@ -1021,9 +1100,54 @@ public:
 
     /**
      * Resize to the specified size.
+     *
+     * In incremental mode the new bucket array is swapped in at once,
+     * but the items are moved over one old bucket at a time, only
+     * holding that bucket's lock.  Operations touching a bucket that
+     * hasn't been moved yet move it themselves first.  Each call only
+     * moves a batch of old buckets, continueResize() (or another
+     * resize, which won't start over until the last one is done) moves
+     * the rest.
      */
     void resize(size_t to);
 
+    /**
+     * Move the next batch of old buckets of an incremental resize
+     * over to the new array.
+     *
+     * @return true if there are old buckets left to move
+     */
+    bool continueResize();
+
+    /**
+     * True while an incremental resize still has old buckets to move.
+     */
+    bool isResizing() {
+        LockHolder rlh(resizeMutex);
+        return oldValues != NULL;
+    }
+
+    /**
+     * Get the progress of the current incremental resize.
+     *
+     * @param moved receives the number of old buckets moved so far
+     * @return the number of buckets in the old array, 0 if no resize
+     *         is in progress
+     */
+    size_t getResizeProgress(size_t &moved) {
+        size_t rv(oldSize);
+        moved = rv == 0 ? 0 : resizeCursor.get();
+        return rv;
+    }
+
+    /**
+     * Get the time (in microseconds) the last incremental resize took
+     * to move all the items.
+     */
+    hrtime_t getLastResizeTime() {
+        return lastResizeTime;
+    }
+
     /**
      * Find the item with the given key.
      *
@@ -1046,14 +1170,14 @@ public:
                               enum queue_operation op,
                               int bucket_num)
     {
-        if (unlocked_find(itm.getKey(), bucket_num, true)) {
+        if (unlocked_find(itm, bucket_num, true)) {
             // it's already there...
             return false;
         }
 
         StoredValue *v = valFact(itm, values[bucket_num], *this);
         assert(v);
-        values[bucket_num] = v;
+        unlocked_link(v, bucket_num, itm.getKeyHash());
         ++numItems;
         if (op == queue_op_del) {
             unlocked_softDelete(v, itm.getCas());
@@ -1094,8 +1218,8 @@ public:
 
         mutation_type_t rv = NOT_FOUND;
         int bucket_num(0);
-        LockHolder lh = getLockedBucket(val.getKey(), &bucket_num);
-        StoredValue *v = unlocked_find(val.getKey(), bucket_num, true);
+        LockHolder lh = getLockedBucket(val, &bucket_num);
+        StoredValue *v = unlocked_find(val, bucket_num, true);
 
         if (v && !v->_isSmall && v->getCas() == 0) {
             return NEED_METADATA;
@@ -1152,7 +1276,7 @@ public:
                 itm.setCas();
             }
             v = valFact(itm, values[bucket_num], *this);
-            values[bucket_num] = v;
+            unlocked_link(v, bucket_num, itm.getKeyHash());
             ++numItems;
 
             /**
@@ -1192,7 +1316,7 @@ public:
     add_type_t add(const Item &val, bool isDirty = true, bool storeVal = true) {
         assert(isActive());
         int bucket_num(0);
-        LockHolder lh = getLockedBucket(val.getKey(), &bucket_num);
+        LockHolder lh = getLockedBucket(val, &bucket_num);
         return unlocked_add(bucket_num, val, isDirty, storeVal);
     }
 
@@ -1306,17 +1430,32 @@ public:
      */
     StoredValue *unlocked_find(const std::string &key, int bucket_num,
                                bool wantsDeleted=false) {
-        StoredValue *v = values[bucket_num];
-        while (v) {
-            if (v->hasKey(key)) {
-                v->referenced();
-                if (wantsDeleted || !v->isDeleted()) {
-                    return v;
-                } else {
-                    return NULL;
-                }
+        return unlocked_find(key, 0, bucket_num, wantsDeleted);
+    }
+
+    /**
+     * Find an item's key within a specific bucket assuming you already
+     * locked the bucket, reusing the item's key hash.
+     */
+    StoredValue *unlocked_find(const Item &itm, int bucket_num,
+                               bool wantsDeleted=false) {
+        return unlocked_find(itm.getKey(), itm.getKeyHash(), bucket_num,
+                             wantsDeleted);
+    }
+
+    /**
+     * Find a key with the given hash (0 if not known yet) within a
+     * specific bucket assuming you already locked the bucket.
+     */
+    StoredValue *unlocked_find(const std::string &key, uint64_t h,
+                               int bucket_num, bool wantsDeleted) {
+        int pos(0);
+        StoredValue *v = unlocked_findInChain(key, h, bucket_num, &pos);
+        if (v) {
+            v->referenced();
+            if (wantsDeleted || !v->isDeleted()) {
+                return v;
             }
-            v = v->next;
         }
         return NULL;
     }
@@ -1329,15 +1468,9 @@ public:
      *
      * @return the hash value
      */
-    inline int hash(const char *str, const size_t len) {
+    inline uint64_t hash(const char *str, const size_t len) {
         assert(isActive());
-        int h=5381;
-
-        for(size_t i=0; i < len; i++) {
-            h = ((h << 5) + h) ^ str[i];
-        }
-
-        return h;
+        return hashKey(str, len);
     }
 
     /**
@@ -1346,7 +1479,7 @@ public:
      * @param s the string
      * @return the hash value
      */
-    inline int hash(const std::string &s) {
+    inline uint64_t hash(const std::string &s) {
         return hash(s.data(), s.length());
     }
 
@@ -1358,12 +1491,17 @@ public:
      * @param bucket output parameter to receive a bucket
      * @return a locked LockHolder
      */
-    inline LockHolder getLockedBucket(int h, int *bucket) {
+    inline LockHolder getLockedBucket(uint64_t h, int *bucket) {
         while (true) {
             assert(isActive());
             *bucket = getBucketForHash(h);
             LockHolder rv(mutexes[mutexForBucket(*bucket)]);
             if (*bucket == getBucketForHash(h)) {
+                if (oldValues != NULL) {
+                    // The key's old bucket shares this lock, bring it
+                    // over before anyone looks at the new one.
+                    unlocked_moveOldBucket(static_cast<int>(h % oldSize));
+                }
                 return rv;
             }
         }
@@ -1394,6 +1532,18 @@ public:
         return getLockedBucket(hash(s.data(), s.size()), bucket);
     }
 
+    /**
+     * Get a lock holder holding a lock for the bucket of the given
+     * item's key, reusing the item's key hash.
+     *
+     * @param itm the item
+     * @param bucket output parameter to receive a bucket
+     * @return a locked LockHolder
+     */
+    inline LockHolder getLockedBucket(const Item &itm, int *bucket) {
+        return getLockedBucket(itm.getKeyHash(), bucket);
+    }
+
     /**
      * Delete a key from the cache without trying to lock the cache first
      * (Please note that you <b>MUST</b> acquire the mutex before calling
@@ -1405,48 +1555,23 @@ public:
      */
     bool unlocked_del(const std::string &key, int bucket_num) {
         assert(isActive());
-        StoredValue *v = values[bucket_num];
-
-        // Special case empty bucket.
+        int pos(0);
+        StoredValue *v = unlocked_findInChain(key, 0, bucket_num, &pos);
         if (!v) {
             return false;
         }
-
-        // Special case the first one
-        if (v->hasKey(key)) {
-            if (!v->isDeleted() && v->isLocked(ep_current_time())) {
-                return false;
-            }
-            values[bucket_num] = v->next;
-            size_t currSize = v->size();
-            v->reduceCacheSize(*this, currSize);
-            v->reduceCurrentSize(stats,
-                                 v->isDeleted() ? currSize : currSize - v->getValue()->length());
-            delete v;
-            --numItems;
-            return true;
-        }
-
-        while (v->next) {
-            if (v->next->hasKey(key)) {
-                StoredValue *tmp = v->next;
-                if (!tmp->isDeleted() && tmp->isLocked(ep_current_time())) {
-                    return false;
-                }
-                v->next = v->next->next;
-                size_t currSize = tmp->size();
-                tmp->reduceCacheSize(*this, currSize);
-                tmp->reduceCurrentSize(stats,
-                               tmp->isDeleted() ? currSize : currSize - tmp->getValue()->length());
-                delete tmp;
-                --numItems;
-                return true;
-            } else {
-                v = v->next;
-            }
+        if (!v->isDeleted() && v->isLocked(ep_current_time())) {
+            return false;
         }
 
-        return false;
+        unlocked_unlink(v, bucket_num, pos);
+        size_t currSize = v->size();
+        v->reduceCacheSize(*this, currSize);
+        v->reduceCurrentSize(stats,
+                             v->isDeleted() ? currSize : currSize - v->getValue()->length());
+        release(v);
+        --numItems;
+        return true;
     }
 
     /**
@@ -1496,6 +1621,82 @@ public:
      */
     static void setDefaultNumLocks(size_t);
 
+    /**
+     * Set whether hash tables created from now on resize incrementally.
+     */
+    static void setDefaultIncrementalResize(bool to) {
+        defaultIncrementalResize = to;
+    }
+
+    /**
+     * Set the number of old buckets hash tables created from now on
+     * move per incremental resize step.
+     */
+    static void setDefaultResizeBatch(size_t to) {
+        defaultResizeBatch = to > 0 ? to : 1;
+    }
+
+    /**
+     * Set whether hash tables created from now on keep a fingerprint
+     * index of their buckets.
+     */
+    static void setDefaultTagIndex(bool to) {
+        defaultTagIndex = to;
+    }
+
+    /**
+     * True if this table keeps a fingerprint index of its buckets.
+     */
+    bool hasTagIndex() const {
+        return tags != NULL;
+    }
+
+    /**
+     * Set whether hash tables created from now on can be read without
+     * their bucket locks (see optimisticGet()).
+     */
+    static void setDefaultLockFreeReads(bool to) {
+        defaultLockFreeReads = to;
+    }
+
+    /**
+     * True if optimisticGet() may be used on this table.
+     */
+    bool hasLockFreeReads() const {
+        return lockFreeReads;
+    }
+
+    /**
+     * Outcome of optimisticGet().
+     */
+    enum optimistic_get_t {
+        OPTIMISTIC_HIT,         //!< Found a live, resident value.
+        OPTIMISTIC_MISS,        //!< The key isn't there (or deleted).
+        OPTIMISTIC_RETRY        //!< Look again under the bucket lock.
+    };
+
+    /**
+     * Look a key up without taking any lock.
+     *
+     * The caller must be in an epoch critical section (EpochGuard) for
+     * as long as it uses the returned StoredValue pointer.  The lookup
+     * is validated against the version of the bucket's lock: if a
+     * writer held it meanwhile, or the value is anything but a plain
+     * resident, unlocked, unexpired one, OPTIMISTIC_RETRY asks for the
+     * regular locked lookup.
+     *
+     * @param key the key to look up
+     * @param h the key's hash (0 if not known yet)
+     * @param vbucket the vbucket the returned item belongs to
+     * @param itm receives a copy of the value on a hit
+     * @param sv receives the value found on a hit
+     * @param view if given, receives the hit as an ItemView instead of
+     *             itm getting an Item
+     */
+    optimistic_get_t optimisticGet(const std::string &key, uint64_t h,
+                                   uint16_t vbucket, Item **itm,
+                                   StoredValue **sv, ItemView **view = NULL);
+
     /**
      * Set the stored value type by name.
      *
@@ -1564,14 +1765,215 @@ private:
     Atomic<size_t>       numResizes;
     bool                 activeState;
 
+    // Incremental resize state.  The old array and its size only
+    // change while holding every bucket lock.  As the bucket counts
+    // are multiples of the number of locks, a key's old and new
+    // buckets are always guarded by the same lock.
+    bool                 incremental;
+    size_t               resizeBatch;
+    StoredValue        **oldValues;
+    size_t               oldSize;
+    Mutex                resizeMutex;
+    Atomic<size_t>       resizeCursor;
+    hrtime_t             resizeStart;
+    Atomic<hrtime_t>     lastResizeTime;
+
+    // Optional fingerprint index, one word per bucket.  Bytes 0-6 hold
+    // a one byte fingerprint of each of the first TAG_SLOTS values in
+    // the bucket's chain (0 marking an empty slot) and the top byte
+    // the length of the chain, saturating at 255.  Lookups compare the
+    // fingerprints of a whole bucket at once and only follow the chain
+    // to the values whose fingerprint matches, so most misses don't
+    // touch any StoredValue at all.
+    uint64_t            *tags;
+
+    // With lock free reads the bucket locks count their acquisitions
+    // (see Mutex::setVersioned()), and generation is bumped (under
+    // every lock) before and after size and values change, so readers
+    // can tell they used a stale array.  Values and bucket arrays
+    // readers may still be looking at are released through the
+    // EpochManager.
+    bool                 lockFreeReads;
+    Atomic<uint32_t>     generation;
+
     static size_t                 defaultNumBuckets;
     static size_t                 defaultNumLocks;
     static enum stored_value_type defaultStoredValueType;
+    static bool                   defaultIncrementalResize;
+    static size_t                 defaultResizeBatch;
+    static bool                   defaultTagIndex;
+    static bool                   defaultLockFreeReads;
+
+    static const int      TAG_SLOTS = 7;
+    static const uint64_t TAG_MASK = 0x00FFFFFFFFFFFFFFULL;
+    static const uint64_t TAG_LOW_BITS = 0x0101010101010101ULL;
+    static const uint64_t TAG_HIGH_BITS = 0x8080808080808080ULL;
+
+    int getBucketForHash(uint64_t h) {
+        return static_cast<int>(h % size);
+    }
+
+    /**
+     * Round a bucket count up to a multiple of the number of locks
+     * when resizing incrementally.
+     */
+    size_t roundToLocks(size_t n) {
+        if (!incremental || n % n_locks == 0) {
+            return n;
+        }
+        return (n / n_locks + 1) * n_locks;
+    }
+
+    /**
+     * Move the contents of the given old bucket into the new array.
+     * The bucket's lock must be held.
+     */
+    void unlocked_moveOldBucket(int old_bucket);
+
+    /**
+     * Get the fingerprint of a key with the given hash.
+     */
+    static uint8_t fingerprint(uint64_t h) {
+        // The top bits, as the low ones pick the bucket.
+        uint8_t rv = static_cast<uint8_t>(h >> 56);
+        return rv == 0 ? 1 : rv;
+    }
+
+    static size_t tagChainLength(uint64_t word) {
+        return static_cast<size_t>(word >> 56);
+    }
+
+    /**
+     * Add the fingerprint of a value just put at the head of a chain.
+     */
+    static uint64_t pushTag(uint64_t word, uint8_t fp) {
+        uint64_t len = word >> 56;
+        if (len < 255) {
+            ++len;
+        }
+        return (len << 56) | (((word << 8) | fp) & TAG_MASK);
+    }
 
-    int getBucketForHash(int h) {
-        return abs(h % static_cast<int>(size));
+    /**
+     * Drop the fingerprint of the value at the given chain position
+     * (only valid while the whole chain is fingerprinted).
+     */
+    static uint64_t removeTag(uint64_t word, int pos) {
+        uint64_t below = (static_cast<uint64_t>(1) << (8 * pos)) - 1;
+        uint64_t tagged = word & TAG_MASK;
+        tagged = (tagged & below) | ((tagged >> 8) & ~below);
+        return (((word >> 56) - 1) << 56) | tagged;
     }
 
+    /**
+     * Get a mask with the high bit set in each byte of the word
+     * holding the given fingerprint.  It may have false positives
+     * above a true match, never false negatives.
+     */
+    static uint64_t matchTag(uint64_t word, uint8_t fp) {
+        uint64_t x = (word & TAG_MASK) ^ (TAG_LOW_BITS * fp);
+        return (x - TAG_LOW_BITS) & ~x & TAG_HIGH_BITS & TAG_MASK;
+    }
+
+    /**
+     * Find the value with the given key in a (locked) bucket along with
+     * its position in the chain.
+     */
+    StoredValue *unlocked_findInChain(const std::string &key, uint64_t h,
+                                      int bucket_num, int *pos) {
+        StoredValue *v = values[bucket_num];
+        if (tags && tagChainLength(tags[bucket_num]) <= TAG_SLOTS) {
+            uint64_t word = tags[bucket_num];
+            int len = static_cast<int>(tagChainLength(word));
+            uint64_t m = matchTag(word, fingerprint(h ? h : hash(key)));
+            int p = 0;
+            for (int i = 0; m != 0 && i < len; ++i, m >>= 8) {
+                if (m & 0x80) {
+                    for (; p < i; ++p) {
+                        v = v->next;
+                    }
+                    if (v->hasKey(key)) {
+                        *pos = i;
+                        return v;
+                    }
+                }
+            }
+            return NULL;
+        }
+
+        for (int p = 0; v; v = v->next, ++p) {
+            if (v->hasKey(key)) {
+                *pos = p;
+                return v;
+            }
+        }
+        return NULL;
+    }
+
+    /**
+     * Put a value created with the bucket's current head as its next
+     * at the head of the (locked) bucket.
+     */
+    void unlocked_link(StoredValue *v, int bucket_num, uint64_t h) {
+        assert(v->next == values[bucket_num]);
+        if (lockFreeReads) {
+            // Lock free readers must see v fully built.
+            ep_sync_synchronize();
+        }
+        values[bucket_num] = v;
+        if (tags) {
+            tags[bucket_num] = pushTag(tags[bucket_num], fingerprint(h));
+        }
+    }
+
+    /**
+     * Take the value at the given position out of a (locked) bucket.
+     */
+    void unlocked_unlink(StoredValue *v, int bucket_num, int pos) {
+        if (values[bucket_num] == v) {
+            values[bucket_num] = v->next;
+        } else {
+            StoredValue *prev = values[bucket_num];
+            while (prev->next != v) {
+                prev = prev->next;
+            }
+            prev->next = v->next;
+        }
+        if (tags) {
+            if (tagChainLength(tags[bucket_num]) <= TAG_SLOTS) {
+                tags[bucket_num] = removeTag(tags[bucket_num], pos);
+            } else {
+                unlocked_rebuildTags(bucket_num);
+            }
+        }
+    }
+
+    void unlocked_rebuildTags(int bucket_num);
+
+    /**
+     * Free a value taken out of the table, once no lock free reader
+     * can see it any more.
+     */
+    void release(StoredValue *v);
+
+    /**
+     * Free a bucket array that has been replaced.
+     */
+    void releaseBuckets(StoredValue **buckets);
+
+    /**
+     * Wait until the values and arrays released so far are freed.
+     */
+    void waitForReleases();
+
+    /**
+     * Move all the old buckets guarded by the given (held) lock.
+     */
+    void unlocked_moveOldBuckets(int lock);
+
+    void resizeIncrementally(size_t to);
+    bool moveOldBuckets();
+
     inline int mutexForBucket(int bucket_num) {
         assert(isActive());
         assert(bucket_num >= 0);
@@ -42,6 +42,37 @@ static void testAtomicInt() {
     assert(intgen.latest() == (numThreads * numIterations));
 }
 
+class StripedCounterTest : public Generator<int> {
+public:
+
+    int operator()() {
+        for (size_t j = 0; j < numIterations; j++) {
+            ++counter;
+            counter += 2;
+            counter.decr(1);
+        }
+        return 0;
+    }
+
+    size_t total(void) { return counter.get(); }
+
+private:
+    StripedCounter<size_t> counter;
+};
+
+static void testStripedCounter() {
+    StripedCounterTest gen;
+    getCompletedThreads<int>(numThreads, &gen);
+    assert(gen.total() == 2 * numThreads * numIterations);
+
+    StripedCounter<size_t> x(5);
+    --x;
+    x -= 2;
+    assert(x.get() == 2);
+    x.set(0);
+    assert(x == 0);
+}
+
 static void testSetIfLess() {
     Atomic<int> x;
 
@@ -65,6 +96,7 @@ static void testSetIfBigger() {
 int main() {
     alarm(60);
     testAtomicInt();
+    testStripedCounter();
     testSetIfLess();
     testSetIfBigger();
 }
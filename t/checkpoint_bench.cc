@@ -0,0 +1,113 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Times the replacement of items in an open checkpoint with a number of
+ * TAP cursors, some caught up and some still at the start of the
+ * checkpoint.
+ *
+ * Usage: checkpoint_bench [num_updates] [num_keys]
+ */
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <set>
+#include <sstream>
+#include <vector>
+
+#include "assert.h"
+#include "queueditem.hh"
+#include "checkpoint.hh"
+#include "vbucket.hh"
+#include "stats.hh"
+
+EPStats global_stats;
+CheckpointConfig checkpoint_config;
+
+extern "C" {
+    static rel_time_t basic_current_time(void) {
+        return 0;
+    }
+
+    rel_time_t (*ep_current_time)() = basic_current_time;
+
+    time_t ep_real_time() {
+        return time(NULL);
+    }
+}
+
+static std::string cursorName(int i) {
+    std::stringstream name;
+    name << "bench-" << i;
+    return name.str();
+}
+
+static void queueKey(CheckpointManager &manager, const RCPtr<VBucket> &vbucket,
+                     int k) {
+    std::stringstream key;
+    key << "key-" << k;
+    queued_item qi(new QueuedItem(key.str(), 0, queue_op_set));
+    manager.queueDirty(qi, vbucket);
+}
+
+// Every step-th cursor is caught up, the others are still at the start
+// of the checkpoint.
+static void run(const RCPtr<VBucket> &vbucket, int numUpdates, int numKeys,
+                int numCursors, int step) {
+    CheckpointManager manager(global_stats, 0, checkpoint_config, 1);
+    for (int i = 0; i < numCursors; ++i) {
+        manager.registerTAPCursor(cursorName(i));
+    }
+    for (int i = 0; i < numKeys; ++i) {
+        queueKey(manager, vbucket, i);
+    }
+    for (int i = 0; i < numCursors; i += step) {
+        std::vector<queued_item> items;
+        manager.getAllItemsForTAPConnection(cursorName(i), items);
+        assert(items.size() == static_cast<size_t>(numKeys + 1));
+    }
+
+    std::vector<queued_item> updates;
+    std::set<int> updated;
+    for (int i = 0; i < numUpdates; ++i) {
+        int k = (i * 7919) % numKeys;
+        std::stringstream key;
+        key << "key-" << k;
+        updates.push_back(queued_item(new QueuedItem(key.str(), 0, queue_op_set)));
+        updated.insert(k);
+    }
+
+    hrtime_t start = gethrtime();
+    std::vector<queued_item>::iterator it;
+    for (it = updates.begin(); it != updates.end(); ++it) {
+        manager.queueDirty(*it, vbucket);
+    }
+    hrtime_t elapsed = gethrtime() - start;
+    printf("%3d cursors, %3d behind: %8.1f ns/dedup\n", numCursors,
+           numCursors - (numCursors + step - 1) / step,
+           static_cast<double>(elapsed) / numUpdates);
+
+    for (int i = 0; i < numCursors; ++i) {
+        size_t expected = i % step == 0 ? updated.size() : numKeys + 1;
+        assert(manager.getNumItemsForTAPConnection(cursorName(i)) == expected);
+    }
+}
+
+int main(int argc, char **argv) {
+    putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
+    int numUpdates = argc > 1 ? atoi(argv[1]) : 100000;
+    int numKeys = argc > 2 ? atoi(argv[2]) : 1000;
+
+    HashTable::setDefaultNumBuckets(5);
+    HashTable::setDefaultNumLocks(1);
+    RCPtr<VBucket> vbucket(new VBucket(0, vbucket_state_active, global_stats,
+                                       checkpoint_config));
+
+    run(vbucket, numUpdates, numKeys, 1, 1);
+    run(vbucket, numUpdates, numKeys, 10, 1);
+    run(vbucket, numUpdates, numKeys, 100, 1);
+    run(vbucket, numUpdates, numKeys, 10, 2);
+    run(vbucket, numUpdates, numKeys, 100, 2);
+    return 0;
+}
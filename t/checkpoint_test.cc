@@ -2,6 +2,7 @@
 #include "config.h"
 #include <pthread.h>
 #include <signal.h>
+#include <stdio.h>
 #include <unistd.h>
 
 #include <vector>
@@ -143,6 +144,123 @@ static void *launch_set_thread(void *arg) {
 }
 }
 
+static queued_item queueKey(CheckpointManager &manager, const RCPtr<VBucket> &vbucket,
+                            int k) {
+    std::stringstream key;
+    key << "key-" << k;
+    queued_item qi(new QueuedItem(key.str(), 0, queue_op_set));
+    manager.queueDirty(qi, vbucket);
+    return qi;
+}
+
+static void testDeduplication(const RCPtr<VBucket> &vbucket) {
+    CheckpointManager manager(global_stats, 0, checkpoint_config, 1);
+    manager.registerTAPCursor("dedup");
+    for (int i = 0; i < 10; ++i) {
+        queueKey(manager, vbucket, i);
+    }
+
+    bool isLastItem = false;
+    queued_item qi = manager.nextItem("dedup", isLastItem);
+    assert(qi->getOperation() == queue_op_checkpoint_start);
+    for (int i = 0; i < 5; ++i) {
+        qi = manager.nextItem("dedup", isLastItem);
+        std::stringstream key;
+        key << "key-" << i;
+        assert(qi->getKey() == key.str());
+    }
+
+    // Keep rewriting a key the cursor went past and one it didn't reach
+    // yet; the slots of the replaced items must not pile up.
+    size_t memOverhead = global_stats.memOverhead.get();
+    for (int i = 0; i < 10000; ++i) {
+        queueKey(manager, vbucket, 2);
+        queueKey(manager, vbucket, 7);
+    }
+    assert(global_stats.memOverhead.get() <=
+           memOverhead + 4 * CHECKPOINT_CHUNK_SIZE * sizeof(queued_item));
+
+    assert(manager.getNumItemsForTAPConnection("dedup") == 6);
+    const char *expected[] = {"key-5", "key-6", "key-8", "key-9", "key-2", "key-7"};
+    for (int i = 0; i < 6; ++i) {
+        qi = manager.nextItem("dedup", isLastItem);
+        assert(qi->getKey() == expected[i]);
+        assert(isLastItem == (i == 5));
+    }
+    qi = manager.nextItem("dedup", isLastItem);
+    assert(qi->getOperation() == queue_op_empty);
+
+    std::vector<queued_item> items;
+    manager.getAllItemsForPersistence(items);
+    assert(items.size() == 11);
+    assert(items[0]->getOperation() == queue_op_checkpoint_start);
+    assert(items[3]->getKey() == "key-3");
+    assert(items[9]->getKey() == "key-2");
+    assert(items[10]->getKey() == "key-7");
+    assert(manager.getNumItemsForPersistence() == 0);
+}
+
+class TestReclaimList : public CheckpointReclaimList {
+public:
+    TestReclaimList() : notified(0) {}
+
+    int notified;
+
+protected:
+    void notify() {
+        ++notified;
+    }
+};
+
+static void testReclaimList(const RCPtr<VBucket> &vbucket) {
+    TestReclaimList reclaimList;
+    CheckpointConfig config;
+    config.setReclaimList(&reclaimList);
+    CheckpointManager manager(global_stats, 3, config, 1);
+    manager.registerTAPCursor("slow");
+    manager.registerTAPCursor("fast");
+    for (int i = 0; i < 10; ++i) {
+        queueKey(manager, vbucket, i);
+    }
+    manager.createNewCheckpoint();
+    queueKey(manager, vbucket, 10);
+
+    // The checkpoint is only reported once the last cursor leaves it.
+    std::vector<queued_item> items;
+    manager.getAllItemsForPersistence(items);
+    items.clear();
+    manager.getAllItemsForTAPConnection("fast", items);
+    assert(reclaimList.empty());
+    assert(manager.getCheckpointIdForTAPCursor("fast") == 2);
+
+    bool isLastItem = false;
+    while (manager.getCheckpointIdForTAPCursor("slow") == 1) {
+        manager.nextItem("slow", isLastItem);
+    }
+    assert(reclaimList.notified == 1);
+
+    // Nor is it reported again while waiting for the remover.
+    manager.removeTAPCursor("fast");
+    std::vector<uint16_t> vbids;
+    reclaimList.popAll(vbids);
+    assert(vbids.size() == 1 && vbids[0] == 3);
+
+    bool newCheckpointCreated = false;
+    assert(manager.removeClosedUnrefCheckpoints(vbucket, newCheckpointCreated) == 12);
+    assert(manager.getNumCheckpoints() == 1);
+
+    // Once removed, the next one is reported again.
+    manager.createNewCheckpoint();
+    queueKey(manager, vbucket, 11);
+    manager.getAllItemsForPersistence(items);
+    manager.removeTAPCursor("slow");
+    assert(reclaimList.notified == 2);
+    vbids.clear();
+    reclaimList.popAll(vbids);
+    assert(vbids.size() == 1 && vbids[0] == 3);
+    assert(reclaimList.empty());
+}
+
 int main(int argc, char **argv) {
     (void)argc; (void)argv;
     putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
@@ -151,6 +269,9 @@ int main(int argc, char **argv) {
     HashTable::setDefaultNumLocks(1);
     RCPtr<VBucket> vbucket(new VBucket(0, vbucket_state_active, global_stats, checkpoint_config));
 
+    testDeduplication(vbucket);
+    testReclaimList(vbucket);
+
     CheckpointManager *checkpoint_manager = new CheckpointManager(global_stats, 0,
                                                                   checkpoint_config, 1);
     SyncObject *mutex = new SyncObject();
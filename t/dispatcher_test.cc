@@ -10,6 +10,8 @@
 
 EventuallyPersistentEngine *engine = NULL;
 Dispatcher dispatcher(*engine);
+Dispatcher pool(*engine, "Pool", 4);
+Dispatcher waker(*engine, "Waker");
 static Atomic<int> callbacks;
 
 extern "C" {
@@ -57,6 +59,163 @@ bool TestCallback::callback(Dispatcher &d, TaskId t) {
     return thing->doSomething(d, t);
 }
 
+/**
+ * Job that reruns itself a number of times, checking that no two
+ * workers ever run it at the same time.
+ */
+class RepeatingCallback : public DispatcherCallback {
+public:
+    RepeatingCallback(int n) : remaining(n), running(0) { }
+
+    bool callback(Dispatcher &d, TaskId t) {
+        (void)d; (void)t;
+        assert(++running == 1);
+        usleep(10);
+        --running;
+        ++callbacks;
+        return --remaining > 0;
+    }
+
+    std::string description() { return std::string("Repeating"); }
+
+    bool isConcurrent() { return true; }
+
+private:
+    Atomic<int> remaining;
+    Atomic<int> running;
+};
+
+static Atomic<int> runningSerial;
+static Atomic<int> runningConcurrent;
+static Atomic<int> overlapped;
+
+/**
+ * Job that doesn't declare itself concurrent, checking that it never
+ * runs alongside another such job.
+ */
+class SerialCallback : public DispatcherCallback {
+public:
+    SerialCallback(int n) : remaining(n) { }
+
+    bool callback(Dispatcher &d, TaskId t) {
+        (void)d; (void)t;
+        assert(++runningSerial == 1);
+        if (runningConcurrent > 0) {
+            ++overlapped;
+        }
+        usleep(100);
+        --runningSerial;
+        ++callbacks;
+        return --remaining > 0;
+    }
+
+    std::string description() { return std::string("Serial"); }
+
+private:
+    Atomic<int> remaining;
+};
+
+/**
+ * Concurrent job that keeps running until it has been seen alongside
+ * a serial job.
+ */
+class ConcurrentCallback : public DispatcherCallback {
+public:
+    bool callback(Dispatcher &d, TaskId t) {
+        (void)d; (void)t;
+        ++runningConcurrent;
+        usleep(100);
+        --runningConcurrent;
+        return overlapped == 0;
+    }
+
+    std::string description() { return std::string("Concurrent"); }
+
+    bool isConcurrent() { return true; }
+};
+
+static void testPool(void) {
+    const int numJobs(20), numRuns(10);
+    std::vector<shared_ptr<RepeatingCallback> > jobs;
+    std::vector<TaskId> tasks;
+
+    callbacks = 0;
+    pool.start();
+    for (int i = 0; i < numJobs; ++i) {
+        TaskId tid;
+        shared_ptr<RepeatingCallback> cb(new RepeatingCallback(numRuns));
+        pool.schedule(cb, &tid, Priority::ItemPagerPriority);
+        jobs.push_back(cb);
+        tasks.push_back(tid);
+    }
+    // Waking a task hands out a copy of it; the copy must not run
+    // alongside the original.
+    for (int i = 0; i < numJobs; ++i) {
+        pool.wake(tasks[i], NULL);
+    }
+    while (callbacks < numJobs * numRuns) {
+        usleep(100);
+    }
+
+    assert(pool.getNumWorkers() == 4);
+    std::vector<DispatcherState> states(pool.getDispatcherStates());
+    assert(states.size() == 4);
+
+    // Serial jobs take turns, while a concurrent one still runs
+    // alongside them.
+    const int numSerial(8);
+    callbacks = 0;
+    for (int i = 0; i < numSerial; ++i) {
+        pool.schedule(shared_ptr<SerialCallback>(new SerialCallback(numRuns)),
+                      NULL, Priority::ItemPagerPriority);
+    }
+    pool.schedule(shared_ptr<ConcurrentCallback>(new ConcurrentCallback),
+                  NULL, Priority::BackfillTaskPriority);
+    while (callbacks < numSerial * numRuns || overlapped == 0) {
+        usleep(100);
+    }
+    pool.stop();
+}
+
+/**
+ * Job that sleeps for an hour after every run, unless woken up.
+ */
+class SleepyCallback : public DispatcherCallback {
+public:
+    bool callback(Dispatcher &d, TaskId t) {
+        ++callbacks;
+        d.snooze(t, 3600);
+        return true;
+    }
+
+    std::string description() { return std::string("Sleepy"); }
+};
+
+static void testWake(void) {
+    callbacks = 0;
+    waker.start();
+    TaskId tid;
+    waker.schedule(shared_ptr<SleepyCallback>(new SleepyCallback),
+                   &tid, Priority::FlusherPriority, 3600);
+
+    // The woken copy runs right away, and its id is the one handed
+    // back, so the next wake (or cancel) reaches the queued task and
+    // not the one it replaced.
+    TaskId old(tid);
+    waker.wake(tid, &tid);
+    assert(tid.get() != old.get());
+    while (callbacks < 1) {
+        usleep(100);
+    }
+    old = tid;
+    waker.wake(tid, &tid);
+    assert(tid.get() != old.get());
+    while (callbacks < 2) {
+        usleep(100);
+    }
+    waker.stop();
+}
+
 int main(int argc, char **argv) {
     (void)argc; (void)argv;
     int expected_num_callbacks=3;
@@ -85,6 +244,9 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    testPool();
+    testWake();
+
     IdleTask it;
     assert(hrtime2text(it.maxExpectedDuration()) == std::string("3600 ms"));
 
@@ -0,0 +1,110 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+
+#include "flush_controller.hh"
+
+#undef NDEBUG
+#include <assert.h>
+
+static const hrtime_t MSEC(1000000);
+
+static void testDisabled() {
+    FlushController fc(4000, 0);
+    assert(fc.getTxnSize() == 4000);
+    assert(fc.getLastDecision() == FlushController::fixed);
+
+    // Nothing moves the size while there is no target.
+    assert(fc.commitCompleted(100 * MSEC, 1000000, 600) == 4000);
+    assert(fc.commitCompleted(MSEC, 0, 0) == 4000);
+    assert(fc.getLastDecision() == FlushController::fixed);
+    assert(fc.getNumGrows() == 0);
+    assert(fc.getNumShrinks() == 0);
+    assert(fc.getPreemptThreshold() == FlushController::MIN_PREEMPT_THRESHOLD);
+
+    fc.setMaxTxnSize(1000);
+    assert(fc.getTxnSize() == 1000);
+}
+
+static void testShrinkWhenIdle() {
+    FlushController fc(4000, 10);
+    size_t prev = fc.getTxnSize();
+    for (int i = 0; i < 100; ++i) {
+        size_t size = fc.commitCompleted(MSEC, 0, 0);
+        assert(size <= prev);
+        prev = size;
+    }
+    assert(prev == 4000 / FlushController::MIN_SIZE_DIVISOR);
+    assert(fc.getLastDecision() == FlushController::hold);
+    assert(fc.getNumShrinks() > 0);
+    assert(fc.getNumGrows() == 0);
+}
+
+static void testGrowWhenBehind() {
+    FlushController fc(4000, 10);
+    for (int i = 0; i < 100; ++i) {
+        fc.commitCompleted(MSEC, 0, 0);
+    }
+    size_t low = fc.getTxnSize();
+
+    size_t prev = low;
+    for (int i = 0; i < 100; ++i) {
+        size_t size = fc.commitCompleted(MSEC, 1000, 20);
+        assert(size >= prev);
+        prev = size;
+    }
+    assert(prev == 4000);
+    assert(fc.getNumGrows() > 0);
+    // The flusher keeps going for longer while it's behind.
+    assert(fc.getPreemptThreshold() == 1000);
+
+    // A growing queue is enough to grow the transactions even within
+    // the target.
+    fc.setMaxTxnSize(100);
+    assert(fc.getTxnSize() == 100);
+    fc.setMaxTxnSize(4000);
+    assert(fc.getTxnSize() == 4000 / FlushController::MIN_SIZE_DIVISOR);
+    assert(fc.commitCompleted(MSEC, 10, 1) == 250);
+    assert(fc.commitCompleted(MSEC, 20, 1) == 312);
+    assert(fc.getLastDecision() == FlushController::grow);
+    assert(fc.getPreemptThreshold() == FlushController::MIN_PREEMPT_THRESHOLD);
+}
+
+static void testShrinkOnSlowCommits() {
+    FlushController fc(4000, 10);
+    // Commits taking more than half the target shrink the transactions
+    // even though the flusher is behind.
+    assert(fc.commitCompleted(6000 * MSEC, 1000, 20) == 3000);
+    assert(fc.getLastDecision() == FlushController::shrink);
+    // Between a quarter and half of the target, the size is left alone.
+    assert(fc.commitCompleted(3000 * MSEC, 2000, 20) == 3000);
+    assert(fc.getLastDecision() == FlushController::hold);
+}
+
+static void testTargetChanges() {
+    FlushController fc(4000, 10);
+    for (int i = 0; i < 100; ++i) {
+        fc.commitCompleted(MSEC, 0, 0);
+    }
+    assert(fc.getTxnSize() < 4000);
+
+    fc.setLagTarget(0);
+    assert(fc.getTxnSize() == 4000);
+    assert(fc.getLastDecision() == FlushController::fixed);
+
+    fc.setLagTarget(10);
+    fc.setMaxTxnSize(8);
+    assert(fc.getTxnSize() == 8);
+    for (int i = 0; i < 100; ++i) {
+        fc.commitCompleted(MSEC, 0, 0);
+    }
+    assert(fc.getTxnSize() == 1);
+}
+
+int main() {
+    testDisabled();
+    testShrinkWhenIdle();
+    testGrowWhenBehind();
+    testShrinkOnSlowCommits();
+    testTargetChanges();
+    return 0;
+}
@@ -0,0 +1,109 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Times the hash_table_test workloads (store, hits, misses, deletes)
+ * with and without the bucket fingerprint index.
+ *
+ * Usage: hash_table_bench [num_keys] [ht_size]
+ */
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <ep.hh>
+#include <item.hh>
+#include <stats.hh>
+
+time_t time_offset;
+
+extern "C" {
+    static rel_time_t basic_current_time(void) {
+        return 0;
+    }
+
+    rel_time_t (*ep_current_time)() = basic_current_time;
+
+    time_t ep_real_time() {
+        return time(NULL) + time_offset;
+    }
+}
+
+EPStats global_stats;
+
+static std::vector<std::string> generateKeys(int num, int start=0) {
+    std::vector<std::string> rv;
+
+    for (int i = start; i < num; i++) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "key%d", i);
+        rv.push_back(std::string(buf));
+    }
+
+    return rv;
+}
+
+static void report(const char *layout, const char *op, size_t n, hrtime_t ns) {
+    printf("%-8s %-8s %10.1f ns/op\n", layout, op,
+           static_cast<double>(ns) / static_cast<double>(n));
+}
+
+static void run(const char *layout, bool tagged, size_t htSize,
+                const std::vector<std::string> &keys,
+                const std::vector<std::string> &missing) {
+    HashTable::setDefaultTagIndex(tagged);
+    HashTable h(global_stats, htSize, 1);
+
+    hrtime_t start = gethrtime();
+    std::vector<std::string>::const_iterator it;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        Item i(*it, 0, 0, it->c_str(), it->length());
+        int64_t row_id(-1);
+        h.set(i, row_id);
+    }
+    report(layout, "set", keys.size(), gethrtime() - start);
+
+    start = gethrtime();
+    size_t found(0);
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        std::string k(*it);
+        found += h.find(k) != NULL ? 1 : 0;
+    }
+    report(layout, "hit", keys.size(), gethrtime() - start);
+    assert(found == keys.size());
+
+    start = gethrtime();
+    for (it = missing.begin(); it != missing.end(); ++it) {
+        std::string k(*it);
+        found += h.find(k) != NULL ? 1 : 0;
+    }
+    report(layout, "miss", missing.size(), gethrtime() - start);
+    assert(found == keys.size());
+
+    start = gethrtime();
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        h.del(*it);
+    }
+    report(layout, "del", keys.size(), gethrtime() - start);
+}
+
+int main(int argc, char **argv) {
+    putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
+    global_stats.setMaxDataSize(std::numeric_limits<size_t>::max());
+    int numKeys = argc > 1 ? atoi(argv[1]) : 1000000;
+    size_t htSize = argc > 2 ? static_cast<size_t>(atoi(argv[2])) : 786433;
+
+    std::vector<std::string> keys = generateKeys(numKeys);
+    std::vector<std::string> missing = generateKeys(2 * numKeys, numKeys);
+    std::random_shuffle(keys.begin(), keys.end());
+    std::random_shuffle(missing.begin(), missing.end());
+
+    run("chained", false, htSize, keys, missing);
+    run("tagged", true, htSize, keys, missing);
+    return 0;
+}
@@ -6,8 +6,10 @@
 #include <limits>
 #include <cassert>
 #include <algorithm>
+#include <set>
 
 #include <ep.hh>
+#include <epoch.hh>
 #include <item.hh>
 #include <stats.hh>
 
@@ -331,6 +333,343 @@ static void testAutoResize() {
     verifyFound(h, keys);
 }
 
+static void testIncrementalResize() {
+    HashTable::setDefaultIncrementalResize(true);
+    HashTable h(global_stats, 5, 3);
+    // Bucket counts are kept a multiple of the lock count.
+    assert(h.getSize() == 6);
+
+    std::vector<std::string> keys = generateKeys(5000);
+    storeMany(h, keys);
+    verifyFound(h, keys);
+
+    h.resize(6143);
+    assert(h.getSize() == 6144);
+    size_t moved(0);
+    assert(h.getResizeProgress(moved) == 0);
+    assert(moved == 0);
+    verifyFound(h, keys);
+    assert(count(h) == 5000);
+
+    h.resize(769);
+    assert(h.getSize() == 771);
+    verifyFound(h, keys);
+    while (h.continueResize()) {
+    }
+
+    h.resize();
+    assert(h.getSize() == 6144);
+    verifyFound(h, keys);
+    assert(count(h) == 5000);
+
+    // A step only moves a batch of the old buckets, the rest wait for
+    // the resize to be continued.
+    HashTable::setDefaultResizeBatch(100);
+    HashTable ph(global_stats, 769, 3);
+    storeMany(ph, keys);
+    ph.resize(6143);
+    assert(ph.getSize() == 6144);
+    assert(ph.isResizing());
+    assert(ph.getResizeProgress(moved) == 771);
+    assert(moved == 100);
+    // Another resize carries on with the same one.
+    ph.resize(769);
+    assert(ph.getSize() == 6144);
+    assert(ph.getResizeProgress(moved) == 771);
+    assert(moved == 200);
+    verifyFound(ph, keys);
+    int steps(0);
+    while (ph.continueResize()) {
+        ++steps;
+    }
+    assert(steps == 5);
+    assert(!ph.isResizing());
+    assert(ph.getResizeProgress(moved) == 0);
+    assert(count(ph) == 5000);
+    HashTable::setDefaultResizeBatch(1024);
+
+    // Deletes and resizes racing with each other.
+    HashTable ch(global_stats, 5, 3);
+    keys = generateKeys(20000);
+    storeMany(ch, keys);
+    srand(918475);
+    AccessGenerator gen(keys, ch);
+    getCompletedThreads(16, &gen);
+    assert(count(ch) == 0);
+
+    HashTable::setDefaultIncrementalResize(false);
+}
+
+static void testTagIndex() {
+    HashTable::setDefaultTagIndex(true);
+    size_t initialSize = global_stats.currentSize.get();
+
+    // Long chains overflow the fingerprints, they must keep working
+    // as chains shrink back and get fingerprinted again.
+    HashTable h(global_stats, 5, 1);
+    assert(h.hasTagIndex());
+    std::vector<std::string> keys = generateKeys(3000);
+    storeMany(h, keys);
+    verifyFound(h, keys);
+
+    std::vector<std::string>::iterator it;
+    for (it = keys.begin(); it != keys.end(); it += 2) {
+        assert(h.del(*it));
+        assert(!h.del(*it));
+    }
+    for (size_t i = 0; i < keys.size(); ++i) {
+        assert((h.find(keys[i]) == NULL) == (i % 2 == 0));
+    }
+
+    // Short chains, all fingerprinted.
+    h.resize(6143);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        assert((h.find(keys[i]) == NULL) == (i % 2 == 0));
+    }
+    std::vector<std::string> missing = generateKeys(6000, 3000);
+    for (it = missing.begin(); it != missing.end(); ++it) {
+        assert(h.find(*it) == NULL);
+    }
+    addMany(h, missing, ADD_SUCCESS);
+    verifyFound(h, missing);
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        h.del(*it);
+    }
+    assert(count(h) == 3000);
+    for (it = missing.begin(); it != missing.end(); ++it) {
+        assert(h.del(*it));
+    }
+    assert(count(h) == 0);
+    assert(global_stats.currentSize.get() == initialSize);
+
+    // Moved over incrementally.
+    HashTable::setDefaultIncrementalResize(true);
+    HashTable ih(global_stats, 5, 3);
+    storeMany(ih, keys);
+    ih.resize(6143);
+    verifyFound(ih, keys);
+    ih.resize(769);
+    verifyFound(ih, keys);
+    assert(count(ih) == 3000);
+    HashTable::setDefaultIncrementalResize(false);
+
+    HashTable::setDefaultTagIndex(false);
+}
+
+static void testKeyHash() {
+    std::string key("a key long enough to span a few words");
+    Item itm(key, 0, 0, key.c_str(), key.length());
+    QueuedItem qi(key, 0, queue_op_set);
+    assert(itm.getKeyHash() == hashKey(key));
+    assert(qi.getKeyHash() == hashKey(key));
+
+    // Every length (and so every tail) hashes differently.
+    std::set<uint64_t> seen;
+    for (size_t i = 0; i <= key.length(); ++i) {
+        uint64_t h = hashKey(key.data(), i);
+        assert(h != 0);
+        assert(seen.insert(h).second);
+    }
+}
+
+static HashTable::optimistic_get_t lockFreeGet(HashTable &h,
+                                               const std::string &k) {
+    EpochGuard guard;
+    Item *itm(NULL);
+    StoredValue *v(NULL);
+    HashTable::optimistic_get_t rv = h.optimisticGet(k, 0, 0, &itm, &v);
+    if (rv == HashTable::OPTIMISTIC_HIT) {
+        assert(v != NULL && v->hasKey(k));
+        assert(itm->getKey() == k);
+        assert(std::string(itm->getData(), itm->getNBytes()) == k);
+        delete itm;
+    } else {
+        assert(itm == NULL);
+    }
+    return rv;
+}
+
+class LockFreeAccessGenerator : public Generator<bool> {
+public:
+
+    LockFreeAccessGenerator(const std::vector<std::string> &k,
+                            HashTable &h) : keys(k), ht(h) {}
+
+    bool operator()() {
+        // Half of the threads read, the other half churn the table.
+        bool writer = (++threads % 2) == 0;
+        for (int round = 0; round < 20; ++round) {
+            std::vector<std::string>::iterator it;
+            for (it = keys.begin(); it != keys.end(); ++it) {
+                if (!writer) {
+                    lockFreeGet(ht, *it);
+                } else if (rand() % 3 == 0) {
+                    ht.del(*it);
+                } else {
+                    Item i(*it, 0, 0, it->c_str(), it->length());
+                    int64_t row_id(-1);
+                    ht.set(i, row_id);
+                }
+            }
+            if (writer) {
+                ht.resize(round % 2 ? 769 : 6143);
+            }
+        }
+        return true;
+    }
+
+private:
+    std::vector<std::string>  keys;
+    HashTable                &ht;
+    Atomic<int>               threads;
+};
+
+static void testLockFreeReads() {
+    HashTable::setDefaultLockFreeReads(true);
+    HashTable h(global_stats, 3067, 3);
+    assert(h.hasLockFreeReads());
+
+    std::vector<std::string> keys = generateKeys(5000);
+    storeMany(h, keys);
+    std::vector<std::string>::iterator it;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        assert(lockFreeGet(h, *it) == HashTable::OPTIMISTIC_HIT);
+    }
+    assert(lockFreeGet(h, "nokey") == HashTable::OPTIMISTIC_MISS);
+
+    assert(h.del(keys[0]));
+    assert(lockFreeGet(h, keys[0]) == HashTable::OPTIMISTIC_MISS);
+    h.resize(6143);
+    assert(lockFreeGet(h, keys[1]) == HashTable::OPTIMISTIC_HIT);
+
+    // Long chains are left to the locked path.
+    h.resize(3);
+    assert(lockFreeGet(h, keys[1]) == HashTable::OPTIMISTIC_RETRY);
+    h.resize(6143);
+
+    // A writer holding the bucket's lock sends readers to the lock.
+    {
+        int bucket_num(0);
+        LockHolder lh = h.getLockedBucket(keys[1], &bucket_num);
+        assert(lockFreeGet(h, keys[1]) == HashTable::OPTIMISTIC_RETRY);
+    }
+    assert(lockFreeGet(h, keys[1]) == HashTable::OPTIMISTIC_HIT);
+
+    // Readers racing with sets, deletes and resizes.
+    {
+        HashTable ch(global_stats, 769, 3);
+        keys = generateKeys(2000);
+        storeMany(ch, keys);
+        srand(918475);
+        LockFreeAccessGenerator gen(keys, ch);
+        getCompletedThreads(8, &gen);
+    }
+    // Everything the table let go of has been freed.
+    EpochManager::getInstance()->synchronize();
+    assert(EpochManager::getInstance()->getNumPending() == 0);
+
+    HashTable::setDefaultLockFreeReads(false);
+}
+
+static void testItemView() {
+    HashTable h(global_stats, 5, 1);
+    std::string k("somekey");
+    Item i(k, 0xcafe, 0, "somevalue", 9);
+    int64_t row_id(-1);
+    assert(h.set(i, row_id) == NOT_FOUND);
+
+    StoredValue *v = h.find(k);
+    assert(v);
+    ItemView *view = v->toView(false);
+    assert(std::string(view->getKey(), view->getNKey()) == k);
+    assert(std::string(view->getData(), view->getNBytes()) == "somevalue");
+    assert(view->getFlags() == 0xcafe);
+    assert(view->getCas() == v->getCas());
+    // The value is shared, not copied.
+    assert(view->getData() == v->getValue()->getData());
+    delete view;
+
+    view = v->toView(true);
+    assert(view->getCas() == static_cast<uint64_t>(-1));
+
+    // A view handed to the core only ever decodes back to the view.
+    item *tagged = toEngineItem(view);
+    assert(static_cast<void*>(tagged) != static_cast<void*>(view));
+    assert(toItemView(tagged) == view);
+    assert(toItem(tagged) == NULL);
+    assert(toItem(static_cast<const item*>(tagged)) == NULL);
+    delete view;
+
+    // ... and a plain Item decodes to itself.
+    Item *plain = new Item(k, 0, 0, "x", 1);
+    item *untagged = plain;
+    assert(toItemView(untagged) == NULL);
+    assert(toItem(untagged) == plain);
+    delete plain;
+
+    HashTable::setDefaultLockFreeReads(true);
+    HashTable lh(global_stats, 5, 1);
+    Item li(k, 0xcafe, 0, "somevalue", 9);
+    assert(lh.set(li, row_id) == NOT_FOUND);
+    {
+        EpochGuard guard;
+        Item *itm(NULL);
+        StoredValue *sv(NULL);
+        view = NULL;
+        assert(lh.optimisticGet(k, 0, 0, &itm, &sv, &view)
+               == HashTable::OPTIMISTIC_HIT);
+        assert(itm == NULL && view != NULL);
+        assert(std::string(view->getData(), view->getNBytes()) == "somevalue");
+        delete view;
+    }
+    HashTable::setDefaultLockFreeReads(false);
+}
+
+static void testClockReferences() {
+    HashTable h(global_stats, 5, 1);
+    std::string k("clock");
+    store(h, k);
+    StoredValue *v = h.find(k);
+    assert(v);
+
+    // Looking the key up above counted as a reference on top of the
+    // one new values get.
+    assert(v->ageReferences());
+    assert(v->ageReferences());
+    assert(!v->ageReferences());
+
+    // References saturate.
+    for (int i = 0; i < 10; ++i) {
+        v->referenced();
+    }
+    for (int i = 0; i < StoredValue::MAX_REFERENCES; ++i) {
+        assert(v->ageReferences());
+    }
+    assert(!v->ageReferences());
+
+    // The access log's bit is independent from the pager's count.
+    assert(v->isReferenced());
+    assert(!v->isReferenced());
+}
+
+static void testEjectedByPager() {
+    HashTable h(global_stats, 5, 1);
+    std::string pk("paged"), rk("requested");
+    store(h, pk);
+    store(h, rk);
+    StoredValue *paged = h.find(pk);
+    StoredValue *requested = h.find(rk);
+    paged->markClean(NULL);
+    requested->markClean(NULL);
+
+    // Only the pager's ejections count against the eviction
+    // efficiency when the value is fetched back.
+    assert(paged->ejectValue(global_stats, h, true));
+    assert(requested->ejectValue(global_stats, h));
+    assert(!paged->isResident() && paged->wasEjected());
+    assert(!requested->isResident() && !requested->wasEjected());
+}
+
 static void testAdd() {
     HashTable h(global_stats, 5, 1);
     const int nkeys = 5000;
@@ -405,5 +744,12 @@ int main() {
     testResize();
     testConcurrentAccessResize();
     testAutoResize();
+    testIncrementalResize();
+    testTagIndex();
+    testKeyHash();
+    testLockFreeReads();
+    testItemView();
+    testClockReferences();
+    testEjectedByPager();
     exit(0);
 }
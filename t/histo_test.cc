@@ -1,4 +1,5 @@
 #include "config.h"
+#include <pthread.h>
 #include <cassert>
 #include <sstream>
 #include <cmath>
@@ -89,10 +90,85 @@ static void test_complete_range() {
     } while (i != 0);
 }
 
+static void test_log_linear_bins() {
+    typedef LogLinearHistogram<uint64_t> H;
+    size_t prev(0);
+    for (uint64_t v = 0; v < (1 << 20); ++v) {
+        size_t idx = H::getBinIndex(v);
+        assert(idx == prev || idx == prev + 1);
+        assert(H::getBinStart(idx) <= v && v < H::getBinEnd(idx));
+        // No bin is wider than an eighth of the values it holds.
+        assert(H::getBinEnd(idx) - H::getBinStart(idx) <=
+               std::max(static_cast<uint64_t>(1), H::getBinStart(idx) / 8));
+        prev = idx;
+    }
+
+    uint64_t top = std::numeric_limits<uint64_t>::max();
+    assert(H::getBinIndex(top) == H::NUM_BINS - 1);
+    assert(H::getBinIndex(top / 2) < H::NUM_BINS - 1);
+    assert(H::getBinEnd(H::NUM_BINS - 1) == top);
+
+    uint32_t top32 = std::numeric_limits<uint32_t>::max();
+    assert(LogLinearHistogram<uint32_t>::getBinIndex(top32) ==
+           LogLinearHistogram<uint32_t>::NUM_BINS - 1);
+}
+
+static void test_log_linear_percentiles() {
+    LogLinearHistogram<uint64_t> histo;
+    assert(histo.getPercentile(0.5) == 0);
+
+    for (uint64_t v = 1; v <= 1000; ++v) {
+        histo.add(v);
+    }
+    histo.add(5, 2);
+    assert(histo.total() == 1002);
+
+    uint64_t p50(histo.getPercentile(0.5));
+    uint64_t p99(histo.getPercentile(0.99));
+    uint64_t p999(histo.getPercentile(0.999));
+    assert(p50 >= 499 && p50 <= 499 + 499 / 8);
+    assert(p99 >= 990 && p99 <= 990 + 990 / 8);
+    assert(p999 >= 999 && p999 <= 999 + 999 / 8);
+    assert(histo.getPercentile(1.0) >= 1000);
+
+    histo.reset();
+    assert(histo.total() == 0);
+    assert(histo.getPercentile(0.99) == 0);
+}
+
+extern "C" {
+    static void *log_linear_adder(void *arg) {
+        LogLinearHistogram<uint64_t> *histo = static_cast<LogLinearHistogram<uint64_t>*>(arg);
+        for (uint64_t v = 0; v < 10000; ++v) {
+            histo->add(v);
+        }
+        return NULL;
+    }
+}
+
+static void test_log_linear_threads() {
+    LogLinearHistogram<uint64_t> histo;
+    pthread_t threads[8];
+    for (size_t i = 0; i < 8; ++i) {
+        assert(pthread_create(&threads[i], NULL, log_linear_adder, &histo) == 0);
+    }
+    for (size_t i = 0; i < 8; ++i) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+    assert(histo.total() == 80000);
+
+    std::vector<size_t> counts;
+    histo.getCounts(counts);
+    assert(counts[LogLinearHistogram<uint64_t>::getBinIndex(3)] == 8);
+}
+
 int main() {
     test_basic();
     test_fixed_input();
     test_exponential();
     test_complete_range();
+    test_log_linear_bins();
+    test_log_linear_percentiles();
+    test_log_linear_threads();
     return 0;
 }
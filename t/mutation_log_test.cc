@@ -3,6 +3,7 @@
 #include <pthread.h>
 #include <signal.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #include <vector>
 #include <set>
@@ -161,6 +162,307 @@ static void testLogging() {
 
         assert(maps[2].find("key1") != maps[2].end());
         assert(maps[3].find("key2") != maps[3].end());
+
+        // One vbucket at a time, as the access log warmup does.
+        std::map<std::string, uint64_t> one[4];
+        h.apply(&one, loaderFun, 3);
+        assert(one[2].size() == 0);
+        assert(one[3].size() == 1);
+        assert(one[3].find("key2") != one[3].end());
+        // Not registered with setVbVer().
+        h.apply(&one, loaderFun, 0);
+        assert(one[0].size() == 0);
+    }
+
+    remove(TMP_LOG_FILE);
+}
+
+static void testReplay() {
+    remove(TMP_LOG_FILE);
+    remove(TMP_LOG_FILE ".compact");
+
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+        ml.newItem(3, "key1", 1);
+        ml.newItem(3, "key2", 2);
+        ml.commit1();
+        ml.commit2();
+        ml.flush();
+
+        // Everything below is the tail a compaction would replay.
+        size_t snapshot(ml.logSize);
+        ml.delItem(3, "key1");
+        ml.newItem(3, "key3", 3);
+        ml.commit1();
+        ml.commit2();
+        ml.flush();
+        size_t middle(ml.logSize);
+        assert(middle > snapshot);
+        ml.newItem(2, "key4", 4);
+        ml.deleteAll(1);
+        // Not flushed yet, so not visible.
+        assert(ml.logSize == middle);
+
+        MutationLog compacted(TMP_LOG_FILE ".compact");
+        compacted.open();
+        // The image of the data before the snapshot.
+        compacted.newItem(3, "key1", 1);
+        compacted.newItem(3, "key2", 2);
+        compacted.commit1();
+        compacted.commit2();
+
+        assert(compacted.replay(ml, snapshot, snapshot) == 0);
+        assert(compacted.replay(ml, snapshot, middle) == 4);
+        ml.commit1();
+        ml.commit2();
+        assert(compacted.replay(ml, middle, ml.logSize) == 4);
+        assert(compacted.itemsLogged[ML_NEW] == 4);
+        assert(compacted.itemsLogged[ML_DEL] == 1);
+        assert(compacted.itemsLogged[ML_DEL_ALL] == 1);
+        assert(compacted.itemsLogged[ML_COMMIT2] == 3);
+
+        assert(ml.replaceWith(compacted));
+    }
+
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+        MutationLogHarvester h(ml);
+        h.setVbVer(1, 1);
+        h.setVbVer(2, 1);
+        h.setVbVer(3, 1);
+
+        assert(h.load());
+        assert(h.getItemsSeen()[ML_NEW] == 4);
+
+        std::map<std::string, uint64_t> maps[4];
+        h.apply(&maps, loaderFun);
+        assert(maps[2].size() == 1);
+        assert(maps[3].size() == 2);
+        assert(maps[3].find("key1") == maps[3].end());
+        assert(maps[3]["key2"] == 2);
+        assert(maps[3]["key3"] == 3);
+    }
+
+    remove(TMP_LOG_FILE);
+}
+
+static void streamDelFun(void *arg, uint16_t vb, const std::string &k) {
+    std::map<std::string, uint64_t> *maps = reinterpret_cast<std::map<std::string, uint64_t> *>(arg);
+    if (k.empty()) {
+        maps[vb].clear();
+    } else {
+        maps[vb].erase(k);
+    }
+}
+
+static void testStream() {
+    remove(TMP_LOG_FILE);
+
+    const int NUM_VBUCKETS(8);
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+        ml.setSyncConfig("off");
+
+        // Enough transactions to span several read ahead buffers.
+        uint64_t rowid(0);
+        for (int txn = 0; txn < 600; ++txn) {
+            for (int i = 0; i < 100; ++i) {
+                char key[32];
+                snprintf(key, sizeof(key), "key%d", (txn * 37 + i) % 5000);
+                uint16_t vb = static_cast<uint16_t>(i % NUM_VBUCKETS);
+                if (i % 7 == 0) {
+                    ml.delItem(vb, key);
+                } else {
+                    ml.newItem(vb, key, ++rowid);
+                }
+            }
+            if (txn == 150) {
+                ml.deleteAll(3);
+            }
+            ml.commit1();
+            ml.commit2();
+        }
+        // Never committed.
+        ml.newItem(1, "uncommitted", ++rowid);
+        ml.delItem(2, "key2");
+    }
+
+    std::map<std::string, uint64_t> expected[NUM_VBUCKETS];
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+        MutationLogHarvester h(ml);
+        for (int i = 0; i < NUM_VBUCKETS; ++i) {
+            h.setVbVer(static_cast<uint16_t>(i), 1);
+        }
+        assert(!h.load());
+        h.apply(&expected, loaderFun);
+    }
+
+    for (size_t threads = 1; threads <= 4; ++threads) {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+        MutationLogHarvester h(ml);
+        for (int i = 0; i < NUM_VBUCKETS; ++i) {
+            h.setVbVer(static_cast<uint16_t>(i), 1);
+        }
+
+        std::map<std::string, uint64_t> maps[NUM_VBUCKETS];
+        assert(!h.stream(&maps, loaderFun, streamDelFun, threads));
+        for (int i = 0; i < NUM_VBUCKETS; ++i) {
+            assert(maps[i] == expected[i]);
+        }
+        assert(maps[1].find("uncommitted") == maps[1].end());
+        assert(h.total() > 60000);
+
+        std::vector<mutation_log_uncommitted_t> uitems;
+        h.getUncommitted(uitems);
+        assert(uitems.size() == 2);
+    }
+
+    remove(TMP_LOG_FILE);
+}
+
+static void testWriteOptions() {
+    remove(TMP_LOG_FILE);
+
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.setDirectIO(true);
+        ml.setPreallocSize(1024 * 1024);
+        ml.open();
+        assert(ml.setSyncConfig("full"));
+
+        for (int i = 0; i < 1000; ++i) {
+            char key[32];
+            snprintf(key, sizeof(key), "key%d", i);
+            ml.newItem(static_cast<uint16_t>(i % 4), key, i + 1);
+            if (i % 100 == 99) {
+                ml.commit1();
+                ml.commit2();
+            }
+        }
+        // Every commit waited for its sync, but one whose data was
+        // already synced doesn't sync again.
+        assert(ml.syncWaitHisto.total() == 20);
+        assert(ml.groupCommitHisto.total() == ml.syncTimeHisto.total());
+        assert(ml.syncTimeHisto.total() >= 10);
+        assert(ml.syncTimeHisto.total() <= 20);
+    }
+
+    struct stat st;
+    assert(stat(TMP_LOG_FILE, &st) == 0);
+    // The space reserved ahead isn't part of the log.
+    assert(st.st_size % 4096 == 0);
+    assert(st.st_size < 1024 * 1024);
+
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.setDirectIO(true);
+        ml.open();
+        MutationLogHarvester h(ml);
+        for (uint16_t i = 0; i < 4; ++i) {
+            h.setVbVer(i, 1);
+        }
+        assert(h.load());
+
+        std::map<std::string, uint64_t> maps[4];
+        h.apply(&maps, loaderFun);
+        for (int i = 0; i < 4; ++i) {
+            assert(maps[i].size() == 250);
+        }
+        assert(maps[1]["key1"] == 2);
+    }
+
+    remove(TMP_LOG_FILE);
+}
+
+struct group_commit_args {
+    MutationLog *log;
+    Mutex *lock;
+    int id;
+};
+
+static const int GROUP_COMMIT_THREADS(8);
+static const int GROUP_COMMITS(20);
+
+extern "C" {
+    static void *launch_committer_thread(void *arg) {
+        group_commit_args *args(static_cast<group_commit_args*>(arg));
+        MutationLog &ml(*args->log);
+        for (int i = 0; i < GROUP_COMMITS; ++i) {
+            char key[32];
+            snprintf(key, sizeof(key), "key%d", args->id * GROUP_COMMITS + i);
+
+            LockHolder lh(*args->lock);
+            ml.newItem(static_cast<uint16_t>(args->id), key, i + 1);
+            bool needSync(ml.logCommit1());
+            lh.unlock();
+            if (needSync) {
+                ml.syncCommit();
+            }
+            lh.lock();
+            needSync = ml.logCommit2();
+            lh.unlock();
+            if (needSync) {
+                ml.syncCommit();
+            }
+        }
+        return NULL;
+    }
+}
+
+static void testGroupCommit() {
+    remove(TMP_LOG_FILE);
+
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.setGroupCommitWindow(2000);
+        ml.open();
+        assert(ml.setSyncConfig("full"));
+        assert(ml.setFlushConfig("full"));
+
+        Mutex lock;
+        pthread_t threads[GROUP_COMMIT_THREADS];
+        group_commit_args args[GROUP_COMMIT_THREADS];
+        for (int i = 0; i < GROUP_COMMIT_THREADS; ++i) {
+            args[i].log = &ml;
+            args[i].lock = &lock;
+            args[i].id = i;
+            int r = pthread_create(&threads[i], NULL,
+                                   launch_committer_thread, &args[i]);
+            assert(r == 0);
+        }
+        for (int i = 0; i < GROUP_COMMIT_THREADS; ++i) {
+            int r = pthread_join(threads[i], NULL);
+            assert(r == 0);
+        }
+
+        // Every commit flushed its own block and waited for a sync,
+        // but the committers shared them.
+        const int commits(2 * GROUP_COMMIT_THREADS * GROUP_COMMITS);
+        assert(ml.syncWaitHisto.total() == static_cast<size_t>(commits));
+        assert(ml.groupCommitHisto.total() == ml.syncTimeHisto.total());
+        assert(ml.syncTimeHisto.total() < static_cast<size_t>(commits));
+    }
+
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+        MutationLogHarvester h(ml);
+        for (uint16_t i = 0; i < GROUP_COMMIT_THREADS; ++i) {
+            h.setVbVer(i, 1);
+        }
+        assert(h.load());
+
+        std::map<std::string, uint64_t> maps[GROUP_COMMIT_THREADS];
+        h.apply(&maps, loaderFun);
+        for (int i = 0; i < GROUP_COMMIT_THREADS; ++i) {
+            assert(maps[i].size() == static_cast<size_t>(GROUP_COMMITS));
+        }
     }
 
     remove(TMP_LOG_FILE);
@@ -508,6 +810,10 @@ int main(int, char **) {
     testUnconfigured();
     testSyncSet();
     testLogging();
+    testReplay();
+    testStream();
+    testWriteOptions();
+    testGroupCommit();
     testDelAll();
     testLoggingDirty();
     testLoggingBadCRC();
@@ -8,6 +8,7 @@ int main(int argc, char **argv) {
    (void)argc; (void)argv;
 
    assert(Priority::BgFetcherPriority > Priority::TapBgFetcherPriority);
+   assert(Priority::BgFetcherPriority > Priority::WarmupPriority);
    assert(Priority::TapBgFetcherPriority == Priority::VBucketPersistHighPriority);
    assert(Priority::VBucketPersistHighPriority > Priority::VKeyStatBgFetcherPriority);
    assert(Priority::VKeyStatBgFetcherPriority > Priority::FlusherPriority);
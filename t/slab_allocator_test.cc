@@ -0,0 +1,217 @@
+#include "config.h"
+
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+#include "slab_allocator.hh"
+#include "threadtests.hh"
+
+static void testSizeClasses() {
+    SlabAllocator sa(NULL);
+    assert(sa.getChunkSize(1) == SlabAllocator::MIN_CHUNK_SIZE);
+    assert(sa.getChunkSize(SlabAllocator::MIN_CHUNK_SIZE) == SlabAllocator::MIN_CHUNK_SIZE);
+    assert(sa.getChunkSize(SlabAllocator::MAX_CHUNK_SIZE) == SlabAllocator::MAX_CHUNK_SIZE);
+    assert(sa.getChunkSize(SlabAllocator::MAX_CHUNK_SIZE + 1) == 0);
+
+    size_t prev(0);
+    for (size_t i = 1; i <= SlabAllocator::MAX_CHUNK_SIZE; i += 7) {
+        size_t cs = sa.getChunkSize(i);
+        assert(cs >= i);
+        assert(cs >= prev);
+        assert(cs % sizeof(void*) == 0);
+        // No class wastes more than the 25% growth factor.
+        assert(cs <= SlabAllocator::MIN_CHUNK_SIZE || cs <= i + i / 4 + sizeof(void*));
+        prev = cs;
+    }
+}
+
+static void testNoAllocator() {
+    // Without an engine there is no allocator, so memory comes from
+    // the heap.
+    void *p = SlabAllocator::allocate(100);
+    assert(!SlabAllocator::owns(p));
+    SlabAllocator::deallocate(p);
+}
+
+static void testAllocateRelease() {
+    SlabAllocator sa(NULL);
+
+    std::vector<char*> chunks;
+    for (size_t i = 1; i < 5000; ++i) {
+        size_t size = (i * 37) % 600 + 1;
+        char *p = static_cast<char*>(sa.allocateChunk(size));
+        assert(SlabAllocator::owns(p));
+        memset(p, static_cast<int>(size & 0xff), size);
+        chunks.push_back(p);
+    }
+    assert(sa.getUsedBytes() > 0);
+    assert(sa.getReservedBytes() >= sa.getUsedBytes());
+    assert(sa.getNumSlabs() > 0);
+
+    // Every chunk must still hold what was written to it.
+    for (size_t i = 1; i < 5000; ++i) {
+        size_t size = (i * 37) % 600 + 1;
+        char *p = chunks[i - 1];
+        for (size_t j = 0; j < size; ++j) {
+            assert(p[j] == static_cast<char>(size & 0xff));
+        }
+    }
+
+    std::vector<char*>::iterator it;
+    for (it = chunks.begin(); it != chunks.end(); ++it) {
+        SlabAllocator::deallocate(*it);
+    }
+    assert(sa.getUsedBytes() == 0);
+    sa.flushThreadCache();
+
+    void *big = sa.allocateChunk(SlabAllocator::MAX_CHUNK_SIZE + 1);
+    assert(!SlabAllocator::owns(big));
+    SlabAllocator::deallocate(big);
+}
+
+static void testEmptySlabsReleased() {
+    SlabAllocator sa(NULL);
+    size_t size = SlabAllocator::MAX_CHUNK_SIZE;
+
+    // Fill several slabs of a single class.
+    std::vector<void*> chunks;
+    while (sa.getNumSlabs() < 4) {
+        chunks.push_back(sa.allocateChunk(size));
+    }
+    void *mine = sa.allocateChunk(size);
+
+    std::vector<void*>::iterator it;
+    for (it = chunks.begin(); it != chunks.end(); ++it) {
+        SlabAllocator::deallocate(*it);
+    }
+    sa.flushThreadCache();
+
+    // Only the slab holding the live chunk and one spare remain.
+    assert(sa.getNumSlabs() <= 2);
+    assert(sa.getUsedBytes() == sa.getChunkSize(size));
+
+    SlabAllocator::deallocate(mine);
+    sa.flushThreadCache();
+    assert(sa.getNumSlabs() == 1);
+    assert(sa.getUsedBytes() == 0);
+}
+
+static void testSeparateAllocators() {
+    SlabAllocator a(NULL), b(NULL);
+    void *p = a.allocateChunk(64);
+    void *q = b.allocateChunk(64);
+    assert(a.getUsedBytes() == b.getUsedBytes());
+
+    // A chunk goes back to the allocator it came from, whichever
+    // allocator the releasing code has at hand.
+    SlabAllocator::deallocate(p);
+    assert(a.getUsedBytes() == 0);
+    assert(b.getUsedBytes() == b.getChunkSize(64));
+    SlabAllocator::deallocate(q);
+    assert(b.getUsedBytes() == 0);
+}
+
+class Churner : public Generator<bool> {
+public:
+    Churner(SlabAllocator &a) : sa(a) {}
+
+    bool operator()() {
+        std::vector<void*> mine;
+        for (size_t round = 0; round < 20; ++round) {
+            for (size_t i = 0; i < 500; ++i) {
+                mine.push_back(sa.allocateChunk(i % 200 + 8));
+            }
+            while (!mine.empty()) {
+                assert(SlabAllocator::owns(mine.back()));
+                SlabAllocator::deallocate(mine.back());
+                mine.pop_back();
+            }
+        }
+        return true;
+    }
+
+private:
+    SlabAllocator &sa;
+};
+
+static void testConcurrentChurn() {
+    SlabAllocator sa(NULL);
+
+    Churner churner(sa);
+    getCompletedThreads<bool>(8, &churner);
+
+    // Every chunk handed out has come back.
+    assert(sa.getUsedBytes() == 0);
+}
+
+static void testDestroyInUse() {
+    SlabAllocator *sa = new SlabAllocator(NULL);
+    void *p = sa->allocateChunk(64);
+
+    // Freeing the slabs under a live chunk isn't an option, so the
+    // allocator is leaked instead.
+    assert(!SlabAllocator::destroy(sa));
+    SlabAllocator::deallocate(p);
+    assert(SlabAllocator::destroy(sa));
+    assert(!SlabAllocator::destroy(NULL));
+}
+
+struct CacheHolder {
+    SlabAllocator *sa;
+    SyncObject     sync;
+    bool           cached;
+    bool           destroyed;
+};
+
+extern "C" {
+    static void *hold_thread_cache(void *arg) {
+        CacheHolder *h = static_cast<CacheHolder*>(arg);
+        // Leave a chunk in this thread's cache, then keep the thread
+        // (and its slot pointing at the cache) alive until the
+        // allocator is gone.
+        SlabAllocator::deallocate(h->sa->allocateChunk(64));
+        LockHolder lh(h->sync);
+        h->cached = true;
+        h->sync.notify();
+        while (!h->destroyed) {
+            h->sync.wait();
+        }
+        return NULL;
+    }
+}
+
+static void testDestroyWithLiveThreadCaches() {
+    CacheHolder h;
+    h.sa = new SlabAllocator(NULL);
+    h.cached = false;
+    h.destroyed = false;
+
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, hold_thread_cache, &h) == 0);
+    LockHolder lh(h.sync);
+    while (!h.cached) {
+        h.sync.wait();
+    }
+    assert(SlabAllocator::destroy(h.sa));
+
+    // The thread exits after the allocator freed its cache, which must
+    // not be handed back to the allocator a second time.
+    h.destroyed = true;
+    h.sync.notify();
+    lh.unlock();
+    assert(pthread_join(thread, NULL) == 0);
+}
+
+int main() {
+    putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
+    testSizeClasses();
+    testNoAllocator();
+    testAllocateRelease();
+    testEmptySlabsReleased();
+    testSeparateAllocators();
+    testConcurrentChurn();
+    testDestroyInUse();
+    testDestroyWithLiveThreadCaches();
+    return 0;
+}
@@ -178,6 +178,68 @@ static void testVBucketFilterFormatter(void) {
     assertFilterTxt(filter, "{ [1,103] }");
 }
 
+static void testBGFetchQueue(void) {
+    VBucket vb(1, vbucket_state_active, global_stats, checkpoint_config);
+    int c1, c2, c3;
+
+    assert(!vb.hasPendingBGFetchItems());
+    assert(vb.queueBGFetchItem(new VBucketBGFetchItem("a", 1, &c1, false)));
+    assert(!vb.queueBGFetchItem(new VBucketBGFetchItem("a", 1, &c2, true)));
+    assert(!vb.queueBGFetchItem(new VBucketBGFetchItem("b", 2, &c3, true)));
+    assert(vb.hasPendingBGFetchItems());
+
+    vb_bgfetch_queue_t items;
+    assert(vb.getBGFetchItems(items) == 2);
+    assert(!vb.hasPendingBGFetchItems());
+    assert(items["a"].bgfetched_list.size() == 2);
+    assert(!items["a"].isMetaOnly);
+    assert(items["b"].bgfetched_list.size() == 1);
+    assert(items["b"].isMetaOnly);
+    VBucket::clearBGFetchItems(items);
+    assert(items.empty());
+
+    // The queue is empty again, so the next fetch has to be announced.
+    assert(vb.queueBGFetchItem(new VBucketBGFetchItem("c", 3, &c1, false)));
+}
+
+class CountingAbortCallback : public Callback<const void*> {
+public:
+    void callback(const void *&cookie) {
+        cookies.push_back(cookie);
+    }
+
+    std::vector<const void*> cookies;
+};
+
+static void testBGFetchAbortOnDelete(void) {
+    shared_ptr<CountingAbortCallback> cb(new CountingAbortCallback);
+    Configuration config;
+    VBucketMap vbm(config);
+    vbm.setBGFetchAbortCallback(cb);
+    int c1, c2, c3;
+
+    RCPtr<VBucket> vb(new VBucket(1, vbucket_state_active, global_stats,
+                                  checkpoint_config));
+    vbm.addBucket(vb);
+    vb->queueBGFetchItem(new VBucketBGFetchItem("a", 1, &c1, false));
+    vb->queueBGFetchItem(new VBucketBGFetchItem("a", 1, &c2, true));
+    vb->queueBGFetchItem(new VBucketBGFetchItem("b", 2, &c3, false));
+
+    // Fetches already handed to the fetcher are its to complete.
+    vb_bgfetch_queue_t items;
+    assert(vb->getBGFetchItems(items) == 2);
+    VBucket::clearBGFetchItems(items);
+    vb->queueBGFetchItem(new VBucketBGFetchItem("c", 3, &c1, false));
+    vb->queueBGFetchItem(new VBucketBGFetchItem("d", 4, &c2, true));
+
+    vbm.removeBucket(1);
+    assert(cb->cookies.empty());
+    vb.reset();
+    assert(cb->cookies.size() == 2);
+    assert(std::count(cb->cookies.begin(), cb->cookies.end(), &c1) == 1);
+    assert(std::count(cb->cookies.begin(), cb->cookies.end(), &c2) == 1);
+}
+
 int main(int argc, char **argv) {
     (void)argc; (void)argv;
     putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
@@ -191,4 +253,6 @@ int main(int argc, char **argv) {
     testConcurrentUpdate();
     testVBucketFilter();
     testVBucketFilterFormatter();
+    testBGFetchQueue();
+    testBGFetchAbortOnDelete();
 }
@@ -28,6 +28,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sys/time.h>
 #include <netinet/in.h>
 
 #ifdef HAS_ARPA_INET_H
@@ -212,6 +213,75 @@ static test_result test_persistence(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
 }
 }
 
+struct op_thread_args {
+    ENGINE_HANDLE *h;
+    ENGINE_HANDLE_V1 *h1;
+    int id;
+    size_t ops;
+    size_t size;
+};
+
+extern "C" {
+static void *set_get_thread(void *arg) {
+    struct op_thread_args *args = static_cast<struct op_thread_args *>(arg);
+    std::string data(args->size, 'x');
+    char key[32];
+
+    for (size_t i = 0; i < args->ops; ++i) {
+        snprintf(key, sizeof(key), "t%d-k%d", args->id, static_cast<int>(i % 1000));
+        item *it = NULL;
+        check(storeCasVb11(args->h, args->h1, NULL, OPERATION_SET, key, data.data(),
+                           data.length(), 9713, &it, 0, 0) == ENGINE_SUCCESS,
+              "store failure");
+        args->h1->release(args->h, NULL, it);
+
+        check(args->h1->get(args->h, NULL, &it, key, strlen(key), 0) == ENGINE_SUCCESS,
+              "get failure");
+        args->h1->release(args->h, NULL, it);
+    }
+    return NULL;
+}
+
+/**
+ * Run the same number of sets and gets per thread with an increasing
+ * number of threads, to see how the throughput scales.
+ */
+static test_result test_set_get_scaling(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    size_t maxThreads = env_int("TEST_MAX_THREADS", 8);
+    size_t ops = env_int("TEST_OPS_PER_THREAD", 100000);
+    size_t size = env_int("TEST_VAL_SIZE", 20);
+
+    for (size_t n = 1; n <= maxThreads; n *= 2) {
+        std::vector<pthread_t> threads(n);
+        std::vector<struct op_thread_args> args(n);
+
+        struct timeval start, end;
+        gettimeofday(&start, NULL);
+        for (size_t i = 0; i < n; ++i) {
+            args[i].h = h;
+            args[i].h1 = h1;
+            args[i].id = static_cast<int>(i);
+            args[i].ops = ops;
+            args[i].size = size;
+            check(pthread_create(&threads[i], NULL, set_get_thread, &args[i]) == 0,
+                  "Failed to create a thread");
+        }
+        for (size_t i = 0; i < n; ++i) {
+            check(pthread_join(threads[i], NULL) == 0, "Failed to join a thread");
+        }
+        gettimeofday(&end, NULL);
+
+        double secs = (end.tv_sec - start.tv_sec) +
+            (end.tv_usec - start.tv_usec) / 1000000.0;
+        std::cout << n << " threads - "
+                  << static_cast<size_t>(2 * n * ops / secs) << " ops/sec" << std::endl;
+    }
+    wait_for_flusher_to_settle(h, h1);
+
+    return SUCCESS;
+}
+}
+
 extern "C" MEMCACHED_PUBLIC_API
 bool setup_suite(struct test_harness *th) {
     testHarness = *th;
@@ -224,6 +294,8 @@ engine_test_t* get_tests(void) {
     static engine_test_t tests[]  = {
         {"test persistence", test_persistence, NULL, teardown, NULL,
          NULL, NULL},
+        {"test set/get scaling", test_set_get_scaling, NULL, teardown, NULL,
+         NULL, NULL},
         {NULL, NULL, NULL, NULL, NULL, NULL, NULL}
     };
     return tests;
@@ -178,6 +178,51 @@ void VBucket::resetStats() {
     dirtyQueueDrain.set(0);
 }
 
+bool VBucket::queueBGFetchItem(VBucketBGFetchItem *fetch) {
+    LockHolder lh(pendingBGFetchesLock);
+    bool wasEmpty = pendingBGFetches.empty();
+    vb_bgfetch_item_ctx_t &ctx = pendingBGFetches[fetch->key];
+    ctx.bgfetched_list.push_back(fetch);
+    ctx.isMetaOnly = ctx.isMetaOnly && fetch->metaDataOnly;
+    return wasEmpty;
+}
+
+size_t VBucket::getBGFetchItems(vb_bgfetch_queue_t &fetches) {
+    assert(fetches.empty());
+    LockHolder lh(pendingBGFetchesLock);
+    fetches.swap(pendingBGFetches);
+    return fetches.size();
+}
+
+void VBucket::clearBGFetchItems(vb_bgfetch_queue_t &fetches) {
+    vb_bgfetch_queue_t::iterator it;
+    for (it = fetches.begin(); it != fetches.end(); ++it) {
+        std::list<VBucketBGFetchItem *> &items = it->second.bgfetched_list;
+        std::list<VBucketBGFetchItem *>::iterator iit;
+        for (iit = items.begin(); iit != items.end(); ++iit) {
+            delete *iit;
+        }
+        delete it->second.value.getValue();
+    }
+    fetches.clear();
+}
+
+void VBucket::abortBGFetchItems() {
+    LockHolder lh(pendingBGFetchesLock);
+    if (bgFetchAbortCb) {
+        vb_bgfetch_queue_t::iterator it;
+        for (it = pendingBGFetches.begin(); it != pendingBGFetches.end(); ++it) {
+            std::list<VBucketBGFetchItem *> &items = it->second.bgfetched_list;
+            std::list<VBucketBGFetchItem *>::iterator iit;
+            for (iit = items.begin(); iit != items.end(); ++iit) {
+                const void *cookie = (*iit)->cookie;
+                bgFetchAbortCb->callback(cookie);
+            }
+        }
+    }
+    clearBGFetchItems(pendingBGFetches);
+}
+
 void VBucket::addStats(bool details, ADD_STAT add_stat, const void *c) {
     addStat(NULL, toString(state), add_stat, c);
     if (details) {
@@ -6,6 +6,7 @@
 #include <cassert>
 
 #include <map>
+#include <list>
 #include <vector>
 #include <sstream>
 #include <algorithm>
@@ -14,11 +15,45 @@
 #include "queueditem.hh"
 #include "common.hh"
 #include "atomic.hh"
+#include "callbacks.hh"
 #include "stored-value.hh"
 #include "checkpoint.hh"
 
 const size_t BASE_VBUCKET_SIZE=1024;
 
+/**
+ * A single client's request to fetch a non-resident item from disk.
+ */
+class VBucketBGFetchItem {
+public:
+    VBucketBGFetchItem(const std::string &k, uint64_t r, const void *c,
+                       bool metaOnly) :
+        key(k), rowid(r), cookie(c), initTime(gethrtime()),
+        metaDataOnly(metaOnly) { }
+
+    const std::string key;
+    const uint64_t    rowid;
+    const void       *cookie;
+    const hrtime_t    initTime;
+    const bool        metaDataOnly;
+};
+
+/**
+ * All the pending fetches for a single key.  They are satisfied by a
+ * single read from the underlying store, the result of which is left
+ * in value.
+ */
+struct vb_bgfetch_item_ctx_t {
+    vb_bgfetch_item_ctx_t() : isMetaOnly(true) { }
+
+    std::list<VBucketBGFetchItem *> bgfetched_list;
+    //! True if none of the requests need more than the item's metadata.
+    bool isMetaOnly;
+    GetValue value;
+};
+
+typedef unordered_map<std::string, vb_bgfetch_item_ctx_t> vb_bgfetch_queue_t;
+
 /**
  * Function object that returns true if the given vbucket is acceptable.
  */
@@ -121,6 +156,12 @@ public:
                              "Have %d pending ops while destroying vbucket\n",
                              pendingOps.size());
         }
+        if (!pendingBGFetches.empty()) {
+            getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                             "Have %d pending bg fetches while destroying vbucket\n",
+                             pendingBGFetches.size());
+            abortBGFetchItems();
+        }
         stats.memOverhead.decr(sizeof(VBucket) + ht.memorySize() + sizeof(CheckpointManager));
         assert(stats.memOverhead.get() < GIGANTOR);
         getLogger()->log(EXTENSION_LOG_INFO, NULL,
@@ -197,6 +238,44 @@ public:
         backfill.isBackfillPhase = backfillPhase;
     }
 
+    /**
+     * Queue a background fetch against this vbucket.  Fetches for a key
+     * that already has a fetch pending are coalesced so the key is only
+     * read from disk once.
+     *
+     * @param fetch the fetch request (ownership is transferred)
+     * @return true if the queue was empty before this fetch was added
+     */
+    bool queueBGFetchItem(VBucketBGFetchItem *fetch);
+
+    /**
+     * Move all the pending background fetches into the given (empty)
+     * queue.
+     *
+     * @return the number of distinct keys handed over
+     */
+    size_t getBGFetchItems(vb_bgfetch_queue_t &fetches);
+
+    bool hasPendingBGFetchItems() {
+        LockHolder lh(pendingBGFetchesLock);
+        return !pendingBGFetches.empty();
+    }
+
+    /**
+     * Free all the fetch requests in the given queue and any values that
+     * were read for them.
+     */
+    static void clearBGFetchItems(vb_bgfetch_queue_t &fetches);
+
+    /**
+     * Set the callback told about each fetch request still pending when
+     * this vbucket is destroyed.  It is handed the request's cookie,
+     * and must be set before the vbucket is shared with other threads.
+     */
+    void setBGFetchAbortCallback(shared_ptr<Callback<const void*> > cb) {
+        bgFetchAbortCb = cb;
+    }
+
     HashTable         ht;
     CheckpointManager checkpointManager;
     struct {
@@ -264,12 +343,21 @@ private:
 
     void fireAllOps(EventuallyPersistentEngine &engine, ENGINE_ERROR_CODE code);
 
+    /**
+     * Drop the pending fetch requests, telling the abort callback about
+     * each of them.
+     */
+    void abortBGFetchItems();
+
     int                      id;
     Atomic<vbucket_state_t>  state;
     vbucket_state_t          initialState;
     Mutex                    pendingOpLock;
     std::vector<const void*> pendingOps;
     hrtime_t                 pendingOpsStart;
+    Mutex                    pendingBGFetchesLock;
+    vb_bgfetch_queue_t       pendingBGFetches;
+    shared_ptr<Callback<const void*> > bgFetchAbortCb;
     EPStats                 &stats;
 
     DISALLOW_COPY_AND_ASSIGN(VBucket);
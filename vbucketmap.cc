@@ -8,6 +8,7 @@ VBucketMap::VBucketMap(Configuration &config) :
     bucketDeletion(new Atomic<bool>[config.getMaxVbuckets()]),
     bucketVersions(new Atomic<uint16_t>[config.getMaxVbuckets()]),
     persistenceCheckpointIds(new Atomic<uint64_t>[config.getMaxVbuckets()]),
+    bucketTrafficEnabled(new Atomic<bool>[config.getMaxVbuckets()]),
     size(config.getMaxVbuckets())
 {
     highPriorityVbSnapshot.set(false);
@@ -16,6 +17,7 @@ VBucketMap::VBucketMap(Configuration &config) :
         bucketDeletion[i].set(false);
         bucketVersions[i].set(static_cast<uint16_t>(-1));
         persistenceCheckpointIds[i].set(0);
+        bucketTrafficEnabled[i].set(false);
     }
 }
 
@@ -24,6 +26,7 @@ VBucketMap::~VBucketMap() {
     delete[] bucketDeletion;
     delete[] bucketVersions;
     delete[] persistenceCheckpointIds;
+    delete[] bucketTrafficEnabled;
 }
 
 RCPtr<VBucket> VBucketMap::getBucket(uint16_t id) const {
@@ -37,6 +40,9 @@ RCPtr<VBucket> VBucketMap::getBucket(uint16_t id) const {
 
 void VBucketMap::addBucket(const RCPtr<VBucket> &b) {
     if (static_cast<size_t>(b->getId()) < size) {
+        if (bgFetchAbortCb) {
+            b->setBGFetchAbortCallback(bgFetchAbortCb);
+        }
         buckets[b->getId()].reset(b);
         getLogger()->log(EXTENSION_LOG_INFO, NULL,
                          "Mapped new vbucket %d in state %s",
@@ -115,6 +121,18 @@ bool VBucketMap::setLowPriorityVbSnapshotFlag(bool lowPrioritySnapshot) {
     return lowPriorityVbSnapshot.cas(!lowPrioritySnapshot, lowPrioritySnapshot);
 }
 
+bool VBucketMap::isBucketTrafficEnabled(uint16_t id) const {
+    if (static_cast<size_t>(id) < size) {
+        return bucketTrafficEnabled[id].get();
+    }
+    return false;
+}
+
+void VBucketMap::setBucketTrafficEnabled(uint16_t id, bool enabled) {
+    assert(id < size);
+    bucketTrafficEnabled[id].set(enabled);
+}
+
 void VBucketMap::addBuckets(const std::vector<VBucket*> &newBuckets) {
     std::vector<VBucket*>::const_iterator it;
     for (it = newBuckets.begin(); it != newBuckets.end(); ++it) {
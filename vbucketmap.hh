@@ -85,14 +85,32 @@ public:
      *                "false".
      */
     bool setLowPriorityVbSnapshotFlag(bool lowPrioritySnapshot);
+
+    /**
+     * Check if warmup has loaded the keys of a vbucket, so it may serve
+     * reads while the rest of the bucket is still warming up.
+     */
+    bool isBucketTrafficEnabled(uint16_t id) const;
+    void setBucketTrafficEnabled(uint16_t id, bool enabled);
+
+    /**
+     * Set the background fetch abort callback (see
+     * VBucket::setBGFetchAbortCallback()) given to every vbucket added
+     * from now on.
+     */
+    void setBGFetchAbortCallback(shared_ptr<Callback<const void*> > cb) {
+        bgFetchAbortCb = cb;
+    }
 private:
 
     RCPtr<VBucket> *buckets;
     Atomic<bool> *bucketDeletion;
     Atomic<uint16_t> *bucketVersions;
     Atomic<uint64_t> *persistenceCheckpointIds;
+    Atomic<bool> *bucketTrafficEnabled;
     Atomic<bool> highPriorityVbSnapshot;
     Atomic<bool> lowPriorityVbSnapshot;
+    shared_ptr<Callback<const void*> > bgFetchAbortCb;
     size_t size;
 
     DISALLOW_COPY_AND_ASSIGN(VBucketMap);
@@ -15,6 +15,10 @@
  *   limitations under the License.
  */
 #include "config.h"
+
+#include <algorithm>
+#include <set>
+
 #include "warmup.hh"
 #include "ep_engine.h"
 
@@ -111,6 +115,13 @@ std::ostream& operator <<(std::ostream &out, const WarmupState &state)
 /**
  * Helper class used to insert items into the storage by using
  * the KVStore::dump method to load items from the database
+ *
+ * The mutation log is streamed into the hash tables by several threads,
+ * each owning a disjoint set of vbuckets, so callback() may run
+ * concurrently for different vbuckets.  The hash tables and the stats
+ * look after themselves; everything else it touches (the emergency
+ * purge, the invalid item pager and the mutation log being rebuilt) is
+ * serialized here.
  */
 class LoadStorageKVPairCallback : public Callback<GetValue> {
 public:
@@ -136,6 +147,8 @@ private:
 
     void purge();
 
+    //! Serializes everything but the hash table inserts.
+    Mutex       mutex;
     VBucketMap &vbuckets;
     EPStats    &stats;
     EventuallyPersistentStore *epstore;
@@ -170,7 +183,9 @@ void LoadStorageKVPairCallback::callback(GetValue &val) {
     if (i != NULL) {
         uint16_t vb_version = vbuckets.getBucketVersion(i->getVBucketId());
         if (vb_version != static_cast<uint16_t>(-1) && val.getVBucketVersion() != vb_version) {
+            LockHolder lh(mutex);
             epstore->getInvalidItemDbPager()->addInvalidItem(i, val.getVBucketVersion());
+            lh.unlock();
 
             getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                              "Received invalid item (v %d != v %d).. ignored",
@@ -193,6 +208,7 @@ void LoadStorageKVPairCallback::callback(GetValue &val) {
             switch (vb->ht.insert(*i, shouldEject(), val.isPartial())) {
             case NOMEM:
                 if (retry == 2) {
+                    LockHolder lh(mutex);
                     if (hasPurged) {
                         if (++stats.warmOOM == 1) {
                             getLogger()->log(EXTENSION_LOG_WARNING, NULL,
@@ -241,6 +257,7 @@ void LoadStorageKVPairCallback::callback(GetValue &val) {
         }
 
         if (succeeded && epstore->warmupTask->doReconstructLog()) {
+            LockHolder lh(epstore->mutationLogLock);
             epstore->mutationLog.newItem(i->getVBucketId(), i->getKey(), i->getId());
         }
         delete i;
@@ -294,7 +311,8 @@ Warmup::Warmup(EventuallyPersistentStore *st, Dispatcher *d) :
     estimatedItemCount(std::numeric_limits<size_t>::max()),
     corruptMutationLog(false),
     corruptAccessLog(false),
-    estimatedWarmupCount(std::numeric_limits<size_t>::max())
+    estimatedWarmupCount(std::numeric_limits<size_t>::max()),
+    dumpOffset(0), vbucketsReady(0)
 {
 
 }
@@ -331,6 +349,7 @@ bool Warmup::loadingMutationLog(Dispatcher&, TaskId)
 {
     shared_ptr<Callback<GetValue> > cb(createLKVPCB(initialVbState, false));
     bool success = false;
+    size_t oom = store->stats.warmOOM.get();
 
     try {
         success = store->warmupFromLog(initialVbState, cb);
@@ -341,6 +360,16 @@ bool Warmup::loadingMutationLog(Dispatcher&, TaskId)
     }
 
     if (success) {
+        // The log holds the keys of every vbucket, so they may all
+        // serve reads while the values are loaded.
+        if (store->stats.warmOOM.get() == oom) {
+            std::vector<uint16_t> vbids;
+            std::map<std::pair<uint16_t, uint16_t>, vbucket_state>::const_iterator it;
+            for (it = initialVbState.begin(); it != initialVbState.end(); ++it) {
+                vbids.push_back(it->first.first);
+            }
+            enableTraffic(vbids);
+        }
         transition(WarmupState::LoadingAccessLog);
     } else {
         try {
@@ -366,39 +395,111 @@ bool Warmup::estimateDatabaseItemCount(Dispatcher&, TaskId)
     store->roUnderlying->getEstimatedItemCount(estimatedItemCount);
     estimateTime = gethrtime() - st;
 
+    scheduleDump(true);
     transition(WarmupState::KeyDump);
     return true;
 }
 
-bool Warmup::keyDump(Dispatcher&, TaskId)
+static int dumpRank(vbucket_state_t state) {
+    switch (state) {
+    case vbucket_state_active:
+        return 0;
+    case vbucket_state_replica:
+        return 1;
+    default:
+        return 2;
+    }
+}
+
+void Warmup::scheduleDump(bool keysOnly)
 {
-    bool success = false;
-    if (store->roUnderlying->isKeyDumpSupported()) {
-        shared_ptr<Callback<GetValue> > cb(createLKVPCB(initialVbState, false));
-        std::map<std::pair<uint16_t, uint16_t>, vbucket_state>::const_iterator it;
-        std::vector<uint16_t> vbids;
-        for (it = initialVbState.begin(); it != initialVbState.end(); ++it) {
-            std::pair<uint16_t, uint16_t> vbp = it->first;
-            vbucket_state vbs = it->second;
-            if (vbs.state == vbucket_state_active || vbs.state == vbucket_state_replica) {
-                vbids.push_back(vbp.first);
-            }
+    // Clients read from the active vbuckets, so they are loaded first.
+    // Only active and replica vbuckets have their keys dumped.
+    std::vector<std::pair<int, uint16_t> > ranked;
+    std::set<uint16_t> seen;
+    std::map<std::pair<uint16_t, uint16_t>, vbucket_state>::const_iterator it;
+    for (it = initialVbState.begin(); it != initialVbState.end(); ++it) {
+        uint16_t vbid = it->first.first;
+        int rank = dumpRank(it->second.state);
+        if ((!keysOnly || rank < 2) && seen.insert(vbid).second) {
+            ranked.push_back(std::make_pair(rank, vbid));
         }
+    }
+    std::sort(ranked.begin(), ranked.end());
 
-        store->roUnderlying->dumpKeys(vbids, cb);
-        success = true;
+    dumpVBuckets.clear();
+    std::vector<std::pair<int, uint16_t> >::iterator rit;
+    for (rit = ranked.begin(); rit != ranked.end(); ++rit) {
+        dumpVBuckets.push_back(rit->second);
     }
+    dumpOffset = 0;
+}
 
-    if (success) {
-        transition(WarmupState::LoadingAccessLog);
-    } else {
-        if (store->roUnderlying->isKeyDumpSupported()) {
-            getLogger()->log(EXTENSION_LOG_WARNING, NULL,
-                             "Failed to dump keys, falling back to full dump");
+bool Warmup::dumpNextVBucket(bool maybeEnable)
+{
+    if (!dumpCallback) {
+        dumpCallback.reset(createLKVPCB(initialVbState, maybeEnable));
+        scheduleDump(false);
+    }
+    if (dumpOffset < dumpVBuckets.size()) {
+        store->roUnderlying->dump(dumpVBuckets[dumpOffset++], dumpCallback);
+    }
+    if (dumpOffset < dumpVBuckets.size()) {
+        return false;
+    }
+    dumpCallback.reset();
+    return true;
+}
+
+void Warmup::enableTraffic(const std::vector<uint16_t> &vbids)
+{
+    std::vector<uint16_t>::const_iterator it;
+    for (it = vbids.begin(); it != vbids.end(); ++it) {
+        if (!store->vbuckets.isBucketTrafficEnabled(*it)) {
+            store->vbuckets.setBucketTrafficEnabled(*it, true);
+            ++vbucketsReady;
         }
+    }
+    getLogger()->log(EXTENSION_LOG_INFO, NULL,
+                     "Keys of %d vbuckets loaded, %d vbuckets serving reads",
+                     static_cast<int>(vbids.size()),
+                     static_cast<int>(vbucketsReady.get()));
+}
+
+bool Warmup::keyDump(Dispatcher&, TaskId)
+{
+    if (!store->roUnderlying->isKeyDumpSupported()) {
         transition(WarmupState::LoadingKVPairs);
+        return true;
+    }
+
+    // Each step loads the keys of one batch of vbuckets and lets it
+    // serve reads right away, instead of holding every vbucket back
+    // until all the keys are in memory.
+    if (!dumpCallback) {
+        dumpCallback.reset(createLKVPCB(initialVbState, false));
+    }
+    size_t batch = store->getEPEngine().getConfiguration().getWarmupVbucketBatchCount();
+    size_t end = std::min(dumpOffset + batch, dumpVBuckets.size());
+    std::vector<uint16_t> vbids(dumpVBuckets.begin() + dumpOffset,
+                                dumpVBuckets.begin() + end);
+    dumpOffset = end;
+
+    if (!vbids.empty()) {
+        size_t oom = store->stats.warmOOM.get();
+        store->roUnderlying->dumpKeys(vbids, dumpCallback);
+        // Keys dropped for lack of memory would read as missing.
+        if (store->stats.warmOOM.get() == oom) {
+            enableTraffic(vbids);
+        }
+    }
+
+    if (dumpOffset < dumpVBuckets.size()) {
+        return true;
     }
 
+    dumpCallback.reset();
+    transition(WarmupState::LoadingAccessLog);
     return true;
 }
 
@@ -456,8 +557,10 @@ bool Warmup::loadingAccessLog(Dispatcher&, TaskId)
 
     if (success) {
         if (doReconstructLog()) {
+            LockHolder lh(store->mutationLogLock);
             store->mutationLog.commit1();
             store->mutationLog.commit2();
+            lh.unlock();
             setReconstructLog(false);
         }
         transition(WarmupState::Done);
@@ -471,12 +574,24 @@ bool Warmup::loadingAccessLog(Dispatcher&, TaskId)
 
 bool Warmup::loadingKVPairs(Dispatcher&, TaskId)
 {
-    shared_ptr<Callback<GetValue> > cb(createLKVPCB(initialVbState, false));
-    store->roUnderlying->dump(cb);
+    // Warmup may share its dispatcher with the background fetches, so
+    // when the store can dump a single vbucket each step loads just
+    // one, letting the fetches queued for the vbuckets already serving
+    // reads run in between.
+    if (store->getStorageProperties().hasEfficientVBDump()) {
+        if (!dumpNextVBucket(false)) {
+            return true;
+        }
+    } else {
+        shared_ptr<Callback<GetValue> > cb(createLKVPCB(initialVbState, false));
+        store->roUnderlying->dump(cb);
+    }
 
     if (doReconstructLog()) {
+        LockHolder lh(store->mutationLogLock);
         store->mutationLog.commit1();
         store->mutationLog.commit2();
+        lh.unlock();
         setReconstructLog(false);
     }
     transition(WarmupState::Done);
@@ -485,8 +600,15 @@ bool Warmup::loadingKVPairs(Dispatcher&, TaskId)
 
 bool Warmup::loadingData(Dispatcher&, TaskId)
 {
-    shared_ptr<Callback<GetValue> > cb(createLKVPCB(initialVbState, true));
-    store->roUnderlying->dump(cb);
+    // One vbucket per step where possible, as in loadingKVPairs().
+    if (store->getStorageProperties().hasEfficientVBDump()) {
+        if (!dumpNextVBucket(true)) {
+            return true;
+        }
+    } else {
+        shared_ptr<Callback<GetValue> > cb(createLKVPCB(initialVbState, true));
+        store->roUnderlying->dump(cb);
+    }
     transition(WarmupState::Done);
     return true;
 }
@@ -582,6 +704,7 @@ void Warmup::addStats(ADD_STAT add_stat, const void *c) const
                 stats.warmupMemUsedCap * 100.0, add_stat, c);
         addStat("min_item_threshold",
                 stats.warmupNumReadCap * 100.0, add_stat, c);
+        addStat("vbuckets_ready", vbucketsReady.get(), add_stat, c);
 
         if (metadata > 0) {
             addStat("keys_time", metadata / 1000, add_stat, c);
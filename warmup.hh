@@ -112,6 +112,10 @@ private:
     LoadStorageKVPairCallback *createLKVPCB(const std::map<std::pair<uint16_t, uint16_t>, vbucket_state> &st,
                                             bool maybeEnable);
 
+    void scheduleDump(bool keysOnly);
+    bool dumpNextVBucket(bool maybeEnable);
+    void enableTraffic(const std::vector<uint16_t> &vbids);
+
     WarmupState state;
     EventuallyPersistentStore *store;
     Dispatcher *dispatcher;
@@ -130,6 +134,15 @@ private:
     bool corruptAccessLog;
     size_t estimatedWarmupCount;
 
+    // The vbuckets the key or data dump loads a few at a time, one
+    // step after another, active ones first, and the callback
+    // inserting their items.
+    std::vector<uint16_t> dumpVBuckets;
+    size_t dumpOffset;
+    shared_ptr<Callback<GetValue> > dumpCallback;
+    // Number of vbuckets serving reads ahead of the end of warmup
+    Atomic<size_t> vbucketsReady;
+
     struct {
         Mutex mutex;
         std::list<WarmupStateListener*> listeners;